@@ -2,6 +2,164 @@
 //#include "OpenThreads.h"
 #include "OpenSceneGraph.h"
 
+// OSGFILE src/OpenThreads/pthreads/PThreadBarrier.cpp
+
+//#include <OpenThreads/Barrier>
+//#include <OpenThreads/Block>
+
+namespace OpenThreads
+{
+
+class BarrierPrivateData
+{
+    public:
+
+        BarrierPrivateData(int numThreads):
+            maxcnt(numThreads),
+            cnt(0),
+            phase(0) {}
+
+        Mutex                       lock;
+        Condition                   cond;
+        volatile int                maxcnt;
+        volatile int                cnt;
+        // monotonically increasing, so a spinning thread can't miss a release
+        std::atomic<unsigned int>   phase;
+        SpinBudget                  spinBudget;
+};
+
+//----------------------------------------------------------------------------
+//
+// Description: Constructor
+//
+// Use: public.
+//
+Barrier::Barrier(int numThreads)
+{
+    _prvData = new BarrierPrivateData(numThreads);
+    _valid = true;
+}
+
+//----------------------------------------------------------------------------
+//
+// Description: Destructor
+//
+// Use: public.
+//
+Barrier::~Barrier()
+{
+    BarrierPrivateData *pd = static_cast<BarrierPrivateData*>(_prvData);
+    delete pd;
+}
+
+//----------------------------------------------------------------------------
+//
+// Description: Reset the barrier to its original state
+//
+// Use: public.
+//
+void Barrier::reset()
+{
+    BarrierPrivateData *pd = static_cast<BarrierPrivateData*>(_prvData);
+
+    ScopedLock<Mutex> lock(pd->lock);
+    pd->cnt = 0;
+    pd->phase.store(0, std::memory_order_release);
+}
+
+//----------------------------------------------------------------------------
+//
+// Description: Block until numThreads threads have entered the barrier.
+//              Waiting threads first spin on the phase for the adaptive
+//              spin budget, and only park on the condition once it is spent.
+//
+// Use: public.
+//
+void Barrier::block(unsigned int numThreads)
+{
+    BarrierPrivateData *pd = static_cast<BarrierPrivateData*>(_prvData);
+
+    if(numThreads != 0) pd->maxcnt = numThreads;
+
+    unsigned int my_phase;
+    {
+        ScopedLock<Mutex> lock(pd->lock);
+        if(!_valid) return;
+
+        my_phase = pd->phase.load(std::memory_order_relaxed);
+        ++pd->cnt;
+
+        if (pd->cnt >= pd->maxcnt)
+        {
+            pd->cnt = 0;
+            pd->phase.store(my_phase+1, std::memory_order_release);
+            pd->cond.broadcast();
+            return;
+        }
+    }
+
+    if (pd->spinBudget.spin([pd, my_phase]() { return pd->phase.load(std::memory_order_acquire)!=my_phase; })) return;
+
+    ScopedLock<Mutex> lock(pd->lock);
+    while (_valid && pd->phase.load(std::memory_order_relaxed)==my_phase)
+    {
+        pd->cond.wait(&(pd->lock));
+    }
+}
+
+//----------------------------------------------------------------------------
+//
+// Description: Release the barrier, now.
+//
+// Use: public.
+//
+void Barrier::release()
+{
+    BarrierPrivateData *pd = static_cast<BarrierPrivateData*>(_prvData);
+
+    ScopedLock<Mutex> lock(pd->lock);
+    pd->cnt = 0;
+    pd->phase.fetch_add(1, std::memory_order_release);
+    pd->cond.broadcast();
+}
+
+//----------------------------------------------------------------------------
+//
+// Description: Return the number of threads currently blocked in the barrier
+//
+// Use: public
+//
+int Barrier::numThreadsCurrentlyBlocked()
+{
+    BarrierPrivateData *pd = static_cast<BarrierPrivateData*>(_prvData);
+
+    ScopedLock<Mutex> lock(pd->lock);
+    return pd->cnt;
+}
+
+void Barrier::invalidate()
+{
+    BarrierPrivateData *pd = static_cast<BarrierPrivateData*>(_prvData);
+
+    ScopedLock<Mutex> lock(pd->lock);
+    _valid = false;
+    pd->cnt = 0;
+    pd->phase.fetch_add(1, std::memory_order_release);
+    pd->cond.broadcast();
+}
+
+void Barrier::setSpinCount(unsigned int spinCount)
+{
+    static_cast<BarrierPrivateData*>(_prvData)->spinBudget.set(spinCount);
+}
+
+unsigned int Barrier::getSpinCount() const
+{
+    return static_cast<BarrierPrivateData*>(_prvData)->spinBudget.get();
+}
+
+}
+
 // OSGFILE src/osg/Referenced.cpp
 
 #include <stdlib.h>
@@ -206,7 +364,8 @@ Referenced::~Referenced()
 
     // delete the ObserverSet
 #if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
-    if (_observerSet.get()) static_cast<ObserverSet*>(_observerSet.get())->unref();
+    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get(std::memory_order_acquire));
+    if (observerSet) observerSet->unref();
 #else
     if (_observerSet) static_cast<ObserverSet*>(_observerSet)->unref();
 #endif
@@ -219,18 +378,19 @@ Referenced::~Referenced()
 ObserverSet* Referenced::getOrCreateObserverSet() const
 {
 #if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
-    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get());
+    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get(std::memory_order_acquire));
     while (0 == observerSet)
     {
         ObserverSet* newObserverSet = new ObserverSet(this);
         newObserverSet->ref();
 
-        if (!_observerSet.assign(newObserverSet, 0))
+        // publish the constructed set, or acquire the one another thread published first.
+        if (!_observerSet.assign(newObserverSet, 0, std::memory_order_acq_rel))
         {
             newObserverSet->unref();
         }
 
-        observerSet = static_cast<ObserverSet*>(_observerSet.get());
+        observerSet = static_cast<ObserverSet*>(_observerSet.get(std::memory_order_acquire));
     }
     return observerSet;
 #else
@@ -269,7 +429,7 @@ void Referenced::removeObserver(Observer* observer) const
 void Referenced::signalObserversAndDelete(bool signalDelete, bool doDelete) const
 {
 #if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
-    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get());
+    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get(std::memory_order_acquire));
 #else
     ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet);
 #endif
@@ -292,7 +452,7 @@ void Referenced::signalObserversAndDelete(bool signalDelete, bool doDelete) cons
 int Referenced::unref_nodelete() const
 {
 #if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
-    return --_refCount;
+    return _refCount.decrement(std::memory_order_acq_rel);
 #else
     if (_refMutex)
     {
@@ -574,8 +734,8 @@ bool osg::initNotifyLevel()
     return true;
 }
 
-// Use a proxy to force the initialization of the NotifySingleton during static initialization
-OSG_INIT_SINGLETON_PROXY(NotifySingletonProxy, osg::initNotifyLevel())
+// The NotifySingleton is constructed on first use rather than through a static initialization proxy,
+// so processes that never log don't pay for reading OSG_NOTIFY_LEVEL before main().
 
 void osg::setNotifyLevel(osg::NotifySeverity severity)
 {
@@ -2443,8 +2603,18 @@ void Matrix_implementation::getLookAt(Vec3d& eye,Vec3d& center,Vec3d& up,value_t
 */
 
 #include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
 #include <string.h>
 
+#if !defined(WIN32) || defined(__CYGWIN__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 using namespace osg;
 using namespace std;
 
@@ -2471,7 +2641,8 @@ ref_ptr<DisplaySettings>& DisplaySettings::instance()
     return s_displaySettings;
 }
 
-OSG_INIT_SINGLETON_PROXY(ProxyInitDisplaySettings, DisplaySettings::instance())
+// DisplaySettings::instance() is constructed on first use, the environment and command line
+// are only parsed once something actually asks for the display settings.
 
 DisplaySettings::DisplaySettings(const DisplaySettings& vs):Referenced(true)
 {
@@ -2480,6 +2651,14 @@ DisplaySettings::DisplaySettings(const DisplaySettings& vs):Referenced(true)
 
 DisplaySettings::~DisplaySettings()
 {
+    delete getValueSnapshot();
+
+    for(ValueSnapshots::iterator itr = _retiredValueSnapshots.begin();
+        itr != _retiredValueSnapshots.end();
+        ++itr)
+    {
+        delete *itr;
+    }
 }
 
 
@@ -2524,6 +2703,7 @@ void DisplaySettings::setDisplaySettings(const DisplaySettings& vs)
     _compileContextsHint = vs._compileContextsHint;
     _serializeDrawDispatch = vs._serializeDrawDispatch;
     _useSceneViewForStereoHint = vs._useSceneViewForStereoHint;
+    _instancedStereoHint = vs._instancedStereoHint;
 
     _numDatabaseThreadsHint = vs._numDatabaseThreadsHint;
     _numHttpDatabaseThreadsHint = vs._numHttpDatabaseThreadsHint;
@@ -2552,6 +2732,8 @@ void DisplaySettings::setDisplaySettings(const DisplaySettings& vs)
     _OSXMenubarBehavior = vs._OSXMenubarBehavior;
 
     _syncSwapBuffers = vs._syncSwapBuffers;
+
+    updateEyeTransforms();
 }
 
 void DisplaySettings::merge(const DisplaySettings& vs)
@@ -2571,6 +2753,7 @@ void DisplaySettings::merge(const DisplaySettings& vs)
     if (vs._compileContextsHint) _compileContextsHint = vs._compileContextsHint;
     if (vs._serializeDrawDispatch) _serializeDrawDispatch = vs._serializeDrawDispatch;
     if (vs._useSceneViewForStereoHint) _useSceneViewForStereoHint = vs._useSceneViewForStereoHint;
+    if (vs._instancedStereoHint) _instancedStereoHint = vs._instancedStereoHint;
 
     if (vs._numDatabaseThreadsHint>_numDatabaseThreadsHint) _numDatabaseThreadsHint = vs._numDatabaseThreadsHint;
     if (vs._numHttpDatabaseThreadsHint>_numHttpDatabaseThreadsHint) _numHttpDatabaseThreadsHint = vs._numHttpDatabaseThreadsHint;
@@ -2654,6 +2837,7 @@ void DisplaySettings::setDefaults()
     _compileContextsHint = false;
     _serializeDrawDispatch = false;
     _useSceneViewForStereoHint = true;
+    _instancedStereoHint = false;
 
     _numDatabaseThreadsHint = 2;
     _numHttpDatabaseThreadsHint = 1;
@@ -2693,7 +2877,7 @@ void DisplaySettings::setDefaults()
     _shaderPipeline = false;
     _shaderPipelineNumTextureUnits = 4;
 
-
+    updateEyeTransforms();
 }
 
 void DisplaySettings::setMaxNumberOfGraphicsContexts(unsigned int num)
@@ -2826,11 +3010,224 @@ static ApplicationUsageProxy DisplaySetting_e35(ApplicationUsage::ENVIRONMENTAL_
 static ApplicationUsageProxy DisplaySetting_e36(ApplicationUsage::ENVIRONMENTAL_VARIABLE,
         "OSG_TEXT_SHADER_TECHNIQUE <value>",
         "Set the defafult osgText::ShaderTechnique. ALL_FEATURES | ALL | GREYSCALE | SIGNED_DISTANCE_FIELD | SDF | NO_TEXT_SHADER | NONE");
+static ApplicationUsageProxy DisplaySetting_e37(ApplicationUsage::ENVIRONMENTAL_VARIABLE,
+        "OSG_DISPLAY_SETTINGS_SNAPSHOT <filename>",
+        "Adopt the DisplaySettings snapshot written by DisplaySettings::writeSnapshot() instead of reading the environmental variables.");
+static ApplicationUsageProxy DisplaySetting_e38(ApplicationUsage::ENVIRONMENTAL_VARIABLE,
+        "OSG_INSTANCED_STEREO <mode>",
+        "OFF | ON Disable/enable the hint to render stereo in a single instanced pass when the stereo mode allows it.");
+
+#if !defined(WIN32) || defined(__CYGWIN__)
+extern char** environ;
+#endif
+
+namespace
+{
+
+/** Names of the environmental variables read by DisplaySettings::readEnvironmentalVariables().*/
+constexpr const char* s_environmentalVariableNames[] =
+{
+    "OSG_BUFFER_OBJECT_POOL_SIZE",
+    "OSG_COMPILE_CONTEXTS",
+    "OSG_DISPLAY_TYPE",
+    "OSG_EYE_SEPARATION",
+    "OSG_GL_CONTEXT_FLAGS",
+    "OSG_GL_CONTEXT_PROFILE_MASK",
+    "OSG_GL_CONTEXT_VERSION",
+    "OSG_GL_VERSION",
+    "OSG_IMPLICIT_BUFFER_ATTACHMENT_RENDER_MASK",
+    "OSG_IMPLICIT_BUFFER_ATTACHMENT_RESOLVE_MASK",
+    "OSG_INSTANCED_STEREO",
+    "OSG_KEYSTONE",
+    "OSG_KEYSTONE_FILES",
+    "OSG_MAX_NUMBER_OF_GRAPHICS_CONTEXTS",
+    "OSG_MENUBAR_BEHAVIOR",
+    "OSG_MULTI_SAMPLES",
+    "OSG_NUM_DATABASE_THREADS",
+    "OSG_NUM_HTTP_DATABASE_THREADS",
+    "OSG_NvOptimusEnablement",
+    "OSG_SCREEN_DISTANCE",
+    "OSG_SCREEN_HEIGHT",
+    "OSG_SCREEN_WIDTH",
+    "OSG_SERIALIZE_DRAW_DISPATCH",
+    "OSG_SHADER_HINT",
+    "OSG_SHADER_PIPELINE",
+    "OSG_SHADER_PIPELINE_FILES",
+    "OSG_SHADER_PIPELINE_NUM_TEXTURE_UNITS",
+    "OSG_SPLIT_STEREO_AUTO_ADJUST_ASPECT_RATIO",
+    "OSG_SPLIT_STEREO_HORIZONTAL_EYE_MAPPING",
+    "OSG_SPLIT_STEREO_HORIZONTAL_SEPARATION",
+    "OSG_SPLIT_STEREO_VERTICAL_EYE_MAPPING",
+    "OSG_SPLIT_STEREO_VERTICAL_SEPARATION",
+    "OSG_STEREO",
+    "OSG_STEREO_MODE",
+    "OSG_SWAP_METHOD",
+    "OSG_SYNC_SWAP_BUFFERS",
+    "OSG_TEXTURE_POOL_SIZE",
+    "OSG_TEXT_SHADER_TECHNIQUE",
+    "OSG_USE_SCENEVIEW_FOR_STEREO",
+    "OSG_VERTEX_BUFFER_HINT"
+};
+
+constexpr unsigned int s_numEnvironmentalVariables = sizeof(s_environmentalVariableNames)/sizeof(s_environmentalVariableNames[0]);
+
+/** Size and seed of the perfect hash table, chosen so that every name above lands in its own slot.
+  * When adding a name pick a new seed (or size) that keeps the static_assert below happy.*/
+constexpr unsigned int s_environmentalVariableTableSize = 127;
+constexpr unsigned int s_environmentalVariableHashSeed = 1873;
+
+/** FNV-1a hash of a variable name, stops at the end of the string or at the '=' of a "NAME=value" environ entry.*/
+constexpr unsigned int hashEnvironmentalVariable(const char* str)
+{
+    unsigned int hash = 2166136261u ^ s_environmentalVariableHashSeed;
+    for(; *str!=0 && *str!='='; ++str)
+    {
+        hash = (hash ^ static_cast<unsigned char>(*str)) * 16777619u;
+    }
+    return hash;
+}
+
+constexpr unsigned int environmentalVariableSlot(const char* str)
+{
+    return hashEnvironmentalVariable(str) % s_environmentalVariableTableSize;
+}
+
+constexpr bool environmentalVariableSlotsAreUnique()
+{
+    for(unsigned int i=0; i<s_numEnvironmentalVariables; ++i)
+    {
+        for(unsigned int j=i+1; j<s_numEnvironmentalVariables; ++j)
+        {
+            if (environmentalVariableSlot(s_environmentalVariableNames[i])==environmentalVariableSlot(s_environmentalVariableNames[j])) return false;
+        }
+    }
+    return true;
+}
+
+static_assert(environmentalVariableSlotsAreUnique(), "environmental variable names collide in the perfect hash table, choose another s_environmentalVariableHashSeed");
+
+/** Slot to name mapping of the perfect hash table, built at compile time.*/
+struct EnvironmentalVariableSlots
+{
+    constexpr EnvironmentalVariableSlots():
+        names()
+    {
+        for(unsigned int i=0; i<s_numEnvironmentalVariables; ++i)
+        {
+            names[environmentalVariableSlot(s_environmentalVariableNames[i])] = s_environmentalVariableNames[i];
+        }
+    }
+
+    const char* names[s_environmentalVariableTableSize];
+};
+
+constexpr EnvironmentalVariableSlots s_environmentalVariableSlots;
+
+/** Values of the known environmental variables, collected in a single pass over environ
+  * rather than one getenv() call, and one std::string, per variable.*/
+class EnvironmentalVariables
+{
+public:
+
+    EnvironmentalVariables()
+    {
+        for(unsigned int i=0; i<s_environmentalVariableTableSize; ++i) _values[i] = 0;
+
+        if (!environ) return;
+
+        for(char** entry = environ; *entry!=0; ++entry)
+        {
+            const char* str = *entry;
+
+            // quick reject of everything that isn't an OSG_ variable before hashing.
+            if (strncmp(str, "OSG_", 4)!=0) continue;
+
+            const char* name = s_environmentalVariableSlots.names[environmentalVariableSlot(str)];
+            if (!name) continue;
+
+            size_t length = strlen(name);
+            if (strncmp(str, name, length)==0 && str[length]=='=')
+            {
+                _values[environmentalVariableSlot(name)] = str+length+1;
+            }
+        }
+    }
+
+    const char* get(const char* name) const
+    {
+        unsigned int slot = environmentalVariableSlot(name);
+        const char* known = s_environmentalVariableSlots.names[slot];
+        if (known && strcmp(known, name)==0) return _values[slot];
+
+        // not one of the variables collected up front so fall back to querying the environment.
+        return getenv(name);
+    }
+
+    bool get(const char* name, std::string& value) const
+    {
+        const char* str = get(name);
+        if (!str) return false;
+        value = str;
+        return true;
+    }
+
+    bool get(const char* name, int& value) const
+    {
+        const char* str = get(name);
+        if (!str) return false;
+        char* end = 0;
+        long result = strtol(str, &end, 10);
+        if (end==str) return false;
+        value = static_cast<int>(result);
+        return true;
+    }
+
+    bool get(const char* name, unsigned int& value) const
+    {
+        const char* str = get(name);
+        if (!str) return false;
+        char* end = 0;
+        unsigned long result = strtoul(str, &end, 10);
+        if (end==str) return false;
+        value = static_cast<unsigned int>(result);
+        return true;
+    }
+
+    bool get(const char* name, float& value) const
+    {
+        const char* str = get(name);
+        if (!str) return false;
+        char* end = 0;
+        float result = strtof(str, &end);
+        if (end==str) return false;
+        value = result;
+        return true;
+    }
+
+    bool get(const char* name, double& value) const
+    {
+        const char* str = get(name);
+        if (!str) return false;
+        char* end = 0;
+        double result = strtod(str, &end);
+        if (end==str) return false;
+        value = result;
+        return true;
+    }
+
+protected:
+
+    const char* _values[s_environmentalVariableTableSize];
+};
+
+}
 
 void DisplaySettings::readEnvironmentalVariables()
 {
+    EnvironmentalVariables environment;
+
     std::string value;
-    if (getEnvVar("OSG_DISPLAY_TYPE", value))
+    if (environment.get("OSG_DISPLAY_TYPE", value))
     {
         if (value=="MONITOR")
         {
@@ -2853,7 +3250,7 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_STEREO_MODE", value))
+    if (environment.get("OSG_STEREO_MODE", value))
     {
         if (value=="QUAD_BUFFER")
         {
@@ -2893,7 +3290,7 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_STEREO", value))
+    if (environment.get("OSG_STEREO", value))
     {
         if (value=="OFF")
         {
@@ -2906,12 +3303,12 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    getEnvVar("OSG_EYE_SEPARATION", _eyeSeparation);
-    getEnvVar("OSG_SCREEN_WIDTH", _screenWidth);
-    getEnvVar("OSG_SCREEN_HEIGHT", _screenHeight);
-    getEnvVar("OSG_SCREEN_DISTANCE", _screenDistance);
+    environment.get("OSG_EYE_SEPARATION", _eyeSeparation);
+    environment.get("OSG_SCREEN_WIDTH", _screenWidth);
+    environment.get("OSG_SCREEN_HEIGHT", _screenHeight);
+    environment.get("OSG_SCREEN_DISTANCE", _screenDistance);
 
-    if (getEnvVar("OSG_SPLIT_STEREO_HORIZONTAL_EYE_MAPPING", value))
+    if (environment.get("OSG_SPLIT_STEREO_HORIZONTAL_EYE_MAPPING", value))
     {
         if (value=="LEFT_EYE_LEFT_VIEWPORT")
         {
@@ -2924,10 +3321,10 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    getEnvVar("OSG_SPLIT_STEREO_HORIZONTAL_SEPARATION", _splitStereoHorizontalSeparation);
+    environment.get("OSG_SPLIT_STEREO_HORIZONTAL_SEPARATION", _splitStereoHorizontalSeparation);
 
 
-    if (getEnvVar("OSG_SPLIT_STEREO_VERTICAL_EYE_MAPPING", value))
+    if (environment.get("OSG_SPLIT_STEREO_VERTICAL_EYE_MAPPING", value))
     {
         if (value=="LEFT_EYE_TOP_VIEWPORT")
         {
@@ -2940,7 +3337,7 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_SPLIT_STEREO_AUTO_ADJUST_ASPECT_RATIO", value))
+    if (environment.get("OSG_SPLIT_STEREO_AUTO_ADJUST_ASPECT_RATIO", value))
     {
         if (value=="OFF")
         {
@@ -2953,11 +3350,11 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    getEnvVar("OSG_SPLIT_STEREO_VERTICAL_SEPARATION", _splitStereoVerticalSeparation);
+    environment.get("OSG_SPLIT_STEREO_VERTICAL_SEPARATION", _splitStereoVerticalSeparation);
 
-    getEnvVar("OSG_MAX_NUMBER_OF_GRAPHICS_CONTEXTS", _maxNumOfGraphicsContexts);
+    environment.get("OSG_MAX_NUMBER_OF_GRAPHICS_CONTEXTS", _maxNumOfGraphicsContexts);
 
-    if (getEnvVar("OSG_COMPILE_CONTEXTS", value))
+    if (environment.get("OSG_COMPILE_CONTEXTS", value))
     {
         if (value=="OFF")
         {
@@ -2970,7 +3367,7 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_SERIALIZE_DRAW_DISPATCH", value))
+    if (environment.get("OSG_SERIALIZE_DRAW_DISPATCH", value))
     {
         if (value=="OFF")
         {
@@ -2983,7 +3380,7 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_USE_SCENEVIEW_FOR_STEREO", value))
+    if (environment.get("OSG_USE_SCENEVIEW_FOR_STEREO", value))
     {
         if (value=="OFF")
         {
@@ -2996,15 +3393,28 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    getEnvVar("OSG_NUM_DATABASE_THREADS", _numDatabaseThreadsHint);
+    if (environment.get("OSG_INSTANCED_STEREO", value))
+    {
+        if (value=="OFF")
+        {
+            _instancedStereoHint = false;
+        }
+        else
+        if (value=="ON")
+        {
+            _instancedStereoHint = true;
+        }
+    }
+
+    environment.get("OSG_NUM_DATABASE_THREADS", _numDatabaseThreadsHint);
 
-    getEnvVar("OSG_NUM_HTTP_DATABASE_THREADS", _numHttpDatabaseThreadsHint);
+    environment.get("OSG_NUM_HTTP_DATABASE_THREADS", _numHttpDatabaseThreadsHint);
 
-    getEnvVar("OSG_MULTI_SAMPLES", _numMultiSamples);
+    environment.get("OSG_MULTI_SAMPLES", _numMultiSamples);
 
-    getEnvVar("OSG_TEXTURE_POOL_SIZE", _maxTexturePoolSize);
+    environment.get("OSG_TEXTURE_POOL_SIZE", _maxTexturePoolSize);
 
-    getEnvVar("OSG_BUFFER_OBJECT_POOL_SIZE", _maxBufferObjectPoolSize);
+    environment.get("OSG_BUFFER_OBJECT_POOL_SIZE", _maxBufferObjectPoolSize);
 
 
     {  // Read implicit buffer attachments combinations for both render and resolve mask
@@ -3021,7 +3431,7 @@ void DisplaySettings::readEnvironmentalVariables()
         for( unsigned int n = 0; n < sizeof( variable ) / sizeof( variable[0] ); n++ )
         {
             std::string str;
-            if (getEnvVar(variable[n], str))
+            if (environment.get(variable[n], str))
             {
                 if(str.find("OFF")!=std::string::npos) *mask[n] = 0;
 
@@ -3040,16 +3450,16 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_GL_VERSION", value) || getEnvVar("OSG_GL_CONTEXT_VERSION", value))
+    if (environment.get("OSG_GL_VERSION", value) || environment.get("OSG_GL_CONTEXT_VERSION", value))
     {
         _glContextVersion = value;
     }
 
-    getEnvVar("OSG_GL_CONTEXT_FLAGS", _glContextFlags);
+    environment.get("OSG_GL_CONTEXT_FLAGS", _glContextFlags);
 
-    getEnvVar("OSG_GL_CONTEXT_PROFILE_MASK", _glContextProfileMask);
+    environment.get("OSG_GL_CONTEXT_PROFILE_MASK", _glContextProfileMask);
 
-    if (getEnvVar("OSG_SWAP_METHOD", value))
+    if (environment.get("OSG_SWAP_METHOD", value))
     {
         if (value=="DEFAULT")
         {
@@ -3073,7 +3483,7 @@ void DisplaySettings::readEnvironmentalVariables()
 
     }
 
-    if (getEnvVar("OSG_SYNC_SWAP_BUFFERS", value))
+    if (environment.get("OSG_SYNC_SWAP_BUFFERS", value))
     {
         if (value=="OFF")
         {
@@ -3091,7 +3501,7 @@ void DisplaySettings::readEnvironmentalVariables()
     }
 
 
-    if (getEnvVar("OSG_VERTEX_BUFFER_HINT", value))
+    if (environment.get("OSG_VERTEX_BUFFER_HINT", value))
     {
         if (value=="VERTEX_BUFFER_OBJECT" || value=="VBO")
         {
@@ -3111,7 +3521,7 @@ void DisplaySettings::readEnvironmentalVariables()
     }
 
 
-    if (getEnvVar("OSG_SHADER_HINT", value))
+    if (environment.get("OSG_SHADER_HINT", value))
     {
         if (value=="GL2")
         {
@@ -3135,12 +3545,12 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_TEXT_SHADER_TECHNIQUE", value))
+    if (environment.get("OSG_TEXT_SHADER_TECHNIQUE", value))
     {
         setTextShaderTechnique(value);
     }
 
-    if (getEnvVar("OSG_KEYSTONE", value))
+    if (environment.get("OSG_KEYSTONE", value))
     {
         if (value=="OFF")
         {
@@ -3154,7 +3564,7 @@ void DisplaySettings::readEnvironmentalVariables()
     }
 
 
-    if (getEnvVar("OSG_KEYSTONE_FILES", value))
+    if (environment.get("OSG_KEYSTONE_FILES", value))
     {
     #if defined(WIN32) && !defined(__CYGWIN__)
         char delimitor = ';';
@@ -3179,7 +3589,7 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if (getEnvVar("OSG_MENUBAR_BEHAVIOR", value))
+    if (environment.get("OSG_MENUBAR_BEHAVIOR", value))
     {
         if (value=="AUTO_HIDE")
         {
@@ -3198,13 +3608,13 @@ void DisplaySettings::readEnvironmentalVariables()
     }
 
     int enable = 0;
-    if (getEnvVar("OSG_NvOptimusEnablement", enable))
+    if (environment.get("OSG_NvOptimusEnablement", enable))
     {
         setNvOptimusEnablement(enable);
     }
 
 
-    if (getEnvVar("OSG_SHADER_PIPELINE", value))
+    if (environment.get("OSG_SHADER_PIPELINE", value))
     {
         if (value=="OFF")
         {
@@ -3218,7 +3628,7 @@ void DisplaySettings::readEnvironmentalVariables()
     }
 
 
-    if (getEnvVar("OSG_SHADER_PIPELINE_FILES", value))
+    if (environment.get("OSG_SHADER_PIPELINE_FILES", value))
     {
     #if defined(WIN32) && !defined(__CYGWIN__)
         char delimitor = ';';
@@ -3245,12 +3655,46 @@ void DisplaySettings::readEnvironmentalVariables()
         }
     }
 
-    if(getEnvVar("OSG_SHADER_PIPELINE_NUM_TEXTURE_UNITS", value))
+    if(environment.get("OSG_SHADER_PIPELINE_NUM_TEXTURE_UNITS", value))
     {
         _shaderPipelineNumTextureUnits = atoi(value.c_str());
 
     }
     OSG_INFO<<"_shaderPipelineNumTextureUnits = "<<_shaderPipelineNumTextureUnits<<std::endl;
+
+    updateEyeTransforms();
+}
+
+namespace
+{
+
+/** Hashes of the options present on the command line, gathered in a single pass over the arguments
+  * so that readCommandLine() only rescans the arguments for the options that were actually given.
+  * A hash collision at worst results in a redundant ArgumentParser::read().*/
+class CommandLineOptions
+{
+public:
+
+    CommandLineOptions(ArgumentParser& arguments)
+    {
+        for(int pos=1; pos<arguments.argc(); ++pos)
+        {
+            const char* str = arguments[pos];
+            if (str && str[0]=='-') _hashes.push_back(hashEnvironmentalVariable(str));
+        }
+        std::sort(_hashes.begin(), _hashes.end());
+    }
+
+    bool has(const char* option) const
+    {
+        return std::binary_search(_hashes.begin(), _hashes.end(), hashEnvironmentalVariable(option));
+    }
+
+protected:
+
+    std::vector<unsigned int> _hashes;
+};
+
 }
 
 void DisplaySettings::readCommandLine(ArgumentParser& arguments)
@@ -3263,6 +3707,7 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
         arguments.getApplicationUsage()->addCommandLineOption("--display <type>","MONITOR | POWERWALL | REALITY_CENTER | HEAD_MOUNTED_DISPLAY");
         arguments.getApplicationUsage()->addCommandLineOption("--stereo","Use default stereo mode which is ANAGLYPHIC if not overridden by environmental variable");
         arguments.getApplicationUsage()->addCommandLineOption("--stereo <mode>","ANAGLYPHIC | QUAD_BUFFER | HORIZONTAL_SPLIT | VERTICAL_SPLIT | LEFT_EYE | RIGHT_EYE | HORIZONTAL_INTERLACE | VERTICAL_INTERLACE | CHECKERBOARD | ON | OFF ");
+        arguments.getApplicationUsage()->addCommandLineOption("--instanced-stereo <mode>","OFF | ON - set the hint to render stereo in a single instanced pass");
         arguments.getApplicationUsage()->addCommandLineOption("--rgba","Request a RGBA color buffer visual");
         arguments.getApplicationUsage()->addCommandLineOption("--stencil","Request a stencil buffer visual");
         arguments.getApplicationUsage()->addCommandLineOption("--accum-rgb","Request a rgb accumulator buffer visual");
@@ -3283,8 +3728,10 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
         arguments.getApplicationUsage()->addCommandLineOption("--sync","Enable sync of swap buffers");
     }
 
+    CommandLineOptions options(arguments);
+
     std::string str;
-    while(arguments.read("--display",str))
+    while(options.has("--display") && arguments.read("--display",str))
     {
         if (str=="MONITOR") _displayType = MONITOR;
         else if (str=="POWERWALL") _displayType = POWERWALL;
@@ -3293,7 +3740,7 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
     }
 
     int pos;
-    while ((pos=arguments.find("--stereo"))>0)
+    while (options.has("--stereo") && (pos=arguments.find("--stereo"))>0)
     {
         if (arguments.match(pos+1,"ANAGLYPHIC"))            { arguments.remove(pos,2); _stereo = true;_stereoMode = ANAGLYPHIC; }
         else if (arguments.match(pos+1,"QUAD_BUFFER"))      { arguments.remove(pos,2); _stereo = true;_stereoMode = QUAD_BUFFER; }
@@ -3309,38 +3756,44 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
         else                                                { arguments.remove(pos); _stereo = true; }
     }
 
-    while (arguments.read("--rgba"))
+    while(options.has("--instanced-stereo") && arguments.read("--instanced-stereo",str))
+    {
+        if (str=="ON") _instancedStereoHint = true;
+        else if (str=="OFF") _instancedStereoHint = false;
+    }
+
+    while (options.has("--rgba") && arguments.read("--rgba"))
     {
         _RGB = true;
         _minimumNumberAlphaBits = 1;
     }
 
-    while (arguments.read("--stencil"))
+    while (options.has("--stencil") && arguments.read("--stencil"))
     {
         _minimumNumberStencilBits = 1;
     }
 
-    while (arguments.read("--accum-rgb"))
+    while (options.has("--accum-rgb") && arguments.read("--accum-rgb"))
     {
         setMinimumNumAccumBits(8,8,8,0);
     }
 
-    while (arguments.read("--accum-rgba"))
+    while (options.has("--accum-rgba") && arguments.read("--accum-rgba"))
     {
         setMinimumNumAccumBits(8,8,8,8);
     }
 
-    while(arguments.read("--samples",str))
+    while(options.has("--samples") && arguments.read("--samples",str))
     {
         _numMultiSamples = atoi(str.c_str());
     }
 
-    while(arguments.read("--sync"))
+    while(options.has("--sync") && arguments.read("--sync"))
     {
         _syncSwapBuffers = 1;
     }
 
-    if (arguments.read("--keystone",str))
+    if (options.has("--keystone") && arguments.read("--keystone",str))
     {
         _keystoneHint = true;
 
@@ -3353,32 +3806,32 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
         }
     }
 
-    if (arguments.read("--keystone-on"))
+    if (options.has("--keystone-on") && arguments.read("--keystone-on"))
     {
         _keystoneHint = true;
     }
 
-    if (arguments.read("--keystone-off"))
+    if (options.has("--keystone-off") && arguments.read("--keystone-off"))
     {
         _keystoneHint = false;
     }
 
-    while(arguments.read("--cc"))
+    while(options.has("--cc") && arguments.read("--cc"))
     {
         _compileContextsHint = true;
     }
 
-    while(arguments.read("--serialize-draw",str))
+    while(options.has("--serialize-draw") && arguments.read("--serialize-draw",str))
     {
         if (str=="ON") _serializeDrawDispatch = true;
         else if (str=="OFF") _serializeDrawDispatch = false;
     }
 
-    while(arguments.read("--num-db-threads",_numDatabaseThreadsHint)) {}
-    while(arguments.read("--num-http-threads",_numHttpDatabaseThreadsHint)) {}
+    while(options.has("--num-db-threads") && arguments.read("--num-db-threads",_numDatabaseThreadsHint)) {}
+    while(options.has("--num-http-threads") && arguments.read("--num-http-threads",_numHttpDatabaseThreadsHint)) {}
 
-    while(arguments.read("--texture-pool-size",_maxTexturePoolSize)) {}
-    while(arguments.read("--buffer-object-pool-size",_maxBufferObjectPoolSize)) {}
+    while(options.has("--texture-pool-size") && arguments.read("--texture-pool-size",_maxTexturePoolSize)) {}
+    while(options.has("--buffer-object-pool-size") && arguments.read("--buffer-object-pool-size",_maxBufferObjectPoolSize)) {}
 
     {  // Read implicit buffer attachments combinations for both render and resolve mask
         const char* option[] = {
@@ -3393,7 +3846,7 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
 
         for( unsigned int n = 0; n < sizeof( option ) / sizeof( option[0]); n++ )
         {
-            while(arguments.read( option[n],str))
+            while(options.has(option[n]) && arguments.read( option[n],str))
             {
                 if(str.find("OFF")!=std::string::npos) *mask[n] = 0;
 
@@ -3412,11 +3865,11 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
         }
     }
 
-    while (arguments.read("--gl-version", _glContextVersion)) {}
-    while (arguments.read("--gl-flags", _glContextFlags)) {}
-    while (arguments.read("--gl-profile-mask", _glContextProfileMask)) {}
+    while (options.has("--gl-version") && arguments.read("--gl-version", _glContextVersion)) {}
+    while (options.has("--gl-flags") && arguments.read("--gl-flags", _glContextFlags)) {}
+    while (options.has("--gl-profile-mask") && arguments.read("--gl-profile-mask", _glContextProfileMask)) {}
 
-    while(arguments.read("--swap-method",str))
+    while(options.has("--swap-method") && arguments.read("--swap-method",str))
     {
         if (str=="DEFAULT") _swapMethod = SWAP_DEFAULT;
         else if (str=="EXCHANGE") _swapMethod = SWAP_EXCHANGE;
@@ -3424,123 +3877,125 @@ void DisplaySettings::readCommandLine(ArgumentParser& arguments)
         else if (str=="UNDEFINED") _swapMethod = SWAP_UNDEFINED;
     }
 
-    while(arguments.read("--menubar-behavior",str))
+    while(options.has("--menubar-behavior") && arguments.read("--menubar-behavior",str))
     {
         if (str=="AUTO_HIDE") _OSXMenubarBehavior = MENUBAR_AUTO_HIDE;
         else if (str=="FORCE_HIDE") _OSXMenubarBehavior = MENUBAR_FORCE_HIDE;
         else if (str=="FORCE_SHOW") _OSXMenubarBehavior = MENUBAR_FORCE_SHOW;
     }
 
+    updateEyeTransforms();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // Helper funciotns for computing projection and view matrices of left and right eyes
 //
-osg::Matrixd DisplaySettings::computeLeftEyeProjectionImplementation(const osg::Matrixd& projection) const
+void DisplaySettings::updateEyeTransforms()
 {
     double iod = getEyeSeparation();
     double sd = getScreenDistance();
-    double scale_x = 1.0;
-    double scale_y = 1.0;
 
+    _eyeTransforms.scaleX = 1.0;
+    _eyeTransforms.scaleY = 1.0;
     if (getSplitStereoAutoAdjustAspectRatio())
     {
         switch(getStereoMode())
         {
             case(HORIZONTAL_SPLIT):
-                scale_x = 2.0;
+                _eyeTransforms.scaleX = 2.0;
                 break;
             case(VERTICAL_SPLIT):
-                scale_y = 2.0;
+                _eyeTransforms.scaleY = 2.0;
                 break;
             default:
                 break;
         }
     }
 
-    if (getDisplayType()==HEAD_MOUNTED_DISPLAY)
+    // head mounted display has the same projection matrix for left and right eyes, all other display types
+    // assume working like a projected power wall, shearing the projection to account for the asymmetric
+    // frustum due to the eye offset.
+    _eyeTransforms.projectionShear = getDisplayType()==HEAD_MOUNTED_DISPLAY ? 0.0 : iod/(2.0*sd);
+    _eyeTransforms.viewOffset = 0.5*iod;
+}
+
+namespace
+{
+    // scale(scaleX,scaleY,1.0) * projection, premultiplied by the matrix shearing z into x by shear, without
+    // the two general products: only three rows change.
+    inline void computeEyeProjection(const osg::Matrixd& projection, double scaleX, double scaleY, double shear, osg::Matrixd& result)
     {
-        // head mounted display has the same projection matrix for left and right eyes.
-        return osg::Matrixd::scale(scale_x,scale_y,1.0) *
-               projection;
+        const osg::Matrixd::value_type* p = projection.ptr();
+        osg::Matrixd::value_type* r = result.ptr();
+        double shearX = shear*scaleX;
+        for(unsigned int i=0; i<4; ++i)
+        {
+            r[i] = scaleX*p[i];
+            r[4+i] = scaleY*p[4+i];
+            r[8+i] = shearX*p[i] + p[8+i];
+            r[12+i] = p[12+i];
+        }
     }
-    else
+
+    // view * translate(offset,0,0), only the first column changes.
+    inline void computeEyeView(const osg::Matrixd& view, double offset, osg::Matrixd& result)
     {
-        // all other display types assume working like a projected power wall
-        // need to shjear projection matrix to account for asymetric frustum due to eye offset.
-        return osg::Matrixd(1.0,0.0,0.0,0.0,
-                           0.0,1.0,0.0,0.0,
-                           iod/(2.0*sd),0.0,1.0,0.0,
-                           0.0,0.0,0.0,1.0) *
-               osg::Matrixd::scale(scale_x,scale_y,1.0) *
-               projection;
+        const osg::Matrixd::value_type* v = view.ptr();
+        osg::Matrixd::value_type* r = result.ptr();
+        for(unsigned int i=0; i<16; i+=4)
+        {
+            r[i] = v[i] + offset*v[i+3];
+            r[i+1] = v[i+1];
+            r[i+2] = v[i+2];
+            r[i+3] = v[i+3];
+        }
     }
 }
 
-osg::Matrixd DisplaySettings::computeLeftEyeViewImplementation(const osg::Matrixd& view, double eyeSeperationScale) const
+osg::Matrixd DisplaySettings::computeLeftEyeProjectionImplementation(const osg::Matrixd& projection) const
 {
-    double iod = getEyeSeparation();
-    double es = 0.5f*iod*eyeSeperationScale;
+    osg::Matrixd result;
+    computeEyeProjection(projection, _eyeTransforms.scaleX, _eyeTransforms.scaleY, _eyeTransforms.projectionShear, result);
+    return result;
+}
 
-    return view *
-           osg::Matrixd(1.0,0.0,0.0,0.0,
-                       0.0,1.0,0.0,0.0,
-                       0.0,0.0,1.0,0.0,
-                       es,0.0,0.0,1.0);
+osg::Matrixd DisplaySettings::computeLeftEyeViewImplementation(const osg::Matrixd& view, double eyeSeperationScale) const
+{
+    osg::Matrixd result;
+    computeEyeView(view, _eyeTransforms.viewOffset*eyeSeperationScale, result);
+    return result;
 }
 
 osg::Matrixd DisplaySettings::computeRightEyeProjectionImplementation(const osg::Matrixd& projection) const
 {
-    double iod = getEyeSeparation();
-    double sd = getScreenDistance();
-    double scale_x = 1.0;
-    double scale_y = 1.0;
-
-    if (getSplitStereoAutoAdjustAspectRatio())
-    {
-        switch(getStereoMode())
-        {
-            case(HORIZONTAL_SPLIT):
-                scale_x = 2.0;
-                break;
-            case(VERTICAL_SPLIT):
-                scale_y = 2.0;
-                break;
-            default:
-                break;
-        }
-    }
-
-    if (getDisplayType()==HEAD_MOUNTED_DISPLAY)
-    {
-        // head mounted display has the same projection matrix for left and right eyes.
-        return osg::Matrixd::scale(scale_x,scale_y,1.0) *
-               projection;
-    }
-    else
-    {
-        // all other display types assume working like a projected power wall
-        // need to shjear projection matrix to account for asymetric frustum due to eye offset.
-        return osg::Matrixd(1.0,0.0,0.0,0.0,
-                           0.0,1.0,0.0,0.0,
-                           -iod/(2.0*sd),0.0,1.0,0.0,
-                           0.0,0.0,0.0,1.0) *
-               osg::Matrixd::scale(scale_x,scale_y,1.0) *
-               projection;
-    }
+    osg::Matrixd result;
+    computeEyeProjection(projection, _eyeTransforms.scaleX, _eyeTransforms.scaleY, -_eyeTransforms.projectionShear, result);
+    return result;
 }
 
 osg::Matrixd DisplaySettings::computeRightEyeViewImplementation(const osg::Matrixd& view, double eyeSeperationScale) const
 {
-    double iod = getEyeSeparation();
-    double es = 0.5*iod*eyeSeperationScale;
+    osg::Matrixd result;
+    computeEyeView(view, -_eyeTransforms.viewOffset*eyeSeperationScale, result);
+    return result;
+}
+
+void DisplaySettings::computeEyeMatrices(unsigned int numCameras, const osg::Matrixd* views, const osg::Matrixd* projections,
+                                         EyeMatrices* results, double eyeSeperationScale) const
+{
+    // read the coefficients once for all the cameras, the per camera rows are independent so the loops vectorize.
+    const EyeTransforms transforms = _eyeTransforms;
+    double offset = transforms.viewOffset*eyeSeperationScale;
 
-    return view *
-           osg::Matrixd(1.0,0.0,0.0,0.0,
-                       0.0,1.0,0.0,0.0,
-                       0.0,0.0,1.0,0.0,
-                       -es,0.0,0.0,1.0);
+    for(unsigned int i=0; i<numCameras; ++i)
+    {
+        EyeMatrices& eyes = results[i];
+        computeEyeView(views[i], offset, eyes.leftView);
+        computeEyeView(views[i], -offset, eyes.rightView);
+        computeEyeProjection(projections[i], transforms.scaleX, transforms.scaleY, transforms.projectionShear, eyes.leftProjection);
+        computeEyeProjection(projections[i], transforms.scaleX, transforms.scaleY, -transforms.projectionShear, eyes.rightProjection);
+    }
 }
 
 void DisplaySettings::setShaderHint(ShaderHint hint, bool setShaderValues)
@@ -3589,39 +4044,707 @@ void DisplaySettings::setShaderHint(ShaderHint hint, bool setShaderValues)
     }
 }
 
-void DisplaySettings::setValue(const std::string& name, const std::string& value)
+namespace
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_valueMapMutex);
 
-    _valueMap[name] = value;
+/** Hazard slot of a thread reading value snapshots. Slots are never freed, a thread that exits hands its slot
+  * over to the next thread needing one, so their number is bounded by the peak number of reading threads.*/
+struct ValueSnapshotHazard
+{
+    ValueSnapshotHazard(): snapshot(0), inUse(true), next(0) {}
+
+    std::atomic<const void*>    snapshot;
+    std::atomic<bool>           inUse;
+    ValueSnapshotHazard*        next;
+
+    // keep slots of different threads off each other's cache lines.
+    char                        padding[64];
+};
+
+std::atomic<ValueSnapshotHazard*> s_valueSnapshotHazards(0);
+
+ValueSnapshotHazard* allocateValueSnapshotHazard()
+{
+    for(ValueSnapshotHazard* hazard = s_valueSnapshotHazards.load(std::memory_order_acquire); hazard; hazard = hazard->next)
+    {
+        bool inUse = false;
+        if (hazard->inUse.compare_exchange_strong(inUse, true, std::memory_order_acq_rel)) return hazard;
+    }
+
+    ValueSnapshotHazard* hazard = new ValueSnapshotHazard;
+    ValueSnapshotHazard* head = s_valueSnapshotHazards.load(std::memory_order_relaxed);
+    do
+    {
+        hazard->next = head;
+    } while(!s_valueSnapshotHazards.compare_exchange_weak(head, hazard, std::memory_order_release, std::memory_order_relaxed));
+    return hazard;
 }
 
-bool DisplaySettings::getValue(const std::string& name, std::string& value, bool use_env_fallback) const
+struct ThreadValueSnapshotHazard
 {
-    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_valueMapMutex);
+    ThreadValueSnapshotHazard(): hazard(allocateValueSnapshotHazard()) {}
 
-    ValueMap::iterator itr = _valueMap.find(name);
-    if (itr!=_valueMap.end())
+    ~ThreadValueSnapshotHazard()
     {
-        value = itr->second;
-        OSG_INFO<<"DisplaySettings::getValue("<<name<<") found existing value = ["<<value<<"]"<<std::endl;
-        return true;
+        hazard->snapshot.store(0, std::memory_order_release);
+        hazard->inUse.store(false, std::memory_order_release);
     }
 
+    ValueSnapshotHazard* hazard;
+};
+
+ValueSnapshotHazard& getThreadValueSnapshotHazard()
+{
+    static thread_local ThreadValueSnapshotHazard s_threadHazard;
+    return *s_threadHazard.hazard;
+}
+
+}
+
+const DisplaySettings::ValueSnapshot* DisplaySettings::acquireValueSnapshot() const
+{
+    ValueSnapshotHazard& hazard = getThreadValueSnapshotHazard();
+
+    const void* snapshot = _valueSnapshot.get(std::memory_order_acquire);
+    while(true)
+    {
+        hazard.snapshot.store(snapshot, std::memory_order_seq_cst);
+
+        // the snapshot may have been retired before the hazard was visible, move on to the new one then.
+        const void* current = _valueSnapshot.get(std::memory_order_seq_cst);
+        if (current==snapshot) return static_cast<const ValueSnapshot*>(snapshot);
+        snapshot = current;
+    }
+}
+
+void DisplaySettings::releaseValueSnapshot() const
+{
+    getThreadValueSnapshotHazard().snapshot.store(0, std::memory_order_release);
+}
+
+void DisplaySettings::swapValueSnapshot(const ValueSnapshot* snapshot) const
+{
+    // writers are serialized by _valueMapMutex so the swap can't fail.
+    const ValueSnapshot* previous = getValueSnapshot();
+    _valueSnapshot.assign(const_cast<ValueSnapshot*>(snapshot), previous, std::memory_order_seq_cst);
+    if (previous) _retiredValueSnapshots.push_back(previous);
+
+    // a reader publishing its hazard after this scan sees the new snapshot when it rechecks, so only the retired
+    // snapshots held in a hazard slot now can still be in use.
+    std::vector<const void*> hazards;
+    for(ValueSnapshotHazard* hazard = s_valueSnapshotHazards.load(std::memory_order_acquire); hazard; hazard = hazard->next)
+    {
+        const void* held = hazard->snapshot.load(std::memory_order_seq_cst);
+        if (held) hazards.push_back(held);
+    }
+
+    ValueSnapshots::iterator kept = _retiredValueSnapshots.begin();
+    for(ValueSnapshots::iterator itr = _retiredValueSnapshots.begin();
+        itr != _retiredValueSnapshots.end();
+        ++itr)
+    {
+        if (std::find(hazards.begin(), hazards.end(), static_cast<const void*>(*itr))!=hazards.end()) *(kept++) = *itr;
+        else delete *itr;
+    }
+    _retiredValueSnapshots.erase(kept, _retiredValueSnapshots.end());
+}
+
+void DisplaySettings::publishValue(const std::string& name, const ValueEntry& entry) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_valueMapMutex);
+
+    const ValueSnapshot* previous = getValueSnapshot();
+
+    ValueSnapshot* snapshot = previous ? new ValueSnapshot(*previous) : new ValueSnapshot;
+    (*snapshot)[name] = entry;
+
+    swapValueSnapshot(snapshot);
+}
+
+void DisplaySettings::setValue(const std::string& name, const std::string& value)
+{
+    publishValue(name, ValueEntry(value, true));
+}
+
+bool DisplaySettings::getValue(const std::string& name, std::string& value, bool use_env_fallback) const
+{
+    bool cached = false;
+    bool found = false;
+
+    const ValueSnapshot* snapshot = acquireValueSnapshot();
+    if (snapshot)
+    {
+        ValueSnapshot::const_iterator itr = snapshot->find(name);
+        if (itr!=snapshot->end())
+        {
+            cached = true;
+            found = itr->second.found;
+            if (found) value = itr->second.value;
+        }
+    }
+    releaseValueSnapshot();
+
+    if (cached) return found;
+
     if (!use_env_fallback) return false;
 
     std::string str;
     if (getEnvVar(name.c_str(), str))
     {
-        OSG_INFO<<"DisplaySettings::getValue("<<name<<") found getEnvVar value = ["<<value<<"]"<<std::endl;
-        _valueMap[name] = value = str;
+        OSG_INFO<<"DisplaySettings::getValue("<<name<<") found getEnvVar value = ["<<str<<"]"<<std::endl;
+        publishValue(name, ValueEntry(str, true));
+        value = str;
         return true;
-
     }
     else
     {
+        publishValue(name, ValueEntry(std::string(), false));
+        return false;
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  DisplaySettings snapshot
+//
+//  Layout: SnapshotHeader followed by payloadSize bytes of payload. The payload is a flat sequence
+//  of native endian 32 bit words, with strings written as a length word followed by the characters
+//  and string lists as a count word followed by the strings. Snapshots are meant to be handed to
+//  processes on the same machine, so the byte order is only checked, never swapped.
+//
+namespace
+{
+
+const char         s_snapshotMagic[8] = { 'O','S','G','D','S','N','A','P' };
+const unsigned int s_snapshotVersion = 2;
+const unsigned int s_snapshotByteOrder = 0x01020304;
+
+struct SnapshotHeader
+{
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    byteOrder;
+    unsigned int    payloadSize;
+    unsigned int    checksum;
+};
+
+unsigned int computeSnapshotChecksum(const unsigned char* data, size_t size)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for(const unsigned char* end = data+size; data!=end; ++data)
+    {
+        hash = (hash ^ *data) * 16777619u;
+    }
+    return hash;
+}
+
+class SnapshotWriter
+{
+public:
+
+    void write(unsigned int value) { _buffer.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+    void write(int value) { write(static_cast<unsigned int>(value)); }
+    void write(bool value) { write(value ? 1u : 0u); }
+    void write(float value) { _buffer.append(reinterpret_cast<const char*>(&value), sizeof(value)); }
+
+    void write(const std::string& value)
+    {
+        write(static_cast<unsigned int>(value.size()));
+        _buffer.append(value);
+    }
+
+    void write(const std::vector<std::string>& values)
+    {
+        write(static_cast<unsigned int>(values.size()));
+        for(std::vector<std::string>::const_iterator itr = values.begin(); itr != values.end(); ++itr) write(*itr);
+    }
+
+    const std::string& getBuffer() const { return _buffer; }
+
+protected:
+
+    std::string _buffer;
+};
+
+/** Values read from a snapshot payload, kept apart from the DisplaySettings until the whole payload has been read.*/
+struct SnapshotFields
+{
+    unsigned int                displayType;
+    bool                        stereo;
+    unsigned int                stereoMode;
+    float                       eyeSeparation;
+    float                       screenWidth;
+    float                       screenHeight;
+    float                       screenDistance;
+
+    unsigned int                splitStereoHorizontalEyeMapping;
+    int                         splitStereoHorizontalSeparation;
+    unsigned int                splitStereoVerticalEyeMapping;
+    int                         splitStereoVerticalSeparation;
+    bool                        splitStereoAutoAdjustAspectRatio;
+
+    bool                        doubleBuffer;
+    bool                        RGB;
+    bool                        depthBuffer;
+    unsigned int                minimumNumberAlphaBits;
+    unsigned int                minimumNumberStencilBits;
+    unsigned int                minimumNumberAccumRedBits;
+    unsigned int                minimumNumberAccumGreenBits;
+    unsigned int                minimumNumberAccumBlueBits;
+    unsigned int                minimumNumberAccumAlphaBits;
+
+    unsigned int                maxNumOfGraphicsContexts;
+    unsigned int                numMultiSamples;
+
+    bool                        compileContextsHint;
+    bool                        serializeDrawDispatch;
+    bool                        useSceneViewForStereoHint;
+    bool                        instancedStereoHint;
+
+    unsigned int                numDatabaseThreadsHint;
+    unsigned int                numHttpDatabaseThreadsHint;
+
+    unsigned int                maxTexturePoolSize;
+    unsigned int                maxBufferObjectPoolSize;
+
+    int                         implicitBufferAttachmentRenderMask;
+    int                         implicitBufferAttachmentResolveMask;
+
+    std::string                 glContextVersion;
+    unsigned int                glContextFlags;
+    unsigned int                glContextProfileMask;
+
+    unsigned int                swapMethod;
+    unsigned int                syncSwapBuffers;
+
+    unsigned int                vertexBufferHint;
+    unsigned int                shaderHint;
+    std::string                 textShaderTechnique;
+
+    bool                        keystoneHint;
+    std::vector<std::string>    keystoneFileNames;
+
+    unsigned int                OSXMenubarBehavior;
+
+    bool                        shaderPipeline;
+    std::vector<std::string>    shaderPipelineFiles;
+    unsigned int                shaderPipelineNumTextureUnits;
+
+    int                         nvOptimusEnablement;
+};
+
+class SnapshotReader
+{
+public:
+
+    SnapshotReader(const unsigned char* data, size_t size): _ptr(data), _end(data+size), _ok(true) {}
+
+    bool ok() const { return _ok; }
+
+    unsigned int readUInt()
+    {
+        unsigned int value = 0;
+        if (!readBytes(&value, sizeof(value))) return 0;
+        return value;
+    }
+
+    int readInt() { return static_cast<int>(readUInt()); }
+    bool readBool() { return readUInt()!=0; }
+
+    float readFloat()
+    {
+        float value = 0.0f;
+        if (!readBytes(&value, sizeof(value))) return 0.0f;
+        return value;
+    }
+
+    std::string readString()
+    {
+        unsigned int length = readUInt();
+        if (!_ok || length>static_cast<size_t>(_end-_ptr)) { _ok = false; return std::string(); }
+
+        std::string value(reinterpret_cast<const char*>(_ptr), length);
+        _ptr += length;
+        return value;
+    }
+
+    std::vector<std::string> readStrings()
+    {
+        std::vector<std::string> values;
+        unsigned int count = readUInt();
+        for(unsigned int i=0; i<count && _ok; ++i) values.push_back(readString());
+        return values;
+    }
+
+protected:
+
+    bool readBytes(void* value, size_t size)
+    {
+        if (!_ok || size>static_cast<size_t>(_end-_ptr)) { _ok = false; return false; }
+
+        memcpy(value, _ptr, size);
+        _ptr += size;
+        return true;
+    }
+
+    const unsigned char*    _ptr;
+    const unsigned char*    _end;
+    bool                    _ok;
+};
+
+}
+
+bool DisplaySettings::writeSnapshot(const std::string& filename) const
+{
+    SnapshotWriter writer;
+
+    writer.write(static_cast<unsigned int>(_displayType));
+    writer.write(_stereo);
+    writer.write(static_cast<unsigned int>(_stereoMode));
+    writer.write(_eyeSeparation);
+    writer.write(_screenWidth);
+    writer.write(_screenHeight);
+    writer.write(_screenDistance);
+
+    writer.write(static_cast<unsigned int>(_splitStereoHorizontalEyeMapping));
+    writer.write(_splitStereoHorizontalSeparation);
+    writer.write(static_cast<unsigned int>(_splitStereoVerticalEyeMapping));
+    writer.write(_splitStereoVerticalSeparation);
+    writer.write(_splitStereoAutoAdjustAspectRatio);
+
+    writer.write(_doubleBuffer);
+    writer.write(_RGB);
+    writer.write(_depthBuffer);
+    writer.write(_minimumNumberAlphaBits);
+    writer.write(_minimumNumberStencilBits);
+    writer.write(_minimumNumberAccumRedBits);
+    writer.write(_minimumNumberAccumGreenBits);
+    writer.write(_minimumNumberAccumBlueBits);
+    writer.write(_minimumNumberAccumAlphaBits);
+
+    writer.write(_maxNumOfGraphicsContexts);
+    writer.write(_numMultiSamples);
+
+    writer.write(_compileContextsHint);
+    writer.write(_serializeDrawDispatch);
+    writer.write(_useSceneViewForStereoHint);
+    writer.write(_instancedStereoHint);
+
+    writer.write(_numDatabaseThreadsHint);
+    writer.write(_numHttpDatabaseThreadsHint);
+
+    writer.write(_application);
+
+    writer.write(_maxTexturePoolSize);
+    writer.write(_maxBufferObjectPoolSize);
+
+    writer.write(_implicitBufferAttachmentRenderMask);
+    writer.write(_implicitBufferAttachmentResolveMask);
+
+    writer.write(_glContextVersion);
+    writer.write(_glContextFlags);
+    writer.write(_glContextProfileMask);
+
+    writer.write(static_cast<unsigned int>(_swapMethod));
+    writer.write(_syncSwapBuffers);
+
+    writer.write(static_cast<unsigned int>(_vertexBufferHint));
+    writer.write(static_cast<unsigned int>(_shaderHint));
+    writer.write(_textShaderTechnique);
+
+    writer.write(_keystoneHint);
+    writer.write(_keystoneFileNames);
+
+    writer.write(static_cast<unsigned int>(_OSXMenubarBehavior));
+
+    writer.write(_shaderPipeline);
+    writer.write(_shaderPipelineFiles);
+    writer.write(_shaderPipelineNumTextureUnits);
+
+    writer.write(static_cast<int>(getNvOptimusEnablement()));
+
+    // only values that were found are written, failed getenv() lookups belong to this process' environment.
+    const ValueSnapshot* values = acquireValueSnapshot();
+    unsigned int numValues = 0;
+    if (values)
+    {
+        for(ValueSnapshot::const_iterator itr = values->begin(); itr != values->end(); ++itr)
+        {
+            if (itr->second.found) ++numValues;
+        }
+    }
+
+    writer.write(numValues);
+    if (values)
+    {
+        for(ValueSnapshot::const_iterator itr = values->begin(); itr != values->end(); ++itr)
+        {
+            if (!itr->second.found) continue;
+
+            writer.write(itr->first);
+            writer.write(itr->second.value);
+        }
+    }
+    releaseValueSnapshot();
+
+    const std::string& payload = writer.getBuffer();
+
+    SnapshotHeader header;
+    memcpy(header.magic, s_snapshotMagic, sizeof(header.magic));
+    header.version = s_snapshotVersion;
+    header.byteOrder = s_snapshotByteOrder;
+    header.payloadSize = static_cast<unsigned int>(payload.size());
+    header.checksum = computeSnapshotChecksum(reinterpret_cast<const unsigned char*>(payload.data()), payload.size());
+
+    std::ofstream fout(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!fout)
+    {
+        OSG_NOTICE<<"DisplaySettings::writeSnapshot("<<filename<<") unable to open file for writing."<<std::endl;
+        return false;
+    }
+
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    fout.write(payload.data(), payload.size());
+    fout.close();
+
+    if (fout.fail())
+    {
+        OSG_NOTICE<<"DisplaySettings::writeSnapshot("<<filename<<") failed writing file."<<std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool DisplaySettings::readSnapshot(const std::string& filename)
+{
+#if !defined(WIN32) || defined(__CYGWIN__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd<0) return false;
+
+    struct stat status;
+    if (fstat(fd, &status)!=0 || status.st_size<=0)
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(status.st_size);
+    void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data==MAP_FAILED) return false;
+
+    bool result = readSnapshot(static_cast<const unsigned char*>(data), size);
+
+    munmap(data, size);
+#else
+    std::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!fin) return false;
+
+    std::vector<char> data((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+    if (data.empty()) return false;
+
+    bool result = readSnapshot(reinterpret_cast<const unsigned char*>(&data[0]), data.size());
+#endif
+
+    if (!result)
+    {
+        OSG_NOTICE<<"DisplaySettings::readSnapshot("<<filename<<") snapshot doesn't match, ignoring it."<<std::endl;
+    }
+
+    return result;
+}
+
+bool DisplaySettings::readSnapshot(const unsigned char* data, size_t size)
+{
+    SnapshotHeader header;
+    if (size<sizeof(header)) return false;
+
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, s_snapshotMagic, sizeof(header.magic))!=0 ||
+        header.version!=s_snapshotVersion ||
+        header.byteOrder!=s_snapshotByteOrder ||
+        header.payloadSize!=size-sizeof(header))
+    {
+        return false;
+    }
+
+    const unsigned char* payload = data+sizeof(header);
+    if (computeSnapshotChecksum(payload, header.payloadSize)!=header.checksum) return false;
+
+    SnapshotReader reader(payload, header.payloadSize);
+
+    // parse into plain fields, only adopted once the whole payload has been read.
+    SnapshotFields fields = SnapshotFields();
+
+    fields.displayType = reader.readUInt();
+    fields.stereo = reader.readBool();
+    fields.stereoMode = reader.readUInt();
+    fields.eyeSeparation = reader.readFloat();
+    fields.screenWidth = reader.readFloat();
+    fields.screenHeight = reader.readFloat();
+    fields.screenDistance = reader.readFloat();
+
+    fields.splitStereoHorizontalEyeMapping = reader.readUInt();
+    fields.splitStereoHorizontalSeparation = reader.readInt();
+    fields.splitStereoVerticalEyeMapping = reader.readUInt();
+    fields.splitStereoVerticalSeparation = reader.readInt();
+    fields.splitStereoAutoAdjustAspectRatio = reader.readBool();
+
+    fields.doubleBuffer = reader.readBool();
+    fields.RGB = reader.readBool();
+    fields.depthBuffer = reader.readBool();
+    fields.minimumNumberAlphaBits = reader.readUInt();
+    fields.minimumNumberStencilBits = reader.readUInt();
+    fields.minimumNumberAccumRedBits = reader.readUInt();
+    fields.minimumNumberAccumGreenBits = reader.readUInt();
+    fields.minimumNumberAccumBlueBits = reader.readUInt();
+    fields.minimumNumberAccumAlphaBits = reader.readUInt();
+
+    fields.maxNumOfGraphicsContexts = reader.readUInt();
+    fields.numMultiSamples = reader.readUInt();
+
+    fields.compileContextsHint = reader.readBool();
+    fields.serializeDrawDispatch = reader.readBool();
+    fields.useSceneViewForStereoHint = reader.readBool();
+    fields.instancedStereoHint = reader.readBool();
+
+    fields.numDatabaseThreadsHint = reader.readUInt();
+    fields.numHttpDatabaseThreadsHint = reader.readUInt();
+
+    // the application name belongs to the process that wrote the snapshot, skip it.
+    reader.readString();
+
+    fields.maxTexturePoolSize = reader.readUInt();
+    fields.maxBufferObjectPoolSize = reader.readUInt();
+
+    fields.implicitBufferAttachmentRenderMask = reader.readInt();
+    fields.implicitBufferAttachmentResolveMask = reader.readInt();
+
+    fields.glContextVersion = reader.readString();
+    fields.glContextFlags = reader.readUInt();
+    fields.glContextProfileMask = reader.readUInt();
+
+    fields.swapMethod = reader.readUInt();
+    fields.syncSwapBuffers = reader.readUInt();
+
+    fields.vertexBufferHint = reader.readUInt();
+    fields.shaderHint = reader.readUInt();
+    fields.textShaderTechnique = reader.readString();
+
+    fields.keystoneHint = reader.readBool();
+    fields.keystoneFileNames = reader.readStrings();
+
+    fields.OSXMenubarBehavior = reader.readUInt();
+
+    fields.shaderPipeline = reader.readBool();
+    fields.shaderPipelineFiles = reader.readStrings();
+    fields.shaderPipelineNumTextureUnits = reader.readUInt();
+
+    fields.nvOptimusEnablement = reader.readInt();
+
+    ValueSnapshot* values = new ValueSnapshot;
+    unsigned int numValues = reader.readUInt();
+    for(unsigned int i=0; i<numValues && reader.ok(); ++i)
+    {
+        std::string name = reader.readString();
+        std::string value = reader.readString();
+        (*values)[name] = ValueEntry(value, true);
+    }
+
+    if (!reader.ok())
+    {
+        // can only happen if the writer and reader disagree on the layout for the same version.
+        OSG_WARN<<"Warning: DisplaySettings::readSnapshot() snapshot payload is malformed, ignoring it."<<std::endl;
+        delete values;
         return false;
     }
+
+    _displayType = static_cast<DisplayType>(fields.displayType);
+    _stereo = fields.stereo;
+    _stereoMode = static_cast<StereoMode>(fields.stereoMode);
+    _eyeSeparation = fields.eyeSeparation;
+    _screenWidth = fields.screenWidth;
+    _screenHeight = fields.screenHeight;
+    _screenDistance = fields.screenDistance;
+
+    _splitStereoHorizontalEyeMapping = static_cast<SplitStereoHorizontalEyeMapping>(fields.splitStereoHorizontalEyeMapping);
+    _splitStereoHorizontalSeparation = fields.splitStereoHorizontalSeparation;
+    _splitStereoVerticalEyeMapping = static_cast<SplitStereoVerticalEyeMapping>(fields.splitStereoVerticalEyeMapping);
+    _splitStereoVerticalSeparation = fields.splitStereoVerticalSeparation;
+    _splitStereoAutoAdjustAspectRatio = fields.splitStereoAutoAdjustAspectRatio;
+
+    _doubleBuffer = fields.doubleBuffer;
+    _RGB = fields.RGB;
+    _depthBuffer = fields.depthBuffer;
+    _minimumNumberAlphaBits = fields.minimumNumberAlphaBits;
+    _minimumNumberStencilBits = fields.minimumNumberStencilBits;
+    _minimumNumberAccumRedBits = fields.minimumNumberAccumRedBits;
+    _minimumNumberAccumGreenBits = fields.minimumNumberAccumGreenBits;
+    _minimumNumberAccumBlueBits = fields.minimumNumberAccumBlueBits;
+    _minimumNumberAccumAlphaBits = fields.minimumNumberAccumAlphaBits;
+
+    _maxNumOfGraphicsContexts = fields.maxNumOfGraphicsContexts;
+    _numMultiSamples = fields.numMultiSamples;
+
+    _compileContextsHint = fields.compileContextsHint;
+    _serializeDrawDispatch = fields.serializeDrawDispatch;
+    _useSceneViewForStereoHint = fields.useSceneViewForStereoHint;
+    _instancedStereoHint = fields.instancedStereoHint;
+
+    _numDatabaseThreadsHint = fields.numDatabaseThreadsHint;
+    _numHttpDatabaseThreadsHint = fields.numHttpDatabaseThreadsHint;
+
+    _maxTexturePoolSize = fields.maxTexturePoolSize;
+    _maxBufferObjectPoolSize = fields.maxBufferObjectPoolSize;
+
+    _implicitBufferAttachmentRenderMask = fields.implicitBufferAttachmentRenderMask;
+    _implicitBufferAttachmentResolveMask = fields.implicitBufferAttachmentResolveMask;
+
+    _glContextVersion = fields.glContextVersion;
+    _glContextFlags = fields.glContextFlags;
+    _glContextProfileMask = fields.glContextProfileMask;
+
+    _swapMethod = static_cast<SwapMethod>(fields.swapMethod);
+    _syncSwapBuffers = fields.syncSwapBuffers;
+
+    _vertexBufferHint = static_cast<VertexBufferHint>(fields.vertexBufferHint);
+    // the shader values are part of the adopted value store, so the hint is set without setShaderHint().
+    _shaderHint = static_cast<ShaderHint>(fields.shaderHint);
+    _textShaderTechnique = fields.textShaderTechnique;
+
+    _keystoneHint = fields.keystoneHint;
+    _keystoneFileNames = fields.keystoneFileNames;
+    _keystones.clear();
+
+    _OSXMenubarBehavior = static_cast<OSXMenubarBehavior>(fields.OSXMenubarBehavior);
+
+    _shaderPipeline = fields.shaderPipeline;
+    _shaderPipelineFiles = fields.shaderPipelineFiles;
+    _shaderPipelineNumTextureUnits = fields.shaderPipelineNumTextureUnits;
+
+    setNvOptimusEnablement(fields.nvOptimusEnablement);
+
+    updateEyeTransforms();
+
+    // the adopted values replace the whole value store in one publish.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_valueMapMutex);
+
+    swapValueSnapshot(values);
+
+    return true;
+}
+
+bool DisplaySettings::readEnvironmentalSnapshot()
+{
+    std::string filename;
+    if (!getEnvVar("OSG_DISPLAY_SETTINGS_SNAPSHOT", filename) || filename.empty()) return false;
+
+    OSG_INFO<<"DisplaySettings adopting snapshot "<<filename<<std::endl;
+    return readSnapshot(filename);
 }
 
 
@@ -3918,9 +5041,9 @@ void OperationThread::setOperationQueue(OperationQueue* opq)
 void OperationThread::setDone(bool done)
 {
     unsigned d = done?1:0;
-    if (_done==d) return;
+    if (_done.load(std::memory_order_relaxed)==d) return;
 
-    _done.exchange(d);
+    _done.store(d, std::memory_order_release);
 
     if (done)
     {
@@ -3947,7 +5070,7 @@ int OperationThread::cancel()
     if( isRunning() )
     {
 
-        _done.exchange(1);
+        _done.store(1, std::memory_order_release);
 
         OSG_INFO<<"   Doing cancel "<<this<<std::endl;
 
@@ -4040,7 +5163,7 @@ void OperationThread::run()
 
         operation = operationQueue->getNextOperation(true);
 
-        if (_done) break;
+        if (_done.load(std::memory_order_acquire)) break;
 
         if (operation.valid())
         {
@@ -4070,7 +5193,7 @@ void OperationThread::run()
 
         // OSG_NOTICE<<"operations.size()="<<_operations.size()<<" done="<<_done<<" testCancel()"<<testCancel()<<std::endl;
 
-    } while (!testCancel() && !_done);
+    } while (!testCancel() && !_done.load(std::memory_order_acquire));
 
     OSG_INFO<<"exit loop "<<this<<" isRunning()="<<isRunning()<<std::endl;
 
@@ -4103,6 +5226,7 @@ void OperationThread::run()
 
 #include <sstream>
 #include <algorithm>
+#include <limits>
 
 #ifndef GL_MAX_TEXTURE_COORDS
 #define GL_MAX_TEXTURE_COORDS 0x8871
@@ -4142,6 +5266,15 @@ State::State():
     _drawBuffer = GL_INVALID_ENUM; // avoid the lazy state mechanism from ignoreing the first call to State::glDrawBuffer() to make sure it's always passed to OpenGL
     _readBuffer = GL_INVALID_ENUM; // avoid the lazy state mechanism from ignoreing the first call to State::glReadBuffer() to make sure it's always passed to OpenGL
 
+    _viewportShadowValid = false;
+    _scissorShadowValid = false;
+    _clearColorShadowValid = false;
+    for(unsigned int i=0; i<4; ++i)
+    {
+        _viewportShadow[i] = 0;
+        _scissorShadow[i] = 0;
+    }
+
     _identity = new osg::RefMatrix(); // default RefMatrix constructs to identity.
     _initialViewMatrix = _identity;
     _projection = _identity;
@@ -4189,12 +5322,14 @@ State::State():
 
     _currentPBO = 0;
     _currentDIBO = 0;
+    _currentDrawIndirectBuffer = 0;
     _currentVAO = 0;
 
     _isSecondaryColorSupported = false;
     _isFogCoordSupported = false;
     _isVertexBufferObjectSupported = false;
     _isVertexArrayObjectSupported = false;
+    _isShaderViewportLayerArraySupported = false;
 
 #if OSG_GL3_FEATURES
     _forceVertexBufferObject = true;
@@ -4219,10 +5354,27 @@ State::State():
     _glDisableVertexAttribArray = 0;
     _glDrawArraysInstanced = 0;
     _glDrawElementsInstanced = 0;
+    _glDrawElementsInstancedBaseVertexBaseInstance = 0;
     _glMultiTexCoord4f = 0;
     _glVertexAttrib4fv = 0;
     _glVertexAttrib4f = 0;
     _glBindBuffer = 0;
+    _glGenBuffers = 0;
+    _glDeleteBuffers = 0;
+    _glBufferData = 0;
+    _glBufferSubData = 0;
+    _glBufferStorage = 0;
+    _glMapBufferRange = 0;
+    _glUnmapBuffer = 0;
+    _glMultiDrawElementsIndirect = 0;
+    _glBindBufferRange = 0;
+    _glBindBufferBase = 0;
+    _glViewportArrayv = 0;
+    _glUniform4fv = 0;
+    _glUniformMatrix3fv = 0;
+    _glUniformMatrix4fv = 0;
+
+    _useQuadElementBufferObjects = false;
 
     _dynamicObjectCount  = 0;
 
@@ -4235,6 +5387,7 @@ State::State():
     _arrayDispatchers.setState(this);
 
     _graphicsCostEstimator = new GraphicsCostEstimator;
+    _glObjectDeletionCostModel = new GLObjectDeletionCostModel;
 
     _startTick = 0;
     _gpuTick = 0;
@@ -4305,6 +5458,7 @@ void State::initializeExtensionProcs()
     _isFogCoordSupported = osg::isGLExtensionSupported(_contextID,"GL_EXT_fog_coord");
     _isVertexBufferObjectSupported = OSG_GLES2_FEATURES || OSG_GLES3_FEATURES || OSG_GL3_FEATURES || osg::isGLExtensionSupported(_contextID,"GL_ARB_vertex_buffer_object");
     _isVertexArrayObjectSupported = _glExtensions->isVAOSupported;
+    _isShaderViewportLayerArraySupported = osg::isGLExtensionSupported(_contextID,"GL_ARB_shader_viewport_layer_array");
 
     const DisplaySettings* ds = getDisplaySettings() ? getDisplaySettings() : osg::DisplaySettings::instance().get();
 
@@ -4337,6 +5491,42 @@ void State::initializeExtensionProcs()
     setCurrentToGlobalVertexArrayState();
 
 
+#ifdef OSG_GL_RECORDING
+    // there may be no GL driver to query the entry points from, route them to the current GLRecorder.
+    _glClientActiveTexture = &osgRecordingGL_glClientActiveTexture;
+    _glActiveTexture = &osgRecordingGL_glActiveTexture;
+    _glFogCoordPointer = &osgRecordingGL_glFogCoordPointer;
+    _glSecondaryColorPointer = &osgRecordingGL_glSecondaryColorPointer;
+    _glVertexAttribPointer = &osgRecordingGL_glVertexAttribPointer;
+    _glVertexAttribIPointer = &osgRecordingGL_glVertexAttribIPointer;
+    _glVertexAttribLPointer = &osgRecordingGL_glVertexAttribLPointer;
+    _glEnableVertexAttribArray = &osgRecordingGL_glEnableVertexAttribArray;
+    _glMultiTexCoord4f = &osgRecordingGL_glMultiTexCoord4f;
+    _glVertexAttrib4f = &osgRecordingGL_glVertexAttrib4f;
+    _glVertexAttrib4fv = &osgRecordingGL_glVertexAttrib4fv;
+    _glDisableVertexAttribArray = &osgRecordingGL_glDisableVertexAttribArray;
+    _glBindBuffer = &osgRecordingGL_glBindBuffer;
+    _glGenBuffers = &osgRecordingGL_glGenBuffers;
+    _glDeleteBuffers = &osgRecordingGL_glDeleteBuffers;
+    _glBufferData = &osgRecordingGL_glBufferData;
+    _glBufferSubData = &osgRecordingGL_glBufferSubData;
+    _glBufferStorage = &osgRecordingGL_glBufferStorage;
+    _glMapBufferRange = &osgRecordingGL_glMapBufferRange;
+    _glUnmapBuffer = &osgRecordingGL_glUnmapBuffer;
+    _glBindBufferRange = &osgRecordingGL_glBindBufferRange;
+    _glBindBufferBase = &osgRecordingGL_glBindBufferBase;
+    _glViewportArrayv = &osgRecordingGL_glViewportArrayv;
+    _glUniform4fv = &osgRecordingGL_glUniform4fv;
+    _glUniformMatrix3fv = &osgRecordingGL_glUniformMatrix3fv;
+    _glUniformMatrix4fv = &osgRecordingGL_glUniformMatrix4fv;
+    // nothing compiles the shaders, so gl_ViewportIndex in vertex shaders is as good as supported.
+    _isShaderViewportLayerArraySupported = true;
+
+    _glDrawArraysInstanced = &osgRecordingGL_glDrawArraysInstanced;
+    _glDrawElementsInstanced = &osgRecordingGL_glDrawElementsInstanced;
+    _glDrawElementsInstancedBaseVertexBaseInstance = &osgRecordingGL_glDrawElementsInstancedBaseVertexBaseInstance;
+    _glMultiDrawElementsIndirect = &osgRecordingGL_glMultiDrawElementsIndirect;
+#else
     setGLExtensionFuncPtr(_glClientActiveTexture,"glClientActiveTexture","glClientActiveTextureARB");
     setGLExtensionFuncPtr(_glActiveTexture, "glActiveTexture","glActiveTextureARB");
     setGLExtensionFuncPtr(_glFogCoordPointer, "glFogCoordPointer","glFogCoordPointerEXT");
@@ -4350,9 +5540,25 @@ void State::initializeExtensionProcs()
     setGLExtensionFuncPtr(_glVertexAttrib4fv, "glVertexAttrib4fv");
     setGLExtensionFuncPtr(_glDisableVertexAttribArray, "glDisableVertexAttribArray","glDisableVertexAttribArrayARB");
     setGLExtensionFuncPtr(_glBindBuffer, "glBindBuffer","glBindBufferARB");
+    setGLExtensionFuncPtr(_glGenBuffers, "glGenBuffers","glGenBuffersARB");
+    setGLExtensionFuncPtr(_glDeleteBuffers, "glDeleteBuffers","glDeleteBuffersARB");
+    setGLExtensionFuncPtr(_glBufferData, "glBufferData","glBufferDataARB");
+    setGLExtensionFuncPtr(_glBufferSubData, "glBufferSubData","glBufferSubDataARB");
+    setGLExtensionFuncPtr(_glBufferStorage, "glBufferStorage","glBufferStorageEXT");
+    setGLExtensionFuncPtr(_glMapBufferRange, "glMapBufferRange","glMapBufferRangeEXT");
+    setGLExtensionFuncPtr(_glUnmapBuffer, "glUnmapBuffer","glUnmapBufferARB","glUnmapBufferOES");
+    setGLExtensionFuncPtr(_glBindBufferRange, "glBindBufferRange","glBindBufferRangeEXT");
+    setGLExtensionFuncPtr(_glBindBufferBase, "glBindBufferBase","glBindBufferBaseEXT");
+    setGLExtensionFuncPtr(_glViewportArrayv, "glViewportArrayv","glViewportArrayvNV","glViewportArrayvOES");
+    setGLExtensionFuncPtr(_glUniform4fv, "glUniform4fv","glUniform4fvARB");
+    setGLExtensionFuncPtr(_glUniformMatrix3fv, "glUniformMatrix3fv","glUniformMatrix3fvARB");
+    setGLExtensionFuncPtr(_glUniformMatrix4fv, "glUniformMatrix4fv","glUniformMatrix4fvARB");
 
     setGLExtensionFuncPtr(_glDrawArraysInstanced, "glDrawArraysInstanced","glDrawArraysInstancedARB","glDrawArraysInstancedEXT");
     setGLExtensionFuncPtr(_glDrawElementsInstanced, "glDrawElementsInstanced","glDrawElementsInstancedARB","glDrawElementsInstancedEXT");
+    setGLExtensionFuncPtr(_glDrawElementsInstancedBaseVertexBaseInstance, "glDrawElementsInstancedBaseVertexBaseInstance","glDrawElementsInstancedBaseVertexBaseInstanceEXT");
+    setGLExtensionFuncPtr(_glMultiDrawElementsIndirect, "glMultiDrawElementsIndirect","glMultiDrawElementsIndirectEXT");
+#endif
 
     if (osg::getGLVersionNumber() >= 2.0 || osg::isGLExtensionSupported(_contextID, "GL_ARB_vertex_shader") || OSG_GLES2_FEATURES || OSG_GLES3_FEATURES || OSG_GL3_FEATURES)
     {
@@ -4515,7 +5721,22 @@ void State::releaseGLObjects()
     // release any GL objects held by the shader composer
     _shaderComposer->releaseGLObjects(this);
 
-    // release any StateSet's on the stack
+    // release the quad index element buffer objects
+    for(unsigned int i=0; i<4; ++i)
+    {
+        QuadElementBufferObject* ebos[2] = { &_quadElementBufferObjectsGLushort[i], &_quadElementBufferObjectsGLuint[i] };
+        for(unsigned int j=0; j<2; ++j)
+        {
+            if (ebos[j]->id!=0 && _glDeleteBuffers)
+            {
+                _glDeleteBuffers(1, &(ebos[j]->id));
+                if (_glObjectDeletionCostModel.valid()) _glObjectDeletionCostModel->deletedImmediately(GLObjectDeletionCostModel::BUFFER_OBJECT);
+            }
+            *ebos[j] = QuadElementBufferObject();
+        }
+    }
+
+    // release any StateSet's on the stack
     for(StateSetStack::iterator itr = _stateStateStack.begin();
         itr != _stateStateStack.end();
         ++itr)
@@ -4623,6 +5844,8 @@ void State::reset()
 
     _stateStateStack.clear();
 
+    dirtyGLShadowState();
+
     _modelView = _identity;
     _projection = _identity;
 
@@ -4666,6 +5889,11 @@ void State::glDrawBuffer(GLenum buffer)
         ::glDrawBuffer(buffer);
         #endif
         _drawBuffer=buffer;
+        ++_glShadowCounts[SHADOW_DRAW_BUFFER].misses;
+    }
+    else
+    {
+        ++_glShadowCounts[SHADOW_DRAW_BUFFER].hits;
     }
 }
 
@@ -4677,7 +5905,157 @@ void State::glReadBuffer(GLenum buffer)
         ::glReadBuffer(buffer);
         #endif
         _readBuffer=buffer;
+        ++_glShadowCounts[SHADOW_READ_BUFFER].misses;
+    }
+    else
+    {
+        ++_glShadowCounts[SHADOW_READ_BUFFER].hits;
+    }
+}
+
+void State::glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (_viewportShadowValid &&
+        _viewportShadow[0]==x && _viewportShadow[1]==y && _viewportShadow[2]==width && _viewportShadow[3]==height)
+    {
+        ++_glShadowCounts[SHADOW_VIEWPORT].hits;
+        return;
+    }
+
+    ::glViewport(x, y, width, height);
+
+    _viewportShadowValid = true;
+    _viewportShadow[0] = x;
+    _viewportShadow[1] = y;
+    _viewportShadow[2] = width;
+    _viewportShadow[3] = height;
+    ++_glShadowCounts[SHADOW_VIEWPORT].misses;
+}
+
+void State::glScissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (_scissorShadowValid &&
+        _scissorShadow[0]==x && _scissorShadow[1]==y && _scissorShadow[2]==width && _scissorShadow[3]==height)
+    {
+        ++_glShadowCounts[SHADOW_SCISSOR].hits;
+        return;
+    }
+
+    ::glScissor(x, y, width, height);
+
+    _scissorShadowValid = true;
+    _scissorShadow[0] = x;
+    _scissorShadow[1] = y;
+    _scissorShadow[2] = width;
+    _scissorShadow[3] = height;
+    ++_glShadowCounts[SHADOW_SCISSOR].misses;
+}
+
+void State::glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    if (_clearColorShadowValid && _clearColorShadow==Vec4f(red, green, blue, alpha))
+    {
+        ++_glShadowCounts[SHADOW_CLEAR_COLOR].hits;
+        return;
+    }
+
+    ::glClearColor(red, green, blue, alpha);
+
+    _clearColorShadowValid = true;
+    _clearColorShadow.set(red, green, blue, alpha);
+    ++_glShadowCounts[SHADOW_CLEAR_COLOR].misses;
+}
+
+void State::dirtyGLShadowState()
+{
+    _drawBuffer = GL_INVALID_ENUM;
+    _readBuffer = GL_INVALID_ENUM;
+    _viewportShadowValid = false;
+    _scissorShadowValid = false;
+    _clearColorShadowValid = false;
+    dirtyVertexAttribShadowsAboveAndIncluding(0);
+}
+
+const char* State::getGLShadowCallName(GLShadowCall call)
+{
+    switch(call)
+    {
+        case(SHADOW_VIEWPORT): return "glViewport";
+        case(SHADOW_SCISSOR): return "glScissor";
+        case(SHADOW_CLEAR_COLOR): return "glClearColor";
+        case(SHADOW_DRAW_BUFFER): return "glDrawBuffer";
+        case(SHADOW_READ_BUFFER): return "glReadBuffer";
+        case(SHADOW_VERTEX_ATTRIB): return "glVertexAttrib";
+        case(SHADOW_MODE): return "glEnable/glDisable";
+        default: return "unknown";
+    }
+}
+
+static bool compareGLShadow(const char* name, const GLint* shadow, const GLint* current, unsigned int num)
+{
+    for(unsigned int i=0; i<num; ++i)
+    {
+        if (shadow[i]!=current[i])
+        {
+            OSG_NOTICE<<"Warning: State::checkGLShadowState() "<<name<<" shadow (";
+            for(unsigned int j=0; j<num; ++j) OSG_NOTICE<<(j>0 ? ", " : "")<<shadow[j];
+            OSG_NOTICE<<") doesn't match OpenGL (";
+            for(unsigned int j=0; j<num; ++j) OSG_NOTICE<<(j>0 ? ", " : "")<<current[j];
+            OSG_NOTICE<<")"<<std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool State::checkGLShadowState() const
+{
+    bool matches = true;
+
+    if (_viewportShadowValid)
+    {
+        GLint viewport[4] = { 0, 0, 0, 0 };
+        ::glGetIntegerv(GL_VIEWPORT, viewport);
+        matches = compareGLShadow("viewport", _viewportShadow, viewport, 4) && matches;
+    }
+
+    if (_scissorShadowValid)
+    {
+        GLint scissor[4] = { 0, 0, 0, 0 };
+        ::glGetIntegerv(GL_SCISSOR_BOX, scissor);
+        matches = compareGLShadow("scissor", _scissorShadow, scissor, 4) && matches;
     }
+
+    if (_clearColorShadowValid)
+    {
+        GLfloat clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        ::glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+        if (_clearColorShadow!=Vec4f(clearColor[0], clearColor[1], clearColor[2], clearColor[3]))
+        {
+            OSG_NOTICE<<"Warning: State::checkGLShadowState() clear color shadow ("
+                      <<_clearColorShadow[0]<<", "<<_clearColorShadow[1]<<", "<<_clearColorShadow[2]<<", "<<_clearColorShadow[3]<<") doesn't match OpenGL ("
+                      <<clearColor[0]<<", "<<clearColor[1]<<", "<<clearColor[2]<<", "<<clearColor[3]<<")"<<std::endl;
+            matches = false;
+        }
+    }
+
+    #if !defined(OSG_GLES1_AVAILABLE) && !defined(OSG_GLES2_AVAILABLE) && !defined(OSG_GLES3_AVAILABLE)
+    if (_drawBuffer!=GL_INVALID_ENUM)
+    {
+        GLint shadow = static_cast<GLint>(_drawBuffer), current = 0;
+        ::glGetIntegerv(GL_DRAW_BUFFER, &current);
+        matches = compareGLShadow("draw buffer", &shadow, &current, 1) && matches;
+    }
+
+    if (_readBuffer!=GL_INVALID_ENUM)
+    {
+        GLint shadow = static_cast<GLint>(_readBuffer), current = 0;
+        ::glGetIntegerv(GL_READ_BUFFER, &current);
+        matches = compareGLShadow("read buffer", &shadow, &current, 1) && matches;
+    }
+    #endif
+
+    return matches;
 }
 
 void State::setInitialViewMatrix(const osg::RefMatrix* matrix)
@@ -5363,6 +6741,8 @@ void State::disableAllVertexArrays()
 void State::dirtyAllVertexArrays()
 {
     OSG_INFO<<"State::dirtyAllVertexArrays()"<<std::endl;
+
+    dirtyVertexAttribShadowsAboveAndIncluding(0);
 }
 
 bool State::setClientActiveTextureUnit( unsigned int unit )
@@ -5732,6 +7112,96 @@ void State::updateModelViewAndProjectionMatrixUniforms()
     }
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////
+//
+//  QuadIndexTable
+//
+template<typename T>
+unsigned int QuadIndexTable<T>::getMaxNumQuads()
+{
+    // the largest vertex index of a table, numQuads*4+phase+3, has to fit in T, as does the number of indices.
+    unsigned long long maxIndex = static_cast<unsigned long long>(std::numeric_limits<T>::max());
+    unsigned long long maxNumQuads = std::min((maxIndex-6)/4, maxIndex/6);
+    return static_cast<unsigned int>(std::min(maxNumQuads, static_cast<unsigned long long>(std::numeric_limits<unsigned int>::max()/6)));
+}
+
+template<typename T>
+QuadIndexTable<T>::QuadIndexTable(unsigned int phase, unsigned int numQuads):
+    Referenced(true),
+    _phase(phase),
+    _indices(numQuads*6)
+{
+    // written as independent stores of a fixed pattern rather than push_back()'s so the compiler can vectorize the fill.
+    T* indices = _indices.empty() ? 0 : &(_indices.front());
+    for(unsigned int i=0; i<numQuads; ++i)
+    {
+        T base = static_cast<T>(i*4 + phase);
+        T* quad = indices + i*6;
+        quad[0] = base;
+        quad[1] = base+1;
+        quad[2] = base+3;
+        quad[3] = base+1;
+        quad[4] = base+2;
+        quad[5] = base+3;
+    }
+}
+
+template<typename T>
+ref_ptr<const QuadIndexTable<T> > QuadIndexTable<T>::get(unsigned int phase, unsigned int numQuads)
+{
+    static OpenThreads::Mutex s_mutex;
+    static ref_ptr<const QuadIndexTable> s_tables[4];
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_mutex);
+
+    ref_ptr<const QuadIndexTable>& table = s_tables[phase];
+    if (!table || table->getNumQuads()<numQuads)
+    {
+        // round up to a power of two, starting at 1024 quads, to amortize regeneration of growing tables.
+        unsigned int maxNumQuads = getMaxNumQuads();
+        unsigned int requiredNumQuads = 1024;
+        while(requiredNumQuads<numQuads && requiredNumQuads<maxNumQuads/2) requiredNumQuads *= 2;
+        requiredNumQuads = std::min(std::max(requiredNumQuads, numQuads), maxNumQuads);
+
+        table = new QuadIndexTable(phase, requiredNumQuads);
+    }
+
+    return table;
+}
+
+template class QuadIndexTable<GLushort>;
+template class QuadIndexTable<GLuint>;
+
+template<typename T>
+void State::drawQuads(const QuadIndexTable<T>& table, QuadElementBufferObject& ebo, GLenum type, unsigned int offsetFirst, unsigned int numIndices, GLsizei primCount)
+{
+    if (_useQuadElementBufferObjects && _glGenBuffers && _glBufferData && _glBindBuffer)
+    {
+        if (ebo.id==0) _glGenBuffers(1, &ebo.id);
+
+        // the element buffer binding belongs to the bound vertex array object, if any, so the one it had is put back after the draw.
+        const GLBufferObject* previousEBO = getCurrentElementBufferObject();
+
+        _glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, ebo.id);
+
+        if (ebo.numQuads<table.getNumQuads())
+        {
+            // upload once per table size, from then on the draw never touches the CPU side indices.
+            _glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, table.getIndices().size()*sizeof(T), table.getIndices(0), GL_STATIC_DRAW_ARB);
+            ebo.numQuads = table.getNumQuads();
+        }
+
+        glDrawElementsInstanced(GL_TRIANGLES, numIndices, type, reinterpret_cast<const GLvoid*>(offsetFirst*sizeof(T)), primCount);
+
+        // with no element buffer tracked this unbinds, so subsequent client side index arrays aren't taken as buffer offsets.
+        _glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, previousEBO ? previousEBO->getGLObjectID() : 0);
+    }
+    else
+    {
+        glDrawElementsInstanced(GL_TRIANGLES, numIndices, type, table.getIndices(offsetFirst), primCount);
+    }
+}
+
 void State::drawQuads(GLint first, GLsizei count, GLsizei primCount)
 {
     // OSG_NOTICE<<"State::drawQuads("<<first<<", "<<count<<")"<<std::endl;
@@ -5741,66 +7211,27 @@ void State::drawQuads(GLint first, GLsizei count, GLsizei primCount)
     unsigned int numQuads = (count/4);
     unsigned int numIndices = numQuads * 6;
     unsigned int endOfIndices = offsetFirst+numIndices;
+    unsigned int numRequiredQuads = endOfIndices/6;
 
     if (endOfIndices<65536)
     {
-        IndicesGLushort& indices = _quadIndicesGLushort[array];
-
-        if (endOfIndices >= indices.size())
+        ref_ptr<const QuadIndexTable<GLushort> >& table = _quadIndicesGLushort[array];
+        if (!table || table->getNumQuads()<numRequiredQuads)
         {
-            // we need to expand the _indexArray to be big enough to cope with all the quads required.
-            unsigned int numExistingQuads = indices.size()/6;
-            unsigned int numRequiredQuads = endOfIndices/6;
-            indices.reserve(endOfIndices);
-            for(unsigned int i=numExistingQuads; i<numRequiredQuads; ++i)
-            {
-                unsigned int base = i*4 + array;
-                indices.push_back(base);
-                indices.push_back(base+1);
-                indices.push_back(base+3);
-
-                indices.push_back(base+1);
-                indices.push_back(base+2);
-                indices.push_back(base+3);
-
-                // OSG_NOTICE<<"   adding quad indices ("<<base<<")"<<std::endl;
-            }
+            table = QuadIndexTable<GLushort>::get(array, numRequiredQuads);
         }
 
-        // if (array!=0) return;
-
-        // OSG_NOTICE<<"  glDrawElements(GL_TRIANGLES, "<<numIndices<<", GL_UNSIGNED_SHORT, "<<&(indices[base])<<")"<<std::endl;
-        glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_SHORT, &(indices[offsetFirst]), primCount);
+        drawQuads(*table, _quadElementBufferObjectsGLushort[array], GL_UNSIGNED_SHORT, offsetFirst, numIndices, primCount);
     }
     else
     {
-        IndicesGLuint& indices = _quadIndicesGLuint[array];
-
-        if (endOfIndices >= indices.size())
+        ref_ptr<const QuadIndexTable<GLuint> >& table = _quadIndicesGLuint[array];
+        if (!table || table->getNumQuads()<numRequiredQuads)
         {
-            // we need to expand the _indexArray to be big enough to cope with all the quads required.
-            unsigned int numExistingQuads = indices.size()/6;
-            unsigned int numRequiredQuads = endOfIndices/6;
-            indices.reserve(endOfIndices);
-            for(unsigned int i=numExistingQuads; i<numRequiredQuads; ++i)
-            {
-                unsigned int base = i*4 + array;
-                indices.push_back(base);
-                indices.push_back(base+1);
-                indices.push_back(base+3);
-
-                indices.push_back(base+1);
-                indices.push_back(base+2);
-                indices.push_back(base+3);
-
-                // OSG_NOTICE<<"   adding quad indices ("<<base<<")"<<std::endl;
-            }
+            table = QuadIndexTable<GLuint>::get(array, numRequiredQuads);
         }
 
-        // if (array!=0) return;
-
-        // OSG_NOTICE<<"  glDrawElements(GL_TRIANGLES, "<<numIndices<<", GL_UNSIGNED_SHORT, "<<&(indices[base])<<")"<<std::endl;
-        glDrawElementsInstanced(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, &(indices[offsetFirst]), primCount);
+        drawQuads(*table, _quadElementBufferObjectsGLuint[array], GL_UNSIGNED_INT, offsetFirst, numIndices, primCount);
     }
 }
 
@@ -5952,6 +7383,12 @@ void State::print(std::ostream& fout) const
 
 void State::frameCompleted()
 {
+    for(unsigned int i=0; i<NUM_GL_SHADOW_CALLS; ++i)
+    {
+        _previousFrameGLShadowCounts[i] = _glShadowCounts[i];
+        _glShadowCounts[i] = GLShadowCount();
+    }
+
     if (getTimestampBits())
     {
         GLint64 timestamp;
@@ -6143,12 +7580,162 @@ bool State::supportsShaderRequirement(const std::string& shaderRequirement)
 }
 
 
+GLObjectDeletionCostModel::GLObjectDeletionCostModel():
+    _learningRate(0.1)
+{
+    for(unsigned int i=0; i<NUM_OBJECT_TYPES; ++i)
+    {
+        _numPending[i] = 0;
+        _numDeleted[i] = 0;
+    }
+    setDefaults();
+}
+
+const char* GLObjectDeletionCostModel::getObjectTypeName(ObjectType type)
+{
+    switch(type)
+    {
+        case(BUFFER_OBJECT): return "BUFFER_OBJECT";
+        case(TEXTURE_OBJECT): return "TEXTURE_OBJECT";
+        case(FRAME_BUFFER_OBJECT): return "FRAME_BUFFER_OBJECT";
+        case(RENDER_BUFFER_OBJECT): return "RENDER_BUFFER_OBJECT";
+        case(PROGRAM_OBJECT): return "PROGRAM_OBJECT";
+        case(SHADER_OBJECT): return "SHADER_OBJECT";
+        case(VERTEX_ARRAY_OBJECT): return "VERTEX_ARRAY_OBJECT";
+        case(QUERY_OBJECT): return "QUERY_OBJECT";
+        case(DISPLAY_LIST): return "DISPLAY_LIST";
+        case(OTHER_OBJECT): return "OTHER_OBJECT";
+        default: return "UNKNOWN";
+    }
+}
+
+void GLObjectDeletionCostModel::setDefaults()
+{
+    // rough per object costs in seconds, textures and programs take the driver longest to release,
+    // the measured timings soon replace these.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _cost[BUFFER_OBJECT] = 2e-6;
+    _cost[TEXTURE_OBJECT] = 10e-6;
+    _cost[FRAME_BUFFER_OBJECT] = 5e-6;
+    _cost[RENDER_BUFFER_OBJECT] = 5e-6;
+    _cost[PROGRAM_OBJECT] = 20e-6;
+    _cost[SHADER_OBJECT] = 10e-6;
+    _cost[VERTEX_ARRAY_OBJECT] = 2e-6;
+    _cost[QUERY_OBJECT] = 1e-6;
+    _cost[DISPLAY_LIST] = 5e-6;
+    _cost[OTHER_OBJECT] = 5e-6;
+}
+
+void GLObjectDeletionCostModel::scheduledForDeletion(ObjectType type, unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _numPending[type] += num;
+}
+
+void GLObjectDeletionCostModel::deleted(ObjectType type, unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _numPending[type] -= std::min(num, _numPending[type]);
+    _numDeleted[type] += num;
+}
+
+void GLObjectDeletionCostModel::deletedImmediately(ObjectType type, unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _numDeleted[type] += num;
+}
+
+void GLObjectDeletionCostModel::unscheduled(ObjectType type, unsigned int num)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _numPending[type] -= std::min(num, _numPending[type]);
+}
+
+void GLObjectDeletionCostModel::setCost(ObjectType type, double cost)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _cost[type] = cost;
+}
+
+double GLObjectDeletionCostModel::getCost(ObjectType type) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _cost[type];
+}
+
+unsigned int GLObjectDeletionCostModel::getNumPending(ObjectType type) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _numPending[type];
+}
+
+unsigned int GLObjectDeletionCostModel::getNumDeleted(ObjectType type) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _numDeleted[type];
+}
+
+unsigned int GLObjectDeletionCostModel::getBacklogSize() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    unsigned int backlog = 0;
+    for(unsigned int i=0; i<NUM_OBJECT_TYPES; ++i) backlog += _numPending[i];
+    return backlog;
+}
+
+double GLObjectDeletionCostModel::getEstimatedDrainTime() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    double drainTime = 0.0;
+    for(unsigned int i=0; i<NUM_OBJECT_TYPES; ++i) drainTime += double(_numPending[i])*_cost[i];
+    return drainTime;
+}
+
+double GLObjectDeletionCostModel::estimateCost(const unsigned int numDeleted[NUM_OBJECT_TYPES]) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    double cost = 0.0;
+    for(unsigned int i=0; i<NUM_OBJECT_TYPES; ++i) cost += double(numDeleted[i])*_cost[i];
+    return cost;
+}
+
+void GLObjectDeletionCostModel::update(const unsigned int numDeleted[NUM_OBJECT_TYPES], double measuredTime)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    double estimatedTime = 0.0;
+    unsigned int totalDeleted = 0;
+    for(unsigned int i=0; i<NUM_OBJECT_TYPES; ++i)
+    {
+        estimatedTime += double(numDeleted[i])*_cost[i];
+        totalDeleted += numDeleted[i];
+    }
+
+    if (totalDeleted==0 || measuredTime<=0.0) return;
+
+    // scale each type that took part towards the measured time, clamping the ratio so that
+    // a single preempted flush can't throw the model out.
+    double ratio = estimatedTime>0.0 ? measuredTime/estimatedTime : 1.0;
+    ratio = osg::clampBetween(ratio, 0.1, 10.0);
+
+    for(unsigned int i=0; i<NUM_OBJECT_TYPES; ++i)
+    {
+        if (numDeleted[i]==0) continue;
+
+        double target = estimatedTime>0.0 ? _cost[i]*ratio : measuredTime/double(totalDeleted);
+        _cost[i] += (target-_cost[i])*_learningRate;
+    }
+}
+
+
 // OSGFILE src/osg/GraphicsThread.cpp
 
 /*
 #include <osg/GraphicsThread>
 #include <osg/GraphicsContext>
 #include <osg/GLObjects>
+#include <osg/Texture>
+#include <osg/BufferObject>
 #include <osg/Notify>
 */
 
@@ -6253,8 +7840,43 @@ void BlockAndFlushOperation::operator () (GraphicsContext*)
 FlushDeletedGLObjectsOperation::FlushDeletedGLObjectsOperation(double availableTime, bool keep):
     osg::Referenced(true),
     GraphicsOperation("FlushDeletedGLObjectsOperation",keep),
-    _availableTime(availableTime)
+    _availableTime(availableTime),
+    _targetFrameTime(0.0),
+    _minimumAvailableTime(0.0005),
+    _maximumAvailableTime(0.005),
+    _drainFrames(120),
+    _lastTime(-1.0),
+    _lastAvailableTime(0.0),
+    _lastFlushTime(0.0),
+    _backlogSize(0),
+    _estimatedDrainTime(0.0)
+{
+}
+
+static void reportPendingDeletions(GLObjectDeletionCostModel& model, GLObjectDeletionCostModel::ObjectType type, unsigned int numPending)
 {
+    unsigned int numModelPending = model.getNumPending(type);
+    if (numPending>numModelPending) model.scheduledForDeletion(type, numPending-numModelPending);
+    else if (numPending<numModelPending) model.unscheduled(type, numModelPending-numPending);
+}
+
+double FlushDeletedGLObjectsOperation::time() const
+{
+    return osg::Timer::instance()->time_s();
+}
+
+double FlushDeletedGLObjectsOperation::computeAvailableTime(const GLObjectDeletionCostModel* model, double currentTime)
+{
+    if (_lastTime<0.0) return osg::clampBetween(_availableTime, _minimumAvailableTime, _maximumAvailableTime);
+
+    // the time the rest of the frame took is the interval since the last call less the time spent flushing then.
+    double frameTime = currentTime - _lastTime;
+    double slack = _targetFrameTime - (frameTime - _lastFlushTime);
+
+    // make steady progress on a large backlog even when the frame leaves no slack.
+    double drainTime = (model && _drainFrames>0) ? model->getEstimatedDrainTime()/double(_drainFrames) : 0.0;
+
+    return osg::clampBetween(osg::maximum(slack, drainTime), _minimumAvailableTime, _maximumAvailableTime);
 }
 
 void FlushDeletedGLObjectsOperation::operator () (GraphicsContext* context)
@@ -6265,7 +7887,62 @@ void FlushDeletedGLObjectsOperation::operator () (GraphicsContext* context)
     double currentTime = frameStamp ? frameStamp->getReferenceTime() : 0.0;
     double availableTime = _availableTime;
 
+    GLObjectDeletionCostModel* model = state ? state->getGLObjectDeletionCostModel() : 0;
+
+    // the texture and buffer object managers keep their orphaned objects until they are flushed, bring the
+    // model's backlog in line with them.
+    TextureObjectManager* textureObjectManager = model ? osg::get<TextureObjectManager>(contextID) : 0;
+    GLBufferObjectManager* bufferObjectManager = model ? osg::get<GLBufferObjectManager>(contextID) : 0;
+    unsigned int numTexturesDeleted = 0;
+    unsigned int numBuffersDeleted = 0;
+    if (model)
+    {
+        reportPendingDeletions(*model, GLObjectDeletionCostModel::TEXTURE_OBJECT, textureObjectManager->getNumberOrphanedTextureObjects());
+        reportPendingDeletions(*model, GLObjectDeletionCostModel::BUFFER_OBJECT, bufferObjectManager->getNumberOrphanedGLBufferObjects());
+        numTexturesDeleted = textureObjectManager->getNumberDeleted();
+        numBuffersDeleted = bufferObjectManager->getNumberDeleted();
+    }
+
+    double startTime = time();
+    if (_targetFrameTime>0.0) availableTime = computeAvailableTime(model, startTime);
+
+    unsigned int numDeleted[GLObjectDeletionCostModel::NUM_OBJECT_TYPES];
+    if (model)
+    {
+        for(unsigned int i=0; i<GLObjectDeletionCostModel::NUM_OBJECT_TYPES; ++i)
+        {
+            numDeleted[i] = model->getNumDeleted(GLObjectDeletionCostModel::ObjectType(i));
+        }
+    }
+
+    _lastAvailableTime = availableTime;
+
     flushDeletedGLObjects(contextID, currentTime, availableTime);
+
+    _lastFlushTime = time() - startTime;
+    _lastTime = startTime;
+
+    if (model)
+    {
+        // the managers' counts are reset along with their stats, only report them when they have moved on.
+        if (textureObjectManager->getNumberDeleted()>numTexturesDeleted) model->deleted(GLObjectDeletionCostModel::TEXTURE_OBJECT, textureObjectManager->getNumberDeleted()-numTexturesDeleted);
+        if (bufferObjectManager->getNumberDeleted()>numBuffersDeleted) model->deleted(GLObjectDeletionCostModel::BUFFER_OBJECT, bufferObjectManager->getNumberDeleted()-numBuffersDeleted);
+
+        for(unsigned int i=0; i<GLObjectDeletionCostModel::NUM_OBJECT_TYPES; ++i)
+        {
+            numDeleted[i] = model->getNumDeleted(GLObjectDeletionCostModel::ObjectType(i)) - numDeleted[i];
+        }
+        model->update(numDeleted, _lastFlushTime);
+
+        _backlogSize = model->getBacklogSize();
+        _estimatedDrainTime = model->getEstimatedDrainTime();
+    }
+
+    if (_backlogSize>0)
+    {
+        OSG_DEBUG<<"FlushDeletedGLObjectsOperation : flushed for "<<_lastFlushTime*1000.0<<"ms of "<<_lastAvailableTime*1000.0<<"ms, "
+                 <<_backlogSize<<" GL objects pending, estimated drain time "<<_estimatedDrainTime*1000.0<<"ms"<<std::endl;
+    }
 }
 
 
@@ -6290,26 +7967,545 @@ void EndOfDynamicDrawBlock::completed(osg::State* /*state*/)
 }
 
 
-// OSGFILE src/osg/GraphicsContext.cpp
-
-#include <stdlib.h>
+// OSGFILE src/osg/CommandBuffer.cpp
 
 /*
-#include <osg/GraphicsContext>
-#include <osg/Camera>
-#include <osg/View>
-#include <osg/GLObjects>
-#include <osg/ContextData>
-#include <osg/os_utils>
+#include <osg/CommandBuffer>
+#include <osg/Timer>
 */
 
-/*
-#include <osg/FrameBufferObject>
-#include <osg/Program>
-#include <osg/Drawable>
-#include <osg/FragmentProgram>
-#include <osg/VertexProgram>
-#include <osg/GLExtensions>
+#include <string.h>
+
+using namespace osg;
+
+CommandBuffer::CommandBuffer(unsigned int initialCapacity):
+    _data(0),
+    _size(0),
+    _capacity(0),
+    _numCommands(0),
+    _numElided(0),
+    _order(0)
+{
+    if (initialCapacity>0) reserve(initialCapacity);
+}
+
+CommandBuffer::~CommandBuffer()
+{
+    delete [] _data;
+}
+
+void CommandBuffer::reserve(unsigned int capacity)
+{
+    if (capacity<=_capacity) return;
+
+    // grow geometrically so that recording a frame's worth of commands only reallocates a handful of times.
+    unsigned int newCapacity = _capacity>0 ? _capacity : 256;
+    while(newCapacity<capacity) newCapacity *= 2;
+
+    unsigned char* data = new unsigned char[newCapacity];
+    if (_size>0) memcpy(data, _data, _size);
+    delete [] _data;
+
+    _data = data;
+    _capacity = newCapacity;
+}
+
+void CommandBuffer::reset()
+{
+    _size = 0;
+    _numCommands = 0;
+    _numElided = 0;
+    _shadow.dirty();
+}
+
+void CommandBuffer::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint* v = _shadow.viewport;
+    if (_shadow.viewportValid && v[0]==x && v[1]==y && v[2]==width && v[3]==height)
+    {
+        ++_numElided;
+        return;
+    }
+    v[0] = x; v[1] = y; v[2] = width; v[3] = height;
+    _shadow.viewportValid = true;
+
+    ViewportCommand* command = allocate<ViewportCommand>(VIEWPORT);
+    command->x = x;
+    command->y = y;
+    command->width = width;
+    command->height = height;
+}
+
+void CommandBuffer::scissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLint* s = _shadow.scissor;
+    if (_shadow.scissorValid && s[0]==x && s[1]==y && s[2]==width && s[3]==height)
+    {
+        ++_numElided;
+        return;
+    }
+    s[0] = x; s[1] = y; s[2] = width; s[3] = height;
+    _shadow.scissorValid = true;
+
+    ViewportCommand* command = allocate<ViewportCommand>(SCISSOR);
+    command->x = x;
+    command->y = y;
+    command->width = width;
+    command->height = height;
+}
+
+void CommandBuffer::clearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    GLclampf* c = _shadow.clearColor;
+    if (_shadow.clearColorValid && c[0]==red && c[1]==green && c[2]==blue && c[3]==alpha)
+    {
+        ++_numElided;
+        return;
+    }
+    c[0] = red; c[1] = green; c[2] = blue; c[3] = alpha;
+    _shadow.clearColorValid = true;
+
+    ClearColorCommand* command = allocate<ClearColorCommand>(CLEAR_COLOR);
+    command->red = red;
+    command->green = green;
+    command->blue = blue;
+    command->alpha = alpha;
+}
+
+void CommandBuffer::clear(GLbitfield mask)
+{
+    allocate<ClearCommand>(CLEAR)->mask = mask;
+}
+
+void CommandBuffer::mode(StateAttribute::GLMode mode, bool enabled)
+{
+    // only a handful of modes are set per buffer so a linear search beats a map here.
+    ShadowState::Modes::iterator itr = _shadow.modes.begin();
+    for(; itr != _shadow.modes.end() && itr->first!=mode; ++itr) {}
+
+    if (itr != _shadow.modes.end())
+    {
+        if (itr->second==enabled)
+        {
+            ++_numElided;
+            return;
+        }
+        itr->second = enabled;
+    }
+    else
+    {
+        _shadow.modes.push_back(ShadowState::Modes::value_type(mode, enabled));
+    }
+
+    ModeCommand* command = allocate<ModeCommand>(MODE);
+    command->mode = mode;
+    command->enabled = enabled ? 1 : 0;
+}
+
+void CommandBuffer::drawBuffer(GLenum buffer)
+{
+    if (_shadow.drawBufferValid && _shadow.drawBuffer==buffer)
+    {
+        ++_numElided;
+        return;
+    }
+    _shadow.drawBuffer = buffer;
+    _shadow.drawBufferValid = true;
+
+    allocate<BufferCommand>(DRAW_BUFFER)->buffer = buffer;
+}
+
+void CommandBuffer::readBuffer(GLenum buffer)
+{
+    if (_shadow.readBufferValid && _shadow.readBuffer==buffer)
+    {
+        ++_numElided;
+        return;
+    }
+    _shadow.readBuffer = buffer;
+    _shadow.readBufferValid = true;
+
+    allocate<BufferCommand>(READ_BUFFER)->buffer = buffer;
+}
+
+void CommandBuffer::modelViewMatrix(const Matrix& matrix)
+{
+    memcpy(allocate<MatrixCommand>(MODEL_VIEW_MATRIX)->matrix, matrix.ptr(), sizeof(MatrixCommand::matrix));
+}
+
+void CommandBuffer::vertexAttrib(GLuint location, GLfloat x, GLfloat y, GLfloat z, GLfloat w)
+{
+    VertexAttribCommand* command = allocate<VertexAttribCommand>(VERTEX_ATTRIB);
+    command->location = location;
+    command->x = x;
+    command->y = y;
+    command->z = z;
+    command->w = w;
+}
+
+void CommandBuffer::drawArrays(GLenum mode, GLint first, GLsizei count)
+{
+    DrawArraysCommand* command = allocate<DrawArraysCommand>(DRAW_ARRAYS);
+    command->mode = mode;
+    command->first = first;
+    command->count = count;
+    command->primcount = 0;
+}
+
+void CommandBuffer::drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei primcount)
+{
+    DrawArraysCommand* command = allocate<DrawArraysCommand>(DRAW_ARRAYS_INSTANCED);
+    command->mode = mode;
+    command->first = first;
+    command->count = count;
+    command->primcount = primcount;
+}
+
+void CommandBuffer::drawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices)
+{
+    DrawElementsCommand* command = allocate<DrawElementsCommand>(DRAW_ELEMENTS);
+    command->mode = mode;
+    command->count = count;
+    command->type = type;
+    command->primcount = 0;
+    command->indices = indices;
+}
+
+void CommandBuffer::drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei primcount)
+{
+    DrawElementsCommand* command = allocate<DrawElementsCommand>(DRAW_ELEMENTS_INSTANCED);
+    command->mode = mode;
+    command->count = count;
+    command->type = type;
+    command->primcount = primcount;
+    command->indices = indices;
+}
+
+void CommandBuffer::call(Function function, const void* data, unsigned int size)
+{
+    FunctionCallCommand* command = allocate<FunctionCallCommand>(FUNCTION_CALL, size);
+    command->function = function;
+    if (size>0) memcpy(command+1, data, size);
+}
+
+void CommandBuffer::replay(State& state) const
+{
+    const unsigned char* ptr = _data;
+    const unsigned char* end = _data+_size;
+    while(ptr<end)
+    {
+        const Command* command = reinterpret_cast<const Command*>(ptr);
+        switch(command->type)
+        {
+            case(VIEWPORT):
+            {
+                const ViewportCommand* c = static_cast<const ViewportCommand*>(command);
+                state.glViewport(c->x, c->y, c->width, c->height);
+                break;
+            }
+            case(SCISSOR):
+            {
+                const ViewportCommand* c = static_cast<const ViewportCommand*>(command);
+                state.glScissor(c->x, c->y, c->width, c->height);
+                break;
+            }
+            case(CLEAR_COLOR):
+            {
+                const ClearColorCommand* c = static_cast<const ClearColorCommand*>(command);
+                state.glClearColor(c->red, c->green, c->blue, c->alpha);
+                break;
+            }
+            case(CLEAR):
+                glClear(static_cast<const ClearCommand*>(command)->mask);
+                break;
+            case(MODE):
+            {
+                const ModeCommand* c = static_cast<const ModeCommand*>(command);
+                state.applyMode(c->mode, c->enabled!=0);
+                break;
+            }
+            case(DRAW_BUFFER):
+                state.glDrawBuffer(static_cast<const BufferCommand*>(command)->buffer);
+                break;
+            case(READ_BUFFER):
+                state.glReadBuffer(static_cast<const BufferCommand*>(command)->buffer);
+                break;
+            case(MODEL_VIEW_MATRIX):
+                state.applyModelViewMatrix(Matrix(static_cast<const MatrixCommand*>(command)->matrix));
+                break;
+            case(VERTEX_ATTRIB):
+            {
+                const VertexAttribCommand* c = static_cast<const VertexAttribCommand*>(command);
+                state.VerteAttrib(c->location, c->x, c->y, c->z, c->w);
+                break;
+            }
+            case(DRAW_ARRAYS):
+            {
+                const DrawArraysCommand* c = static_cast<const DrawArraysCommand*>(command);
+                glDrawArrays(c->mode, c->first, c->count);
+                break;
+            }
+            case(DRAW_ELEMENTS):
+            {
+                const DrawElementsCommand* c = static_cast<const DrawElementsCommand*>(command);
+                glDrawElements(c->mode, c->count, c->type, c->indices);
+                break;
+            }
+            case(DRAW_ARRAYS_INSTANCED):
+            {
+                const DrawArraysCommand* c = static_cast<const DrawArraysCommand*>(command);
+                state.glDrawArraysInstanced(c->mode, c->first, c->count, c->primcount);
+                break;
+            }
+            case(DRAW_ELEMENTS_INSTANCED):
+            {
+                const DrawElementsCommand* c = static_cast<const DrawElementsCommand*>(command);
+                state.glDrawElementsInstanced(c->mode, c->count, c->type, c->indices, c->primcount);
+                break;
+            }
+            case(FUNCTION_CALL):
+            {
+                const FunctionCallCommand* c = static_cast<const FunctionCallCommand*>(command);
+                c->function(state, c+1);
+                break;
+            }
+            default:
+                OSG_WARN<<"Warning: CommandBuffer::replay() unknown command type "<<command->type<<", abandoning replay."<<std::endl;
+                return;
+        }
+        ptr += command->size;
+    }
+}
+
+void CommandBuffer::replay(State& state, Stats& stats) const
+{
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    replay(state);
+
+    stats.replayTime += osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+    stats.numBuffers += 1;
+    stats.numCommands += _numCommands;
+    stats.numElided += _numElided;
+}
+
+
+// OSGFILE src/osg/RenderQueue.cpp
+
+/*
+#include <osg/RenderQueue>
+*/
+
+using namespace osg;
+
+class RenderQueue::SortOperation : public Operation
+{
+    public:
+
+        SortOperation(RenderQueue* queue, unsigned int chunk):
+            osg::Referenced(true),
+            Operation("RenderQueueSort", false),
+            _queue(queue),
+            _chunk(chunk) {}
+
+        virtual void operator () (Object*)
+        {
+            _queue->runChunk(_chunk);
+            _queue->_completed->completed();
+        }
+
+    protected:
+
+        // the queue owns its operations, so holds no reference back.
+        RenderQueue*    _queue;
+        unsigned int    _chunk;
+};
+
+RenderQueue::RenderQueue():
+    _numThreads(0),
+    _parallelThreshold(65536),
+    _completed(new RefBlockCount(0)),
+    _phase(COUNT),
+    _shift(0),
+    _numChunks(1),
+    _source(0),
+    _destination(0)
+{
+}
+
+RenderQueue::~RenderQueue()
+{
+    stopThreads();
+}
+
+uint64_t RenderQueue::makeKey(unsigned int program, unsigned int textureSet, unsigned int attributes, float depth)
+{
+    const uint64_t depthMax = (uint64_t(1)<<DEPTH_BITS)-1;
+    uint64_t quantizedDepth = depth>0.0f ? (depth<1.0f ? uint64_t(double(depth)*double(depthMax)) : depthMax) : 0;
+
+    return (uint64_t(program & ((1u<<PROGRAM_BITS)-1)) << (TEXTURE_BITS+ATTRIBUTE_BITS+DEPTH_BITS)) |
+           (uint64_t(textureSet & ((1u<<TEXTURE_BITS)-1)) << (ATTRIBUTE_BITS+DEPTH_BITS)) |
+           (uint64_t(attributes & ((1u<<ATTRIBUTE_BITS)-1)) << DEPTH_BITS) |
+           quantizedDepth;
+}
+
+void RenderQueue::setNumThreads(unsigned int numThreads)
+{
+    if (numThreads==_numThreads) return;
+
+    stopThreads();
+    _numThreads = numThreads;
+}
+
+void RenderQueue::stopThreads()
+{
+    for(std::vector< ref_ptr<OperationThread> >::iterator itr = _threads.begin(); itr != _threads.end(); ++itr)
+    {
+        (*itr)->cancel();
+    }
+    _threads.clear();
+    _operations.clear();
+    _operationQueue = 0;
+}
+
+void RenderQueue::sort()
+{
+    unsigned int n = size();
+    if (n<2) return;
+
+    // only sort on the bytes that differ between keys, ids and depths rarely use all their bits.
+    uint64_t allOnes = ~uint64_t(0), anyOnes = 0;
+    for(Entries::const_iterator itr = _entries.begin(); itr != _entries.end(); ++itr)
+    {
+        allOnes &= itr->key;
+        anyOnes |= itr->key;
+    }
+    uint64_t differing = allOnes ^ anyOnes;
+    if (differing==0) return;
+
+    _numChunks = (_numThreads>0 && n>=_parallelThreshold) ? _numThreads+1 : 1;
+    if (_numChunks>1 && _threads.empty())
+    {
+        _operationQueue = new OperationQueue;
+        for(unsigned int i=0; i<_numThreads; ++i)
+        {
+            OperationThread* thread = new OperationThread;
+            thread->setOperationQueue(_operationQueue.get());
+            thread->startThread();
+            _threads.push_back(thread);
+            _operations.push_back(new SortOperation(this, i+1));
+        }
+    }
+
+    _scratch.resize(n);
+    _counts.resize(_numChunks*RADIX);
+
+    Entry* source = &_entries[0];
+    Entry* destination = &_scratch[0];
+    for(_shift=0; _shift<64; _shift+=RADIX_BITS)
+    {
+        if (((differing>>_shift) & (RADIX-1))==0) continue;
+
+        _source = source;
+        _destination = destination;
+
+        runPhase(COUNT);
+
+        // turn the per chunk counts into scatter offsets, digit major so equal digits keep the chunk order.
+        unsigned int offset = 0;
+        for(unsigned int digit=0; digit<RADIX; ++digit)
+        {
+            for(unsigned int chunk=0; chunk<_numChunks; ++chunk)
+            {
+                unsigned int& count = _counts[chunk*RADIX+digit];
+                unsigned int chunkCount = count;
+                count = offset;
+                offset += chunkCount;
+            }
+        }
+
+        runPhase(SCATTER);
+
+        std::swap(source, destination);
+    }
+
+    if (source!=&_entries[0]) _entries.swap(_scratch);
+}
+
+void RenderQueue::runPhase(Phase phase)
+{
+    _phase = phase;
+
+    if (_numChunks>1)
+    {
+        _completed->setBlockCount(_numChunks-1);
+        _completed->reset();
+        for(unsigned int i=0; i<_numChunks-1; ++i)
+        {
+            _operationQueue->add(_operations[i].get());
+        }
+    }
+
+    runChunk(0);
+
+    if (_numChunks>1) _completed->block();
+}
+
+void RenderQueue::runChunk(unsigned int chunk)
+{
+    unsigned int n = size();
+    unsigned int first = static_cast<unsigned int>(uint64_t(n)*chunk/_numChunks);
+    unsigned int last = static_cast<unsigned int>(uint64_t(n)*(chunk+1)/_numChunks);
+    unsigned int* counts = &_counts[chunk*RADIX];
+
+    if (_phase==COUNT)
+    {
+        std::fill(counts, counts+RADIX, 0u);
+        for(unsigned int i=first; i<last; ++i)
+        {
+            ++counts[(_source[i].key>>_shift) & (RADIX-1)];
+        }
+    }
+    else
+    {
+        for(unsigned int i=first; i<last; ++i)
+        {
+            _destination[counts[(_source[i].key>>_shift) & (RADIX-1)]++] = _source[i];
+        }
+    }
+}
+
+unsigned int RenderQueue::getNumStateChanges() const
+{
+    unsigned int numChanges = 0;
+    for(unsigned int i=0; i<_entries.size(); ++i)
+    {
+        if (i==0 || getStateKey(_entries[i].key)!=getStateKey(_entries[i-1].key)) ++numChanges;
+    }
+    return numChanges;
+}
+
+
+// OSGFILE src/osg/GraphicsContext.cpp
+
+#include <stdlib.h>
+
+/*
+#include <osg/GraphicsContext>
+#include <osg/Camera>
+#include <osg/View>
+#include <osg/GLObjects>
+#include <osg/ContextData>
+#include <osg/os_utils>
+*/
+
+/*
+#include <osg/FrameBufferObject>
+#include <osg/Program>
+#include <osg/Drawable>
+#include <osg/FragmentProgram>
+#include <osg/VertexProgram>
+#include <osg/GLExtensions>
 */
 
 /*
@@ -6321,6 +8517,7 @@ void EndOfDynamicDrawBlock::completed(osg::State* /*state*/)
 #include <map>
 #include <sstream>
 #include <algorithm>
+#include <limits>
 #include <iterator>
 #include <stdio.h>
 
@@ -6396,7 +8593,8 @@ osg::ref_ptr<GraphicsContext::WindowingSystemInterfaces>& GraphicsContext::getWi
     return s_WindowingSystemInterface;
 }
 
-OSG_INIT_SINGLETON_PROXY(ProxyInitWindowingSystemInterfaces, GraphicsContext::getWindowingSystemInterfaces())
+// No static initialization proxy, the interfaces are created on first use, which at the latest is the
+// registration of the first WindowingSystemInterface, so they still outlive every registered interface.
 
 
 //  GraphicsContext static method implementations
@@ -6703,10 +8901,21 @@ void GraphicsContext::clear()
 
     if (_clearMask==0 || !_traits) return;
 
-    glViewport(0, 0, _traits->width, _traits->height);
-    glScissor(0, 0, _traits->width, _traits->height);
+    if (_state.valid())
+    {
+        // route through State so the per frame viewport, scissor and clear color are only issued when they change.
+        _state->glViewport(0, 0, _traits->width, _traits->height);
+        _state->glScissor(0, 0, _traits->width, _traits->height);
+
+        _state->glClearColor( _clearColor[0], _clearColor[1], _clearColor[2], _clearColor[3]);
+    }
+    else
+    {
+        glViewport(0, 0, _traits->width, _traits->height);
+        glScissor(0, 0, _traits->width, _traits->height);
 
-    glClearColor( _clearColor[0], _clearColor[1], _clearColor[2], _clearColor[3]);
+        glClearColor( _clearColor[0], _clearColor[1], _clearColor[2], _clearColor[3]);
+    }
 
     glClear( _clearMask );
 }
@@ -6967,8 +9176,47 @@ void GraphicsContext::removeAllOperations()
     _operationsBlock->set(false);
 }
 
-void GraphicsContext::runOperations()
+struct CommandBufferOrderSortOp
 {
+    inline bool operator() (const ref_ptr<CommandBuffer>& lhs,const ref_ptr<CommandBuffer>& rhs) const
+    {
+        return lhs->getOrder() < rhs->getOrder();
+    }
+};
+
+void GraphicsContext::submit(CommandBuffer* commandBuffer)
+{
+    if (!commandBuffer || commandBuffer->empty()) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_commandBuffersMutex);
+    _commandBuffers.push_back(commandBuffer);
+}
+
+void GraphicsContext::runCommandBuffers(int minOrder, int maxOrder)
+{
+    if (!_state.valid()) return;
+
+    // _commandBuffersToRun is stable sorted by order, so buffers with the same order are replayed in submission order.
+    for(CommandBuffers::iterator itr = _commandBuffersToRun.begin();
+        itr != _commandBuffersToRun.end() && (*itr)->getOrder()<=maxOrder;
+        ++itr)
+    {
+        if ((*itr)->getOrder()>=minOrder) (*itr)->replay(*_state, _commandBufferStats);
+    }
+}
+
+void GraphicsContext::runOperations()
+{
+    // take the command buffers submitted since the last frame, holding the lock only for the swap.
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_commandBuffersMutex);
+        _commandBuffersToRun.swap(_commandBuffers);
+    }
+    std::stable_sort(_commandBuffersToRun.begin(), _commandBuffersToRun.end(), CommandBufferOrderSortOp());
+    _commandBufferStats = CommandBuffer::Stats();
+
+    runCommandBuffers(std::numeric_limits<int>::min(), -1);
+
     // sort the cameras into order
     typedef std::vector<Camera*> CameraVector;
     CameraVector camerasCopy;
@@ -6983,6 +9231,9 @@ void GraphicsContext::runOperations()
         if (camera->getRenderer()) (*(camera->getRenderer()))(this);
     }
 
+    runCommandBuffers(0, std::numeric_limits<int>::max());
+    _commandBuffersToRun.clear();
+
     for(GraphicsOperationQueue::iterator itr = _operations.begin();
         itr != _operations.end();
         )
@@ -7194,10 +9445,44 @@ void GraphicsContext::resizedImplementation(int x, int y, int width, int height)
 //
 // SyncSwapBuffersCallback
 //
-SyncSwapBuffersCallback::SyncSwapBuffersCallback()
+SyncSwapBuffersCallback::SyncSwapBuffersCallback(unsigned int maxFramesInFlight):
+    _fences(new GLFences),
+    _maxFramesInFlight(osg::maximum(maxFramesInFlight, 1u)),
+    _timeout(1.0),
+    _latencyReduction(false),
+    _sleepMargin(0.001),
+    _sleepTime(0.0)
+{
+    OSG_INFO<<"Created SyncSwapBuffersCallback, max frames in flight "<<_maxFramesInFlight<<"."<<std::endl;
+}
+
+SyncSwapBuffersCallback::~SyncSwapBuffersCallback()
+{
+    // fences of a context that has been deleted went with it.
+    osg::ref_ptr<GraphicsContext> gc;
+    if (!_syncs.empty() && _fences.valid() && _graphicsContext.lock(gc)) removeAllSyncs(gc.get());
+}
+
+void SyncSwapBuffersCallback::setMaxFramesInFlight(unsigned int numFrames)
+{
+    _maxFramesInFlight = osg::maximum(numFrames, 1u);
+}
+
+void SyncSwapBuffersCallback::resetHistograms()
+{
+    _waitHistogram.reset();
+    _sleepHistogram.reset();
+}
+
+void SyncSwapBuffersCallback::removeAllSyncs(GraphicsContext* gc)
 {
-    OSG_INFO<<"Created SyncSwapBuffersCallback."<<std::endl;
-    _previousSync = 0;
+    for(std::deque<GLsync>::iterator itr = _syncs.begin();
+        itr != _syncs.end();
+        ++itr)
+    {
+        _fences->remove(gc, *itr);
+    }
+    _syncs.clear();
 }
 
 void SyncSwapBuffersCallback::swapBuffersImplementation(osg::GraphicsContext* gc)
@@ -7206,22 +9491,1948 @@ void SyncSwapBuffersCallback::swapBuffersImplementation(osg::GraphicsContext* gc
     gc->swapBuffersImplementation();
     //glFinish();
 
-    GLExtensions* ext = gc->getState()->get<GLExtensions>();
+    if (!_fences.valid() || !_fences->valid(gc)) return;
+
+    if (_graphicsContext.get()!=gc) _graphicsContext = gc;
+
+    _syncs.push_back(_fences->insert(gc));
 
-    if (ext->glClientWaitSync)
+    // wait for the GPU to catch up to within _maxFramesInFlight frames.
+    double waitTime = 0.0;
+    while(_syncs.size()>_maxFramesInFlight)
     {
-        if (_previousSync)
+        GLsync sync = _syncs.front();
+        _syncs.pop_front();
+
+        double startTime = _fences->time();
+        bool signalled = _fences->wait(gc, sync, _timeout);
+        waitTime += _fences->time() - startTime;
+
+        _fences->remove(gc, sync);
+
+        if (!signalled)
         {
-            unsigned int num_seconds = 1;
-            GLuint64 timeout = num_seconds * ((GLuint64)1000 * 1000 * 1000);
-            ext->glClientWaitSync(_previousSync, 0, timeout);
-            ext->glDeleteSync(_previousSync);
+            OSG_INFO<<"SyncSwapBuffersCallback : fence not signalled within "<<_timeout<<"s, dropping remaining fences."<<std::endl;
+            removeAllSyncs(gc);
+            break;
         }
+    }
+    _waitHistogram.add(waitTime);
+
+    if (_latencyReduction)
+    {
+        // steer the sleep so that the next frame's wait settles at the margin, the CPU then samples input for the
+        // next frame as late as it can without the GPU running dry.
+        if (waitTime>_sleepMargin) _sleepTime += (waitTime-_sleepMargin)*0.5;
+        else _sleepTime -= (_sleepMargin-waitTime)*0.5;
+        _sleepTime = osg::clampBetween(_sleepTime, 0.0, _timeout);
 
-        _previousSync = ext->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        if (_sleepTime>0.0)
+        {
+            double startTime = _fences->time();
+            _fences->sleep(_sleepTime);
+            _sleepHistogram.add(_fences->time() - startTime);
+        }
     }
     //gc->getState()->checkGLErrors("after glWaitSync");
 
     //OSG_NOTICE<<"After swap"<<std::endl;
 }
 
+bool SyncSwapBuffersCallback::GLFences::valid(GraphicsContext* gc) const
+{
+    GLExtensions* ext = gc->getState()->get<GLExtensions>();
+    return ext && ext->glClientWaitSync;
+}
+
+GLsync SyncSwapBuffersCallback::GLFences::insert(GraphicsContext* gc)
+{
+    return gc->getState()->get<GLExtensions>()->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool SyncSwapBuffersCallback::GLFences::wait(GraphicsContext* gc, GLsync sync, double timeout)
+{
+    GLuint64 timeoutNanoSeconds = static_cast<GLuint64>(timeout*1e9);
+    GLenum result = gc->getState()->get<GLExtensions>()->glClientWaitSync(sync, 0, timeoutNanoSeconds);
+    return result==GL_ALREADY_SIGNALED || result==GL_CONDITION_SATISFIED;
+}
+
+void SyncSwapBuffersCallback::GLFences::remove(GraphicsContext* gc, GLsync sync)
+{
+    gc->getState()->get<GLExtensions>()->glDeleteSync(sync);
+}
+
+double SyncSwapBuffersCallback::GLFences::time() const
+{
+    return osg::Timer::instance()->time_s();
+}
+
+void SyncSwapBuffersCallback::GLFences::sleep(double seconds)
+{
+    OpenThreads::Thread::microSleep(static_cast<unsigned int>(seconds*1e6));
+}
+
+void SyncSwapBuffersCallback::Histogram::reset()
+{
+    for(unsigned int i=0; i<NUM_BINS; ++i) _counts[i] = 0;
+    _totalCount = 0;
+    _total = 0.0;
+    _maximum = 0.0;
+}
+
+void SyncSwapBuffersCallback::Histogram::add(double seconds)
+{
+    double microSeconds = seconds*1e6;
+    unsigned int bin = 0;
+    while(bin<NUM_BINS-1 && microSeconds>=getBinUpperBound(bin)*1e6) ++bin;
+
+    ++_counts[bin];
+    ++_totalCount;
+    _total += seconds;
+    _maximum = osg::maximum(_maximum, seconds);
+}
+
+double SyncSwapBuffersCallback::Histogram::getBinUpperBound(unsigned int bin)
+{
+    return double(1u<<bin)*1e-6;
+}
+
+double SyncSwapBuffersCallback::Histogram::getPercentile(double fraction) const
+{
+    unsigned int threshold = static_cast<unsigned int>(ceil(fraction*double(_totalCount)));
+    unsigned int count = 0;
+    for(unsigned int i=0; i<NUM_BINS; ++i)
+    {
+        count += _counts[i];
+        if (count>=threshold && count>0) return getBinUpperBound(i);
+    }
+    return 0.0;
+}
+
+void SyncSwapBuffersCallback::Histogram::report(std::ostream& out) const
+{
+    out<<"  frames "<<_totalCount<<", mean "<<getMean()*1000.0<<"ms, max "<<_maximum*1000.0<<"ms"<<std::endl;
+    for(unsigned int i=0; i<NUM_BINS; ++i)
+    {
+        if (_counts[i]>0) out<<"  < "<<getBinUpperBound(i)*1000.0<<"ms\t"<<_counts[i]<<std::endl;
+    }
+}
+
+
+
+// OSGFILE src/osg/CompileService.cpp
+
+/*
+#include <osg/CompileService>
+#include <osg/Notify>
+*/
+
+using namespace osg;
+
+GLObjectCompileCostModel::GLObjectCompileCostModel():
+    _learningRate(0.1)
+{
+    setDefaults();
+}
+
+const char* GLObjectCompileCostModel::getObjectTypeName(ObjectType type)
+{
+    switch(type)
+    {
+        case(BUFFER_OBJECT): return "BUFFER_OBJECT";
+        case(TEXTURE_OBJECT): return "TEXTURE_OBJECT";
+        case(PROGRAM_OBJECT): return "PROGRAM_OBJECT";
+        case(SHADER_OBJECT): return "SHADER_OBJECT";
+        case(OTHER_OBJECT): return "OTHER_OBJECT";
+        default: return "UNKNOWN";
+    }
+}
+
+void GLObjectCompileCostModel::setDefaults()
+{
+    // rough costs in seconds, uploads are dominated by the copy at a few GB/s while shader compiles and program
+    // links are dominated by the driver's compiler, the measured timings soon replace these.
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _costPerObject[BUFFER_OBJECT] = 5e-6;      _costPerByte[BUFFER_OBJECT] = 0.25e-9;
+    _costPerObject[TEXTURE_OBJECT] = 20e-6;    _costPerByte[TEXTURE_OBJECT] = 0.5e-9;
+    _costPerObject[PROGRAM_OBJECT] = 500e-6;   _costPerByte[PROGRAM_OBJECT] = 0.0;
+    _costPerObject[SHADER_OBJECT] = 200e-6;    _costPerByte[SHADER_OBJECT] = 50e-9;
+    _costPerObject[OTHER_OBJECT] = 10e-6;      _costPerByte[OTHER_OBJECT] = 0.5e-9;
+}
+
+void GLObjectCompileCostModel::setCost(ObjectType type, double costPerObject, double costPerByte)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _costPerObject[type] = costPerObject;
+    _costPerByte[type] = costPerByte;
+}
+
+double GLObjectCompileCostModel::getCostPerObject(ObjectType type) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _costPerObject[type];
+}
+
+double GLObjectCompileCostModel::getCostPerByte(ObjectType type) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _costPerByte[type];
+}
+
+double GLObjectCompileCostModel::estimateCost(ObjectType type, size_t size) const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _costPerObject[type] + double(size)*_costPerByte[type];
+}
+
+void GLObjectCompileCostModel::update(ObjectType type, size_t size, double measuredTime)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    if (measuredTime<=0.0) return;
+
+    double estimatedTime = _costPerObject[type] + double(size)*_costPerByte[type];
+    if (estimatedTime<=0.0)
+    {
+        _costPerObject[type] += (measuredTime-_costPerObject[type])*_learningRate;
+        return;
+    }
+
+    // scale both terms towards the measured time, clamping the ratio so that a compile
+    // preempted by the OS can't throw the model out.
+    double ratio = osg::clampBetween(measuredTime/estimatedTime, 0.1, 10.0);
+    _costPerObject[type] += (_costPerObject[type]*ratio-_costPerObject[type])*_learningRate;
+    _costPerByte[type] += (_costPerByte[type]*ratio-_costPerByte[type])*_learningRate;
+}
+
+
+CompileService::CompileSet::CompileSet():
+    _numCompiled(0),
+    _sync(0),
+    _ready(0)
+{
+}
+
+class CompileService::CompileOperation : public GraphicsOperation
+{
+    public:
+
+        CompileOperation(CompileService* service):
+            osg::Referenced(true),
+            GraphicsOperation("CompileService", false),
+            _service(service) {}
+
+        virtual void operator () (GraphicsContext* context)
+        {
+            _service->compile(context);
+        }
+
+    protected:
+
+        ref_ptr<CompileService> _service;
+};
+
+CompileService::CompileService(GraphicsContext* compileContext):
+    _compileContext(compileContext),
+    _fences(new SyncSwapBuffersCallback::GLFences),
+    _costModel(new GLObjectCompileCostModel),
+    _timeBudget(0.002),
+    _compileScheduled(0)
+{
+}
+
+CompileService::~CompileService()
+{
+}
+
+void CompileService::add(CompileSet* compileSet)
+{
+    if (!compileSet) return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _toCompile.push_back(compileSet);
+}
+
+void CompileService::scheduleCompile()
+{
+    if (!_compileContext.valid() || !_compileContext->getGraphicsThread()) return;
+
+    if (getNumPending()==0) return;
+
+    // only one slice in flight, a compile thread that falls behind skips frames rather than queueing them up.
+    if (_compileScheduled.exchange(1, std::memory_order_acq_rel)!=0) return;
+
+    _compileContext->add(new CompileOperation(this));
+}
+
+double CompileService::compile(GraphicsContext* gc)
+{
+    State* state = gc ? gc->getState() : 0;
+    if (!state)
+    {
+        _compileScheduled.store(0, std::memory_order_release);
+        return 0.0;
+    }
+
+    const double startTime = _fences->time();
+    unsigned int numCompiled = 0;
+
+    while(true)
+    {
+        ref_ptr<CompileSet> compileSet;
+        {
+            // only the compile thread takes from the front, add() appends at the back.
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            if (_toCompile.empty()) break;
+            compileSet = _toCompile.front();
+        }
+
+        if (compileSet->_numCompiled<compileSet->_objects.size())
+        {
+            GLCompileObject* object = compileSet->_objects[compileSet->_numCompiled].get();
+            GLObjectCompileCostModel::ObjectType type = object->getObjectType();
+            size_t size = object->getSize();
+
+            double estimatedTime = _costModel->estimateCost(type, size);
+            if (numCompiled>0 && (_fences->time()-startTime)+estimatedTime>_timeBudget) break;
+
+            double objectStartTime = _fences->time();
+            object->compile(*state);
+            double compileTime = _fences->time()-objectStartTime;
+
+            _costModel->update(type, size, compileTime);
+
+            ++numCompiled;
+            ++compileSet->_numCompiled;
+
+            if (compileSet->_numCompiled<compileSet->_objects.size()) continue;
+        }
+
+        // all objects of the set are compiled, fence them so the draw context knows when they are visible to it.
+        if (_fences->valid(gc))
+        {
+            compileSet->_sync = _fences->insert(gc);
+            glFlush();
+        }
+        else
+        {
+            glFinish();
+        }
+
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _toCompile.pop_front();
+        _fenced.push_back(compileSet);
+    }
+
+    double sliceTime = _fences->time()-startTime;
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        _stats.numObjectsCompiled += numCompiled;
+        ++_stats.numSlices;
+        if (sliceTime>_timeBudget) ++_stats.numSlicesOverBudget;
+        _stats.compileTime += sliceTime;
+        _stats.maxSliceTime = osg::maximum(_stats.maxSliceTime, sliceTime);
+    }
+
+    OSG_DEBUG<<"CompileService::compile() compiled "<<numCompiled<<" objects in "<<sliceTime*1000.0<<"ms"<<std::endl;
+
+    _compileScheduled.store(0, std::memory_order_release);
+
+    return sliceTime;
+}
+
+unsigned int CompileService::checkReady(GraphicsContext* gc)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+    unsigned int numReady = 0;
+    for(CompileSets::iterator itr = _fenced.begin(); itr != _fenced.end(); )
+    {
+        CompileSet* compileSet = itr->get();
+        if (compileSet->_sync)
+        {
+            if (!_fences->wait(gc, compileSet->_sync, 0.0))
+            {
+                ++itr;
+                continue;
+            }
+
+            _fences->remove(gc, compileSet->_sync);
+            compileSet->_sync = 0;
+        }
+
+        compileSet->_ready.store(1, std::memory_order_release);
+        ++numReady;
+        itr = _fenced.erase(itr);
+    }
+
+    _stats.numSetsReady += numReady;
+    return numReady;
+}
+
+unsigned int CompileService::getNumPending() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return static_cast<unsigned int>(_toCompile.size());
+}
+
+unsigned int CompileService::getNumFenced() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return static_cast<unsigned int>(_fenced.size());
+}
+
+CompileService::Stats CompileService::getStats() const
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    return _stats;
+}
+
+void CompileService::resetStats()
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+    _stats = Stats();
+}
+
+
+
+// OSGFILE src/osg/IndirectDrawBatcher.cpp
+
+/*
+#include <osg/IndirectDrawBatcher>
+#include <osg/Notify>
+*/
+
+#include <string.h>
+
+using namespace osg;
+
+IndirectDrawBatcher::IndirectDrawBatcher(unsigned int maxCommands, unsigned int numRegions):
+    _maxCommands(osg::maximum(maxCommands, 1u)),
+    _fences(new SyncSwapBuffersCallback::GLFences),
+    _buffer(0),
+    _mapped(0),
+    _regionSyncs(osg::maximum(numRegions, 1u), GLsync(0)),
+    _currentRegion(0)
+{
+}
+
+void IndirectDrawBatcher::add(const StateSet* stateSet, const VertexArrayState* vertexArrayState, GLenum mode, GLenum type,
+                              GLuint count, GLuint firstIndex, GLint baseVertex, GLuint instanceCount, GLuint baseInstance)
+{
+    DrawElementsIndirectCommand command;
+    command.count = count;
+    command.instanceCount = instanceCount;
+    command.firstIndex = firstIndex;
+    command.baseVertex = baseVertex;
+    command.baseInstance = baseInstance;
+
+    if (_batches.empty() ||
+        _batches.back().stateSet!=stateSet ||
+        _batches.back().vertexArrayState!=vertexArrayState ||
+        _batches.back().mode!=mode ||
+        _batches.back().type!=type)
+    {
+        Batch batch;
+        batch.stateSet = stateSet;
+        batch.vertexArrayState = vertexArrayState;
+        batch.mode = mode;
+        batch.type = type;
+        batch.firstCommand = static_cast<unsigned int>(_commands.size());
+        batch.numCommands = 0;
+        _batches.push_back(batch);
+    }
+
+    _commands.push_back(command);
+    ++_batches.back().numCommands;
+}
+
+void IndirectDrawBatcher::clear()
+{
+    _commands.clear();
+    _batches.clear();
+}
+
+void IndirectDrawBatcher::allocate(State& state)
+{
+    GraphicsContext* gc = state.getGraphicsContext();
+
+    state.glGenBuffers(1, &_buffer);
+    state.bindDrawIndirectBuffer(_buffer);
+
+    if (state.isBufferStorageSupported() && gc && _fences->valid(gc))
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = static_cast<GLsizeiptr>(getRegionSize()*_regionSyncs.size());
+
+        state.glBufferStorage(GL_DRAW_INDIRECT_BUFFER, size, 0, flags);
+        _mapped = static_cast<unsigned char*>(state.glMapBufferRange(GL_DRAW_INDIRECT_BUFFER, 0, size, flags));
+    }
+
+    if (!_mapped)
+    {
+        state.glBufferData(GL_DRAW_INDIRECT_BUFFER, static_cast<GLsizeiptr>(getRegionSize()), 0, GL_STREAM_DRAW);
+    }
+
+    OSG_INFO<<"IndirectDrawBatcher::allocate() "<<_maxCommands<<" commands per region, "<<(_mapped ? "persistently mapped" : "streamed")<<std::endl;
+}
+
+void IndirectDrawBatcher::releaseGLObjects(State& state)
+{
+    GraphicsContext* gc = state.getGraphicsContext();
+    for(std::vector<GLsync>::iterator itr = _regionSyncs.begin(); itr != _regionSyncs.end(); ++itr)
+    {
+        if (*itr && gc) _fences->remove(gc, *itr);
+        *itr = 0;
+    }
+    _currentRegion = 0;
+
+    if (!_buffer) return;
+
+    state.bindDrawIndirectBuffer(_buffer);
+    if (_mapped) state.glUnmapBuffer(GL_DRAW_INDIRECT_BUFFER);
+    state.unbindDrawIndirectBufferObject();
+
+    // GL keeps the storage until the GPU has finished with it.
+    state.glDeleteBuffers(1, &_buffer);
+    if (state.getGLObjectDeletionCostModel()) state.getGLObjectDeletionCostModel()->deletedImmediately(GLObjectDeletionCostModel::BUFFER_OBJECT);
+    _buffer = 0;
+    _mapped = 0;
+}
+
+void IndirectDrawBatcher::draw(State& state)
+{
+    if (_commands.empty()) return;
+
+    unsigned int numCommands = static_cast<unsigned int>(_commands.size());
+    size_t size = _commands.size()*sizeof(DrawElementsIndirectCommand);
+    size_t offset = 0;
+
+    bool indirect = state.isMultiDrawIndirectSupported();
+    if (indirect)
+    {
+        if (numCommands>_maxCommands)
+        {
+            releaseGLObjects(state);
+            _maxCommands = osg::maximum(numCommands, _maxCommands*2);
+        }
+
+        if (!_buffer) allocate(state);
+
+        if (_mapped)
+        {
+            // wait for the GPU to have read the commands last written to this region.
+            GraphicsContext* gc = state.getGraphicsContext();
+            GLsync& sync = _regionSyncs[_currentRegion];
+            if (sync)
+            {
+                bool signalled = _fences->wait(gc, sync, 0.0);
+                if (!signalled)
+                {
+                    ++_stats.numFenceWaits;
+                    signalled = _fences->wait(gc, sync, 1.0);
+                }
+
+                if (signalled)
+                {
+                    _fences->remove(gc, sync);
+                    sync = 0;
+                }
+                else
+                {
+                    // the GPU may still read the region, orphan the buffer rather than overwrite it.
+                    OSG_WARN<<"Warning: IndirectDrawBatcher::draw() timed out waiting on region "<<_currentRegion<<", orphaning the buffer."<<std::endl;
+                    ++_stats.numFenceTimeouts;
+                    releaseGLObjects(state);
+                    allocate(state);
+                }
+            }
+        }
+
+        state.bindDrawIndirectBuffer(_buffer);
+
+        if (_mapped)
+        {
+            offset = getRegionSize()*_currentRegion;
+            memcpy(_mapped+offset, &_commands[0], size);
+        }
+        else
+        {
+            // orphan the previous frame's commands rather than wait for the GPU to read them.
+            state.glBufferData(GL_DRAW_INDIRECT_BUFFER, static_cast<GLsizeiptr>(getRegionSize()), 0, GL_STREAM_DRAW);
+            state.glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, static_cast<GLsizeiptr>(size), &_commands[0]);
+        }
+
+        _stats.bytesStreamed += size;
+    }
+
+    const StateSet* currentStateSet = 0;
+    const VertexArrayState* currentVertexArrayState = 0;
+    for(Batches::const_iterator itr = _batches.begin(); itr != _batches.end(); ++itr)
+    {
+        const Batch& batch = *itr;
+        if (batch.stateSet && batch.stateSet!=currentStateSet)
+        {
+            state.apply(batch.stateSet);
+            currentStateSet = batch.stateSet;
+        }
+        if (batch.vertexArrayState && batch.vertexArrayState!=currentVertexArrayState)
+        {
+            state.bindVertexArrayObject(batch.vertexArrayState);
+            currentVertexArrayState = batch.vertexArrayState;
+        }
+
+        if (indirect)
+        {
+            const GLvoid* commands = reinterpret_cast<const GLvoid*>(offset + size_t(batch.firstCommand)*sizeof(DrawElementsIndirectCommand));
+            state.glMultiDrawElementsIndirect(batch.mode, batch.type, commands, static_cast<GLsizei>(batch.numCommands), 0);
+            ++_stats.numDrawCalls;
+        }
+        else
+        {
+            size_t indexSize = batch.type==GL_UNSIGNED_BYTE ? 1 : (batch.type==GL_UNSIGNED_SHORT ? 2 : 4);
+            bool baseInstance = state.isBaseInstanceSupported();
+            for(unsigned int i=batch.firstCommand; i<batch.firstCommand+batch.numCommands; ++i)
+            {
+                const DrawElementsIndirectCommand& command = _commands[i];
+                const GLvoid* indices = reinterpret_cast<const GLvoid*>(size_t(command.firstIndex)*indexSize);
+                if (baseInstance)
+                {
+                    state.glDrawElementsInstancedBaseVertexBaseInstance(batch.mode, static_cast<GLsizei>(command.count), batch.type, indices,
+                                                                        static_cast<GLsizei>(command.instanceCount), command.baseVertex, command.baseInstance);
+                }
+                else if (command.baseVertex==0 && command.baseInstance==0)
+                {
+                    state.glDrawElementsInstanced(batch.mode, static_cast<GLsizei>(command.count), batch.type, indices, static_cast<GLsizei>(command.instanceCount));
+                }
+                else
+                {
+                    // without the offsets the draw would read the wrong vertices and instanced attributes.
+                    if (_stats.numDrawsSkipped==0)
+                    {
+                        OSG_WARN<<"Warning: IndirectDrawBatcher::draw() skipping draws with a base vertex or base instance, neither multi draw indirect nor base instance are supported."<<std::endl;
+                    }
+                    ++_stats.numDrawsSkipped;
+                    continue;
+                }
+                ++_stats.numDrawCalls;
+            }
+        }
+    }
+
+    if (indirect && _mapped)
+    {
+        _regionSyncs[_currentRegion] = _fences->insert(state.getGraphicsContext());
+        _currentRegion = (_currentRegion+1) % static_cast<unsigned int>(_regionSyncs.size());
+    }
+
+    _stats.numDraws += numCommands;
+    _stats.numBatches += static_cast<unsigned int>(_batches.size());
+
+    clear();
+}
+
+
+
+// OSGFILE src/osg/StreamingBufferRing.cpp
+
+/*
+#include <osg/StreamingBufferRing>
+#include <osg/Notify>
+*/
+
+using namespace osg;
+
+StreamingBufferRing::StreamingBufferRing(unsigned int regionSize, unsigned int numRegions):
+    // regions start at multiples of 256 bytes, the largest offset alignment GL allows, so that offsets aligned
+    // within a region stay aligned in the buffer.
+    _regionSize(osg::minimum((osg::maximum(regionSize, 256u)+255u) & ~255u, getMaxRegionSize())),
+    _fences(new SyncSwapBuffersCallback::GLFences),
+    _buffer(0),
+    _mapped(0),
+    _uniformAlignment(256),
+    _regionSyncs(osg::maximum(numRegions, 1u), GLsync(0)),
+    _currentRegion(0),
+    _regionOffset(0),
+    _used(0),
+    _uploaded(0),
+    _requested(0),
+    _overflowed(false)
+{
+    _alignments[VERTEX_DATA] = 16;
+    _alignments[INDEX_DATA] = 4;
+    _alignments[UNIFORM_DATA] = 0;
+}
+
+void StreamingBufferRing::allocateGLObjects(State& state)
+{
+    GraphicsContext* gc = state.getGraphicsContext();
+
+    GLint alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    // the alignment is a power of two, fall back to the largest one allowed if the driver doesn't report it.
+    _uniformAlignment = (alignment>0 && (alignment & (alignment-1))==0) ? static_cast<unsigned int>(alignment) : 256u;
+
+    state.glGenBuffers(1, &_buffer);
+    state.glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+
+    if (state.isBufferStorageSupported() && gc && _fences->valid(gc))
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = static_cast<GLsizeiptr>(size_t(_regionSize)*_regionSyncs.size());
+
+        state.glBufferStorage(GL_COPY_WRITE_BUFFER, size, 0, flags);
+        _mapped = static_cast<unsigned char*>(state.glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags));
+    }
+
+    if (!_mapped)
+    {
+        state.glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(_regionSize), 0, GL_STREAM_DRAW);
+        _staging.resize(_regionSize);
+    }
+
+    OSG_INFO<<"StreamingBufferRing::allocateGLObjects() "<<_regionSize<<" bytes per region, "<<(_mapped ? "persistently mapped" : "streamed")<<std::endl;
+}
+
+void StreamingBufferRing::releaseGLObjects(State& state)
+{
+    GraphicsContext* gc = state.getGraphicsContext();
+    for(std::vector<GLsync>::iterator itr = _regionSyncs.begin(); itr != _regionSyncs.end(); ++itr)
+    {
+        if (*itr && gc) _fences->remove(gc, *itr);
+        *itr = 0;
+    }
+    _currentRegion = 0;
+
+    if (!_buffer) return;
+
+    if (_mapped)
+    {
+        state.glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+        state.glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    }
+
+    // GL keeps the storage until the GPU has finished with it.
+    state.glDeleteBuffers(1, &_buffer);
+    if (state.getGLObjectDeletionCostModel()) state.getGLObjectDeletionCostModel()->deletedImmediately(GLObjectDeletionCostModel::BUFFER_OBJECT);
+    _buffer = 0;
+    _mapped = 0;
+    _staging.clear();
+}
+
+void StreamingBufferRing::beginFrame(State& state)
+{
+    if (_requested>_regionSize && _regionSize<getMaxRegionSize())
+    {
+        // doubled in size_t and clamped, so a huge request can't wrap the size around to 0.
+        size_t regionSize = _regionSize;
+        while(regionSize<_requested && regionSize<getMaxRegionSize()) regionSize *= 2;
+        regionSize = osg::minimum((regionSize+255) & ~size_t(255), size_t(getMaxRegionSize()));
+
+        OSG_INFO<<"StreamingBufferRing::beginFrame() last frame requested "<<_requested<<" bytes, growing regions to "<<regionSize<<" bytes"<<std::endl;
+
+        releaseGLObjects(state);
+        _regionSize = static_cast<unsigned int>(regionSize);
+    }
+
+    if (!_buffer) allocateGLObjects(state);
+
+    _used = 0;
+    _uploaded = 0;
+    _requested = 0;
+    _overflowed = false;
+    _stats.frameBytesStreamed = 0;
+
+    if (_mapped)
+    {
+        // wait for the GPU to have read the data last written to this region.
+        GraphicsContext* gc = state.getGraphicsContext();
+        GLsync& sync = _regionSyncs[_currentRegion];
+        if (sync)
+        {
+            bool signalled = _fences->wait(gc, sync, 0.0);
+            if (!signalled)
+            {
+                double startTime = _fences->time();
+                signalled = _fences->wait(gc, sync, 1.0);
+                _stats.fenceWaitTime += _fences->time()-startTime;
+                ++_stats.numFenceWaits;
+            }
+
+            if (signalled)
+            {
+                _fences->remove(gc, sync);
+                sync = 0;
+            }
+            else
+            {
+                // the GPU may still read the region, orphan the buffer rather than overwrite it.
+                OSG_WARN<<"Warning: StreamingBufferRing::beginFrame() timed out waiting on region "<<_currentRegion<<", orphaning the buffer."<<std::endl;
+                ++_stats.numFenceTimeouts;
+                releaseGLObjects(state);
+                allocateGLObjects(state);
+            }
+        }
+    }
+
+    if (_mapped)
+    {
+        _regionOffset = size_t(_regionSize)*_currentRegion;
+    }
+    else
+    {
+        // orphan the previous frame's data rather than wait for the GPU to read it.
+        state.glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+        state.glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(_regionSize), 0, GL_STREAM_DRAW);
+        _regionOffset = 0;
+    }
+}
+
+unsigned char* StreamingBufferRing::allocate(unsigned int size, AlignmentClass alignmentClass, GLintptr& offset)
+{
+    offset = -1;
+    if (!_buffer || size==0) return 0;
+
+    unsigned int alignment = _alignments[alignmentClass] ? _alignments[alignmentClass] : _uniformAlignment;
+    size_t start = (size_t(_used)+alignment-1) & ~size_t(alignment-1);
+
+    // failed requests are counted too, so that the next frame's regions fit them all.
+    _requested = ((_requested+alignment-1) & ~size_t(alignment-1)) + size;
+
+    if (start+size>_regionSize)
+    {
+        if (!_overflowed)
+        {
+            OSG_INFO<<"StreamingBufferRing::allocate() region of "<<_regionSize<<" bytes full, growing it next frame"<<std::endl;
+            ++_stats.numOverflows;
+            _overflowed = true;
+        }
+        return 0;
+    }
+
+    _used = static_cast<unsigned int>(start+size);
+    offset = static_cast<GLintptr>(_regionOffset+start);
+
+    ++_stats.numAllocations;
+    _stats.bytesStreamed += size;
+    _stats.frameBytesStreamed += size;
+
+    return _mapped ? _mapped+_regionOffset+start : &_staging[start];
+}
+
+void StreamingBufferRing::flush(State& state)
+{
+    if (_mapped || _used<=_uploaded) return;
+
+    state.glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+    state.glBufferSubData(GL_COPY_WRITE_BUFFER, static_cast<GLintptr>(_uploaded), static_cast<GLsizeiptr>(_used-_uploaded), &_staging[_uploaded]);
+    _uploaded = _used;
+    ++_stats.numUploads;
+}
+
+void StreamingBufferRing::endFrame(State& state)
+{
+    if (_mapped && _used>0)
+    {
+        _regionSyncs[_currentRegion] = _fences->insert(state.getGraphicsContext());
+        _currentRegion = (_currentRegion+1) % static_cast<unsigned int>(_regionSyncs.size());
+    }
+
+    ++_stats.numFrames;
+    _stats.maxFrameBytesStreamed = osg::maximum(_stats.maxFrameBytesStreamed, _stats.frameBytesStreamed);
+}
+
+
+
+// OSGFILE src/osg/UniformBufferRing.cpp
+
+/*
+#include <osg/UniformBufferRing>
+#include <osg/Notify>
+*/
+
+using namespace osg;
+
+UniformBufferRing::UniformBufferRing(GLuint bindingIndex, unsigned int regionSize, unsigned int numRegions):
+    _bindingIndex(bindingIndex),
+    _ring(new StreamingBufferRing(regionSize, numRegions)),
+    _boundBuffer(0),
+    _boundOffset(-1),
+    _boundSize(0)
+{
+}
+
+const char* UniformBufferRing::getMatricesBlockSource()
+{
+    return
+        "layout(std140) uniform osg_Matrices\n"
+        "{\n"
+        "    mat4 osg_ModelViewMatrix;\n"
+        "    mat4 osg_ProjectionMatrix;\n"
+        "    mat4 osg_ModelViewProjectionMatrix;\n"
+        "    mat3 osg_NormalMatrix;\n"
+        "};\n";
+}
+
+unsigned int UniformBufferRing::getMatricesBlockSize()
+{
+    // 3 mat4 of 64 bytes and a mat3 of 3 vec4 columns.
+    return 3*64 + 48;
+}
+
+void UniformBufferRing::beginFrame(State& state)
+{
+    _ring->beginFrame(state);
+    _boundOffset = -1;
+}
+
+unsigned char* UniformBufferRing::allocate(unsigned int size, GLintptr& offset)
+{
+    unsigned char* data = _ring->allocate(size, StreamingBufferRing::UNIFORM_DATA, offset);
+    if (data) ++_stats.numSlices;
+    return data;
+}
+
+GLintptr UniformBufferRing::writeMatrices(const Matrixd& modelView, const Matrixd& projection)
+{
+    GLintptr offset;
+    unsigned char* data = allocate(getMatricesBlockSize(), offset);
+    if (!data) return -1;
+
+    // the normal matrix is the inverse transpose of the model view's upper 3x3, as State computes it.
+    Matrixd mv(modelView);
+    mv.setTrans(0.0, 0.0, 0.0);
+    Matrixd inverse;
+    inverse.invert(mv);
+
+    float normalMatrix[9];
+    for(unsigned int c=0; c<3; ++c)
+    {
+        for(unsigned int r=0; r<3; ++r) normalMatrix[c*3+r] = static_cast<float>(inverse(r,c));
+    }
+
+    Std140Writer writer(data);
+    writer.add(modelView);
+    writer.add(projection);
+    writer.add(modelView*projection);
+    writer.addMatrix3(normalMatrix);
+
+    return offset;
+}
+
+void UniformBufferRing::bind(State& state, GLintptr offset, GLsizeiptr size)
+{
+    GLuint buffer = _ring->getBuffer();
+    if (!buffer || offset<0) return;
+
+    if (buffer==_boundBuffer && offset==_boundOffset && size==_boundSize)
+    {
+        ++_stats.numBindsElided;
+        return;
+    }
+
+    _ring->flush(state);
+
+    state.glBindBufferRange(GL_UNIFORM_BUFFER, _bindingIndex, buffer, offset, size);
+    _boundBuffer = buffer;
+    _boundOffset = offset;
+    _boundSize = size;
+    ++_stats.numBinds;
+}
+
+void UniformBufferRing::endFrame(State& state)
+{
+    _ring->endFrame(state);
+}
+
+void UniformBufferRing::releaseGLObjects(State& state)
+{
+    _ring->releaseGLObjects(state);
+    _boundBuffer = 0;
+    _boundOffset = -1;
+}
+
+
+
+// OSGFILE src/osg/InstancedStereo.cpp
+
+/*
+#include <osg/InstancedStereo>
+#include <osg/Notify>
+*/
+
+using namespace osg;
+
+InstancedStereo::InstancedStereo(ViewportSelection selection):
+    _viewportSelection(selection)
+{
+    for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+    {
+        _clipTransform[eye].set(1.0f, 1.0f, 0.0f, 0.0f);
+    }
+}
+
+bool InstancedStereo::isSupported(const DisplaySettings* ds)
+{
+    if (!ds || !ds->getStereo()) return false;
+
+    switch(ds->getStereoMode())
+    {
+        case(DisplaySettings::HORIZONTAL_SPLIT):
+        case(DisplaySettings::VERTICAL_SPLIT):
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool InstancedStereo::update(const DisplaySettings* ds, const Matrixd& view, const Matrixd& projection, int x, int y, int width, int height)
+{
+    if (!isSupported(ds)) return false;
+
+    // a single camera, so the virtual methods a DisplaySettings subclass may override rather than the batched computeEyeMatrices().
+    _eyeView[LEFT_EYE] = ds->computeLeftEyeViewImplementation(view);
+    _eyeView[RIGHT_EYE] = ds->computeRightEyeViewImplementation(view);
+    _eyeProjection[LEFT_EYE] = ds->computeLeftEyeProjectionImplementation(projection);
+    _eyeProjection[RIGHT_EYE] = ds->computeRightEyeProjectionImplementation(projection);
+
+    Matrixd inverseView = Matrixd::inverse(view);
+    for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+    {
+        _viewOffset[eye] = inverseView * _eyeView[eye];
+    }
+
+    // split the viewport as the two pass stereo does.
+    switch(ds->getStereoMode())
+    {
+        case(DisplaySettings::HORIZONTAL_SPLIT):
+        {
+            int separation = ds->getSplitStereoHorizontalSeparation();
+            int left_half_width = (width-separation)/2;
+            int right_half_begin = (width+separation)/2;
+            int right_half_width = width-right_half_begin;
+
+            Vec4f leftViewport(x, y, left_half_width, height);
+            Vec4f rightViewport(x+right_half_begin, y, right_half_width, height);
+            bool leftEyeLeft = ds->getSplitStereoHorizontalEyeMapping()==DisplaySettings::LEFT_EYE_LEFT_VIEWPORT;
+            _eyeViewport[LEFT_EYE] = leftEyeLeft ? leftViewport : rightViewport;
+            _eyeViewport[RIGHT_EYE] = leftEyeLeft ? rightViewport : leftViewport;
+            _unionViewport.set(x, y, width, height);
+            break;
+        }
+        default:
+        {
+            // VERTICAL_SPLIT, the only other mode supported.
+            int separation = ds->getSplitStereoVerticalSeparation();
+            int bottom_half_height = (height-separation)/2;
+            int top_half_begin = (height+separation)/2;
+            int top_half_height = height-top_half_begin;
+
+            Vec4f topViewport(x, y+top_half_begin, width, top_half_height);
+            Vec4f bottomViewport(x, y, width, bottom_half_height);
+            bool leftEyeTop = ds->getSplitStereoVerticalEyeMapping()==DisplaySettings::LEFT_EYE_TOP_VIEWPORT;
+            _eyeViewport[LEFT_EYE] = leftEyeTop ? topViewport : bottomViewport;
+            _eyeViewport[RIGHT_EYE] = leftEyeTop ? bottomViewport : topViewport;
+            _unionViewport.set(x, y, width, height);
+            break;
+        }
+    }
+
+    for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+    {
+        if (_viewportSelection==CLIP_DISTANCES)
+        {
+            const Vec4f& ev = _eyeViewport[eye];
+            _clipTransform[eye].set(ev[2]/_unionViewport[2],
+                                    ev[3]/_unionViewport[3],
+                                    (2.0f*(ev[0]-_unionViewport[0])+ev[2])/_unionViewport[2] - 1.0f,
+                                    (2.0f*(ev[1]-_unionViewport[1])+ev[3])/_unionViewport[3] - 1.0f);
+        }
+        else
+        {
+            _clipTransform[eye].set(1.0f, 1.0f, 0.0f, 0.0f);
+        }
+    }
+
+    computeCullFrustum(view);
+
+    return true;
+}
+
+void InstancedStereo::computeCullFrustum(const Matrixd& view)
+{
+    // corners of the eye frustums in the view space of the center view.
+    Vec3d corners[NUM_EYES][8];
+    Vec3d origins[NUM_EYES];
+    for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+    {
+        Matrixd eyeToView = Matrixd::inverse(_viewOffset[eye]);
+        Matrixd clipToView = Matrixd::inverse(_eyeProjection[eye]) * eyeToView;
+        for(unsigned int i=0; i<8; ++i)
+        {
+            corners[eye][i] = Vec3d((i&1) ? 1.0 : -1.0, (i&2) ? 1.0 : -1.0, (i&4) ? 1.0 : -1.0) * clipToView;
+        }
+        origins[eye] = Vec3d(0.0, 0.0, 0.0) * eyeToView;
+    }
+
+    bool orthographic = _eyeProjection[LEFT_EYE](3,3)==1.0 && _eyeProjection[LEFT_EYE](2,3)==0.0;
+    if (orthographic)
+    {
+        // the box enclosing both eye boxes.
+        Vec3d boxMin = corners[0][0];
+        Vec3d boxMax = corners[0][0];
+        for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+        {
+            for(unsigned int i=0; i<8; ++i)
+            {
+                for(unsigned int c=0; c<3; ++c)
+                {
+                    boxMin[c] = minimum(boxMin[c], corners[eye][i][c]);
+                    boxMax[c] = maximum(boxMax[c], corners[eye][i][c]);
+                }
+            }
+        }
+
+        _cullView = view;
+        _cullProjection = Matrixd::ortho(boxMin.x(), boxMax.x(), boxMin.y(), boxMax.y(), -boxMax.z(), -boxMin.z());
+        computeFrustumPlanes(_cullView*_cullProjection, _cullPlanes);
+        return;
+    }
+
+    // put the apex where the outer edges of the eye frustums meet behind the eyes, in the xz plane, so the
+    // merged frustum is no wider than the two eyes need.
+    unsigned int outerLeft = origins[LEFT_EYE].x()<=origins[RIGHT_EYE].x() ? LEFT_EYE : RIGHT_EYE;
+    unsigned int outerRight = 1-outerLeft;
+
+    double leftSlope = DBL_MAX;
+    double rightSlope = -DBL_MAX;
+    for(unsigned int i=0; i<8; ++i)
+    {
+        const Vec3d& l = corners[outerLeft][i];
+        const Vec3d& r = corners[outerRight][i];
+        leftSlope = minimum(leftSlope, (l.x()-origins[outerLeft].x())/(origins[outerLeft].z()-l.z()));
+        rightSlope = maximum(rightSlope, (r.x()-origins[outerRight].x())/(origins[outerRight].z()-r.z()));
+    }
+
+    Vec3d apex = (origins[LEFT_EYE]+origins[RIGHT_EYE])*0.5;
+    if (rightSlope-leftSlope>1e-6)
+    {
+        double depth = (origins[outerLeft].x()-origins[outerRight].x())/(rightSlope-leftSlope);
+        apex.x() = origins[outerLeft].x() + leftSlope*depth;
+        apex.z() -= depth;
+    }
+
+    // keep every corner in front of the apex.
+    double nearestZ = -DBL_MAX;
+    for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+    {
+        for(unsigned int i=0; i<8; ++i) nearestZ = maximum(nearestZ, corners[eye][i].z());
+    }
+    if (apex.z()<=nearestZ)
+    {
+        OSG_INFO<<"InstancedStereo::computeCullFrustum() moving the apex behind the eye frustums"<<std::endl;
+        apex.z() = nearestZ + 1e-3;
+    }
+
+    double left = DBL_MAX, right = -DBL_MAX, bottom = DBL_MAX, top = -DBL_MAX;
+    double zNear = DBL_MAX, zFar = 0.0;
+    for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+    {
+        for(unsigned int i=0; i<8; ++i)
+        {
+            Vec3d corner = corners[eye][i]-apex;
+            double depth = -corner.z();
+            left = minimum(left, corner.x()/depth);
+            right = maximum(right, corner.x()/depth);
+            bottom = minimum(bottom, corner.y()/depth);
+            top = maximum(top, corner.y()/depth);
+            zNear = minimum(zNear, depth);
+            zFar = maximum(zFar, depth);
+        }
+    }
+
+    _cullView = view * Matrixd::translate(-apex);
+    _cullProjection = Matrixd::frustum(left*zNear, right*zNear, bottom*zNear, top*zNear, zNear, zFar);
+    computeFrustumPlanes(_cullView*_cullProjection, _cullPlanes);
+}
+
+void InstancedStereo::computeFrustumPlanes(const Matrixd& viewProjection, Vec4d planes[6])
+{
+    // clip coordinates are the world position times the columns of viewProjection, a point is inside when
+    // -w<=x<=w, -w<=y<=w and -w<=z<=w.
+    Vec4d columns[4];
+    for(unsigned int c=0; c<4; ++c)
+    {
+        columns[c].set(viewProjection(0,c), viewProjection(1,c), viewProjection(2,c), viewProjection(3,c));
+    }
+
+    for(unsigned int axis=0; axis<3; ++axis)
+    {
+        planes[axis*2] = columns[3] + columns[axis];
+        planes[axis*2+1] = columns[3] - columns[axis];
+    }
+
+    for(unsigned int i=0; i<6; ++i)
+    {
+        double length = sqrt(planes[i].x()*planes[i].x() + planes[i].y()*planes[i].y() + planes[i].z()*planes[i].z());
+        if (length>0.0) planes[i] /= length;
+    }
+}
+
+bool InstancedStereo::contains(const Vec4d planes[6], const Vec3d& center, double radius)
+{
+    for(unsigned int i=0; i<6; ++i)
+    {
+        const Vec4d& p = planes[i];
+        if (p.x()*center.x() + p.y()*center.y() + p.z()*center.z() + p.w() < -radius) return false;
+    }
+    return true;
+}
+
+void InstancedStereo::writeUniforms(Std140Writer& writer) const
+{
+    writer.add(_viewOffset[LEFT_EYE]);
+    writer.add(_viewOffset[RIGHT_EYE]);
+    writer.add(_eyeProjection[LEFT_EYE]);
+    writer.add(_eyeProjection[RIGHT_EYE]);
+    writer.addArray(_clipTransform, NUM_EYES);
+}
+
+unsigned int InstancedStereo::getUniformBlockSize()
+{
+    // 4 mat4 of 64 bytes and 2 vec4.
+    return 4*64 + 2*16;
+}
+
+const char* InstancedStereo::getUniformBlockSource()
+{
+    return
+        "layout(std140) uniform osg_Stereo\n"
+        "{\n"
+        "    mat4 osg_StereoViewOffsetMatrix[2];\n"
+        "    mat4 osg_StereoProjectionMatrix[2];\n"
+        "    vec4 osg_StereoClipTransform[2];\n"
+        "};\n";
+}
+
+const char* InstancedStereo::getVertexShaderSource(ViewportSelection selection)
+{
+    if (selection==VIEWPORT_INDEX)
+    {
+        // the #extension line has to follow the shader's #version line.
+        return
+            "#extension GL_ARB_shader_viewport_layer_array : require\n"
+            "layout(std140) uniform osg_Stereo\n"
+            "{\n"
+            "    mat4 osg_StereoViewOffsetMatrix[2];\n"
+            "    mat4 osg_StereoProjectionMatrix[2];\n"
+            "    vec4 osg_StereoClipTransform[2];\n"
+            "};\n"
+            "int osg_StereoEye() { return gl_InstanceID & 1; }\n"
+            "int osg_StereoInstanceID() { return gl_InstanceID >> 1; }\n"
+            "vec4 osg_StereoPosition(vec4 viewPosition)\n"
+            "{\n"
+            "    int eye = osg_StereoEye();\n"
+            "    gl_ViewportIndex = eye;\n"
+            "    return osg_StereoProjectionMatrix[eye] * (osg_StereoViewOffsetMatrix[eye] * viewPosition);\n"
+            "}\n";
+    }
+
+    return
+        "layout(std140) uniform osg_Stereo\n"
+        "{\n"
+        "    mat4 osg_StereoViewOffsetMatrix[2];\n"
+        "    mat4 osg_StereoProjectionMatrix[2];\n"
+        "    vec4 osg_StereoClipTransform[2];\n"
+        "};\n"
+        "out float gl_ClipDistance[4];\n"
+        "int osg_StereoEye() { return gl_InstanceID & 1; }\n"
+        "int osg_StereoInstanceID() { return gl_InstanceID >> 1; }\n"
+        "vec4 osg_StereoPosition(vec4 viewPosition)\n"
+        "{\n"
+        "    int eye = osg_StereoEye();\n"
+        "    vec4 clip = osg_StereoProjectionMatrix[eye] * (osg_StereoViewOffsetMatrix[eye] * viewPosition);\n"
+        "    gl_ClipDistance[0] = clip.w + clip.x;\n"
+        "    gl_ClipDistance[1] = clip.w - clip.x;\n"
+        "    gl_ClipDistance[2] = clip.w + clip.y;\n"
+        "    gl_ClipDistance[3] = clip.w - clip.y;\n"
+        "    vec4 transform = osg_StereoClipTransform[eye];\n"
+        "    clip.xy = clip.xy*transform.xy + clip.w*transform.zw;\n"
+        "    return clip;\n"
+        "}\n";
+}
+
+void InstancedStereo::apply(State& state) const
+{
+    if (_viewportSelection==VIEWPORT_INDEX)
+    {
+        if (!state.isViewportArraySupported() || !state.isShaderViewportLayerArraySupported())
+        {
+            OSG_WARN<<"Warning: InstancedStereo::apply() viewport arrays or gl_ViewportIndex in vertex shaders not supported, use CLIP_DISTANCES instead."<<std::endl;
+            return;
+        }
+
+        GLfloat viewports[NUM_EYES*4];
+        for(unsigned int eye=0; eye<NUM_EYES; ++eye)
+        {
+            for(unsigned int i=0; i<4; ++i) viewports[eye*4+i] = _eyeViewport[eye][i];
+        }
+        state.glViewportArrayv(0, NUM_EYES, viewports);
+        return;
+    }
+
+    state.glViewport(static_cast<GLint>(_unionViewport[0]), static_cast<GLint>(_unionViewport[1]),
+                     static_cast<GLsizei>(_unionViewport[2]), static_cast<GLsizei>(_unionViewport[3]));
+
+    for(unsigned int i=0; i<4; ++i) state.applyMode(GL_CLIP_DISTANCE0+i, true);
+}
+
+void InstancedStereo::restore(State& state) const
+{
+    if (_viewportSelection==CLIP_DISTANCES)
+    {
+        for(unsigned int i=0; i<4; ++i) state.applyMode(GL_CLIP_DISTANCE0+i, false);
+    }
+}
+
+
+
+// OSGFILE src/osg/GLRecorder.cpp
+
+/*
+#include <osg/GLRecorder>
+*/
+
+using namespace osg;
+
+static thread_local GLRecorder* s_currentGLRecorder = 0;
+
+static const char* s_GLRecorderCallNames[GLRecorder::NUM_CALLS] =
+{
+    "glLoadMatrix",
+    "glMultMatrix",
+    "glMatrixMode",
+    "glGetError",
+    "glEnable",
+    "glDisable",
+    "glGetIntegerv",
+    "glGetFloatv",
+    "glGetString",
+    "glFlush",
+    "glFinish",
+    "glClear",
+    "glClearColor",
+    "glViewport",
+    "glScissor",
+    "glDrawBuffer",
+    "glReadBuffer",
+    "glDrawArrays",
+    "glDrawElements",
+    "glDrawArraysInstanced",
+    "glDrawElementsInstanced",
+    "glDrawElementsInstancedBaseVertexBaseInstance",
+    "glInterleavedArrays",
+    "glVertex",
+    "glNormal",
+    "glColor",
+    "glTexCoord",
+    "glMultiTexCoord",
+    "glVertexAttrib",
+    "glActiveTexture",
+    "glClientActiveTexture",
+    "glVertexAttribPointer",
+    "glFogCoordPointer",
+    "glSecondaryColorPointer",
+    "glEnableVertexAttribArray",
+    "glDisableVertexAttribArray",
+    "glBindBuffer",
+    "glGenBuffers",
+    "glDeleteBuffers",
+    "glBufferData",
+    "glBufferSubData",
+    "glBufferStorage",
+    "glMapBufferRange",
+    "glUnmapBuffer",
+    "glMultiDrawElementsIndirect",
+    "glBindBufferRange",
+    "glBindBufferBase",
+    "glUniform",
+    "glViewportArrayv",
+    "glFenceSync",
+    "glClientWaitSync",
+    "glDeleteSync",
+    "swapBuffers"
+};
+
+GLRecorder::GLRecorder():
+    Referenced(true),
+    _logCalls(false)
+{
+    reset();
+    setViewport(0, 0, 0, 0);
+    setScissor(0, 0, 0, 0);
+    setClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    setDrawBuffer(GL_BACK);
+    setReadBuffer(GL_BACK);
+    _nextBufferObject = 1;
+}
+
+void GLRecorder::setCurrent(GLRecorder* recorder)
+{
+    s_currentGLRecorder = recorder;
+}
+
+GLRecorder* GLRecorder::getCurrent()
+{
+    return s_currentGLRecorder;
+}
+
+const char* GLRecorder::getCallName(Call call)
+{
+    return (call>=0 && call<NUM_CALLS) ? s_GLRecorderCallNames[call] : "unknown";
+}
+
+unsigned int GLRecorder::getTotalCount() const
+{
+    unsigned int total = 0;
+    for(unsigned int i=0; i<NUM_CALLS; ++i) total += _counts[i];
+    return total;
+}
+
+void GLRecorder::reset()
+{
+    for(unsigned int i=0; i<NUM_CALLS; ++i) _counts[i] = 0;
+    _log.clear();
+    _bufferDataBytes = 0;
+    _indirectCommands.clear();
+}
+
+GLuint GLRecorder::getBoundBuffer(GLenum target) const
+{
+    BoundBuffers::const_iterator itr = _boundBuffers.find(target);
+    return itr!=_boundBuffers.end() ? itr->second : 0;
+}
+
+void GLRecorder::setBufferSize(GLuint buffer, size_t size)
+{
+    if (buffer==0) return;
+
+    BufferContents& contents = _buffers[buffer];
+    contents.size = size;
+    contents.data.clear();
+}
+
+size_t GLRecorder::getBufferSize(GLuint buffer) const
+{
+    Buffers::const_iterator itr = _buffers.find(buffer);
+    return itr!=_buffers.end() ? itr->second.size : 0;
+}
+
+unsigned char* GLRecorder::getBufferData(GLuint buffer, size_t offset, size_t length)
+{
+    Buffers::iterator itr = _buffers.find(buffer);
+    if (itr==_buffers.end() || offset>itr->second.size || length>itr->second.size-offset) return 0;
+
+    BufferContents& contents = itr->second;
+    if (contents.data.size()!=contents.size) contents.data.resize(contents.size);
+    return contents.size>0 ? &contents.data[offset] : 0;
+}
+
+void GLRecorder::deleteBuffer(GLuint buffer)
+{
+    _buffers.erase(buffer);
+    for(BoundBuffers::iterator itr = _boundBuffers.begin(); itr != _boundBuffers.end(); ++itr)
+    {
+        if (itr->second==buffer) itr->second = 0;
+    }
+}
+
+void GLRecorder::addIndirectCommands(const void* data, size_t size)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    _indirectCommands.insert(_indirectCommands.end(), bytes, bytes+size);
+}
+
+void GLRecorder::report(std::ostream& out) const
+{
+    for(unsigned int i=0; i<NUM_CALLS; ++i)
+    {
+        if (_counts[i]>0) out<<"    "<<s_GLRecorderCallNames[i]<<" "<<_counts[i]<<std::endl;
+    }
+    out<<"    total "<<getTotalCount()<<std::endl;
+}
+
+static inline GLRecorder* recordGLCall(GLRecorder::Call call)
+{
+    GLRecorder* recorder = s_currentGLRecorder;
+    if (recorder) recorder->record(call);
+    return recorder;
+}
+
+// The recording entry points are defined even when OSG_GL_RECORDING isn't, so applications can install
+// them in their own function tables, they are only wired into the core by the macros in include/osg/GL.
+#ifdef OSG_GL_RECORDING
+    #undef glLoadMatrixf
+    #undef glLoadMatrixd
+    #undef glMultMatrixf
+    #undef glMultMatrixd
+    #undef glMatrixMode
+    #undef glGetError
+    #undef glEnable
+    #undef glDisable
+    #undef glGetIntegerv
+    #undef glGetFloatv
+    #undef glGetString
+    #undef glFlush
+    #undef glFinish
+    #undef glClear
+    #undef glClearColor
+    #undef glViewport
+    #undef glScissor
+    #undef glDrawBuffer
+    #undef glReadBuffer
+    #undef glDrawArrays
+    #undef glDrawElements
+    #undef glInterleavedArrays
+    #undef glVertex4f
+    #undef glNormal3f
+    #undef glColor4f
+    #undef glTexCoord4f
+#else
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glLoadMatrixf(const GLfloat* m);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glLoadMatrixd(const GLdouble* m);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glMultMatrixf(const GLfloat* m);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glMultMatrixd(const GLdouble* m);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glMatrixMode(GLenum mode);
+    OSG_EXPORT GLenum GL_APIENTRY osgRecordingGL_glGetError();
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glEnable(GLenum cap);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glDisable(GLenum cap);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glGetIntegerv(GLenum pname, GLint* params);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glGetFloatv(GLenum pname, GLfloat* params);
+    OSG_EXPORT const GLubyte* GL_APIENTRY osgRecordingGL_glGetString(GLenum name);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glFlush();
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glFinish();
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glClear(GLbitfield mask);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glScissor(GLint x, GLint y, GLsizei width, GLsizei height);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glDrawBuffer(GLenum buffer);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glReadBuffer(GLenum buffer);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glDrawArrays(GLenum mode, GLint first, GLsizei count);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glDrawElements(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glInterleavedArrays(GLenum format, GLsizei stride, const GLvoid* pointer);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glVertex4f(GLfloat x, GLfloat y, GLfloat z, GLfloat w);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glNormal3f(GLfloat x, GLfloat y, GLfloat z);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glColor4f(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+    OSG_EXPORT void GL_APIENTRY osgRecordingGL_glTexCoord4f(GLfloat s, GLfloat t, GLfloat r, GLfloat q);
+#endif
+
+void GL_APIENTRY osgRecordingGL_glLoadMatrixf(const GLfloat*) { recordGLCall(GLRecorder::LOAD_MATRIX); }
+void GL_APIENTRY osgRecordingGL_glLoadMatrixd(const GLdouble*) { recordGLCall(GLRecorder::LOAD_MATRIX); }
+void GL_APIENTRY osgRecordingGL_glMultMatrixf(const GLfloat*) { recordGLCall(GLRecorder::MULT_MATRIX); }
+void GL_APIENTRY osgRecordingGL_glMultMatrixd(const GLdouble*) { recordGLCall(GLRecorder::MULT_MATRIX); }
+void GL_APIENTRY osgRecordingGL_glMatrixMode(GLenum) { recordGLCall(GLRecorder::MATRIX_MODE); }
+
+GLenum GL_APIENTRY osgRecordingGL_glGetError()
+{
+    recordGLCall(GLRecorder::GET_ERROR);
+    return GL_NO_ERROR;
+}
+
+void GL_APIENTRY osgRecordingGL_glEnable(GLenum) { recordGLCall(GLRecorder::ENABLE); }
+void GL_APIENTRY osgRecordingGL_glDisable(GLenum) { recordGLCall(GLRecorder::DISABLE); }
+
+void GL_APIENTRY osgRecordingGL_glGetIntegerv(GLenum pname, GLint* params)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::GET_INTEGER);
+    if (!params) return;
+
+    switch(pname)
+    {
+        case(GL_VIEWPORT):
+        {
+            const GLint* viewport = recorder ? recorder->getViewport() : 0;
+            for(unsigned int i=0; i<4; ++i) params[i] = viewport ? viewport[i] : 0;
+            break;
+        }
+        case(GL_SCISSOR_BOX):
+        {
+            const GLint* scissor = recorder ? recorder->getScissor() : 0;
+            for(unsigned int i=0; i<4; ++i) params[i] = scissor ? scissor[i] : 0;
+            break;
+        }
+        case(GL_DRAW_BUFFER):
+            *params = recorder ? static_cast<GLint>(recorder->getDrawBuffer()) : GL_BACK;
+            break;
+        case(GL_READ_BUFFER):
+            *params = recorder ? static_cast<GLint>(recorder->getReadBuffer()) : GL_BACK;
+            break;
+        case(GL_MAX_TEXTURE_UNITS):
+        case(GL_MAX_TEXTURE_COORDS):
+        case(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS):
+            *params = 8;
+            break;
+        case(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT):
+            *params = 256;
+            break;
+        default:
+            *params = 0;
+            break;
+    }
+}
+
+void GL_APIENTRY osgRecordingGL_glGetFloatv(GLenum pname, GLfloat* params)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::GET_FLOAT);
+    if (!params) return;
+
+    if (pname==GL_COLOR_CLEAR_VALUE)
+    {
+        const GLfloat* clearColor = recorder ? recorder->getClearColor() : 0;
+        for(unsigned int i=0; i<4; ++i) params[i] = clearColor ? clearColor[i] : 0.0f;
+    }
+    else
+    {
+        *params = 0.0f;
+    }
+}
+
+const GLubyte* GL_APIENTRY osgRecordingGL_glGetString(GLenum name)
+{
+    recordGLCall(GLRecorder::GET_STRING);
+    switch(name)
+    {
+        case(GL_VENDOR): return reinterpret_cast<const GLubyte*>("OpenSceneGraph");
+        case(GL_RENDERER): return reinterpret_cast<const GLubyte*>("GLRecorder");
+        case(GL_VERSION): return reinterpret_cast<const GLubyte*>("2.1 GLRecorder");
+        case(GL_EXTENSIONS): return reinterpret_cast<const GLubyte*>("");
+        default: return 0;
+    }
+}
+
+void GL_APIENTRY osgRecordingGL_glFlush() { recordGLCall(GLRecorder::FLUSH); }
+void GL_APIENTRY osgRecordingGL_glFinish() { recordGLCall(GLRecorder::FINISH); }
+void GL_APIENTRY osgRecordingGL_glClear(GLbitfield) { recordGLCall(GLRecorder::CLEAR); }
+
+void GL_APIENTRY osgRecordingGL_glClearColor(GLclampf red, GLclampf green, GLclampf blue, GLclampf alpha)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::CLEAR_COLOR);
+    if (recorder) recorder->setClearColor(red, green, blue, alpha);
+}
+
+void GL_APIENTRY osgRecordingGL_glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::VIEWPORT);
+    if (recorder) recorder->setViewport(x, y, width, height);
+}
+
+void GL_APIENTRY osgRecordingGL_glScissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::SCISSOR);
+    if (recorder) recorder->setScissor(x, y, width, height);
+}
+
+void GL_APIENTRY osgRecordingGL_glDrawBuffer(GLenum buffer)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::DRAW_BUFFER);
+    if (recorder) recorder->setDrawBuffer(buffer);
+}
+
+void GL_APIENTRY osgRecordingGL_glReadBuffer(GLenum buffer)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::READ_BUFFER);
+    if (recorder) recorder->setReadBuffer(buffer);
+}
+
+void GL_APIENTRY osgRecordingGL_glDrawArrays(GLenum, GLint, GLsizei) { recordGLCall(GLRecorder::DRAW_ARRAYS); }
+void GL_APIENTRY osgRecordingGL_glDrawElements(GLenum, GLsizei, GLenum, const GLvoid*) { recordGLCall(GLRecorder::DRAW_ELEMENTS); }
+void GL_APIENTRY osgRecordingGL_glInterleavedArrays(GLenum, GLsizei, const GLvoid*) { recordGLCall(GLRecorder::INTERLEAVED_ARRAYS); }
+void GL_APIENTRY osgRecordingGL_glVertex4f(GLfloat, GLfloat, GLfloat, GLfloat) { recordGLCall(GLRecorder::VERTEX); }
+void GL_APIENTRY osgRecordingGL_glNormal3f(GLfloat, GLfloat, GLfloat) { recordGLCall(GLRecorder::NORMAL); }
+void GL_APIENTRY osgRecordingGL_glColor4f(GLfloat, GLfloat, GLfloat, GLfloat) { recordGLCall(GLRecorder::COLOR); }
+void GL_APIENTRY osgRecordingGL_glTexCoord4f(GLfloat, GLfloat, GLfloat, GLfloat) { recordGLCall(GLRecorder::TEX_COORD); }
+
+void GL_APIENTRY osgRecordingGL_glActiveTexture(GLenum) { recordGLCall(GLRecorder::ACTIVE_TEXTURE); }
+void GL_APIENTRY osgRecordingGL_glClientActiveTexture(GLenum) { recordGLCall(GLRecorder::CLIENT_ACTIVE_TEXTURE); }
+void GL_APIENTRY osgRecordingGL_glFogCoordPointer(GLenum, GLsizei, const GLvoid*) { recordGLCall(GLRecorder::FOG_COORD_POINTER); }
+void GL_APIENTRY osgRecordingGL_glSecondaryColorPointer(GLint, GLenum, GLsizei, const GLvoid*) { recordGLCall(GLRecorder::SECONDARY_COLOR_POINTER); }
+void GL_APIENTRY osgRecordingGL_glMultiTexCoord4f(GLenum, GLfloat, GLfloat, GLfloat, GLfloat) { recordGLCall(GLRecorder::MULTI_TEX_COORD); }
+void GL_APIENTRY osgRecordingGL_glVertexAttrib4f(GLuint, GLfloat, GLfloat, GLfloat, GLfloat) { recordGLCall(GLRecorder::VERTEX_ATTRIB); }
+void GL_APIENTRY osgRecordingGL_glVertexAttrib4fv(GLuint, const GLfloat*) { recordGLCall(GLRecorder::VERTEX_ATTRIB); }
+void GL_APIENTRY osgRecordingGL_glVertexAttribPointer(unsigned int, GLint, GLenum, GLboolean, GLsizei, const GLvoid*) { recordGLCall(GLRecorder::VERTEX_ATTRIB_POINTER); }
+void GL_APIENTRY osgRecordingGL_glVertexAttribIPointer(unsigned int, GLint, GLenum, GLsizei, const GLvoid*) { recordGLCall(GLRecorder::VERTEX_ATTRIB_POINTER); }
+void GL_APIENTRY osgRecordingGL_glVertexAttribLPointer(unsigned int, GLint, GLenum, GLsizei, const GLvoid*) { recordGLCall(GLRecorder::VERTEX_ATTRIB_POINTER); }
+void GL_APIENTRY osgRecordingGL_glEnableVertexAttribArray(unsigned int) { recordGLCall(GLRecorder::ENABLE_VERTEX_ATTRIB_ARRAY); }
+void GL_APIENTRY osgRecordingGL_glDisableVertexAttribArray(unsigned int) { recordGLCall(GLRecorder::DISABLE_VERTEX_ATTRIB_ARRAY); }
+void GL_APIENTRY osgRecordingGL_glBindBuffer(GLenum target, GLuint buffer)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::BIND_BUFFER);
+    if (recorder) recorder->bindBuffer(target, buffer);
+}
+
+void GL_APIENTRY osgRecordingGL_glGenBuffers(GLsizei n, GLuint* buffers)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::GEN_BUFFERS);
+    for(GLsizei i=0; i<n; ++i) buffers[i] = recorder ? recorder->generateBufferObject() : 0;
+}
+
+void GL_APIENTRY osgRecordingGL_glDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::DELETE_BUFFERS);
+    for(GLsizei i=0; recorder && i<n; ++i) recorder->deleteBuffer(buffers[i]);
+}
+
+void GL_APIENTRY osgRecordingGL_glBufferData(GLenum target, GLsizeiptr size, const GLvoid* data, GLenum)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::BUFFER_DATA);
+    if (!recorder) return;
+
+    recorder->addBufferDataBytes(static_cast<size_t>(size));
+
+    GLuint buffer = recorder->getBoundBuffer(target);
+    recorder->setBufferSize(buffer, static_cast<size_t>(size));
+
+    unsigned char* contents = data ? recorder->getBufferData(buffer, 0, static_cast<size_t>(size)) : 0;
+    if (contents) memcpy(contents, data, static_cast<size_t>(size));
+}
+
+void GL_APIENTRY osgRecordingGL_glBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const GLvoid* data)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::BUFFER_SUB_DATA);
+    if (!recorder) return;
+
+    recorder->addBufferDataBytes(static_cast<size_t>(size));
+
+    unsigned char* contents = recorder->getBufferData(recorder->getBoundBuffer(target), static_cast<size_t>(offset), static_cast<size_t>(size));
+    if (contents && data) memcpy(contents, data, static_cast<size_t>(size));
+}
+
+void GL_APIENTRY osgRecordingGL_glBufferStorage(GLenum target, GLsizeiptr size, const GLvoid* data, GLbitfield)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::BUFFER_STORAGE);
+    if (!recorder) return;
+
+    GLuint buffer = recorder->getBoundBuffer(target);
+    recorder->setBufferSize(buffer, static_cast<size_t>(size));
+
+    unsigned char* contents = data ? recorder->getBufferData(buffer, 0, static_cast<size_t>(size)) : 0;
+    if (contents) memcpy(contents, data, static_cast<size_t>(size));
+}
+
+void* GL_APIENTRY osgRecordingGL_glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::MAP_BUFFER_RANGE);
+    return recorder ? recorder->getBufferData(recorder->getBoundBuffer(target), static_cast<size_t>(offset), static_cast<size_t>(length)) : 0;
+}
+
+GLboolean GL_APIENTRY osgRecordingGL_glUnmapBuffer(GLenum)
+{
+    recordGLCall(GLRecorder::UNMAP_BUFFER);
+    return GL_TRUE;
+}
+
+void GL_APIENTRY osgRecordingGL_glMultiDrawElementsIndirect(GLenum, GLenum, const GLvoid* indirect, GLsizei drawcount, GLsizei stride)
+{
+    GLRecorder* recorder = recordGLCall(GLRecorder::MULTI_DRAW_ELEMENTS_INDIRECT);
+    if (!recorder || drawcount<=0) return;
+
+    // commands are 5 GLuints, tightly packed when stride is 0.
+    size_t commandSize = stride>0 ? static_cast<size_t>(stride) : 5*sizeof(GLuint);
+    size_t size = commandSize*static_cast<size_t>(drawcount-1) + 5*sizeof(GLuint);
+
+    // indirect is an offset into the bound draw indirect buffer, or a client side pointer when none is bound.
+    GLuint buffer = recorder->getBoundBuffer(GL_DRAW_INDIRECT_BUFFER);
+    const unsigned char* commands = buffer ?
+        recorder->getBufferData(buffer, reinterpret_cast<size_t>(indirect), size) :
+        static_cast<const unsigned char*>(indirect);
+    if (!commands) return;
+
+    for(GLsizei i=0; i<drawcount; ++i)
+    {
+        recorder->addIndirectCommands(commands+commandSize*static_cast<size_t>(i), 5*sizeof(GLuint));
+    }
+}
+
+void GL_APIENTRY osgRecordingGL_glBindBufferRange(GLenum, GLuint, GLuint, GLintptr, GLsizeiptr) { recordGLCall(GLRecorder::BIND_BUFFER_RANGE); }
+void GL_APIENTRY osgRecordingGL_glBindBufferBase(GLenum, GLuint, GLuint) { recordGLCall(GLRecorder::BIND_BUFFER_BASE); }
+void GL_APIENTRY osgRecordingGL_glUniform4fv(GLint, GLsizei, const GLfloat*) { recordGLCall(GLRecorder::UNIFORM); }
+void GL_APIENTRY osgRecordingGL_glUniformMatrix3fv(GLint, GLsizei, GLboolean, const GLfloat*) { recordGLCall(GLRecorder::UNIFORM); }
+void GL_APIENTRY osgRecordingGL_glUniformMatrix4fv(GLint, GLsizei, GLboolean, const GLfloat*) { recordGLCall(GLRecorder::UNIFORM); }
+void GL_APIENTRY osgRecordingGL_glViewportArrayv(GLuint, GLsizei, const GLfloat*) { recordGLCall(GLRecorder::VIEWPORT_ARRAY); }
+
+void GL_APIENTRY osgRecordingGL_glDrawArraysInstanced(GLenum, GLint, GLsizei, GLsizei) { recordGLCall(GLRecorder::DRAW_ARRAYS_INSTANCED); }
+void GL_APIENTRY osgRecordingGL_glDrawElementsInstanced(GLenum, GLsizei, GLenum, const GLvoid*, GLsizei) { recordGLCall(GLRecorder::DRAW_ELEMENTS_INSTANCED); }
+void GL_APIENTRY osgRecordingGL_glDrawElementsInstancedBaseVertexBaseInstance(GLenum, GLsizei, GLenum, const GLvoid*, GLsizei, GLint, GLuint) { recordGLCall(GLRecorder::DRAW_ELEMENTS_INSTANCED_BASE_VERTEX_BASE_INSTANCE); }
+
+RecordingFences::RecordingFences():
+    _time(0.0),
+    _gpuFrameTime(0.0),
+    _gpuFreeTime(0.0),
+    _nextFence(1)
+{
+}
+
+GLsync RecordingFences::insert(GraphicsContext*)
+{
+    recordGLCall(GLRecorder::FENCE_SYNC);
+
+    // the simulated GPU starts the frame once it has finished the previous one.
+    _gpuFreeTime = osg::maximum(_gpuFreeTime, _time) + _gpuFrameTime;
+
+    GLsync sync = reinterpret_cast<GLsync>(_nextFence++);
+    _signalTimes[sync] = _gpuFreeTime;
+    return sync;
+}
+
+bool RecordingFences::wait(GraphicsContext*, GLsync sync, double timeout)
+{
+    recordGLCall(GLRecorder::CLIENT_WAIT_SYNC);
+
+    SignalTimes::iterator itr = _signalTimes.find(sync);
+    if (itr==_signalTimes.end()) return false;
+
+    if (itr->second<=_time) return true;
+
+    if (itr->second<=_time+timeout)
+    {
+        _time = itr->second;
+        return true;
+    }
+
+    _time += timeout;
+    return false;
+}
+
+void RecordingFences::remove(GraphicsContext*, GLsync sync)
+{
+    recordGLCall(GLRecorder::DELETE_SYNC);
+    _signalTimes.erase(sync);
+}
+
+RecordingCompileObject::RecordingCompileObject(RecordingFences* fences, GLObjectCompileCostModel::ObjectType type, size_t size, double cost):
+    _fences(fences),
+    _type(type),
+    _size(size),
+    _cost(cost),
+    _compiled(false)
+{
+}
+
+void RecordingCompileObject::compile(State&)
+{
+    if (_type==GLObjectCompileCostModel::BUFFER_OBJECT)
+    {
+        GLuint buffer = 0;
+        osgRecordingGL_glGenBuffers(1, &buffer);
+        osgRecordingGL_glBindBuffer(GL_ARRAY_BUFFER_ARB, buffer);
+        osgRecordingGL_glBufferData(GL_ARRAY_BUFFER_ARB, static_cast<GLsizeiptr>(_size), 0, GL_STATIC_DRAW_ARB);
+        osgRecordingGL_glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+    }
+
+    if (_fences.valid()) _fences->advance(_cost);
+    _compiled = true;
+}
+
+
+// OSGFILE src/osg/HeadlessGraphicsContext.cpp
+
+/*
+#include <osg/HeadlessGraphicsContext>
+*/
+
+using namespace osg;
+
+HeadlessGraphicsContext::HeadlessGraphicsContext(GraphicsContext::Traits* traits):
+    _realized(false),
+    _recorder(new GLRecorder)
+{
+    _traits = traits;
+
+    setState(new osg::State);
+    getState()->setGraphicsContext(this);
+
+    if (_traits.valid() && _traits->sharedContext.valid())
+    {
+        getState()->setContextID(_traits->sharedContext->getState()->getContextID());
+        incrementContextIDUsageCount(getState()->getContextID());
+    }
+    else
+    {
+        getState()->setContextID(osg::GraphicsContext::createNewContextID());
+    }
+}
+
+HeadlessGraphicsContext::~HeadlessGraphicsContext()
+{
+    close(true);
+}
+
+bool HeadlessGraphicsContext::realizeImplementation()
+{
+    _realized = true;
+    return true;
+}
+
+void HeadlessGraphicsContext::closeImplementation()
+{
+    _realized = false;
+}
+
+bool HeadlessGraphicsContext::makeCurrentImplementation()
+{
+    if (!_realized) return false;
+
+    GLRecorder::setCurrent(_recorder.get());
+    return true;
+}
+
+bool HeadlessGraphicsContext::makeContextCurrentImplementation(GraphicsContext* /*readContext*/)
+{
+    return makeCurrentImplementation();
+}
+
+bool HeadlessGraphicsContext::releaseContextImplementation()
+{
+    if (GLRecorder::getCurrent()==_recorder.get()) GLRecorder::setCurrent(0);
+    return true;
+}
+
+void HeadlessGraphicsContext::swapBuffersImplementation()
+{
+    _recorder->record(GLRecorder::SWAP_BUFFERS);
+}
+
+/** WindowingSystemInterface creating HeadlessGraphicsContext's, with a single nominal screen.*/
+struct HeadlessWindowingSystemInterface : public GraphicsContext::WindowingSystemInterface
+{
+    virtual unsigned int getNumScreens(const GraphicsContext::ScreenIdentifier& /*screenIdentifier*/)
+    {
+        return 1;
+    }
+
+    virtual void getScreenSettings(const GraphicsContext::ScreenIdentifier& /*screenIdentifier*/, GraphicsContext::ScreenSettings& resolution)
+    {
+        resolution.width = 1920;
+        resolution.height = 1080;
+        resolution.refreshRate = 60.0;
+        resolution.colorDepth = 24;
+    }
+
+    virtual void enumerateScreenSettings(const GraphicsContext::ScreenIdentifier& screenIdentifier, GraphicsContext::ScreenSettingsList& resolutionList)
+    {
+        GraphicsContext::ScreenSettings settings;
+        getScreenSettings(screenIdentifier, settings);
+        resolutionList.push_back(settings);
+    }
+
+    virtual GraphicsContext* createGraphicsContext(GraphicsContext::Traits* traits)
+    {
+        return new HeadlessGraphicsContext(traits);
+    }
+};
+
+// only registered where the GL entry points are the recording ones, real GL calls need a real context.
+#ifdef OSG_GL_RECORDING
+REGISTER_WINDOWINGSYSTEMINTERFACE(Headless, HeadlessWindowingSystemInterface)
+#endif
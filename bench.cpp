@@ -0,0 +1,2654 @@
+#include "main.h"
+
+using namespace ogs;
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <set>
+#include <thread>
+#include <tuple>
+
+#if !defined(WIN32) || defined(__CYGWIN__)
+#include <spawn.h>
+#include <sys/wait.h>
+#endif
+
+// Microbenchmarks of the core primitives, in the spirit of Google Benchmark.
+//
+// Every benchmark is calibrated to run for at least `min_time` seconds,
+// repeated `repetitions` times and reported with the median, so results are
+// stable from run to run. Results are written as JSON, one benchmark per
+// line. With `--baseline=file.json` the results are compared against an
+// earlier run and the exit code is 1 if the baseline can't be read, if any
+// benchmark lost more than `--threshold` (default 0.1) of its throughput or
+// if a benchmark of the baseline the filter selects didn't run.
+//
+// Checks of the paths the benchmarks time run first, against the recording
+// stand-ins for the driver and the GPU. They are filtered like the
+// benchmarks and the exit code is 1 if any of them failed.
+//
+// The target is built with OSG_GL_RECORDING, GL calls go to osg::GLRecorder,
+// so the GL benchmarks measure the CPU side of the calls only.
+//
+// The atomic benchmarks are the ones to compare across architectures, a
+// cross built binary runs on x86 under qemu-user (qemu-aarch64 -L sysroot),
+// though only relative numbers from the same run mean anything there.
+//
+//   sfosg_bench --filter=matrixd --repetitions=9 --out=now.json
+//   sfosg_bench --baseline=then.json --threshold=0.05
+
+namespace ogs
+{
+namespace bench
+{
+
+//! Keep the compiler from optimizing a value away.
+template<typename T>
+inline void doNotOptimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+struct Result
+{
+    std::string name;
+    uint64_t iterations;
+    //! Median time per iteration over the repetitions.
+    double nsPerIteration;
+    double itemsPerSecond;
+};
+
+class Runner
+{
+    public:
+        //! Runs the iterations it is given and returns the items processed
+        //! per iteration.
+        typedef std::function<double(uint64_t)> Body;
+
+        std::string filter;
+        double minTime = 0.2;
+        unsigned int repetitions = 5;
+        std::vector<Result> results;
+
+        bool selected(const std::string &name) const
+        {
+            return name.find(this->filter) != std::string::npos;
+        }
+
+        void run(const std::string &name, const Body &body)
+        {
+            if (!this->selected(name))
+            {
+                return;
+            }
+            // Grow the iteration count until one run takes a tenth of
+            // min_time, then scale it up to min_time.
+            uint64_t iterations = 1;
+            double elapsed = 0;
+            while (true)
+            {
+                auto start = Clock::now();
+                body(iterations);
+                elapsed = seconds(start, Clock::now());
+                if (elapsed >= this->minTime / 10 || iterations >= (uint64_t(1) << 40))
+                {
+                    break;
+                }
+                iterations *= 10;
+            }
+            if (elapsed > 0)
+            {
+                iterations = std::max<uint64_t>(
+                    1,
+                    static_cast<uint64_t>(iterations * this->minTime / elapsed)
+                );
+            }
+
+            std::vector<double> times;
+            double items = 1;
+            for (unsigned int r = 0; r < this->repetitions; ++r)
+            {
+                auto start = Clock::now();
+                items = body(iterations);
+                times.push_back(seconds(start, Clock::now()) / iterations);
+            }
+            this->add(name, iterations, times, items);
+        }
+
+        //! Add a benchmark timed by the caller, one sample per repetition.
+        void add(
+            const std::string &name,
+            uint64_t iterations,
+            std::vector<double> times,
+            double itemsPerIteration
+        ) {
+            std::sort(times.begin(), times.end());
+            double median = times.empty() ? 0 : times[times.size() / 2];
+            Result result;
+            result.name = name;
+            result.iterations = iterations;
+            result.nsPerIteration = median * 1e9;
+            result.itemsPerSecond = median > 0 ? itemsPerIteration / median : 0;
+            this->results.push_back(result);
+
+            std::cerr
+                << name << "\t"
+                << result.nsPerIteration << " ns\t"
+                << result.itemsPerSecond << " items/s"
+                << std::endl;
+        }
+
+        void writeJSON(std::ostream &out) const
+        {
+            out << "{\n  \"benchmarks\": [\n";
+            for (size_t i = 0; i < this->results.size(); ++i)
+            {
+                const Result &result = this->results[i];
+                out
+                    << "    {\"name\": \"" << result.name
+                    << "\", \"iterations\": " << result.iterations
+                    << ", \"real_time_ns\": " << result.nsPerIteration
+                    << ", \"items_per_second\": " << result.itemsPerSecond
+                    << "}" << (i + 1 < this->results.size() ? "," : "") << "\n";
+            }
+            out << "  ]\n}" << std::endl;
+        }
+};
+
+//! Runs the checks, which report failed expectations with BENCH_EXPECT().
+class Checker
+{
+    public:
+        std::string filter;
+        unsigned int numFailures = 0;
+
+        bool selected(const std::string &name) const
+        {
+            return name.find(this->filter) != std::string::npos;
+        }
+
+        void run(const std::string &name, const std::function<void()> &body)
+        {
+            if (!this->selected(name))
+            {
+                return;
+            }
+            unsigned int failures = this->numFailures;
+            this->current = name;
+            body();
+            std::cerr
+                << name << "\t"
+                << (this->numFailures == failures ? "passed" : "FAILED")
+                << std::endl;
+        }
+
+        void expect(bool condition, const char *expression, int line)
+        {
+            if (!condition)
+            {
+                ++this->numFailures;
+                std::cerr
+                    << "CHECK FAILED " << this->current << ": "
+                    << expression << " (bench.cpp:" << line << ")"
+                    << std::endl;
+            }
+        }
+
+    private:
+        std::string current;
+};
+
+#define BENCH_EXPECT(checker, expression) (checker).expect((expression), #expression, __LINE__)
+
+//! Read name and items_per_second of each benchmark line written by
+//! Runner::writeJSON(), return false if the file can't be read or holds no
+//! benchmarks.
+bool readBaseline(const std::string &path, std::map<std::string, double> &baseline)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Could not read baseline " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    const std::string nameKey = "\"name\": \"";
+    const std::string itemsKey = "\"items_per_second\": ";
+    while (std::getline(file, line))
+    {
+        auto name = line.find(nameKey);
+        auto items = line.find(itemsKey);
+        if (name == std::string::npos || items == std::string::npos)
+        {
+            continue;
+        }
+        name += nameKey.size();
+        std::string benchmark = line.substr(name, line.find('"', name) - name);
+        const char *value = line.c_str() + items + itemsKey.size();
+        char *end = nullptr;
+        double itemsPerSecond = std::strtod(value, &end);
+        if (end == value)
+        {
+            std::cerr << "Malformed baseline line in " << path << ": " << line << std::endl;
+            return false;
+        }
+        baseline[benchmark] = itemsPerSecond;
+    }
+    if (baseline.empty())
+    {
+        std::cerr << "No benchmarks in baseline " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//! Report throughput changes against the baseline, return false if any
+//! benchmark regressed beyond threshold or if a benchmark of the baseline
+//! the filter selects didn't run.
+bool compare(
+    const Runner &runner,
+    const std::map<std::string, double> &baseline,
+    double threshold
+) {
+    bool passed = true;
+    std::set<std::string> ran;
+    for (auto &result : runner.results)
+    {
+        ran.insert(result.name);
+        auto it = baseline.find(result.name);
+        if (it == baseline.end() || it->second <= 0)
+        {
+            continue;
+        }
+        double change = result.itemsPerSecond / it->second - 1;
+        bool regressed = change < -threshold;
+        passed = passed && !regressed;
+        std::cerr
+            << (regressed ? "REGRESSION " : "")
+            << result.name << ": "
+            << it->second << " -> " << result.itemsPerSecond << " items/s ("
+            << (change >= 0 ? "+" : "") << change * 100 << "%)"
+            << std::endl;
+    }
+    for (auto &benchmark : baseline)
+    {
+        if (runner.selected(benchmark.first) && !ran.count(benchmark.first))
+        {
+            std::cerr << "MISSING " << benchmark.first << ": in the baseline but not run" << std::endl;
+            passed = false;
+        }
+    }
+    return passed;
+}
+
+void mathBenchmarks(Runner &runner)
+{
+    runner.run("matrixd_mult", [](uint64_t iterations) {
+        osg::Matrixd a = osg::Matrixd::rotate(0.5, 0, 0, 1) * osg::Matrixd::translate(1, 2, 3);
+        osg::Matrixd b = osg::Matrixd::rotate(0.3, 1, 0, 0);
+        osg::Matrixd c;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            c.mult(a, b);
+            doNotOptimize(c);
+        }
+        return 1.0;
+    });
+    runner.run("matrixd_invert", [](uint64_t iterations) {
+        osg::Matrixd a = osg::Matrixd::rotate(0.5, 0, 0, 1) * osg::Matrixd::translate(1, 2, 3);
+        osg::Matrixd c;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            c.invert(a);
+            doNotOptimize(c);
+        }
+        return 1.0;
+    });
+    // Eye matrices of 64 power wall cameras, with the four per eye calls per
+    // camera and with the batch call. Items are cameras.
+    const unsigned int cameras = 64;
+    std::vector<osg::Matrixd> views(cameras), projections(cameras);
+    for (unsigned int i = 0; i < cameras; ++i)
+    {
+        views[i] = osg::Matrixd::rotate(i * 0.1, 0, 0, 1) * osg::Matrixd::translate(i, 0, -10);
+        projections[i] = osg::Matrixd::perspective(40.0 + i % 8, 16.0 / 9.0, 1.0, 1000.0);
+    }
+    osg::ref_ptr<osg::DisplaySettings> wall = new osg::DisplaySettings;
+    wall->setStereo(true);
+    wall->setStereoMode(osg::DisplaySettings::QUAD_BUFFER);
+    wall->setDisplayType(osg::DisplaySettings::POWERWALL);
+    runner.run("eye_matrices_64_cameras_per_eye", [wall, &views, &projections, cameras](uint64_t iterations) {
+        std::vector<osg::DisplaySettings::EyeMatrices> eyes(cameras);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int j = 0; j < cameras; ++j)
+            {
+                eyes[j].leftView = wall->computeLeftEyeViewImplementation(views[j]);
+                eyes[j].rightView = wall->computeRightEyeViewImplementation(views[j]);
+                eyes[j].leftProjection = wall->computeLeftEyeProjectionImplementation(projections[j]);
+                eyes[j].rightProjection = wall->computeRightEyeProjectionImplementation(projections[j]);
+            }
+            doNotOptimize(eyes.data());
+        }
+        return double(cameras);
+    });
+    runner.run("eye_matrices_64_cameras_batch", [wall, &views, &projections, cameras](uint64_t iterations) {
+        std::vector<osg::DisplaySettings::EyeMatrices> eyes(cameras);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            wall->computeEyeMatrices(cameras, views.data(), projections.data(), eyes.data());
+            doNotOptimize(eyes.data());
+        }
+        return double(cameras);
+    });
+    runner.run("quat_slerp", [](uint64_t iterations) {
+        osg::Quat from(0.5, osg::Vec3d(0, 0, 1));
+        osg::Quat to(2.0, osg::Vec3d(0, 1, 0));
+        osg::Quat q;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            q.slerp((i & 1023) / 1023.0, from, to);
+            doNotOptimize(q);
+        }
+        return 1.0;
+    });
+    runner.run("ascii_to_double", [](uint64_t iterations) {
+        const char *numbers[] = { "12345.678e-3", "-0.5", "3.14159265358979", "1e10" };
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            double value = osg::asciiToDouble(numbers[i & 3]);
+            doNotOptimize(value);
+        }
+        return 1.0;
+    });
+}
+
+void referencedBenchmarks(Runner &runner)
+{
+    runner.run("ref_ptr_copy_unref", [](uint64_t iterations) {
+        osg::ref_ptr<osg::Referenced> object = new osg::Referenced(true);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            osg::ref_ptr<osg::Referenced> copy(object);
+            doNotOptimize(copy);
+        }
+        return 1.0;
+    });
+    runner.run("observer_set_add_ref_lock", [](uint64_t iterations) {
+        osg::ref_ptr<osg::Referenced> object = new osg::Referenced(true);
+        osg::ObserverSet *observers = object->getOrCreateObserverSet();
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            osg::Referenced *locked = observers->addRefLock();
+            doNotOptimize(locked);
+            locked->unref_nodelete();
+        }
+        return 1.0;
+    });
+    // The same counter with full barriers and with the orders Referenced
+    // uses. On x86 only the loads differ, weakly ordered CPUs such as ARM
+    // gain on every operation.
+    runner.run("atomic_ref_unref_seq_cst", [](uint64_t iterations) {
+        OpenThreads::Atomic count(1);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            ++count;
+            doNotOptimize(--count);
+        }
+        return 1.0;
+    });
+    runner.run("atomic_ref_unref_relaxed_acq_rel", [](uint64_t iterations) {
+        OpenThreads::Atomic count(1);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            count.increment(std::memory_order_relaxed);
+            doNotOptimize(count.decrement(std::memory_order_acq_rel));
+        }
+        return 1.0;
+    });
+    runner.run("observer_set_get", [](uint64_t iterations) {
+        osg::ref_ptr<osg::Referenced> object = new osg::Referenced(true);
+        object->getOrCreateObserverSet();
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            doNotOptimize(object->getObserverSet());
+        }
+        return 1.0;
+    });
+    // Every thread shares one object, as scene graph nodes are shared
+    // between cull threads.
+    runner.run("ref_ptr_copy_unref_4_threads", [](uint64_t iterations) {
+        const unsigned int numThreads = 4;
+        osg::ref_ptr<osg::Referenced> object = new osg::Referenced(true);
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < numThreads; ++t)
+        {
+            threads.push_back(std::thread([&] {
+                for (uint64_t i = 0; i < iterations; ++i)
+                {
+                    osg::ref_ptr<osg::Referenced> copy(object);
+                    doNotOptimize(copy);
+                }
+            }));
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        return double(numThreads);
+    });
+}
+
+void threadingBenchmarks(Runner &runner)
+{
+    runner.run("operation_queue_add_get", [](uint64_t iterations) {
+        struct NoOperation : public osg::Operation
+        {
+            NoOperation() : osg::Operation("NoOperation", false) { }
+            virtual void operator()(osg::Object *) { }
+        };
+        osg::ref_ptr<osg::OperationQueue> queue = new osg::OperationQueue;
+        osg::ref_ptr<osg::Operation> operation = new NoOperation;
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            queue->add(operation.get());
+            osg::ref_ptr<osg::Operation> next = queue->getNextOperation();
+            doNotOptimize(next);
+        }
+        return 1.0;
+    });
+    // Round trips hand control to another thread and back.
+    runner.run("block_round_trip", [](uint64_t iterations) {
+        OpenThreads::Block ping;
+        OpenThreads::Block pong;
+        std::thread partner([&] {
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                ping.block();
+                ping.reset();
+                pong.release();
+            }
+        });
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            ping.release();
+            pong.block();
+            pong.reset();
+        }
+        partner.join();
+        return 1.0;
+    });
+    runner.run("block_count_round_trip", [](uint64_t iterations) {
+        const unsigned int workers = 4;
+        OpenThreads::BlockCount done(workers);
+        OpenThreads::Barrier start(workers + 1);
+        std::vector<std::thread> threads;
+        for (unsigned int w = 0; w < workers; ++w)
+        {
+            threads.push_back(std::thread([&] {
+                for (uint64_t i = 0; i < iterations; ++i)
+                {
+                    start.block();
+                    done.completed();
+                }
+            }));
+        }
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            done.reset();
+            start.block();
+            done.block();
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        return 1.0;
+    });
+    runner.run("barrier_round_trip", [](uint64_t iterations) {
+        OpenThreads::Barrier barrier(2);
+        std::thread partner([&] {
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                barrier.block();
+            }
+        });
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            barrier.block();
+        }
+        partner.join();
+        return 1.0;
+    });
+    // Spin-then-park against park-only barriers, as wide as a frame's
+    // worker threads go.
+    for (unsigned int numThreads : {2u, 4u, 8u, 16u})
+    {
+        for (bool spin : {true, false})
+        {
+            std::string name =
+                "barrier_round_trip_" + std::to_string(numThreads) +
+                "_threads_" + (spin ? "spin" : "park");
+            runner.run(name, [numThreads, spin](uint64_t iterations) {
+                OpenThreads::Barrier barrier(numThreads);
+                if (!spin)
+                {
+                    barrier.setSpinCount(0);
+                }
+                std::vector<std::thread> threads;
+                for (unsigned int t = 1; t < numThreads; ++t)
+                {
+                    threads.push_back(std::thread([&] {
+                        for (uint64_t i = 0; i < iterations; ++i)
+                        {
+                            barrier.block();
+                        }
+                    }));
+                }
+                for (uint64_t i = 0; i < iterations; ++i)
+                {
+                    barrier.block();
+                }
+                for (auto &thread : threads)
+                {
+                    thread.join();
+                }
+                return 1.0;
+            });
+        }
+    }
+    // Lookups of every thread contend on the same DisplaySettings.
+    runner.run("display_settings_get_value_16_threads", [](uint64_t iterations) {
+        const unsigned int numThreads = 16;
+        osg::DisplaySettings *ds = osg::DisplaySettings::instance().get();
+        ds->setValue("bench", "1");
+        std::vector<std::thread> threads;
+        for (unsigned int t = 0; t < numThreads; ++t)
+        {
+            threads.push_back(std::thread([&] {
+                std::string value;
+                for (uint64_t i = 0; i < iterations; ++i)
+                {
+                    ds->getValue("bench", value);
+                    doNotOptimize(value);
+                }
+            }));
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        return double(numThreads);
+    });
+}
+
+//! Set the built in matrices of a draw as uniforms at locations 0 to 3,
+//! the way UniformBufferRing::writeMatrices() packs them: four glUniform
+//! calls.
+void setMatrixUniforms(osg::State &state, const osg::Matrixd &modelView, const osg::Matrixd &projection)
+{
+    GLfloat values[16];
+    osg::Matrixd matrices[3] = { modelView, projection, modelView * projection };
+    for (unsigned int m = 0; m < 3; ++m)
+    {
+        for (unsigned int k = 0; k < 16; ++k)
+        {
+            values[k] = static_cast<GLfloat>(matrices[m].ptr()[k]);
+        }
+        state.glUniformMatrix4fv(m, 1, GL_FALSE, values);
+    }
+    osg::Matrixd rotation = modelView;
+    rotation.setTrans(0.0, 0.0, 0.0);
+    osg::Matrixd inverse = osg::Matrixd::inverse(rotation);
+    for (unsigned int k = 0; k < 9; ++k)
+    {
+        values[k] = static_cast<GLfloat>(inverse(k % 3, k / 3));
+    }
+    state.glUniformMatrix3fv(3, 1, GL_FALSE, values);
+}
+
+void stateBenchmarks(Runner &runner)
+{
+    osg::ref_ptr<osg::GraphicsContext> gc =
+        render::createHeadlessGraphicsContext(800, 600);
+    if (!gc.valid() || !gc->realize() || !gc->makeCurrent())
+    {
+        std::cerr << "Could not create headless context, skipping State benchmarks" << std::endl;
+        return;
+    }
+    osg::State *state = gc->getState();
+    state->initializeExtensionProcs();
+
+    runner.run("state_push_pop_state_set", [state](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            state->pushStateSet(0);
+            state->popStateSet();
+        }
+        return 1.0;
+    });
+    // CPU cost of the draw thread for 1M quads drawn as triangles.
+    const unsigned int quads = 1000000;
+    runner.run("draw_quads_1m", [state, quads](uint64_t iterations) {
+        state->setUseQuadElementBufferObjects(false);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            state->drawQuads(0, quads * 4);
+        }
+        return double(quads);
+    });
+    runner.run("draw_quads_1m_ebo", [state, quads](uint64_t iterations) {
+        state->setUseQuadElementBufferObjects(true);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            state->drawQuads(0, quads * 4);
+        }
+        state->setUseQuadElementBufferObjects(false);
+        return double(quads);
+    });
+    // Replay cost per recorded command, items are commands.
+    runner.run("command_buffer_replay", [state](uint64_t iterations) {
+        osg::ref_ptr<osg::CommandBuffer> buffer = new osg::CommandBuffer;
+        for (unsigned int i = 0; i < 1000; ++i)
+        {
+            buffer->viewport(0, 0, 800 + (i & 1), 600);
+            buffer->vertexAttrib(3, (i & 7) / 7.0f, 0, 0, 1);
+            buffer->drawArrays(GL_TRIANGLES, 0, 36);
+        }
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            buffer->replay(*state);
+        }
+        return double(buffer->getNumCommands());
+    });
+    // Per draw CPU cost of 10k indexed draws, one by one and batched into
+    // glMultiDrawElementsIndirect commands. Items are draws.
+    const unsigned int indexedDraws = 10000;
+    runner.run("draw_elements_10k_direct", [state, indexedDraws](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int j = 0; j < indexedDraws; ++j)
+            {
+                const GLvoid *indices = reinterpret_cast<const GLvoid *>(size_t(j % 64) * 36 * 4);
+                state->glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, indices, 1);
+            }
+        }
+        return double(indexedDraws);
+    });
+    runner.run("draw_elements_10k_indirect", [state, indexedDraws](uint64_t iterations) {
+        osg::ref_ptr<osg::IndirectDrawBatcher> batcher = new osg::IndirectDrawBatcher(indexedDraws);
+        batcher->setFenceInterface(new osg::RecordingFences);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int j = 0; j < indexedDraws; ++j)
+            {
+                batcher->add(0, 0, GL_TRIANGLES, GL_UNSIGNED_INT, 36, (j % 64) * 36);
+            }
+            batcher->draw(*state);
+        }
+        batcher->releaseGLObjects(*state);
+        return double(indexedDraws);
+    });
+    // Per draw cost of the built in matrices of 10k draws, set as four
+    // glUniform calls and packed into the uniform buffer ring with one range
+    // bind. Both compute the same matrices. Items are draws.
+    runner.run("uniform_matrices_10k_gluniform", [state, indexedDraws](uint64_t iterations) {
+        osg::Matrixd projection = osg::Matrixd::perspective(60.0, 4.0 / 3.0, 1.0, 1000.0);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int j = 0; j < indexedDraws; ++j)
+            {
+                setMatrixUniforms(*state, osg::Matrixd::translate(j % 100, j / 100, -50.0), projection);
+                state->glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, 1);
+            }
+        }
+        return double(indexedDraws);
+    });
+    runner.run("uniform_matrices_10k_ring", [state, indexedDraws](uint64_t iterations) {
+        osg::ref_ptr<osg::UniformBufferRing> ring = new osg::UniformBufferRing(0, 4 << 20);
+        ring->setFenceInterface(new osg::RecordingFences);
+        osg::Matrixd projection = osg::Matrixd::perspective(60.0, 4.0 / 3.0, 1.0, 1000.0);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            ring->beginFrame(*state);
+            for (unsigned int j = 0; j < indexedDraws; ++j)
+            {
+                osg::Matrixd modelView = osg::Matrixd::translate(j % 100, j / 100, -50.0);
+                GLintptr offset = ring->writeMatrices(modelView, projection);
+                ring->bind(*state, offset, osg::UniformBufferRing::getMatricesBlockSize());
+                state->glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0, 1);
+            }
+            ring->endFrame(*state);
+        }
+        ring->releaseGLObjects(*state);
+        return double(indexedDraws);
+    });
+    // Per mesh cost of streaming 10k dynamic meshes of 24 vertices and 36
+    // indices, each uploaded into its own buffer with glBufferData and
+    // sub-allocated from the streaming ring. Items are meshes.
+    const unsigned int dynamicMeshes = 10000;
+    runner.run("stream_meshes_10k_buffer_data", [state, dynamicMeshes](uint64_t iterations) {
+        std::vector<GLfloat> vertices(24 * 3, 1.0f);
+        std::vector<GLushort> indices(36, 0);
+        GLuint buffers[2];
+        state->glGenBuffers(2, buffers);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int j = 0; j < dynamicMeshes; ++j)
+            {
+                state->glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+                state->glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), &vertices[0], GL_STREAM_DRAW);
+                state->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[1]);
+                state->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STREAM_DRAW);
+                state->glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, 0, 1);
+            }
+        }
+        state->glDeleteBuffers(2, buffers);
+        return double(dynamicMeshes);
+    });
+    runner.run("stream_meshes_10k_ring", [state, dynamicMeshes](uint64_t iterations) {
+        osg::ref_ptr<osg::StreamingBufferRing> ring = new osg::StreamingBufferRing(4 << 20);
+        ring->setFenceInterface(new osg::RecordingFences);
+        std::vector<GLfloat> vertices(24 * 3, 1.0f);
+        std::vector<GLushort> indices(36, 0);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            ring->beginFrame(*state);
+            state->glBindBuffer(GL_ARRAY_BUFFER, ring->getBuffer());
+            state->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ring->getBuffer());
+            for (unsigned int j = 0; j < dynamicMeshes; ++j)
+            {
+                GLintptr vertexOffset, indexOffset;
+                unsigned char *data = ring->allocate(vertices.size() * sizeof(GLfloat), osg::StreamingBufferRing::VERTEX_DATA, vertexOffset);
+                if (data) memcpy(data, &vertices[0], vertices.size() * sizeof(GLfloat));
+                data = ring->allocate(indices.size() * sizeof(GLushort), osg::StreamingBufferRing::INDEX_DATA, indexOffset);
+                if (data) memcpy(data, &indices[0], indices.size() * sizeof(GLushort));
+                doNotOptimize(vertexOffset);
+                state->glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_SHORT, reinterpret_cast<const GLvoid *>(indexOffset), 1);
+            }
+            ring->endFrame(*state);
+        }
+        ring->releaseGLObjects(*state);
+        return double(dynamicMeshes);
+    });
+    // Per object cost of rendering 10k objects in stereo, culled and drawn
+    // once per eye, and culled once against the frustum enclosing both eyes
+    // and drawn once with an instance per eye. Items are objects.
+    const unsigned int stereoObjects = 10000;
+    osg::ref_ptr<osg::DisplaySettings> stereoSettings = new osg::DisplaySettings;
+    stereoSettings->setStereo(true);
+    stereoSettings->setStereoMode(osg::DisplaySettings::HORIZONTAL_SPLIT);
+    stereoSettings->setDisplayType(osg::DisplaySettings::HEAD_MOUNTED_DISPLAY);
+    osg::ref_ptr<osg::InstancedStereo> stereo = new osg::InstancedStereo;
+    stereo->update(
+        stereoSettings.get(),
+        osg::Matrixd::lookAt(osg::Vec3d(50.0, -40.0, 60.0), osg::Vec3d(50.0, 30.0, 0.0), osg::Vec3d(0.0, 0.0, 1.0)),
+        osg::Matrixd::perspective(60.0, 16.0 / 9.0, 1.0, 500.0),
+        0, 0, 1280, 720
+    );
+    runner.run("stereo_10k_two_pass", [state, stereo, stereoObjects](uint64_t iterations) {
+        osg::Vec4d planes[osg::InstancedStereo::NUM_EYES][6];
+        for (unsigned int eye = 0; eye < osg::InstancedStereo::NUM_EYES; ++eye)
+        {
+            auto e = static_cast<osg::InstancedStereo::Eye>(eye);
+            osg::InstancedStereo::computeFrustumPlanes(stereo->getEyeViewMatrix(e) * stereo->getEyeProjectionMatrix(e), planes[eye]);
+        }
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int eye = 0; eye < osg::InstancedStereo::NUM_EYES; ++eye)
+            {
+                const osg::Vec4f &viewport = stereo->getEyeViewport(static_cast<osg::InstancedStereo::Eye>(eye));
+                state->glViewport(GLint(viewport[0]), GLint(viewport[1]), GLsizei(viewport[2]), GLsizei(viewport[3]));
+                for (unsigned int j = 0; j < stereoObjects; ++j)
+                {
+                    osg::Vec3d center(j % 100, j / 100, 0.0);
+                    if (osg::InstancedStereo::contains(planes[eye], center, 0.87))
+                    {
+                        state->glDrawArraysInstanced(GL_TRIANGLES, 0, 36, 1);
+                    }
+                }
+            }
+        }
+        return double(stereoObjects);
+    });
+    runner.run("stereo_10k_instanced", [state, stereo, stereoObjects](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            stereo->apply(*state);
+            for (unsigned int j = 0; j < stereoObjects; ++j)
+            {
+                osg::Vec3d center(j % 100, j / 100, 0.0);
+                if (stereo->contains(center, 0.87))
+                {
+                    stereo->drawArrays(*state, GL_TRIANGLES, 0, 36);
+                }
+            }
+            stereo->restore(*state);
+        }
+        return double(stereoObjects);
+    });
+    // Overhead of the compile service per object against the simulated
+    // driver, 2ms slices of buffers costing 50us to 450us on the fake clock.
+    runner.run("compile_service_slices", [gc](uint64_t iterations) {
+        const unsigned int objects = 256;
+        osg::ref_ptr<osg::RecordingFences> fences = new osg::RecordingFences;
+        osg::ref_ptr<osg::CompileService> service = new osg::CompileService(gc.get());
+        service->setFenceInterface(fences.get());
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            osg::ref_ptr<osg::CompileService::CompileSet> set = new osg::CompileService::CompileSet;
+            for (unsigned int j = 0; j < objects; ++j)
+            {
+                size_t size = 65536 * (1 + j % 8);
+                set->add(new osg::RecordingCompileObject(
+                    fences.get(),
+                    osg::GLObjectCompileCostModel::BUFFER_OBJECT,
+                    size,
+                    size * 0.75e-9
+                ));
+            }
+            service->add(set.get());
+            while (!set->isReady())
+            {
+                service->compile(gc.get());
+                service->checkReady(gc.get());
+            }
+        }
+        return double(objects);
+    });
+
+    gc->releaseContext();
+    gc->close();
+}
+
+//! RecordingFences reporting fences as unsupported, which sends the rings
+//! down their streamed paths.
+class UnsupportedFences : public osg::RecordingFences
+{
+    public:
+        virtual bool valid(osg::GraphicsContext *) const { return false; }
+};
+
+//! State of a driver without multi draw indirect, and optionally without
+//! base vertex and base instance draws, which sends the batcher down its
+//! draw by draw fallbacks.
+class FallbackState : public osg::State
+{
+    public:
+        FallbackState(osg::GraphicsContext *gc, bool baseInstance)
+        {
+            this->setGraphicsContext(gc);
+            this->setContextID(gc->getState()->getContextID());
+            this->initializeExtensionProcs();
+            this->_glMultiDrawElementsIndirect = 0;
+            if (!baseInstance)
+            {
+                this->_glDrawElementsInstancedBaseVertexBaseInstance = 0;
+            }
+        }
+};
+
+//! Flush driven by a clock of its own, the frames take as long as the
+//! check says they do.
+class ManualClockFlush : public osg::FlushDeletedGLObjectsOperation
+{
+    public:
+        ManualClockFlush(double availableTime) :
+            osg::FlushDeletedGLObjectsOperation(availableTime, true)
+        { }
+
+        void advance(double seconds) { this->now += seconds; }
+
+    protected:
+        virtual double time() const { return this->now; }
+
+    private:
+        double now = 0.0;
+};
+
+void stateChecks(Checker &checker)
+{
+    osg::ref_ptr<osg::GraphicsContext> gc =
+        render::createHeadlessGraphicsContext(800, 600);
+    if (!gc.valid() || !gc->realize() || !gc->makeCurrent())
+    {
+        std::cerr << "Could not create headless context, skipping State checks" << std::endl;
+        return;
+    }
+    osg::State *state = gc->getState();
+    state->initializeExtensionProcs();
+    osg::GLRecorder *recorder = osg::GLRecorder::getCurrent();
+
+    // glMultiDrawElementsIndirect must read the added commands byte for
+    // byte, as the regions wrap around and when a frame outgrows them.
+    checker.run("indirect_draw_commands", [&checker, state, recorder]() {
+        typedef osg::IndirectDrawBatcher::DrawElementsIndirectCommand Command;
+        osg::ref_ptr<osg::RecordingFences> fences = new osg::RecordingFences;
+        fences->setGPUFrameTime(0.010);
+        osg::ref_ptr<osg::IndirectDrawBatcher> batcher = new osg::IndirectDrawBatcher(64, 3);
+        batcher->setFenceInterface(fences.get());
+        for (unsigned int frame = 0; frame < 8; ++frame)
+        {
+            unsigned int draws = frame == 5 ? 200 : 50 + frame;
+            for (unsigned int j = 0; j < draws; ++j)
+            {
+                // A batch per 16 draws.
+                GLenum mode = (j / 16) % 2 ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+                batcher->add(0, 0, mode, GL_UNSIGNED_INT, 36 + j % 5, j * 36, GLint(j) - 7, 1 + j % 3, frame * 1000 + j);
+            }
+            std::vector<Command> expected = batcher->getCommands();
+            unsigned int batches = static_cast<unsigned int>(batcher->getBatches().size());
+            recorder->reset();
+            batcher->draw(*state);
+            fences->advance(0.004);
+
+            const std::vector<unsigned char> &commands = recorder->getIndirectCommands();
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::MULTI_DRAW_ELEMENTS_INDIRECT) == batches);
+            BENCH_EXPECT(checker, commands.size() == expected.size() * sizeof(Command));
+            BENCH_EXPECT(checker,
+                commands.size() == expected.size() * sizeof(Command) &&
+                std::memcmp(commands.data(), expected.data(), commands.size()) == 0
+            );
+        }
+        BENCH_EXPECT(checker, batcher->isPersistentlyMapped());
+        BENCH_EXPECT(checker, batcher->getMaxCommands() >= 200);
+        BENCH_EXPECT(checker, batcher->getStats().numFenceWaits > 0);
+        BENCH_EXPECT(checker, batcher->getStats().numFenceTimeouts == 0);
+        batcher->releaseGLObjects(*state);
+
+        // Draws with a base vertex or base instance on every fourth draw.
+        auto addDraws = [](osg::IndirectDrawBatcher *batcher, unsigned int draws) {
+            for (unsigned int j = 0; j < draws; ++j)
+            {
+                GLenum mode = (j / 16) % 2 ? GL_TRIANGLE_STRIP : GL_TRIANGLES;
+                bool based = j % 4 != 0;
+                batcher->add(0, 0, mode, GL_UNSIGNED_SHORT, 36, j * 36, based ? GLint(j) : 0, 1 + j % 3, based ? j : 0);
+            }
+        };
+
+        // A GPU slower than the timeout: the region is orphaned rather than
+        // rewritten and the commands still reach glMultiDrawElementsIndirect.
+        fences->setGPUFrameTime(2.0);
+        batcher->resetStats();
+        // The fourth and seventh frames find their region's fence unsignalled.
+        for (unsigned int frame = 0; frame < 7; ++frame)
+        {
+            addDraws(batcher.get(), 40);
+            std::vector<Command> expected = batcher->getCommands();
+            recorder->reset();
+            batcher->draw(*state);
+            const std::vector<unsigned char> &commands = recorder->getIndirectCommands();
+            BENCH_EXPECT(checker,
+                commands.size() == expected.size() * sizeof(Command) &&
+                std::memcmp(commands.data(), expected.data(), commands.size()) == 0
+            );
+        }
+        BENCH_EXPECT(checker, batcher->getStats().numFenceTimeouts == 2);
+        BENCH_EXPECT(checker, batcher->isPersistentlyMapped());
+        batcher->releaseGLObjects(*state);
+
+        // Without fences the commands are streamed into an orphaned buffer
+        // each frame.
+        osg::ref_ptr<osg::IndirectDrawBatcher> streamed = new osg::IndirectDrawBatcher(64, 3);
+        streamed->setFenceInterface(new UnsupportedFences);
+        for (unsigned int frame = 0; frame < 3; ++frame)
+        {
+            addDraws(streamed.get(), 50);
+            std::vector<Command> expected = streamed->getCommands();
+            unsigned int batches = static_cast<unsigned int>(streamed->getBatches().size());
+            recorder->reset();
+            streamed->draw(*state);
+            const std::vector<unsigned char> &commands = recorder->getIndirectCommands();
+            BENCH_EXPECT(checker, !streamed->isPersistentlyMapped());
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::MULTI_DRAW_ELEMENTS_INDIRECT) == batches);
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::BUFFER_SUB_DATA) == 1);
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::FENCE_SYNC) == 0);
+            BENCH_EXPECT(checker,
+                commands.size() == expected.size() * sizeof(Command) &&
+                std::memcmp(commands.data(), expected.data(), commands.size()) == 0
+            );
+        }
+        BENCH_EXPECT(checker, streamed->getStats().bytesStreamed == 3 * 50 * sizeof(Command));
+        streamed->releaseGLObjects(*state);
+
+        // Without multi draw indirect the draws go one by one, and without
+        // base instance draws either those with offsets are skipped.
+        for (bool baseInstance : {true, false})
+        {
+            osg::ref_ptr<FallbackState> fallback = new FallbackState(state->getGraphicsContext(), baseInstance);
+            osg::ref_ptr<osg::IndirectDrawBatcher> unbatched = new osg::IndirectDrawBatcher(64, 3);
+            unbatched->setFenceInterface(fences.get());
+            addDraws(unbatched.get(), 100);
+            recorder->reset();
+            unbatched->draw(*fallback);
+            const osg::IndirectDrawBatcher::Stats &stats = unbatched->getStats();
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::MULTI_DRAW_ELEMENTS_INDIRECT) == 0);
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::GEN_BUFFERS) == 0);
+            BENCH_EXPECT(checker, stats.numDraws == 100);
+            if (baseInstance)
+            {
+                BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::DRAW_ELEMENTS_INSTANCED_BASE_VERTEX_BASE_INSTANCE) == 100);
+                BENCH_EXPECT(checker, stats.numDrawCalls == 100 && stats.numDrawsSkipped == 0);
+            }
+            else
+            {
+                BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::DRAW_ELEMENTS_INSTANCED) == 25);
+                BENCH_EXPECT(checker, stats.numDrawCalls == 25 && stats.numDrawsSkipped == 75);
+            }
+            unbatched->releaseGLObjects(*fallback);
+        }
+    });
+    // writeMatrices() lays the matrices out as std140 expects them, the mat3
+    // columns padded to vec4s, and a draw binds one buffer range where the
+    // plain path sets four uniforms. Rebinding the bound slice is elided.
+    checker.run("uniform_buffer_matrices", [&checker, state, recorder]() {
+        const unsigned int draws = 16;
+        const osg::Matrixd projection = osg::Matrixd::perspective(60.0, 4.0 / 3.0, 1.0, 1000.0);
+        std::vector<osg::Matrixd> modelViews;
+        for (unsigned int j = 0; j < draws; ++j)
+        {
+            modelViews.push_back(
+                osg::Matrixd::scale(1.0 + j, 1.0, 0.5) *
+                osg::Matrixd::rotate(j * 0.3, osg::Vec3d(1.0, 1.0, 0.0)) *
+                osg::Matrixd::translate(j, -2.0 * j, -50.0)
+            );
+        }
+
+        recorder->reset();
+        for (unsigned int j = 0; j < draws; ++j)
+        {
+            setMatrixUniforms(*state, modelViews[j], projection);
+        }
+        BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::UNIFORM) == 4 * draws);
+        BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::BIND_BUFFER_RANGE) == 0);
+
+        osg::ref_ptr<osg::UniformBufferRing> ring = new osg::UniformBufferRing(0, 64 << 10);
+        ring->setFenceInterface(new osg::RecordingFences);
+        const unsigned int blockSize = osg::UniformBufferRing::getMatricesBlockSize();
+        BENCH_EXPECT(checker, blockSize == 240);
+        recorder->reset();
+        ring->beginFrame(*state);
+        for (unsigned int j = 0; j < draws; ++j)
+        {
+            const osg::Matrixd &modelView = modelViews[j];
+            GLintptr offset = ring->writeMatrices(modelView, projection);
+            BENCH_EXPECT(checker, offset >= 0 && offset % 16 == 0);
+            ring->bind(*state, offset, blockSize);
+            ring->bind(*state, offset, blockSize);
+            const unsigned char *bytes = recorder->getBufferData(ring->getStreamingBufferRing()->getBuffer(), offset, blockSize);
+            BENCH_EXPECT(checker, bytes != nullptr);
+            if (!bytes || offset < 0)
+            {
+                continue;
+            }
+
+            // The three mat4s column after column, as ptr() lists them.
+            std::vector<float> expected;
+            osg::Matrixd matrices[3] = { modelView, projection, modelView * projection };
+            for (auto &matrix : matrices)
+            {
+                expected.insert(expected.end(), matrix.ptr(), matrix.ptr() + 16);
+            }
+            // The normal matrix is the inverse transpose of the upper 3x3,
+            // each of its columns padded to a vec4.
+            osg::Matrixd rotation = modelView;
+            rotation.setTrans(0.0, 0.0, 0.0);
+            osg::Matrixd normal = osg::Matrixd::inverse(rotation);
+            for (unsigned int c = 0; c < 3; ++c)
+            {
+                expected.push_back(float(normal(0, c)));
+                expected.push_back(float(normal(1, c)));
+                expected.push_back(float(normal(2, c)));
+                expected.push_back(0.0f);
+            }
+            BENCH_EXPECT(checker, expected.size() * sizeof(float) == blockSize);
+            BENCH_EXPECT(checker, std::memcmp(bytes, expected.data(), blockSize) == 0);
+        }
+        ring->endFrame(*state);
+        BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::UNIFORM) == 0);
+        BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::BIND_BUFFER_RANGE) == draws);
+        BENCH_EXPECT(checker, ring->getStats().numBinds == draws);
+        BENCH_EXPECT(checker, ring->getStats().numBindsElided == draws);
+        ring->releaseGLObjects(*state);
+    });
+    // Frames wrap around the regions, wait on a GPU slower than the CPU,
+    // grow the regions after an overflow and orphan the buffer when the GPU
+    // doesn't release a region. Regions stay 256 byte aligned. Without
+    // fences every frame orphans the buffer and flush() uploads what was
+    // written.
+    checker.run("streaming_buffer_ring", [&checker, state, recorder]() {
+        const unsigned int regionSize = 4096;
+        osg::ref_ptr<osg::RecordingFences> fences = new osg::RecordingFences;
+        fences->setGPUFrameTime(0.010);
+        osg::ref_ptr<osg::StreamingBufferRing> ring = new osg::StreamingBufferRing(regionSize, 3);
+        ring->setFenceInterface(fences.get());
+        GLintptr offset;
+        for (unsigned int frame = 0; frame < 6; ++frame)
+        {
+            ring->beginFrame(*state);
+            unsigned char *data = ring->allocate(1000, osg::StreamingBufferRing::VERTEX_DATA, offset);
+            BENCH_EXPECT(checker, data != 0);
+            BENCH_EXPECT(checker, offset == GLintptr(regionSize * (frame % 3)));
+            BENCH_EXPECT(checker, data == recorder->getBufferData(ring->getBuffer(), size_t(offset), 1000));
+            ring->endFrame(*state);
+            fences->advance(0.004);
+        }
+        BENCH_EXPECT(checker, ring->isPersistentlyMapped());
+        BENCH_EXPECT(checker, ring->getStats().numFenceWaits > 0);
+
+        for (unsigned int frame = 0; frame < 2; ++frame)
+        {
+            ring->beginFrame(*state);
+            unsigned int allocated = 0;
+            for (unsigned int i = 0; i < 12; ++i)
+            {
+                allocated += ring->allocate(1024, osg::StreamingBufferRing::VERTEX_DATA, offset) ? 1 : 0;
+            }
+            BENCH_EXPECT(checker, allocated == (frame == 0 ? 4u : 12u));
+            ring->endFrame(*state);
+            fences->advance(0.004);
+        }
+        BENCH_EXPECT(checker, ring->getStats().numOverflows == 1);
+        BENCH_EXPECT(checker, ring->getRegionSize() == 4 * regionSize);
+
+        // Longer than the second the ring waits for.
+        fences->setGPUFrameTime(2.5);
+        GLuint buffer = ring->getBuffer();
+        for (unsigned int frame = 0; frame < 4; ++frame)
+        {
+            ring->beginFrame(*state);
+            BENCH_EXPECT(checker, ring->allocate(100, osg::StreamingBufferRing::VERTEX_DATA, offset) != 0);
+            ring->endFrame(*state);
+            fences->advance(0.004);
+        }
+        BENCH_EXPECT(checker, ring->getStats().numFenceTimeouts == 1);
+        BENCH_EXPECT(checker, ring->getBuffer() != buffer);
+        ring->releaseGLObjects(*state);
+
+        // A region size that isn't a multiple of 256 is rounded up, so the
+        // offsets in every region keep their alignment.
+        osg::ref_ptr<osg::StreamingBufferRing> unaligned = new osg::StreamingBufferRing(1000, 3);
+        unaligned->setFenceInterface(fences.get());
+        fences->setGPUFrameTime(0.010);
+        BENCH_EXPECT(checker, unaligned->getRegionSize() == 1024);
+        for (unsigned int frame = 0; frame < 3; ++frame)
+        {
+            unaligned->beginFrame(*state);
+            BENCH_EXPECT(checker, unaligned->allocate(100, osg::StreamingBufferRing::INDEX_DATA, offset) != 0);
+            BENCH_EXPECT(checker, unaligned->allocate(100, osg::StreamingBufferRing::VERTEX_DATA, offset) != 0);
+            BENCH_EXPECT(checker, offset % 16 == 0);
+            BENCH_EXPECT(checker, unaligned->allocate(100, osg::StreamingBufferRing::UNIFORM_DATA, offset) != 0);
+            BENCH_EXPECT(checker, offset % 256 == 0 && offset >= GLintptr(1024 * frame));
+            unaligned->endFrame(*state);
+            fences->advance(0.016);
+        }
+        unaligned->releaseGLObjects(*state);
+
+        osg::ref_ptr<osg::StreamingBufferRing> streamed = new osg::StreamingBufferRing(regionSize, 3);
+        streamed->setFenceInterface(new UnsupportedFences);
+        for (unsigned int frame = 0; frame < 3; ++frame)
+        {
+            recorder->reset();
+            streamed->beginFrame(*state);
+            unsigned char *data = streamed->allocate(1000, osg::StreamingBufferRing::VERTEX_DATA, offset);
+            BENCH_EXPECT(checker, data != 0 && offset == 0);
+            if (data)
+            {
+                std::memset(data, frame + 1, 1000);
+            }
+            streamed->flush(*state);
+            const unsigned char *contents = recorder->getBufferData(streamed->getBuffer(), 0, 1000);
+            BENCH_EXPECT(checker, contents && contents[0] == frame + 1 && contents[999] == frame + 1);
+            // The first frame also allocates the buffer.
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::BUFFER_DATA) == (frame == 0 ? 2u : 1u));
+            BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::BUFFER_SUB_DATA) == 1);
+            streamed->endFrame(*state);
+        }
+        BENCH_EXPECT(checker, !streamed->isPersistentlyMapped());
+        streamed->releaseGLObjects(*state);
+    });
+    // Points inside either eye's frustum are inside the cull frustum, the
+    // corners of each eye's clip space land on the corners of its viewport
+    // and a pass sets the viewports once and draws each object once.
+    checker.run("instanced_stereo", [&checker, state, recorder]() {
+        typedef osg::InstancedStereo Stereo;
+        const osg::Matrixd view = osg::Matrixd::lookAt(osg::Vec3d(50.0, -40.0, 60.0), osg::Vec3d(50.0, 30.0, 0.0), osg::Vec3d(0.0, 0.0, 1.0));
+        const osg::Matrixd projection = osg::Matrixd::perspective(60.0, 16.0 / 9.0, 1.0, 500.0);
+        for (auto mode : {osg::DisplaySettings::HORIZONTAL_SPLIT, osg::DisplaySettings::VERTICAL_SPLIT})
+        {
+            osg::ref_ptr<osg::DisplaySettings> ds = new osg::DisplaySettings;
+            ds->setStereo(true);
+            ds->setStereoMode(mode);
+            ds->setDisplayType(osg::DisplaySettings::HEAD_MOUNTED_DISPLAY);
+            for (auto selection : {Stereo::VIEWPORT_INDEX, Stereo::CLIP_DISTANCES})
+            {
+                osg::ref_ptr<Stereo> stereo = new Stereo(selection);
+                BENCH_EXPECT(checker, stereo->update(ds.get(), view, projection, 16, 8, 1280, 720));
+                const osg::Vec4f &area = stereo->getUnionViewport();
+                BENCH_EXPECT(checker, area == osg::Vec4f(16, 8, 1280, 720));
+                for (unsigned int eye = 0; eye < Stereo::NUM_EYES; ++eye)
+                {
+                    auto e = static_cast<Stereo::Eye>(eye);
+                    osg::Matrixd clipToWorld = osg::Matrixd::inverse(stereo->getEyeViewMatrix(e) * stereo->getEyeProjectionMatrix(e));
+                    bool inside = true;
+                    for (unsigned int i = 0; i < 125; ++i)
+                    {
+                        osg::Vec3d clip(i % 5 * 0.45 - 0.9, i / 5 % 5 * 0.45 - 0.9, i / 25 * 0.45 - 0.9);
+                        inside = inside && stereo->contains(clip * clipToWorld, 0.0);
+                    }
+                    BENCH_EXPECT(checker, inside);
+
+                    // The clip transform takes the eye's clip space to the
+                    // union viewport, or is the identity with an array of
+                    // viewports.
+                    const osg::Vec4f &transform = stereo->getClipTransform(e);
+                    const osg::Vec4f &viewport = stereo->getEyeViewport(e);
+                    if (selection == Stereo::VIEWPORT_INDEX)
+                    {
+                        BENCH_EXPECT(checker, transform == osg::Vec4f(1.0f, 1.0f, 0.0f, 0.0f));
+                    }
+                    for (unsigned int corner = 0; corner < 4 && selection == Stereo::CLIP_DISTANCES; ++corner)
+                    {
+                        float x = corner & 1 ? 1.0f : -1.0f;
+                        float y = corner & 2 ? 1.0f : -1.0f;
+                        float windowX = area[0] + (x * transform[0] + transform[2] + 1.0f) * 0.5f * area[2];
+                        float windowY = area[1] + (y * transform[1] + transform[3] + 1.0f) * 0.5f * area[3];
+                        BENCH_EXPECT(checker, std::abs(windowX - (viewport[0] + (corner & 1 ? viewport[2] : 0.0f))) < 1e-3f);
+                        BENCH_EXPECT(checker, std::abs(windowY - (viewport[1] + (corner & 2 ? viewport[3] : 0.0f))) < 1e-3f);
+                    }
+                }
+                // Behind the eyes.
+                BENCH_EXPECT(checker, !stereo->contains(osg::Vec3d(50.0, -60.0, 80.0), 0.0));
+
+                state->dirtyGLShadowState();
+                recorder->reset();
+                stereo->apply(*state);
+                for (unsigned int j = 0; j < 100; ++j)
+                {
+                    stereo->drawArrays(*state, GL_TRIANGLES, 0, 36);
+                }
+                stereo->restore(*state);
+                bool indexed = selection == Stereo::VIEWPORT_INDEX;
+                BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::VIEWPORT_ARRAY) == (indexed ? 1u : 0u));
+                BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::VIEWPORT) == (indexed ? 0u : 1u));
+                BENCH_EXPECT(checker, recorder->getCount(osg::GLRecorder::DRAW_ARRAYS_INSTANCED) == 100);
+            }
+        }
+    });
+    // State elides the state setting calls that don't change its shadow of
+    // the GL state and counts them as hits, with the shadow dirtied before
+    // every draw each call reaches GL. GL ends up in the same state.
+    checker.run("gl_shadow_state_dedup", [&checker, state, recorder]() {
+        const unsigned int draws = 10;
+        const osg::State::GLShadowCall calls[] = {
+            osg::State::SHADOW_VIEWPORT,
+            osg::State::SHADOW_SCISSOR,
+            osg::State::SHADOW_CLEAR_COLOR,
+            osg::State::SHADOW_DRAW_BUFFER,
+            osg::State::SHADOW_VERTEX_ATTRIB,
+        };
+        const osg::GLRecorder::Call recorded[] = {
+            osg::GLRecorder::VIEWPORT,
+            osg::GLRecorder::SCISSOR,
+            osg::GLRecorder::CLEAR_COLOR,
+            osg::GLRecorder::DRAW_BUFFER,
+            osg::GLRecorder::VERTEX_ATTRIB,
+        };
+        // The viewport changes half way through, the rest never does.
+        const unsigned int changes[] = { 2, 1, 1, 1, 1 };
+        for (bool dedup : {true, false})
+        {
+            state->dirtyGLShadowState();
+            osg::State::GLShadowCount before[5];
+            for (unsigned int i = 0; i < 5; ++i)
+            {
+                before[i] = state->getGLShadowCount(calls[i]);
+            }
+            recorder->reset();
+            for (unsigned int draw = 0; draw < draws; ++draw)
+            {
+                if (!dedup)
+                {
+                    state->dirtyGLShadowState();
+                }
+                state->glViewport(0, 0, draw < draws / 2 ? 800 : 400, 600);
+                state->glScissor(0, 0, 800, 600);
+                state->glClearColor(0.1f, 0.2f, 0.3f, 1.0f);
+                state->glDrawBuffer(GL_BACK);
+                state->VerteAttrib(3, 1.0f, 0.5f, 0.25f, 1.0f);
+            }
+            for (unsigned int i = 0; i < 5; ++i)
+            {
+                const osg::State::GLShadowCount &count = state->getGLShadowCount(calls[i]);
+                unsigned int misses = dedup ? changes[i] : draws;
+                BENCH_EXPECT(checker, recorder->getCount(recorded[i]) == misses);
+                BENCH_EXPECT(checker, count.misses - before[i].misses == misses);
+                BENCH_EXPECT(checker, count.hits - before[i].hits == draws - misses);
+            }
+            BENCH_EXPECT(checker, state->checkGLShadowState());
+        }
+    });
+    // The time given to deleting GL objects follows the slack left in the
+    // frame, rises to drain a backlog over the drain frames and the costs
+    // follow the measured deletion times. Objects deleted without being
+    // scheduled count as deleted and leave the backlog alone.
+    checker.run("gl_object_deletion_budget", [&checker, gc, state]() {
+        typedef osg::GLObjectDeletionCostModel Model;
+        Model *model = state->getGLObjectDeletionCostModel();
+        osg::ref_ptr<ManualClockFlush> flush = new ManualClockFlush(0.001);
+        flush->setTargetFrameTime(0.016);
+        (*flush)(gc.get());
+        BENCH_EXPECT(checker, flush->getLastAvailableTime() == 0.001);
+        // 14ms frame, 2ms of slack.
+        flush->advance(0.014);
+        (*flush)(gc.get());
+        BENCH_EXPECT(checker, std::abs(flush->getLastAvailableTime() - 0.002) < 1e-9);
+        flush->advance(0.001);
+        (*flush)(gc.get());
+        BENCH_EXPECT(checker, flush->getLastAvailableTime() == flush->getMaximumAvailableTime());
+        flush->advance(0.030);
+        (*flush)(gc.get());
+        BENCH_EXPECT(checker, flush->getLastAvailableTime() == flush->getMinimumAvailableTime());
+
+        // 0.24s of programs to delete, 2ms a frame over 120 frames.
+        model->scheduledForDeletion(Model::PROGRAM_OBJECT, 12000);
+        double drainTime = model->getEstimatedDrainTime();
+        flush->advance(0.030);
+        (*flush)(gc.get());
+        BENCH_EXPECT(checker, flush->getBacklogSize() == 12000);
+        BENCH_EXPECT(checker, std::abs(flush->getLastAvailableTime() - drainTime / flush->getDrainFrames()) < 1e-9);
+
+        unsigned int numDeleted = model->getNumDeleted(Model::PROGRAM_OBJECT);
+        model->deletedImmediately(Model::PROGRAM_OBJECT, 100);
+        BENCH_EXPECT(checker, model->getNumPending(Model::PROGRAM_OBJECT) == 12000);
+        BENCH_EXPECT(checker, model->getNumDeleted(Model::PROGRAM_OBJECT) == numDeleted + 100);
+        model->deleted(Model::PROGRAM_OBJECT, 12000);
+        BENCH_EXPECT(checker, model->getBacklogSize() == 0);
+
+        // The batcher deletes its buffer itself, with buffers pending.
+        model->scheduledForDeletion(Model::BUFFER_OBJECT, 5);
+        unsigned int numBuffersPending = model->getNumPending(Model::BUFFER_OBJECT);
+        unsigned int numBuffersDeleted = model->getNumDeleted(Model::BUFFER_OBJECT);
+        {
+            osg::ref_ptr<osg::IndirectDrawBatcher> batcher = new osg::IndirectDrawBatcher(64, 3);
+            batcher->setFenceInterface(new osg::RecordingFences);
+            batcher->add(0, 0, GL_TRIANGLES, GL_UNSIGNED_SHORT, 36, 0, 0, 1, 0);
+            batcher->draw(*state);
+            batcher->releaseGLObjects(*state);
+        }
+        BENCH_EXPECT(checker, model->getNumPending(Model::BUFFER_OBJECT) == numBuffersPending);
+        BENCH_EXPECT(checker, model->getNumDeleted(Model::BUFFER_OBJECT) == numBuffersDeleted + 1);
+        model->unscheduled(Model::BUFFER_OBJECT, 5);
+
+        double cost = model->getCost(Model::PROGRAM_OBJECT);
+        unsigned int deleted[Model::NUM_OBJECT_TYPES] = {};
+        deleted[Model::PROGRAM_OBJECT] = 100;
+        for (unsigned int i = 0; i < 50; ++i)
+        {
+            model->update(deleted, 100 * cost * 2);
+        }
+        BENCH_EXPECT(checker, std::abs(model->getCost(Model::PROGRAM_OBJECT) - cost * 2) < cost * 0.01);
+        model->setDefaults();
+    });
+    // Swaps keep no more than the maximum frames in flight and run at the
+    // GPU frame rate, the adaptive sleep settles so that the wait comes
+    // down to the margin, a timed out fence drops the others and the
+    // callback deletes the fences still in flight when it goes.
+    checker.run("sync_swap_buffers", [&checker, gc]() {
+        osg::ref_ptr<osg::RecordingFences> fences = new osg::RecordingFences;
+        fences->setGPUFrameTime(0.010);
+        osg::ref_ptr<osg::SyncSwapBuffersCallback> swap = new osg::SyncSwapBuffersCallback(2);
+        swap->setFenceInterface(fences.get());
+
+        // 4ms of CPU work against 10ms of GPU work a frame.
+        double frameStart = fences->time();
+        for (unsigned int frame = 0; frame < 100; ++frame)
+        {
+            double period = fences->time() - frameStart;
+            frameStart = fences->time();
+            fences->advance(0.004);
+            swap->swapBuffersImplementation(gc.get());
+            BENCH_EXPECT(checker, swap->getNumFramesInFlight() <= 2);
+            BENCH_EXPECT(checker, fences->getNumFences() == swap->getNumFramesInFlight());
+            if (frame > 10)
+            {
+                BENCH_EXPECT(checker, std::abs(period - 0.010) < 1e-9);
+            }
+        }
+        BENCH_EXPECT(checker, swap->getWaitHistogram().getTotalCount() == 100);
+        BENCH_EXPECT(checker, std::abs(swap->getWaitHistogram().getMaximum() - 0.006) < 1e-9);
+        BENCH_EXPECT(checker, swap->getSleepHistogram().getTotalCount() == 0);
+
+        // The sleep takes the 6ms wait less the 1ms margin.
+        swap->resetHistograms();
+        swap->setLatencyReduction(true);
+        double lastWait = 0.0;
+        for (unsigned int frame = 0; frame < 100; ++frame)
+        {
+            double period = fences->time() - frameStart;
+            frameStart = fences->time();
+            fences->advance(0.004);
+            double swapStart = fences->time();
+            swap->swapBuffersImplementation(gc.get());
+            lastWait = fences->time() - swapStart - swap->getSleepTime();
+            // The frames stretch while the sleep converges.
+            if (frame > 20)
+            {
+                BENCH_EXPECT(checker, std::abs(period - 0.010) < 1e-6);
+            }
+        }
+        BENCH_EXPECT(checker, std::abs(swap->getSleepTime() - 0.005) < 1e-4);
+        BENCH_EXPECT(checker, std::abs(lastWait - swap->getSleepMargin()) < 1e-4);
+        BENCH_EXPECT(checker, swap->getSleepHistogram().getTotalCount() == 100);
+
+        // A GPU frame longer than the 1s timeout: the third swap gives up on
+        // the fence and drops all of them.
+        swap->setLatencyReduction(false);
+        fences->setGPUFrameTime(2.0);
+        const unsigned int inFlight[] = {2, 2, 0, 1};
+        for (unsigned int frame = 0; frame < 4; ++frame)
+        {
+            fences->advance(0.004);
+            swap->swapBuffersImplementation(gc.get());
+            BENCH_EXPECT(checker, swap->getNumFramesInFlight() == inFlight[frame]);
+            BENCH_EXPECT(checker, fences->getNumFences() == inFlight[frame]);
+        }
+
+        swap = nullptr;
+        BENCH_EXPECT(checker, fences->getNumFences() == 0);
+    });
+
+    gc->releaseContext();
+    gc->close();
+}
+
+//! Read a whole file, empty if it can't be read.
+std::string readFile(const std::string &fileName)
+{
+    std::ifstream in(fileName, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+bool writeFile(const std::string &fileName, const std::string &bytes)
+{
+    std::ofstream out(fileName, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+    return bool(out);
+}
+
+//! DisplaySettings moving the left eye a metre to the left, whatever the
+//! eye separation.
+class OffsetEyeSettings : public osg::DisplaySettings
+{
+    public:
+        virtual osg::Matrixd computeLeftEyeViewImplementation(const osg::Matrixd &view, double) const
+        {
+            return view * osg::Matrixd::translate(1.0, 0.0, 0.0);
+        }
+};
+
+//! Checks of the DisplaySettings snapshots and eye matrices.
+void displaySettingsChecks(Checker &checker)
+{
+    // The cached eye transforms give the matrices of the explicit products,
+    // the shear times the split stereo scale times the projection and the
+    // view times the eye offset, for every display type and stereo mode,
+    // and every setter they depend on refreshes them.
+    checker.run("eye_matrices", [&checker]() {
+        typedef osg::DisplaySettings DS;
+        auto equalMatrices = [](const osg::Matrixd &a, const osg::Matrixd &b) {
+            for (unsigned int i = 0; i < 16; ++i)
+            {
+                if (std::abs(a.ptr()[i] - b.ptr()[i]) > 1e-9)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+        // Eye matrices as DisplaySettings computed them from its settings
+        // on every call.
+        auto expected = [](const DS *ds, const osg::Matrixd &view, const osg::Matrixd &projection, double eyeScale) {
+            double iod = ds->getEyeSeparation();
+            double sd = ds->getScreenDistance();
+            double scaleX = 1.0, scaleY = 1.0;
+            if (ds->getSplitStereoAutoAdjustAspectRatio())
+            {
+                scaleX = ds->getStereoMode() == DS::HORIZONTAL_SPLIT ? 2.0 : 1.0;
+                scaleY = ds->getStereoMode() == DS::VERTICAL_SPLIT ? 2.0 : 1.0;
+            }
+            double shear = ds->getDisplayType() == DS::HEAD_MOUNTED_DISPLAY ? 0.0 : iod / (2.0 * sd);
+            DS::EyeMatrices eyes;
+            osg::Matrixd scaled = osg::Matrixd::scale(scaleX, scaleY, 1.0) * projection;
+            eyes.leftProjection = osg::Matrixd(1, 0, 0, 0, 0, 1, 0, 0, shear, 0, 1, 0, 0, 0, 0, 1) * scaled;
+            eyes.rightProjection = osg::Matrixd(1, 0, 0, 0, 0, 1, 0, 0, -shear, 0, 1, 0, 0, 0, 0, 1) * scaled;
+            eyes.leftView = view * osg::Matrixd::translate(0.5 * iod * eyeScale, 0.0, 0.0);
+            eyes.rightView = view * osg::Matrixd::translate(-0.5 * iod * eyeScale, 0.0, 0.0);
+            return eyes;
+        };
+        auto matches = [&](const DS *ds, const osg::Matrixd &view, const osg::Matrixd &projection) {
+            DS::EyeMatrices eyes = expected(ds, view, projection, 0.5);
+            DS::EyeMatrices batch;
+            ds->computeEyeMatrices(1, &view, &projection, &batch, 0.5);
+            return
+                equalMatrices(ds->computeLeftEyeProjectionImplementation(projection), eyes.leftProjection) &&
+                equalMatrices(ds->computeRightEyeProjectionImplementation(projection), eyes.rightProjection) &&
+                equalMatrices(ds->computeLeftEyeViewImplementation(view, 0.5), eyes.leftView) &&
+                equalMatrices(ds->computeRightEyeViewImplementation(view, 0.5), eyes.rightView) &&
+                equalMatrices(batch.leftProjection, eyes.leftProjection) &&
+                equalMatrices(batch.rightProjection, eyes.rightProjection) &&
+                equalMatrices(batch.leftView, eyes.leftView) &&
+                equalMatrices(batch.rightView, eyes.rightView);
+        };
+
+        const osg::Matrixd view = osg::Matrixd::lookAt(osg::Vec3d(3.0, -8.0, 2.0), osg::Vec3d(0.0, 0.0, 0.5), osg::Vec3d(0.0, 0.0, 1.0));
+        const osg::Matrixd projection = osg::Matrixd::perspective(50.0, 16.0 / 9.0, 0.5, 200.0);
+        const DS::DisplayType displayTypes[] = {DS::MONITOR, DS::POWERWALL, DS::REALITY_CENTER, DS::HEAD_MOUNTED_DISPLAY};
+        const DS::StereoMode stereoModes[] = {DS::QUAD_BUFFER, DS::ANAGLYPHIC, DS::HORIZONTAL_SPLIT, DS::VERTICAL_SPLIT};
+        for (DS::DisplayType displayType : displayTypes)
+        {
+            for (DS::StereoMode stereoMode : stereoModes)
+            {
+                for (bool adjust : {false, true})
+                {
+                    osg::ref_ptr<DS> ds = new DS;
+                    ds->setStereo(true);
+                    ds->setDisplayType(displayType);
+                    ds->setStereoMode(stereoMode);
+                    ds->setSplitStereoAutoAdjustAspectRatio(adjust);
+                    ds->setEyeSeparation(0.065f);
+                    ds->setScreenDistance(0.75f);
+                    BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+                }
+            }
+        }
+
+        // Each setter refreshes the transforms on its own.
+        osg::ref_ptr<DS> ds = new DS;
+        ds->setStereo(true);
+        ds->setEyeSeparation(0.08f);
+        BENCH_EXPECT(checker, std::abs(ds->getEyeTransforms().viewOffset - 0.5 * 0.08f) < 1e-12);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+        ds->setScreenDistance(1.25f);
+        BENCH_EXPECT(checker, std::abs(ds->getEyeTransforms().projectionShear - 0.08f / (2.0 * 1.25f)) < 1e-9);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+        ds->setSplitStereoAutoAdjustAspectRatio(true);
+        ds->setStereoMode(DS::HORIZONTAL_SPLIT);
+        BENCH_EXPECT(checker, ds->getEyeTransforms().scaleX == 2.0 && ds->getEyeTransforms().scaleY == 1.0);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+        ds->setStereoMode(DS::VERTICAL_SPLIT);
+        BENCH_EXPECT(checker, ds->getEyeTransforms().scaleX == 1.0 && ds->getEyeTransforms().scaleY == 2.0);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+        ds->setSplitStereoAutoAdjustAspectRatio(false);
+        BENCH_EXPECT(checker, ds->getEyeTransforms().scaleY == 1.0);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+        ds->setDisplayType(DS::HEAD_MOUNTED_DISPLAY);
+        BENCH_EXPECT(checker, ds->getEyeTransforms().projectionShear == 0.0);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+        ds->setDisplayType(DS::POWERWALL);
+        BENCH_EXPECT(checker, ds->getEyeTransforms().projectionShear > 0.0);
+        BENCH_EXPECT(checker, matches(ds.get(), view, projection));
+
+        // InstancedStereo takes the eyes of a subclass from its overrides.
+        osg::ref_ptr<OffsetEyeSettings> offset = new OffsetEyeSettings;
+        offset->setStereo(true);
+        offset->setStereoMode(DS::HORIZONTAL_SPLIT);
+        osg::ref_ptr<osg::InstancedStereo> stereo = new osg::InstancedStereo;
+        BENCH_EXPECT(checker, stereo->update(offset.get(), view, projection, 0, 0, 1280, 720));
+        BENCH_EXPECT(checker, equalMatrices(stereo->getEyeViewMatrix(osg::InstancedStereo::LEFT_EYE), view * osg::Matrixd::translate(1.0, 0.0, 0.0)));
+        BENCH_EXPECT(checker, equalMatrices(stereo->getEyeViewMatrix(osg::InstancedStereo::RIGHT_EYE), offset->computeRightEyeViewImplementation(view)));
+    });
+
+    // A snapshot carries the settings and values over but not the
+    // application name. Damaged snapshots are rejected and leave the
+    // settings untouched.
+    checker.run("display_settings_snapshot", [&checker]() {
+        const std::string fileName = "sfosg_bench_settings.snapshot";
+        const std::string damagedName = "sfosg_bench_settings_damaged.snapshot";
+        osg::ref_ptr<osg::DisplaySettings> written = new osg::DisplaySettings;
+        written->setStereoMode(osg::DisplaySettings::VERTICAL_SPLIT);
+        written->setEyeSeparation(0.07f);
+        written->setScreenDistance(0.8f);
+        written->setNumMultiSamples(4);
+        written->setGLContextVersion("4.6");
+        written->setApplication("writer");
+        written->setValue("SFOSG_BENCH_CHECK", "snapshot");
+        BENCH_EXPECT(checker, written->writeSnapshot(fileName));
+
+        osg::ref_ptr<osg::DisplaySettings> read = new osg::DisplaySettings;
+        read->setApplication("reader");
+        BENCH_EXPECT(checker, read->readSnapshot(fileName));
+        BENCH_EXPECT(checker, read->getStereoMode() == osg::DisplaySettings::VERTICAL_SPLIT);
+        BENCH_EXPECT(checker, read->getEyeSeparation() == 0.07f);
+        BENCH_EXPECT(checker, read->getScreenDistance() == 0.8f);
+        BENCH_EXPECT(checker, read->getNumMultiSamples() == 4);
+        BENCH_EXPECT(checker, read->getGLContextVersion() == "4.6");
+        BENCH_EXPECT(checker, read->getApplication() == "reader");
+        std::string value;
+        BENCH_EXPECT(checker, read->getValue("SFOSG_BENCH_CHECK", value, false) && value == "snapshot");
+
+        // Rejections are reported as notices, which would go to stdout.
+        osg::NotifySeverity severity = osg::getNotifyLevel();
+        osg::setNotifyLevel(osg::WARN);
+        auto rejected = [&](const std::string &damaged) {
+            writeFile(damagedName, damaged);
+            osg::ref_ptr<osg::DisplaySettings> settings = new osg::DisplaySettings;
+            float eyeSeparation = settings->getEyeSeparation();
+            return !settings->readSnapshot(damagedName) && settings->getEyeSeparation() == eyeSeparation;
+        };
+        // The header is the 8 byte magic, then the version, byte order,
+        // payload size and checksum words.
+        std::string bytes = readFile(fileName);
+        BENCH_EXPECT(checker, bytes.size() > 24);
+        if (bytes.size() > 24)
+        {
+            std::string damaged = bytes;
+            damaged[bytes.size() - 1] ^= 1;
+            BENCH_EXPECT(checker, rejected(damaged));
+            BENCH_EXPECT(checker, rejected(bytes.substr(0, bytes.size() - 4)));
+            BENCH_EXPECT(checker, rejected(bytes.substr(0, 12)));
+            damaged = bytes;
+            damaged[8] += 1;
+            BENCH_EXPECT(checker, rejected(damaged));
+            damaged = bytes;
+            damaged[0] = 'X';
+            BENCH_EXPECT(checker, rejected(damaged));
+        }
+        osg::setNotifyLevel(severity);
+        std::remove(fileName.c_str());
+        std::remove(damagedName.c_str());
+    });
+}
+
+//! Checks of the frame loop, on an Application of its own.
+void applicationChecks(Checker &checker)
+{
+    // Compile slices run by the frame loop against the simulated driver
+    // stay within the 2ms budget once the costs are learned, and every set
+    // becomes ready.
+    checker.run("compile_service_budget", [&checker]() {
+        main::Application app("compile_service_budget");
+        app.setHeadless(true);
+        app.setReportStream(nullptr);
+        app.setupWindow("compile_service_budget", 0, 0, 64, 64);
+        BENCH_EXPECT(checker, app.getGraphicsContext() != nullptr);
+        if (!app.getGraphicsContext())
+        {
+            return;
+        }
+        osg::ref_ptr<osg::RecordingFences> fences = new osg::RecordingFences;
+        fences->setGPUFrameTime(0.010);
+        osg::ref_ptr<osg::CompileService> service = new osg::CompileService;
+        service->setFenceInterface(fences.get());
+        app.setCompileService(service.get());
+        app.setDrawCallback([fences](osg::GraphicsContext *) {
+            fences->advance(0.016);
+        });
+
+        for (unsigned int pass = 0; pass < 2; ++pass)
+        {
+            std::vector<osg::ref_ptr<osg::CompileService::CompileSet> > sets;
+            for (unsigned int i = 0; i < 8; ++i)
+            {
+                osg::ref_ptr<osg::CompileService::CompileSet> set = new osg::CompileService::CompileSet;
+                for (unsigned int j = 0; j < 32; ++j)
+                {
+                    size_t size = 65536 * (1 + j % 8);
+                    set->add(new osg::RecordingCompileObject(
+                        fences.get(),
+                        osg::GLObjectCompileCostModel::BUFFER_OBJECT,
+                        size,
+                        size * 0.75e-9
+                    ));
+                }
+                service->add(set.get());
+                sets.push_back(set);
+            }
+            // The first pass teaches the cost model the driver's costs.
+            service->resetStats();
+            for (unsigned int frame = 0; frame < 200 && !sets.back()->isReady(); ++frame)
+            {
+                app.frame();
+            }
+            for (auto &set : sets)
+            {
+                BENCH_EXPECT(checker, set->isReady());
+            }
+            osg::CompileService::Stats stats = service->getStats();
+            BENCH_EXPECT(checker, stats.numObjectsCompiled == 8 * 32);
+            BENCH_EXPECT(checker, stats.numSetsReady == 8);
+            // 7.1ms of objects a set, 57ms in all, at least 29 slices of 2ms.
+            BENCH_EXPECT(checker, stats.numSlices >= 29);
+            if (pass == 1)
+            {
+                BENCH_EXPECT(checker, stats.maxSliceTime <= service->getTimeBudget() + 1e-9);
+            }
+        }
+    });
+    // Every phase runs all of its jobs each frame, on the pool when there
+    // are threads, and the draw jobs finish before the draw callback.
+    checker.run("application_phase_jobs", [&checker]() {
+        const main::Application::ThreadingModel models[] = {
+            main::Application::SINGLE_THREADED,
+            main::Application::CULL_DRAW_THREAD_PER_CONTEXT,
+            main::Application::PIPELINED,
+        };
+        for (auto model : models)
+        {
+            for (unsigned int threads : {0u, 2u})
+            {
+                main::Application app("application_phase_jobs");
+                app.setHeadless(true);
+                app.setReportStream(nullptr);
+                app.setThreads(threads);
+                app.setThreadingModel(model);
+                app.setupWindow("application_phase_jobs", 0, 0, 64, 64);
+                BENCH_EXPECT(checker, app.getGraphicsContext() != nullptr);
+                if (!app.getGraphicsContext())
+                {
+                    return;
+                }
+                app.setUpdateJobs(3);
+                app.setCullJobs(2);
+                app.setDrawJobs(4);
+                std::atomic<unsigned int> updates{0};
+                std::atomic<unsigned int> culls{0};
+                std::atomic<unsigned int> draws{0};
+                // Counted rather than checked, the Checker isn't thread safe.
+                std::atomic<unsigned int> wrongJobs{0};
+                std::atomic<unsigned int> onPhaseThread{0};
+                std::atomic<unsigned int> drawsBeforeCallback{0};
+                std::thread::id loopThread = std::this_thread::get_id();
+                std::thread::id graphicsThread;
+                std::mutex mutex;
+                auto phaseThread = [&]() {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    return model == main::Application::SINGLE_THREADED ? loopThread : graphicsThread;
+                };
+                app.setUpdateJobCallback([&](double, unsigned int, unsigned int jobs) {
+                    wrongJobs += jobs != 3 ? 1 : 0;
+                    ++updates;
+                    onPhaseThread += std::this_thread::get_id() == loopThread ? 1 : 0;
+                });
+                app.setCullCallback([&](unsigned int, unsigned int jobs) {
+                    wrongJobs += jobs != 2 ? 1 : 0;
+                    ++culls;
+                    onPhaseThread += std::this_thread::get_id() == phaseThread() ? 1 : 0;
+                });
+                app.setDrawJobCallback([&](unsigned int, unsigned int jobs) {
+                    wrongJobs += jobs != 4 ? 1 : 0;
+                    ++draws;
+                    onPhaseThread += std::this_thread::get_id() == phaseThread() ? 1 : 0;
+                });
+                unsigned int frames = 0;
+                app.setDrawCallback([&](osg::GraphicsContext *) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        graphicsThread = std::this_thread::get_id();
+                    }
+                    ++frames;
+                    drawsBeforeCallback += draws == 4 * frames ? 1 : 0;
+                });
+                for (unsigned int frame = 0; frame < 10; ++frame)
+                {
+                    app.frame();
+                }
+                // Drains the last pipelined frame.
+                app.setThreadingModel(main::Application::SINGLE_THREADED);
+                BENCH_EXPECT(checker, updates == 3 * 10);
+                BENCH_EXPECT(checker, culls == 2 * 10);
+                BENCH_EXPECT(checker, draws == 4 * 10);
+                BENCH_EXPECT(checker, drawsBeforeCallback == 10);
+                BENCH_EXPECT(checker, wrongJobs == 0);
+                // The first frame's cull runs before the graphics thread
+                // is known, the rest are compared against it.
+                if (threads)
+                {
+                    BENCH_EXPECT(checker, onPhaseThread == 0);
+                }
+                else
+                {
+                    BENCH_EXPECT(checker, onPhaseThread >= 3 * 10 + (2 + 4) * 9);
+                }
+            }
+        }
+    });
+    // Numeric parameters that don't parse are reported rather than thrown.
+    checker.run("application_parameters", [&checker]() {
+        typedef main::Example::Parameters Parameters;
+        std::ostringstream err;
+        BENCH_EXPECT(checker, main::Example::checkParameters(Parameters{{"frames", "100"}, {"budget", "16.6"}}, err));
+        BENCH_EXPECT(checker, err.str().empty());
+        const Parameters invalid[] = {
+            {{"frames", "abc"}},
+            {{"frames", ""}},
+            {{"frames", "-1"}},
+            {{"frames", "10x"}},
+            {{"threads", "99999999999999999999"}},
+            {{"budget", "fast"}},
+            {{"budget", "-5"}},
+            {{"budget", "nan"}},
+            {{"draw_jobs", " 2"}},
+        };
+        for (auto &parameters : invalid)
+        {
+            std::ostringstream out;
+            BENCH_EXPECT(checker, !main::Example::checkParameters(parameters, out));
+            BENCH_EXPECT(checker, out.str().find("usage: ") != std::string::npos);
+        }
+        BENCH_EXPECT(checker, main::Example::count(Parameters{{"frames", "12"}}, "frames", 3) == 12);
+        BENCH_EXPECT(checker, main::Example::count(Parameters{}, "frames", 3) == 3);
+        BENCH_EXPECT(checker, main::Example::number(Parameters{{"budget", "2.5"}}, "budget", 0) == 2.5);
+    });
+}
+
+//! Checks of the render queue sort.
+void renderQueueChecks(Checker &checker)
+{
+    // The radix sort orders the entries as std::stable_sort of the keys
+    // does, equal keys in the order they were added in, on the calling
+    // thread and with workers, below and above the parallel threshold.
+    checker.run("render_queue_sort", [&checker]() {
+        typedef std::pair<uint64_t, unsigned int> Expected;
+        for (unsigned int threads : {0u, 1u, 3u})
+        {
+            osg::ref_ptr<osg::RenderQueue> queue = new osg::RenderQueue;
+            queue->setNumThreads(threads);
+            queue->setParallelThreshold(1000);
+            for (unsigned int draws : {0u, 1u, 999u, 1000u, 5003u})
+            {
+                for (bool equal : {false, true})
+                {
+                    // Few programs, texture sets and depths, many equal keys.
+                    std::vector<Expected> expected;
+                    queue->clear();
+                    uint32_t seed = draws + threads;
+                    for (unsigned int i = 0; i < draws; ++i)
+                    {
+                        seed = seed * 1664525 + 1013904223;
+                        uint64_t key =
+                            equal ?
+                            osg::RenderQueue::makeKey(3, 7, 11, 0.5f) :
+                            osg::RenderQueue::makeKey(seed >> 29, seed >> 24 & 15, seed >> 12 & 255, (seed >> 4 & 7) / 7.0f);
+                        queue->add(key, i);
+                        expected.push_back(Expected(key, i));
+                    }
+                    std::stable_sort(
+                        expected.begin(),
+                        expected.end(),
+                        [](const Expected &a, const Expected &b) { return a.first < b.first; }
+                    );
+                    queue->sort();
+                    BENCH_EXPECT(checker, queue->size() == draws);
+                    bool same = queue->size() == draws;
+                    for (unsigned int i = 0; same && i < draws; ++i)
+                    {
+                        same = (*queue)[i].key == expected[i].first && (*queue)[i].index == expected[i].second;
+                    }
+                    BENCH_EXPECT(checker, same);
+                }
+            }
+        }
+    });
+}
+
+//! Sorting a frame of 1M draws by state: the radix sort of the render
+//! queue on the calling thread and with workers, against std::stable_sort
+//! of the same keys. Items are draws.
+void renderQueueBenchmarks(Runner &runner)
+{
+    const unsigned int draws = 1000000;
+    std::vector<uint64_t> keys(draws);
+    uint32_t seed = 1;
+    for (auto &key : keys)
+    {
+        seed = seed * 1664525 + 1013904223;
+        key = osg::RenderQueue::makeKey(seed >> 28, seed >> 20 & 255, seed >> 8 & 4095, (seed & 255) / 255.0f);
+    }
+    for (unsigned int threads : {0u, 1u, 3u})
+    {
+        std::string name =
+            threads ?
+            "render_queue_sort_1m_" + std::to_string(threads + 1) + "_threads" :
+            "render_queue_sort_1m";
+        runner.run(name, [&keys, threads](uint64_t iterations) {
+            osg::ref_ptr<osg::RenderQueue> queue = new osg::RenderQueue;
+            queue->setNumThreads(threads);
+            queue->reserve(static_cast<unsigned int>(keys.size()));
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                queue->clear();
+                for (unsigned int j = 0; j < keys.size(); ++j)
+                {
+                    queue->add(keys[j], j);
+                }
+                queue->sort();
+                doNotOptimize(&queue->getEntries()[0]);
+            }
+            return double(keys.size());
+        });
+    }
+    runner.run("render_queue_std_stable_sort_1m", [&keys](uint64_t iterations) {
+        std::vector<std::pair<uint64_t, unsigned int> > entries(keys.size());
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (unsigned int j = 0; j < keys.size(); ++j)
+            {
+                entries[j] = std::make_pair(keys[j], j);
+            }
+            std::stable_sort(entries.begin(), entries.end());
+            doNotOptimize(entries.data());
+        }
+        return double(keys.size());
+    });
+}
+
+//! Checks of the scene format.
+void formatChecks(Checker &checker)
+{
+    // Chunks read back as they were written, and files that are truncated,
+    // not scenes or point outside themselves are rejected.
+    checker.run("format_round_trip", [&checker]() {
+        const std::string fileName = "sfosg_bench_check.ogs";
+        const std::string damagedName = "sfosg_bench_check_damaged.ogs";
+        std::vector<osg::Vec3f> positions;
+        std::vector<uint16_t> indices;
+        for (unsigned int i = 0; i < 1000; ++i)
+        {
+            positions.push_back(osg::Vec3f(i, i * 0.5f, -float(i)));
+            indices.push_back(static_cast<uint16_t>(i * 7 % 1000));
+        }
+        std::vector<osg::Matrixd> matrices;
+        std::vector<format::Matrixf> matricesf;
+        for (unsigned int i = 0; i < 10; ++i)
+        {
+            matrices.push_back(osg::Matrixd::rotate(i * 0.1, osg::Vec3d(0, 0, 1)) * osg::Matrixd::translate(i, 2 * i, 3 * i));
+            format::Matrixf matrix;
+            for (unsigned int j = 0; j < 16; ++j)
+            {
+                matrix.mat[j / 4][j % 4] = float(i * 16 + j);
+            }
+            matricesf.push_back(matrix);
+        }
+        std::vector<format::StateSetDescription> stateSets(3);
+        stateSets[0].name = "opaque";
+        stateSets[0].modes.push_back(std::make_pair(GLenum(GL_DEPTH_TEST), true));
+        stateSets[0].modes.push_back(std::make_pair(GLenum(GL_BLEND), false));
+        stateSets[2].name = "transparent";
+        stateSets[2].modes.push_back(std::make_pair(GLenum(GL_BLEND), true));
+        for (unsigned int i = 0; i < 3; ++i)
+        {
+            for (unsigned int j = 0; j < 4; ++j)
+            {
+                stateSets[i].color[j] = i + j * 0.25f;
+            }
+        }
+        std::vector<std::string> strings = { "", "terrain", "tile 12/34" };
+
+        format::Writer writer;
+        BENCH_EXPECT(checker,
+            writer.open(fileName) &&
+            writer.addArray("positions", positions) &&
+            writer.addArray("indices", indices) &&
+            writer.addMatrices("matrices", matrices) &&
+            writer.addMatrices("matricesf", matricesf) &&
+            writer.addStateSets("states", stateSets) &&
+            writer.addStrings("strings", strings) &&
+            writer.close()
+        );
+
+        {
+            format::File file;
+            BENCH_EXPECT(checker, file.open(fileName));
+            auto readPositions = file.array<osg::Vec3f>("positions");
+            BENCH_EXPECT(checker, std::vector<osg::Vec3f>(readPositions.begin(), readPositions.end()) == positions);
+            auto readIndices = file.array<uint16_t>("indices");
+            BENCH_EXPECT(checker, std::vector<uint16_t>(readIndices.begin(), readIndices.end()) == indices);
+            // Views of other element types are empty.
+            BENCH_EXPECT(checker, file.array<uint32_t>("indices").empty());
+            BENCH_EXPECT(checker, file.array<float>("missing").empty());
+            auto readMatrices = file.array<osg::Matrixd>("matrices");
+            BENCH_EXPECT(checker, std::vector<osg::Matrixd>(readMatrices.begin(), readMatrices.end()) == matrices);
+            auto readMatricesf = file.array<format::Matrixf>("matricesf");
+            BENCH_EXPECT(checker,
+                readMatricesf.size() == matricesf.size() &&
+                std::memcmp(readMatricesf.data, matricesf.data(), sizeof(format::Matrixf) * matricesf.size()) == 0
+            );
+
+            auto records = file.stateSets("states");
+            format::StringTable names = file.strings("states.names");
+            BENCH_EXPECT(checker, records.size() == stateSets.size() && names.size() == 2);
+            for (size_t i = 0; i < records.size() && i < stateSets.size(); ++i)
+            {
+                const format::StateSetDescription &stateSet = stateSets[i];
+                std::string name = records[i].name == format::NO_NAME ? "" : names[records[i].name];
+                BENCH_EXPECT(checker, name == stateSet.name);
+                BENCH_EXPECT(checker, std::equal(stateSet.color, stateSet.color + 4, records[i].color));
+                auto modes = file.modes("states", records[i]);
+                BENCH_EXPECT(checker, modes.size() == stateSet.modes.size());
+                for (size_t j = 0; j < modes.size() && j < stateSet.modes.size(); ++j)
+                {
+                    BENCH_EXPECT(checker, modes[j].mode == stateSet.modes[j].first);
+                    BENCH_EXPECT(checker, (modes[j].enabled != 0) == stateSet.modes[j].second);
+                }
+            }
+
+            format::StringTable readStrings = file.strings("strings");
+            BENCH_EXPECT(checker, readStrings.size() == strings.size());
+            for (size_t i = 0; i < readStrings.size() && i < strings.size(); ++i)
+            {
+                BENCH_EXPECT(checker, readStrings[i] == strings[i] && readStrings.length(i) == strings[i].size());
+            }
+        }
+
+        auto rejected = [&](const std::string &damaged) {
+            writeFile(damagedName, damaged);
+            format::File file;
+            return !file.open(damagedName) && !file.valid();
+        };
+        auto setWord = [](std::string &bytes, size_t offset, uint64_t value) {
+            std::memcpy(&bytes[offset], &value, sizeof(value));
+        };
+        // The header holds the directory offset at byte 24, a directory
+        // entry the offset of its chunk at byte 64.
+        std::string bytes = readFile(fileName);
+        BENCH_EXPECT(checker, bytes.size() > sizeof(format::Header) + sizeof(format::ChunkEntry));
+        if (bytes.size() > sizeof(format::Header) + sizeof(format::ChunkEntry))
+        {
+            uint64_t directoryOffset = 0;
+            std::memcpy(&directoryOffset, &bytes[24], sizeof(directoryOffset));
+            BENCH_EXPECT(checker, !rejected(bytes));
+            BENCH_EXPECT(checker, rejected(bytes.substr(0, bytes.size() - 1)));
+            BENCH_EXPECT(checker, rejected(bytes.substr(0, directoryOffset)));
+            BENCH_EXPECT(checker, rejected(bytes.substr(0, sizeof(format::Header) - 1)));
+            std::string damaged = bytes;
+            damaged[0] = 'X';
+            BENCH_EXPECT(checker, rejected(damaged));
+            damaged = bytes;
+            setWord(damaged, 24, bytes.size() + format::SCENE_ALIGNMENT);
+            BENCH_EXPECT(checker, rejected(damaged));
+            damaged = bytes;
+            setWord(damaged, directoryOffset + 64, directoryOffset + format::SCENE_ALIGNMENT);
+            BENCH_EXPECT(checker, rejected(damaged));
+            damaged = bytes;
+            setWord(damaged, directoryOffset + 72, bytes.size());
+            BENCH_EXPECT(checker, rejected(damaged));
+        }
+        std::remove(fileName.c_str());
+        std::remove(damagedName.c_str());
+    });
+}
+
+//! Opening a scene costs the mapping and the directory, not the size of
+//! its arrays. Items are bytes of the scene.
+void formatBenchmarks(Runner &runner)
+{
+    if (!runner.selected("format_open_view") && !runner.selected("format_read_copy"))
+    {
+        return;
+    }
+    const std::string fileName = "sfosg_bench_scene.ogs";
+    const unsigned int numVertices = 1 << 20;
+    {
+        std::vector<osg::Vec3f> positions(numVertices);
+        std::vector<uint32_t> indices(numVertices);
+        std::vector<osg::Matrixd> matrices(numVertices / 64);
+        for (unsigned int i = 0; i < numVertices; ++i)
+        {
+            positions[i].set(i % 100, i / 100 % 100, i / 10000);
+            indices[i] = i;
+        }
+        format::Writer writer;
+        if (
+            !writer.open(fileName) ||
+            !writer.addArray("positions", positions) ||
+            !writer.addArray("indices", indices) ||
+            !writer.addMatrices("matrices", matrices) ||
+            !writer.close()
+        ) {
+            std::cerr << "Could not write " << fileName << ", skipping format benchmarks" << std::endl;
+            return;
+        }
+    }
+    {
+        format::File file;
+        if (!file.open(fileName) || file.array<osg::Vec3f>("positions").size() != numVertices)
+        {
+            std::cerr << "Could not open " << fileName << ", skipping format benchmarks" << std::endl;
+            std::remove(fileName.c_str());
+            return;
+        }
+    }
+    double bytes = 0;
+    {
+        std::ifstream in(fileName, std::ios::binary | std::ios::ate);
+        bytes = double(in.tellg());
+    }
+    runner.run("format_open_view", [&](uint64_t iterations) {
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            format::File file;
+            // No items when the open fails, rather than a fast failure.
+            if (!file.open(fileName))
+            {
+                return 0.0;
+            }
+            auto positions = file.array<osg::Vec3f>("positions");
+            auto matrices = file.array<osg::Matrixd>("matrices");
+            doNotOptimize(positions.data);
+            doNotOptimize(matrices.data);
+        }
+        return bytes;
+    });
+    // What the mapping saves: reading the same bytes into memory.
+    runner.run("format_read_copy", [&](uint64_t iterations) {
+        std::vector<char> data(static_cast<size_t>(bytes));
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            std::ifstream in(fileName, std::ios::binary);
+            in.read(data.data(), data.size());
+            doNotOptimize(data.data());
+        }
+        return bytes;
+    });
+    std::remove(fileName.c_str());
+}
+
+//! Reading 2000 small files, as tiles are paged: one after another with
+//! blocking reads, then through each asynchronous Reader with the reads in
+//! flight together. Items are files.
+void ioBenchmarks(Runner &runner)
+{
+#if !defined(WIN32) || defined(__CYGWIN__)
+    const std::vector<std::string> names = {
+        "io_small_files_blocking",
+        "io_small_files_threads",
+        "io_small_files_uring"
+    };
+    if (std::none_of(names.begin(), names.end(), [&](const std::string &name) {
+        return runner.selected(name);
+    })) {
+        return;
+    }
+    const unsigned int numFiles = 2000;
+    const std::string directory = "sfosg_bench_files";
+    mkdir(directory.c_str(), 0755);
+    std::vector<std::string> fileNames;
+    std::vector<std::string> contents;
+    for (unsigned int i = 0; i < numFiles; ++i)
+    {
+        fileNames.push_back(directory + "/" + std::to_string(i));
+        contents.push_back(std::string(4096 + (i % 8) * 512, char('a' + i % 26)));
+        std::ofstream file(fileNames.back(), std::ios::binary);
+        file << contents.back();
+    }
+
+    runner.run(names[0], [&](uint64_t iterations) {
+        std::vector<char> buffer(64 * 1024);
+        for (uint64_t i = 0; i < iterations; ++i)
+        {
+            for (auto &fileName : fileNames)
+            {
+                int fd = open(fileName.c_str(), O_RDONLY);
+                ssize_t bytes = read(fd, buffer.data(), buffer.size());
+                doNotOptimize(bytes);
+                close(fd);
+            }
+        }
+        return double(numFiles);
+    });
+    for (bool uring : {false, true})
+    {
+        osg::ref_ptr<io::Reader> reader = io::createReader(64, 64 * 1024, 256, uring);
+        if (uring && std::string(reader->getName()) != "io_uring")
+        {
+            std::cerr << "io_uring is not available, skipping " << names[2] << std::endl;
+            break;
+        }
+        const std::string &name = names[uring ? 2 : 1];
+        if (!runner.selected(name))
+        {
+            continue;
+        }
+        // The reads are checked once against what was written, timing
+        // reads that come back wrong means nothing.
+        {
+            std::vector<osg::ref_ptr<io::Request> > requests;
+            for (auto &fileName : fileNames)
+            {
+                requests.push_back(reader->read(fileName));
+            }
+            reader->submit();
+            bool valid = true;
+            for (unsigned int i = 0; i < numFiles; ++i)
+            {
+                io::Request *request = requests[i].get();
+                if (
+                    !request->wait() ||
+                    request->size() != contents[i].size() ||
+                    std::memcmp(request->data(), contents[i].data(), contents[i].size()) != 0
+                ) {
+                    std::cerr
+                        << "Reading " << fileNames[i] << " with " << reader->getName()
+                        << " failed, errno " << request->getError()
+                        << ", skipping " << name << std::endl;
+                    valid = false;
+                    break;
+                }
+            }
+            if (!valid)
+            {
+                continue;
+            }
+        }
+        runner.run(name, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                std::vector<osg::ref_ptr<io::Request> > requests;
+                for (auto &fileName : fileNames)
+                {
+                    requests.push_back(reader->read(fileName));
+                }
+                reader->submit();
+                for (auto &request : requests)
+                {
+                    // No items when a read fails, rather than a fast failure.
+                    if (!request->wait())
+                    {
+                        return 0.0;
+                    }
+                }
+            }
+            return double(numFiles);
+        });
+    }
+
+    for (auto &fileName : fileNames)
+    {
+        std::remove(fileName.c_str());
+    }
+    rmdir(directory.c_str());
+#endif
+}
+
+//! In memory tiles, loads wait until the gate is opened so the checks
+//! can queue requests behind a load.
+class GatedSource : public paging::Source
+{
+    public:
+        std::atomic<bool> open{true};
+        std::atomic<unsigned int> loading{0};
+        std::mutex mutex;
+        std::vector<std::string> loads;
+
+        virtual osg::ref_ptr<paging::Tile> load(const std::string &name)
+        {
+            ++this->loading;
+            while (!this->open)
+            {
+                OpenThreads::Thread::YieldCurrentThread();
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->loads.push_back(name);
+            }
+            osg::ref_ptr<paging::Tile> tile = new paging::Tile;
+            tile->name = name;
+            return tile;
+        }
+};
+
+//! Checks of the pager.
+void pagingChecks(Checker &checker)
+{
+    osg::ref_ptr<osg::DisplaySettings> ds = new osg::DisplaySettings;
+    ds->setNumOfDatabaseThreadsHint(1);
+    //! Wait up to 10s for the pager to be done with `count` requests.
+    auto settle = [](paging::Pager &pager, unsigned int count) {
+        auto start = Clock::now();
+        while (std::chrono::duration<double>(Clock::now() - start).count() < 10)
+        {
+            paging::Pager::Stats stats = pager.getStats();
+            if (stats.loaded + stats.failed + stats.cancelled >= count && pager.getNumPending() == 0)
+            {
+                return true;
+            }
+            OpenThreads::Thread::YieldCurrentThread();
+        }
+        return false;
+    };
+    // Requests queued behind a load are loaded biggest on screen first,
+    // then nearest, and merged in the same order, one per update() with
+    // no time to spare.
+    checker.run("pager_priority", [&checker, ds, settle]() {
+        osg::ref_ptr<GatedSource> source = new GatedSource;
+        source->open = false;
+        paging::Pager pager(source.get(), ds.get());
+        std::vector<std::string> merges;
+        pager.setMergeCallback([&merges](paging::Tile *tile) { merges.push_back(tile->name); });
+        pager.start();
+        pager.request("gate", 1000, 0, 1);
+        while (source->loading == 0)
+        {
+            OpenThreads::Thread::YieldCurrentThread();
+        }
+        // Name, pixel size and distance, in no particular order.
+        const std::vector<std::tuple<std::string, double, double> > requests = {
+            std::make_tuple("far_small", 10, 300),
+            std::make_tuple("near_big", 200, 10),
+            std::make_tuple("near_small", 10, 100),
+            std::make_tuple("mid", 50, 50),
+            std::make_tuple("far_big", 200, 40),
+        };
+        for (auto &request : requests)
+        {
+            pager.request(std::get<0>(request), std::get<1>(request), std::get<2>(request), 1);
+        }
+        source->open = true;
+        BENCH_EXPECT(checker, settle(pager, 6));
+        const std::vector<std::string> expected = {
+            "gate", "near_big", "far_big", "mid", "near_small", "far_small"
+        };
+        BENCH_EXPECT(checker, source->loads == expected);
+        for (unsigned int i = 0; i < expected.size(); ++i)
+        {
+            BENCH_EXPECT(checker, pager.update(1, 0) == 1);
+        }
+        BENCH_EXPECT(checker, pager.update(1, 0) == 0);
+        BENCH_EXPECT(checker, merges == expected);
+        BENCH_EXPECT(checker, pager.getNumTiles() == expected.size());
+        BENCH_EXPECT(checker, pager.request("mid", 50, 50, 2) == pager.getTile("mid"));
+        BENCH_EXPECT(checker, pager.getTile("mid") != nullptr);
+    });
+    // Requests not renewed for the expiry frames are cancelled, queued or
+    // loading, and never reach the source or the merge.
+    checker.run("pager_cancellation", [&checker, ds, settle]() {
+        osg::ref_ptr<GatedSource> source = new GatedSource;
+        source->open = false;
+        paging::Pager pager(source.get(), ds.get());
+        pager.setExpiryFrames(2);
+        pager.start();
+        pager.request("loading", 1000, 0, 1);
+        while (source->loading == 0)
+        {
+            OpenThreads::Thread::YieldCurrentThread();
+        }
+        for (unsigned int i = 0; i < 4; ++i)
+        {
+            pager.request("queued_" + std::to_string(i), 10, i, 1);
+        }
+        // Renewed up to frame 3, still wanted at frame 5.
+        pager.request("queued_0", 10, 0, 3);
+        BENCH_EXPECT(checker, pager.getNumPending() == 5);
+        // The load in progress is cancelled once it finishes.
+        pager.update(4, 1);
+        BENCH_EXPECT(checker, pager.getStats().cancelled == 3);
+        pager.update(5, 1);
+        BENCH_EXPECT(checker, pager.getStats().cancelled == 3);
+        source->open = true;
+        BENCH_EXPECT(checker, settle(pager, 2));
+        pager.update(5, 1);
+        paging::Pager::Stats stats = pager.getStats();
+        BENCH_EXPECT(checker, stats.cancelled == 4);
+        BENCH_EXPECT(checker, stats.loaded == 1 && stats.merged == 1);
+        BENCH_EXPECT(checker, source->loads == std::vector<std::string>({"loading", "queued_0"}));
+        BENCH_EXPECT(checker, pager.getTile("queued_0") != nullptr);
+        BENCH_EXPECT(checker, pager.getTile("loading") == nullptr);
+    });
+    // Each update() merges until its slice is spent, at least one tile,
+    // and a 1ms merge fits no more than three times in a 2.5ms slice.
+    checker.run("pager_merge_slice", [&checker, ds, settle]() {
+        osg::ref_ptr<GatedSource> source = new GatedSource;
+        paging::Pager pager(source.get(), ds.get());
+        pager.setMergeCallback([](paging::Tile *) {
+            auto start = Clock::now();
+            while (std::chrono::duration<double>(Clock::now() - start).count() < 0.001)
+            {
+            }
+        });
+        pager.start();
+        for (unsigned int i = 0; i < 12; ++i)
+        {
+            pager.request("tile_" + std::to_string(i), 10, i, 1);
+        }
+        BENCH_EXPECT(checker, settle(pager, 12));
+        unsigned int merged = 0;
+        unsigned int updates = 0;
+        while (merged < 12 && updates < 12)
+        {
+            unsigned int count = pager.update(1, 0.0025);
+            BENCH_EXPECT(checker, count >= 1 && count <= 3);
+            merged += count;
+            ++updates;
+        }
+        BENCH_EXPECT(checker, merged == 12);
+        BENCH_EXPECT(checker, updates >= 4);
+        BENCH_EXPECT(checker, pager.getStats().maxMergeTime >= 0.001);
+    });
+    // Past the maximum, the tiles requested longest ago are evicted, tiles
+    // still requested stay however many there are.
+    checker.run("pager_eviction", [&checker, ds, settle]() {
+        osg::ref_ptr<GatedSource> source = new GatedSource;
+        paging::Pager pager(source.get(), ds.get());
+        pager.setExpiryFrames(2);
+        pager.setMaxTiles(3);
+        std::vector<std::string> evictions;
+        pager.setEvictCallback([&evictions](paging::Tile *tile) { evictions.push_back(tile->name); });
+        pager.start();
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            pager.request("tile_" + std::to_string(i), 10, i, 1);
+        }
+        BENCH_EXPECT(checker, settle(pager, 6));
+        pager.update(1, 1);
+        BENCH_EXPECT(checker, pager.getNumTiles() == 6);
+        BENCH_EXPECT(checker, evictions.empty());
+
+        // tile_1 and tile_2 were seen after the others, tile_0 still is.
+        pager.request("tile_1", 10, 1, 2);
+        pager.update(2, 1);
+        pager.request("tile_2", 10, 2, 3);
+        pager.update(3, 1);
+        BENCH_EXPECT(checker, pager.getNumTiles() == 6);
+        pager.request("tile_0", 10, 0, 10);
+        pager.update(10, 1);
+        BENCH_EXPECT(checker, pager.getNumTiles() == 3);
+        BENCH_EXPECT(checker, pager.getStats().evicted == 3);
+        std::sort(evictions.begin(), evictions.end());
+        BENCH_EXPECT(checker, evictions == std::vector<std::string>({"tile_3", "tile_4", "tile_5"}));
+        for (auto name : {"tile_0", "tile_1", "tile_2"})
+        {
+            BENCH_EXPECT(checker, pager.getTile(name) != nullptr);
+        }
+    });
+}
+
+//! Camera flying over a synthetic scene of 10^5 tiles, requesting the
+//! tiles within view range every frame and merging for at most 2 ms.
+//! Items are frames.
+void pagingBenchmark(Runner &runner)
+{
+    const std::string name = "paging_fly_over_100k_tiles";
+    if (!runner.selected(name))
+    {
+        return;
+    }
+    const std::string fileName = "sfosg_bench_tiles.ogs";
+    const unsigned int tilesX = 400;
+    const unsigned int tilesY = 250;
+    const float tileSize = 10;
+    const int range = 12;
+    if (!paging::writeSyntheticScene(fileName, tilesX, tilesY, tileSize))
+    {
+        std::cerr << "Could not write " << fileName << ", skipping " << name << std::endl;
+        return;
+    }
+    {
+        osg::ref_ptr<paging::ArchiveSource> source = new paging::ArchiveSource(fileName);
+        paging::Pager pager(source.get());
+        pager.start();
+        unsigned int frame = 0;
+        runner.run(name, [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i)
+            {
+                ++frame;
+                // Half a tile per frame, wrapping around the scene.
+                double cx = (frame / 2) % tilesX + 0.5;
+                double cy = tilesY / 2 + 0.5;
+                for (int y = int(cy) - range; y <= int(cy) + range; ++y)
+                {
+                    for (int x = int(cx) - range; x <= int(cx) + range; ++x)
+                    {
+                        if (x < 0 || y < 0 || x >= int(tilesX) || y >= int(tilesY))
+                        {
+                            continue;
+                        }
+                        double distance = std::hypot(x + 0.5 - cx, y + 0.5 - cy) * tileSize;
+                        if (distance > range * tileSize)
+                        {
+                            continue;
+                        }
+                        // Tile radius over distance, scaled to a 1000
+                        // pixel high 60 degree view.
+                        double pixelSize = tileSize * 0.7 / std::max(distance, 1.0) * 866;
+                        pager.request(paging::tileName(x, y), pixelSize, distance, frame);
+                    }
+                }
+                pager.update(frame, 0.002);
+            }
+            return 1.0;
+        });
+        auto stats = pager.getStats();
+        std::cerr
+            << name
+            << "\tthreads " << pager.getNumThreads()
+            << "\trequested " << stats.requested
+            << "\tmerged " << stats.merged
+            << "\tcancelled " << stats.cancelled
+            << "\tevicted " << stats.evicted
+            << "\tmax merge " << stats.maxMergeTime * 1000 << " ms"
+            << std::endl;
+    }
+    std::remove(fileName.c_str());
+}
+
+//! Time from spawning `sfosg --headless --frames=1` to its exit, which
+//! covers process start, static initialization, context creation and the
+//! first frame.
+void startupBenchmark(Runner &runner, const std::string &sfosg)
+{
+    const std::string name = "startup_first_frame";
+    if (!runner.selected(name))
+    {
+        return;
+    }
+#if !defined(WIN32) || defined(__CYGWIN__)
+    std::vector<std::string> args = { sfosg, "--headless", "--frames=1" };
+    std::vector<char *> argv;
+    for (auto &arg : args)
+    {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    std::vector<double> times;
+    for (unsigned int r = 0; r < std::max(runner.repetitions, 5u); ++r)
+    {
+        auto start = Clock::now();
+        pid_t pid;
+        if (posix_spawn(&pid, sfosg.c_str(), nullptr, nullptr, argv.data(), environ))
+        {
+            std::cerr << "Could not run " << sfosg << ", skipping " << name << std::endl;
+            return;
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        times.push_back(seconds(start, Clock::now()));
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            std::cerr << sfosg << " failed, skipping " << name << std::endl;
+            return;
+        }
+    }
+    runner.add(name, 1, times, 1);
+#else
+    std::cerr << "Skipping " << name << ", needs posix_spawn" << std::endl;
+#endif
+}
+
+} // namespace bench
+} // namespace ogs
+
+int main(int argc, char *argv[])
+{
+    auto parameters = main::parseParameters(argc, argv);
+
+    bench::Runner runner;
+    runner.filter = main::Example::parameter(parameters, "filter", "");
+    runner.minTime = std::stod(main::Example::parameter(parameters, "min_time", "0.2"));
+    runner.repetitions = std::stoul(main::Example::parameter(parameters, "repetitions", "5"));
+
+    // Read first, so a run isn't wasted on a baseline that can't be compared.
+    std::string baselineFile = main::Example::parameter(parameters, "baseline", "");
+    std::map<std::string, double> baseline;
+    if (!baselineFile.empty() && !bench::readBaseline(baselineFile, baseline))
+    {
+        return 1;
+    }
+
+    bench::Checker checker;
+    checker.filter = runner.filter;
+    bench::stateChecks(checker);
+    bench::displaySettingsChecks(checker);
+    bench::applicationChecks(checker);
+    bench::renderQueueChecks(checker);
+    bench::formatChecks(checker);
+    bench::pagingChecks(checker);
+
+    bench::mathBenchmarks(runner);
+    bench::referencedBenchmarks(runner);
+    bench::threadingBenchmarks(runner);
+    bench::stateBenchmarks(runner);
+    bench::renderQueueBenchmarks(runner);
+    bench::formatBenchmarks(runner);
+    bench::ioBenchmarks(runner);
+    bench::pagingBenchmark(runner);
+    bench::startupBenchmark(runner, main::Example::parameter(parameters, "sfosg", "./sfosg"));
+
+    std::string out = main::Example::parameter(parameters, "out", "");
+    if (out.empty())
+    {
+        runner.writeJSON(std::cout);
+    }
+    else
+    {
+        std::ofstream file(out);
+        runner.writeJSON(file);
+    }
+
+    if (!baselineFile.empty())
+    {
+        double threshold = std::stod(main::Example::parameter(parameters, "threshold", "0.1"));
+        if (!bench::compare(runner, baseline, threshold))
+        {
+            return 1;
+        }
+    }
+    return checker.numFailures ? 1 : 0;
+}
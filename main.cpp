@@ -7,15 +7,27 @@ using namespace ogs;
 
 int main(int argc, char *argv[])
 {
-    main::Example::Parameters parameters;
-    
+    auto parameters = main::parseParameters(argc, argv);
+    if (!main::Example::checkParameters(parameters, std::cerr))
+    {
+        return 2;
+    }
+
+    if (main::Example::parameter(parameters, "threading", "") == "compare")
+    {
+        main::Example::compareThreadingModels(parameters, std::cout);
+        return 0;
+    }
+
     auto example = new main::Example(parameters);
     example->app->setupWindow(main::EXAMPLE_TITLE, 100, 100, 800, 600);
     
     example->app->run();
+    example->writeResults(parameters, std::cout);
     delete example;
 
-    printf("The app was terminated\n");
+    // Not to stdout, where the results go.
+    std::cerr << "The app was terminated" << std::endl;
 
     return 0;
 }
@@ -11,8 +11,46 @@
 
 #include "OpenSceneGraph.h"
 
+#if !defined(WIN32) || defined(__CYGWIN__)
+extern "C" char **environ;
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <malloc.h>
+#endif
+
+// io_uring is used through its system calls, liburing is not required.
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define OGS_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cfloat>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 
 namespace ogs
@@ -21,165 +59,3581 @@ namespace ogs
 namespace format
 {
 
+// Binary scene container, mapped into memory instead of parsed.
+//
+// Layout, little-endian throughout:
+//
+//   Header      magic, version, byte order mark, file size, directory
+//   chunk data  each chunk starts at a multiple of SCENE_ALIGNMENT
+//   directory   one ChunkEntry per chunk sorted by name, written last
+//
+// A chunk is a named, typed array: geometry arrays, matrices, state set
+// records and modes, or a string table. File::open() maps the file and
+// validates the header and the directory, chunks are then viewed in place:
+// elements are never parsed or copied, the cost of loading a scene is the
+// page faults of the parts actually read.
 
-}
+const char SCENE_MAGIC[8] = { 'O', 'G', 'S', 'S', 'C', 'E', 'N', 'E' };
+const uint32_t SCENE_VERSION = 1;
+const uint32_t SCENE_BYTE_ORDER = 0x01020304;
+//! Enough for every element type and for aligned SIMD loads.
+const uint64_t SCENE_ALIGNMENT = 64;
 
-namespace log
+enum ChunkType
 {
+    CHUNK_ARRAY = 1,
+    CHUNK_MATRICES,
+    CHUNK_STATE_SETS,
+    CHUNK_STATE_SET_MODES,
+    CHUNK_STRINGS
+};
 
+enum ElementType
+{
+    ELEMENT_BYTES = 0,
+    ELEMENT_UINT8,
+    ELEMENT_UINT16,
+    ELEMENT_UINT32,
+    ELEMENT_FLOAT,
+    ELEMENT_DOUBLE
+};
 
-}
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint64_t directoryOffset;
+    uint64_t numChunks;
+};
 
-namespace render
+struct ChunkEntry
 {
+    char name[48];
+    uint32_t type;
+    uint32_t elementType;
+    uint32_t components;
+    uint32_t reserved;
+    uint64_t offset;
+    //! Bytes, excluding the alignment padding.
+    uint64_t size;
+    uint64_t count;
+};
 
-//! Create graphics context for desktop: linux, macos, windows.
-osg::GraphicsContext *createGraphicsContext(
-    const std::string &title,
-    int x,
-    int y,
-    int width,
-    int height
-) {
-    // Traits combine configuration parameters.
-    osg::GraphicsContext::Traits *traits =
-        new osg::GraphicsContext::Traits;
-    // Geometry.
-    traits->x = x;
-    traits->y = y;
-    traits->width = width;
-    traits->height = height;
-    // Title.
-    traits->windowName = title;
-    // Window borders.
-    traits->windowDecoration = true;
-    // Double buffer (simply put, it's a flicker fix).
-    traits->doubleBuffer = true;
+//! osg::Matrixf isn't part of the single file build, single precision
+//! matrices are viewed as this POD with the same layout.
+struct Matrixf
+{
+    float mat[4][4];
 
-    return osg::GraphicsContext::createGraphicsContext(traits);
-}
-/*
-// Configure camera with common defaults.
-void setupCamera(
-    osg::Camera *cam,
-    osg::GraphicsContext *gc,
-    double fovy,
-    int width,
-    int height
-) {
-    // Provide GC.
-    cam->setGraphicsContext(gc);
-    // Viewport must have the same size.
-    cam->setViewport(new osg::Viewport(0, 0, width, height));
-    // Clear depth and color buffers each frame.
-    cam->setClearMask(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
-    // Aspect ratio.
-    float aspect = static_cast<float>(width) / static_cast<float>(height);
-    // Configure projection.
-    cam->setProjectionMatrixAsPerspective(fovy, aspect, 1, 1000);
-}
-*/
+    osg::Matrixd matrixd() const
+    {
+        return osg::Matrixd(&this->mat[0][0]);
+    }
+};
 
-}
+//! Fixed size record of a state set: its modes are the range
+//! [firstMode, firstMode + numModes) of the modes chunk.
+struct StateSetRecord
+{
+    uint32_t firstMode;
+    uint32_t numModes;
+    //! Index into the string table, or NO_NAME.
+    uint32_t name;
+    uint32_t reserved;
+    float color[4];
+};
 
-namespace main
+struct ModeRecord
 {
+    uint32_t mode;
+    uint32_t enabled;
+};
 
-class Application
+const uint32_t NO_NAME = 0xffffffff;
+
+//! State set as the application describes it.
+struct StateSetDescription
+{
+    std::string name;
+    std::vector<std::pair<GLenum, bool> > modes;
+    float color[4];
+};
+
+//! Element type and components an array of T is stored as.
+template<typename T> struct ElementTraits { };
+template<> struct ElementTraits<uint8_t> { enum { TYPE = ELEMENT_UINT8, COMPONENTS = 1 }; };
+template<> struct ElementTraits<uint16_t> { enum { TYPE = ELEMENT_UINT16, COMPONENTS = 1 }; };
+template<> struct ElementTraits<uint32_t> { enum { TYPE = ELEMENT_UINT32, COMPONENTS = 1 }; };
+template<> struct ElementTraits<float> { enum { TYPE = ELEMENT_FLOAT, COMPONENTS = 1 }; };
+template<> struct ElementTraits<double> { enum { TYPE = ELEMENT_DOUBLE, COMPONENTS = 1 }; };
+template<> struct ElementTraits<osg::Vec3f> { enum { TYPE = ELEMENT_FLOAT, COMPONENTS = 3 }; };
+template<> struct ElementTraits<osg::Vec4f> { enum { TYPE = ELEMENT_FLOAT, COMPONENTS = 4 }; };
+template<> struct ElementTraits<osg::Vec3d> { enum { TYPE = ELEMENT_DOUBLE, COMPONENTS = 3 }; };
+template<> struct ElementTraits<Matrixf> { enum { TYPE = ELEMENT_FLOAT, COMPONENTS = 16 }; };
+template<> struct ElementTraits<osg::Matrixd> { enum { TYPE = ELEMENT_DOUBLE, COMPONENTS = 16 }; };
+template<> struct ElementTraits<StateSetRecord> { enum { TYPE = ELEMENT_BYTES, COMPONENTS = sizeof(StateSetRecord) }; };
+template<> struct ElementTraits<ModeRecord> { enum { TYPE = ELEMENT_BYTES, COMPONENTS = sizeof(ModeRecord) }; };
+
+//! Elements of a chunk, pointing into the mapping.
+template<typename T>
+struct ArrayView
+{
+    const T *data = nullptr;
+    size_t count = 0;
+
+    const T *begin() const { return this->data; }
+    const T *end() const { return this->data + this->count; }
+    size_t size() const { return this->count; }
+    bool empty() const { return this->count == 0; }
+    const T &operator[](size_t i) const { return this->data[i]; }
+};
+
+//! NUL terminated strings of a string table chunk.
+struct StringTable
+{
+    const uint64_t *offsets = nullptr;
+    const char *chars = nullptr;
+    size_t count = 0;
+
+    size_t size() const { return this->count; }
+    const char *operator[](size_t i) const
+    {
+        return this->chars + this->offsets[i];
+    }
+    size_t length(size_t i) const
+    {
+        return this->offsets[i + 1] - this->offsets[i] - 1;
+    }
+};
+
+bool isLittleEndian()
+{
+    const uint32_t value = 1;
+    return *reinterpret_cast<const uint8_t *>(&value) == 1;
+}
+
+//! Streams chunks to the file as they are added, the directory is written
+//! by close(), so a scene never has to fit in memory twice.
+class Writer
 {
     public:
-        Application(const std::string &name)
+        ~Writer()
         {
+            this->close();
+        }
 
-            this->setupRendering();
-            
+        bool open(const std::string &fileName)
+        {
+            if (!isLittleEndian())
+            {
+                OSG_WARN << "ogs::format::Writer: big-endian hosts are not supported" << std::endl;
+                return false;
+            }
+            this->out.open(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!this->out)
+            {
+                OSG_WARN << "ogs::format::Writer: unable to open " << fileName << std::endl;
+                return false;
+            }
+            // Rewritten by close() once the directory offset is known.
+            Header header = { };
+            this->out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            this->offset = sizeof(header);
+            this->chunks.clear();
+            return true;
         }
-        ~Application()
+
+        template<typename T>
+        bool addArray(const std::string &name, const T *data, size_t count)
+        {
+            return this->addChunk(
+                name,
+                CHUNK_ARRAY,
+                ElementTraits<T>::TYPE,
+                ElementTraits<T>::COMPONENTS,
+                data,
+                sizeof(T) * count,
+                count
+            );
+        }
+        template<typename T>
+        bool addArray(const std::string &name, const std::vector<T> &array)
         {
+            return this->addArray(name, array.data(), array.size());
+        }
 
-            this->tearRenderingDown();
-            
+        bool addMatrices(const std::string &name, const std::vector<osg::Matrixd> &matrices)
+        {
+            return this->addChunk(
+                name,
+                CHUNK_MATRICES,
+                ELEMENT_DOUBLE,
+                16,
+                matrices.data(),
+                sizeof(osg::Matrixd) * matrices.size(),
+                matrices.size()
+            );
+        }
+        bool addMatrices(const std::string &name, const std::vector<Matrixf> &matrices)
+        {
+            return this->addChunk(
+                name,
+                CHUNK_MATRICES,
+                ELEMENT_FLOAT,
+                16,
+                matrices.data(),
+                sizeof(Matrixf) * matrices.size(),
+                matrices.size()
+            );
         }
 
-        /*
-    public:
-        void frame()
+        //! Write the records to `name`, their modes to `name`.modes and
+        //! their names to `name`.names.
+        bool addStateSets(
+            const std::string &name,
+            const std::vector<StateSetDescription> &stateSets
+        ) {
+            std::vector<StateSetRecord> records;
+            std::vector<ModeRecord> modes;
+            std::vector<std::string> names;
+            for (auto &stateSet : stateSets)
+            {
+                StateSetRecord record = { };
+                record.firstMode = static_cast<uint32_t>(modes.size());
+                record.numModes = static_cast<uint32_t>(stateSet.modes.size());
+                record.name = NO_NAME;
+                if (!stateSet.name.empty())
+                {
+                    record.name = static_cast<uint32_t>(names.size());
+                    names.push_back(stateSet.name);
+                }
+                std::copy(stateSet.color, stateSet.color + 4, record.color);
+                records.push_back(record);
+                for (auto &mode : stateSet.modes)
+                {
+                    ModeRecord modeRecord = { mode.first, mode.second ? 1u : 0u };
+                    modes.push_back(modeRecord);
+                }
+            }
+            return
+                this->addChunk(
+                    name,
+                    CHUNK_STATE_SETS,
+                    ELEMENT_BYTES,
+                    sizeof(StateSetRecord),
+                    records.data(),
+                    sizeof(StateSetRecord) * records.size(),
+                    records.size()
+                ) &&
+                this->addChunk(
+                    name + ".modes",
+                    CHUNK_STATE_SET_MODES,
+                    ELEMENT_BYTES,
+                    sizeof(ModeRecord),
+                    modes.data(),
+                    sizeof(ModeRecord) * modes.size(),
+                    modes.size()
+                ) &&
+                this->addStrings(name + ".names", names);
+        }
+
+        //! String table: count + 1 offsets followed by the NUL
+        //! terminated characters.
+        bool addStrings(const std::string &name, const std::vector<std::string> &strings)
         {
-            this->viewer->frame();
+            std::vector<uint64_t> offsets(1, 0);
+            for (auto &string : strings)
+            {
+                offsets.push_back(offsets.back() + string.size() + 1);
+            }
+            std::string data(
+                reinterpret_cast<const char *>(offsets.data()),
+                sizeof(uint64_t) * offsets.size()
+            );
+            for (auto &string : strings)
+            {
+                data.append(string.c_str(), string.size() + 1);
+            }
+            return this->addChunk(
+                name,
+                CHUNK_STRINGS,
+                ELEMENT_BYTES,
+                1,
+                data.data(),
+                data.size(),
+                strings.size()
+            );
         }
-        */
-    public:
-        void run()
+
+        //! Write the directory and the header, return false if any
+        //! write failed.
+        bool close()
         {
-            /*
-            while (!this->viewer->done())
+            if (!this->out.is_open())
             {
-                this->frame();
+                return false;
             }
-            */
+            this->pad();
+            Header header = { };
+            std::memcpy(header.magic, SCENE_MAGIC, sizeof(header.magic));
+            header.version = SCENE_VERSION;
+            header.byteOrder = SCENE_BYTE_ORDER;
+            header.directoryOffset = this->offset;
+            header.numChunks = this->chunks.size();
+            header.fileSize = this->offset + sizeof(ChunkEntry) * this->chunks.size();
+            // Sorted so File::find() is a binary search, archives hold
+            // a chunk per tile.
+            std::sort(
+                this->chunks.begin(),
+                this->chunks.end(),
+                [](const ChunkEntry &a, const ChunkEntry &b) {
+                    return std::strcmp(a.name, b.name) < 0;
+                }
+            );
+            this->out.write(
+                reinterpret_cast<const char *>(this->chunks.data()),
+                sizeof(ChunkEntry) * this->chunks.size()
+            );
+            this->out.seekp(0);
+            this->out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            this->out.close();
+            bool ok = !this->out.fail();
+            if (!ok)
+            {
+                OSG_WARN << "ogs::format::Writer: failed writing the scene" << std::endl;
+            }
+            return ok;
         }
-    public:
-        void setupWindow(
-            const std::string &title,
-            int x,
-            int y,
-            int width,
-            int height
+
+    private:
+        void pad()
+        {
+            static const char zeros[SCENE_ALIGNMENT] = { };
+            uint64_t padding = (SCENE_ALIGNMENT - this->offset % SCENE_ALIGNMENT) % SCENE_ALIGNMENT;
+            this->out.write(zeros, padding);
+            this->offset += padding;
+        }
+
+        bool addChunk(
+            const std::string &name,
+            ChunkType type,
+            uint32_t elementType,
+            uint32_t components,
+            const void *data,
+            uint64_t size,
+            uint64_t count
         ) {
-            /*
-            osg::GraphicsContext *gc =
-                render::createGraphicsContext(title, x, y, width, height);
-            // Configure viewer's camera with FOVY and window size.
-            osg::Camera *cam = this->viewer->getCamera();
-            render::setupCamera(cam, gc, 30, width, height);
-        */
+            ChunkEntry entry = { };
+            if (!this->out.is_open() || name.size() >= sizeof(entry.name))
+            {
+                OSG_WARN << "ogs::format::Writer: can't add chunk " << name << std::endl;
+                return false;
+            }
+            this->pad();
+            std::memcpy(entry.name, name.c_str(), name.size());
+            entry.type = type;
+            entry.elementType = elementType;
+            entry.components = components;
+            entry.offset = this->offset;
+            entry.size = size;
+            entry.count = count;
+            this->chunks.push_back(entry);
+            this->out.write(static_cast<const char *>(data), size);
+            this->offset += size;
+            return !this->out.fail();
         }
 
-    private:
-        /*
-        osgViewer::Viewer *viewer;
-        */
-        void setupRendering()
+        std::ofstream out;
+        uint64_t offset = 0;
+        std::vector<ChunkEntry> chunks;
+};
+
+//! Mapped scene file. Views returned by the accessors point into the
+//! mapping and are valid until the File is closed or destroyed.
+class File
+{
+    public:
+        File() = default;
+        File(const File &) = delete;
+        File &operator=(const File &) = delete;
+        ~File()
         {
-            /*
-            // Create OpenSceneGraph viewer.
-            this->viewer = new osgViewer::Viewer;
-            // Use single thread: CRITICAL for mobile and web because
-            // there were are issues with multiple threads for OpenSceneGraph there.
-            this->viewer->setThreadingModel(osgViewer::ViewerBase::SingleThreaded);
-            // Create manipulator: CRITICAL for mobile and web to focus on the
-            // nodes in the scene.
-            this->viewer->setCameraManipulator(new osgGA::TrackballManipulator);
-            */
+            this->close();
         }
-        void tearRenderingDown()
+
+        //! Map the file and validate the header and the directory, chunk
+        //! contents are not touched.
+        bool open(const std::string &fileName)
         {
-            /*
-            delete this->viewer;
-            */
+            this->close();
+#if !defined(WIN32) || defined(__CYGWIN__)
+            int fd = ::open(fileName.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                OSG_WARN << "ogs::format::File: unable to open " << fileName << std::endl;
+                return false;
+            }
+            struct stat status;
+            if (fstat(fd, &status) != 0 || status.st_size <= 0)
+            {
+                ::close(fd);
+                return false;
+            }
+            size_t size = static_cast<size_t>(status.st_size);
+            void *data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (data == MAP_FAILED)
+            {
+                OSG_WARN << "ogs::format::File: unable to map " << fileName << std::endl;
+                return false;
+            }
+            this->data = static_cast<const uint8_t *>(data);
+            this->size = size;
+#else
+            // Read into storage aligned like the chunks in the file, as
+            // the mapping is.
+            std::ifstream in(fileName.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
+            if (!in)
+            {
+                OSG_WARN << "ogs::format::File: unable to open " << fileName << std::endl;
+                return false;
+            }
+            size_t size = static_cast<size_t>(in.tellg());
+            this->buffer = static_cast<uint8_t *>(_aligned_malloc(size ? size : 1, SCENE_ALIGNMENT));
+            if (!this->buffer)
+            {
+                return false;
+            }
+            in.seekg(0);
+            in.read(reinterpret_cast<char *>(this->buffer), size);
+            this->data = this->buffer;
+            this->size = size;
+#endif
+            if (!this->validate())
+            {
+                OSG_WARN << "ogs::format::File: " << fileName << " is not a valid scene" << std::endl;
+                this->close();
+                return false;
+            }
+            return true;
+        }
+
+        void close()
+        {
+#if !defined(WIN32) || defined(__CYGWIN__)
+            if (this->data)
+            {
+                munmap(const_cast<uint8_t *>(this->data), this->size);
+            }
+#else
+            _aligned_free(this->buffer);
+            this->buffer = nullptr;
+#endif
+            this->data = nullptr;
+            this->size = 0;
+            this->chunks = ArrayView<ChunkEntry>();
+        }
+
+        bool valid() const
+        {
+            return this->data != nullptr;
+        }
+
+        //! Directory of the file.
+        const ArrayView<ChunkEntry> &getChunks() const
+        {
+            return this->chunks;
+        }
+
+        const ChunkEntry *find(const std::string &name) const
+        {
+            if (!this->sorted)
+            {
+                for (auto &chunk : this->chunks)
+                {
+                    if (name == chunk.name)
+                    {
+                        return &chunk;
+                    }
+                }
+                return nullptr;
+            }
+            auto chunk = std::lower_bound(
+                this->chunks.begin(),
+                this->chunks.end(),
+                name,
+                [](const ChunkEntry &chunk, const std::string &name) {
+                    return name.compare(chunk.name) > 0;
+                }
+            );
+            if (chunk != this->chunks.end() && name == chunk->name)
+            {
+                return chunk;
+            }
+            return nullptr;
+        }
+
+        //! Array or matrices chunk viewed as T, empty if there is no such
+        //! chunk or it holds other elements.
+        template<typename T>
+        ArrayView<T> array(const std::string &name) const
+        {
+            ArrayView<T> view;
+            const ChunkEntry *chunk = this->find(name);
+            if (
+                chunk &&
+                chunk->elementType == ElementTraits<T>::TYPE &&
+                chunk->components == ElementTraits<T>::COMPONENTS &&
+                // Count first, so the product below can't overflow.
+                chunk->count <= chunk->size / sizeof(T) &&
+                chunk->size == sizeof(T) * chunk->count
+            ) {
+                view.data = reinterpret_cast<const T *>(this->data + chunk->offset);
+                view.count = chunk->count;
+            }
+            return view;
+        }
+
+        ArrayView<StateSetRecord> stateSets(const std::string &name) const
+        {
+            return this->array<StateSetRecord>(name);
+        }
+        //! Modes of a record of the `name` state sets.
+        ArrayView<ModeRecord> modes(const std::string &name, const StateSetRecord &record) const
+        {
+            ArrayView<ModeRecord> modes = this->array<ModeRecord>(name + ".modes");
+            ArrayView<ModeRecord> view;
+            if (uint64_t(record.firstMode) + record.numModes <= modes.size())
+            {
+                view.data = modes.data + record.firstMode;
+                view.count = record.numModes;
+            }
+            return view;
+        }
+
+        StringTable strings(const std::string &name) const
+        {
+            StringTable table;
+            const ChunkEntry *chunk = this->find(name);
+            if (!chunk || chunk->type != CHUNK_STRINGS)
+            {
+                return table;
+            }
+            // Offsets must fit, increase and end each string with a NUL
+            // within the chunk, checked once here rather than on every
+            // lookup.
+            uint64_t offsetsSize = sizeof(uint64_t) * (chunk->count + 1);
+            if (chunk->count >= chunk->size / sizeof(uint64_t))
+            {
+                return table;
+            }
+            const uint64_t *offsets = reinterpret_cast<const uint64_t *>(this->data + chunk->offset);
+            const char *chars = reinterpret_cast<const char *>(this->data + chunk->offset + offsetsSize);
+            uint64_t charsSize = chunk->size - offsetsSize;
+            if (offsets[chunk->count] != charsSize)
+            {
+                return table;
+            }
+            uint64_t previous = 0;
+            for (uint64_t i = 0; i <= chunk->count; ++i)
+            {
+                // Strings are at least their NUL, the first one starts at 0.
+                uint64_t offset = offsets[i];
+                if (
+                    (i == 0 ? offset != 0 : offset <= previous) ||
+                    offset > charsSize ||
+                    (i > 0 && chars[offset - 1] != '\0')
+                ) {
+                    return table;
+                }
+                previous = offset;
+            }
+            table.offsets = offsets;
+            table.chars = chars;
+            table.count = chunk->count;
+            return table;
+        }
+
+        //! Ask the OS to read a chunk ahead of its first use.
+        void willNeed(const ChunkEntry &chunk) const
+        {
+#if !defined(WIN32) || defined(__CYGWIN__)
+            // madvise needs a page aligned start.
+            uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+            uintptr_t start = reinterpret_cast<uintptr_t>(this->data + chunk.offset);
+            uintptr_t aligned = start & ~(page - 1);
+            madvise(reinterpret_cast<void *>(aligned), chunk.size + (start - aligned), MADV_WILLNEED);
+#endif
+        }
+
+    private:
+        bool validate()
+        {
+            Header header;
+            if (this->size < sizeof(header))
+            {
+                return false;
+            }
+            std::memcpy(&header, this->data, sizeof(header));
+            if (
+                std::memcmp(header.magic, SCENE_MAGIC, sizeof(header.magic)) != 0 ||
+                header.version != SCENE_VERSION ||
+                // Also rejects little-endian files on big-endian hosts.
+                header.byteOrder != SCENE_BYTE_ORDER ||
+                header.fileSize != this->size ||
+                header.directoryOffset % SCENE_ALIGNMENT != 0 ||
+                header.directoryOffset > this->size ||
+                header.numChunks > (this->size - header.directoryOffset) / sizeof(ChunkEntry)
+            ) {
+                return false;
+            }
+            this->chunks.data = reinterpret_cast<const ChunkEntry *>(this->data + header.directoryOffset);
+            this->chunks.count = header.numChunks;
+            this->sorted = true;
+            for (size_t i = 0; i < this->chunks.size(); ++i)
+            {
+                const ChunkEntry &chunk = this->chunks[i];
+                if (
+                    chunk.name[sizeof(chunk.name) - 1] != '\0' ||
+                    chunk.offset % SCENE_ALIGNMENT != 0 ||
+                    chunk.offset > header.directoryOffset ||
+                    chunk.size > header.directoryOffset - chunk.offset
+                ) {
+                    return false;
+                }
+                if (i > 0 && std::strcmp(this->chunks[i - 1].name, chunk.name) > 0)
+                {
+                    this->sorted = false;
+                }
+            }
+            return true;
         }
+
+        const uint8_t *data = nullptr;
+        size_t size = 0;
+        ArrayView<ChunkEntry> chunks;
+        bool sorted = false;
+#if defined(WIN32) && !defined(__CYGWIN__)
+        uint8_t *buffer = nullptr;
+#endif
 };
 
-const auto EXAMPLE_TITLE = "Single-file OSG research";
+}
 
-struct Example
+#if !defined(WIN32) || defined(__CYGWIN__)
+namespace io
 {
-    Application *app;
 
-    typedef std::map<std::string, std::string> Parameters;
+// Asynchronous file reads, POSIX only.
+//
+// read() returns a Request at once, the file is read into pooled aligned
+// memory and the Request is completed on the Reader's thread: wait() on
+// it, or pass an Operation and an OperationQueue to have the Operation
+// queued on completion. Reads are batched until submit() or until a batch
+// is full.
+//
+// The io_uring Reader keeps up to queueDepth reads in flight on a single
+// thread, into buffers registered with the ring. Where io_uring isn't
+// available the fallback runs blocking reads on a pool of OperationThreads,
+// regular files are always ready to epoll, so there is nothing better to
+// fall back to.
 
-    Example(const Parameters &parameters)
-    {
-        this->app = new Application(EXAMPLE_TITLE);
+void *alignedAlloc(size_t alignment, size_t size)
+{
+#if defined(WIN32) && !defined(__CYGWIN__)
+    return _aligned_malloc(size, alignment);
+#else
+    void *data = nullptr;
+    return posix_memalign(&data, alignment, size) == 0 ? data : nullptr;
+#endif
+}
 
-    }
-    ~Example()
-    {
+void alignedFree(void *data)
+{
+#if defined(WIN32) && !defined(__CYGWIN__)
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
 
-        delete this->app;
-    }
+//! Fixed size blocks carved out of one aligned allocation, so they can be
+//! registered with the kernel once.
+class BufferPool : public osg::Referenced
+{
+    public:
+        //! Page aligned, as O_DIRECT and registered buffers want.
+        static const size_t ALIGNMENT = 4096;
 
-};
+        BufferPool(size_t blockSize, unsigned int numBlocks) :
+            blockSize((blockSize + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT),
+            numBlocks(numBlocks)
+        {
+            this->data = static_cast<uint8_t *>(
+                alignedAlloc(ALIGNMENT, this->blockSize * numBlocks)
+            );
+            for (unsigned int i = 0; this->data && i < numBlocks; ++i)
+            {
+                this->available.push_back(numBlocks - 1 - i);
+            }
+        }
+
+        size_t getBlockSize() const { return this->blockSize; }
+        unsigned int getNumBlocks() const { return this->numBlocks; }
+        uint8_t *getBlock(unsigned int block) const
+        {
+            return this->data + this->blockSize * block;
+        }
+
+        //! Take a free block, -1 if there is none.
+        int acquire()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (this->available.empty())
+            {
+                return -1;
+            }
+            int block = this->available.back();
+            this->available.pop_back();
+            return block;
+        }
+        void release(int block)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->available.push_back(block);
+        }
+
+    protected:
+        virtual ~BufferPool()
+        {
+            alignedFree(this->data);
+        }
+
+    private:
+        size_t blockSize;
+        unsigned int numBlocks;
+        uint8_t *data = nullptr;
+        std::mutex mutex;
+        std::vector<int> available;
+};
+
+//! Completion handle of one read.
+class Request : public osg::Referenced
+{
+    public:
+        Request(const std::string &fileName) :
+            fileName(fileName)
+        {
+            this->completed.reset();
+        }
+
+        const std::string &getFileName() const { return this->fileName; }
+
+        bool isComplete() const { return this->complete; }
+        //! Block until the read completed, return true if it succeeded.
+        bool wait()
+        {
+            this->completed.block();
+            return this->ok();
+        }
+        bool ok() const { return this->complete && this->error == 0; }
+        //! errno of the failed read, 0 on success.
+        int getError() const { return this->error; }
+
+        //! Contents of the file, valid until the Request is deleted.
+        const uint8_t *data() const { return this->buffer; }
+        size_t size() const { return this->bytes; }
+
+    protected:
+        virtual ~Request()
+        {
+            if (this->block >= 0)
+            {
+                this->pool->release(this->block);
+            }
+            else
+            {
+                alignedFree(this->buffer);
+            }
+        }
+
+    private:
+        friend class Reader;
+
+        std::string fileName;
+        osg::ref_ptr<osg::Operation> operation;
+        osg::ref_ptr<osg::OperationQueue> queue;
+
+        //! Pooled block, or -1 for a buffer of its own.
+        osg::ref_ptr<BufferPool> pool;
+        int block = -1;
+        uint8_t *buffer = nullptr;
+        size_t bytes = 0;
+        //! Read so far, reads can come back short.
+        size_t offset = 0;
+        int fd = -1;
+
+        std::atomic<bool> complete{false};
+        int error = 0;
+        OpenThreads::Block completed;
+};
+
+class Reader : public osg::Referenced
+{
+    public:
+        //! Reads up to `batchSize` files before submitting them.
+        void setBatchSize(unsigned int batchSize) { this->batchSize = std::max(batchSize, 1u); }
+
+        //! Queue the read of a whole file. On completion `operation`, if
+        //! any, is added to `queue`.
+        osg::ref_ptr<Request> read(
+            const std::string &fileName,
+            osg::Operation *operation = nullptr,
+            osg::OperationQueue *queue = nullptr
+        ) {
+            osg::ref_ptr<Request> request = new Request(fileName);
+            request->operation = operation;
+            request->queue = queue;
+            bool full = false;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->batch.push_back(request);
+                full = this->batch.size() >= this->batchSize;
+            }
+            if (full)
+            {
+                this->submit();
+            }
+            return request;
+        }
+
+        //! Start the batched reads.
+        void submit()
+        {
+            std::vector<osg::ref_ptr<Request> > batch;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                batch.swap(this->batch);
+            }
+            if (!batch.empty())
+            {
+                this->submit(batch);
+            }
+        }
+
+        virtual const char *getName() const = 0;
+
+    protected:
+        Reader(BufferPool *pool) :
+            pool(pool)
+        { }
+        //! Reads batched but never submitted are cancelled, so nobody
+        //! waits on them forever.
+        virtual ~Reader()
+        {
+            for (auto &request : this->batch)
+            {
+                this->complete(request.get(), ECANCELED);
+            }
+        }
+
+        virtual void submit(std::vector<osg::ref_ptr<Request> > &batch) = 0;
+
+        //! Open the file and give it a buffer big enough, false if the
+        //! request can't be read and has been completed with the error.
+        bool prepare(Request *request)
+        {
+            if (request->fd < 0)
+            {
+                request->fd = ::open(request->fileName.c_str(), O_RDONLY);
+                struct stat status;
+                if (request->fd < 0 || fstat(request->fd, &status) != 0)
+                {
+                    this->complete(request, errno ? errno : EIO);
+                    return false;
+                }
+                request->bytes = static_cast<size_t>(status.st_size);
+            }
+            if (request->buffer)
+            {
+                return true;
+            }
+            if (request->bytes <= this->pool->getBlockSize())
+            {
+                // With every block held by Requests the application keeps,
+                // the file gets a buffer of its own rather than waiting.
+                request->block = this->pool->acquire();
+                if (request->block >= 0)
+                {
+                    request->pool = this->pool;
+                    request->buffer = this->pool->getBlock(request->block);
+                    return true;
+                }
+            }
+            request->buffer = static_cast<uint8_t *>(
+                alignedAlloc(BufferPool::ALIGNMENT, request->bytes)
+            );
+            if (!request->buffer)
+            {
+                this->complete(request, ENOMEM);
+                return false;
+            }
+            return true;
+        }
+
+        void complete(Request *request, int error)
+        {
+            if (request->fd >= 0)
+            {
+                ::close(request->fd);
+                request->fd = -1;
+            }
+            request->error = error;
+            request->complete = true;
+            // Queued before waking waiters, which may drop the last
+            // reference to the queue.
+            if (request->operation.valid() && request->queue.valid())
+            {
+                request->queue->add(request->operation.get());
+            }
+            request->completed.release();
+        }
+
+        static int getBlock(const Request *request) { return request->block; }
+        static uint8_t *getBuffer(const Request *request) { return request->buffer; }
+        static size_t getSize(const Request *request) { return request->bytes; }
+        static size_t &getOffset(Request *request) { return request->offset; }
+        static int getFile(const Request *request) { return request->fd; }
+
+        osg::ref_ptr<BufferPool> pool;
+
+    private:
+        std::mutex mutex;
+        std::vector<osg::ref_ptr<Request> > batch;
+        unsigned int batchSize = 32;
+};
+
+//! Blocking reads on a pool of OperationThreads.
+class ThreadPoolReader : public Reader
+{
+    public:
+        ThreadPoolReader(BufferPool *pool, unsigned int numThreads) :
+            Reader(pool),
+            operationQueue(new osg::OperationQueue)
+        {
+            for (unsigned int i = 0; i < std::max(numThreads, 1u); ++i)
+            {
+                osg::OperationThread *thread = new osg::OperationThread;
+                thread->setOperationQueue(this->operationQueue.get());
+                thread->startThread();
+                this->threads.push_back(thread);
+            }
+        }
+
+        virtual const char *getName() const { return "threads"; }
+
+    protected:
+        virtual ~ThreadPoolReader()
+        {
+            for (auto &thread : this->threads)
+            {
+                thread->cancel();
+            }
+            // The threads finish the read they are in, the queued ones are
+            // cancelled.
+            while (!this->operationQueue->empty())
+            {
+                osg::ref_ptr<osg::Operation> operation = this->operationQueue->getNextOperation();
+                ReadOperation *read = dynamic_cast<ReadOperation *>(operation.get());
+                if (read)
+                {
+                    this->complete(read->getRequest(), ECANCELED);
+                }
+            }
+        }
+
+        virtual void submit(std::vector<osg::ref_ptr<Request> > &batch)
+        {
+            for (auto &request : batch)
+            {
+                this->operationQueue->add(new ReadOperation(this, request.get()));
+            }
+        }
+
+    private:
+        class ReadOperation : public osg::Operation
+        {
+            public:
+                ReadOperation(ThreadPoolReader *reader, Request *request) :
+                    osg::Operation("Read", false),
+                    reader(reader),
+                    request(request)
+                { }
+
+                virtual void operator()(osg::Object *)
+                {
+                    this->reader->read(this->request.get());
+                }
+
+                Request *getRequest() const { return this->request.get(); }
+
+            private:
+                ThreadPoolReader *reader;
+                osg::ref_ptr<Request> request;
+        };
+
+        void read(Request *request)
+        {
+            if (!this->prepare(request))
+            {
+                return;
+            }
+            size_t &offset = getOffset(request);
+            while (offset < getSize(request))
+            {
+                ssize_t result = pread(
+                    getFile(request),
+                    getBuffer(request) + offset,
+                    getSize(request) - offset,
+                    offset
+                );
+                if (result <= 0)
+                {
+                    if (result < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    this->complete(request, result < 0 ? errno : EIO);
+                    return;
+                }
+                offset += result;
+            }
+            this->complete(request, 0);
+        }
+
+        osg::ref_ptr<osg::OperationQueue> operationQueue;
+        std::vector<osg::ref_ptr<osg::OperationThread> > threads;
+};
+
+#if defined(OGS_IO_URING)
+
+//! Reads through an io_uring, up to queueDepth in flight, completions are
+//! reaped on an OperationThread.
+class UringReader : public Reader
+{
+    public:
+        UringReader(BufferPool *pool, unsigned int queueDepth) :
+            Reader(pool)
+        {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+            this->ring = static_cast<int>(syscall(__NR_io_uring_setup, queueDepth, &params));
+            if (this->ring < 0)
+            {
+                OSG_INFO << "ogs::io: io_uring_setup failed, errno " << errno << std::endl;
+                return;
+            }
+            if (!this->map(params))
+            {
+                OSG_INFO << "ogs::io: unable to map the io_uring" << std::endl;
+                this->unmap();
+                return;
+            }
+            if (!this->supportsRead())
+            {
+                OSG_INFO << "ogs::io: io_uring can't read, using threads" << std::endl;
+                this->unmap();
+                return;
+            }
+            // Registered buffers save the kernel mapping every read's pages,
+            // plain reads into the same blocks work without.
+            std::vector<iovec> blocks(pool->getNumBlocks());
+            for (unsigned int i = 0; i < blocks.size(); ++i)
+            {
+                blocks[i].iov_base = pool->getBlock(i);
+                blocks[i].iov_len = pool->getBlockSize();
+            }
+            this->fixedBuffers =
+                syscall(
+                    __NR_io_uring_register,
+                    this->ring,
+                    IORING_REGISTER_BUFFERS,
+                    blocks.data(),
+                    static_cast<unsigned int>(blocks.size())
+                ) == 0;
+
+            this->reaper = new osg::OperationThread;
+            this->reaper->add(new ReapOperation(this));
+            this->reaper->startThread();
+        }
+
+        bool valid() const
+        {
+            return this->ring >= 0;
+        }
+        bool hasFixedBuffers() const
+        {
+            return this->fixedBuffers;
+        }
+
+        virtual const char *getName() const { return "io_uring"; }
+
+    protected:
+        virtual ~UringReader()
+        {
+            if (this->reaper.valid())
+            {
+                // Let the reads in flight land before their buffers go.
+                while (true)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(this->ringMutex);
+                        if (this->inFlight == 0)
+                        {
+                            break;
+                        }
+                    }
+                    OpenThreads::Thread::YieldCurrentThread();
+                }
+                // Wake the reaper with a no-op so it sees the flag.
+                this->stopping = true;
+                {
+                    std::lock_guard<std::mutex> lock(this->ringMutex);
+                    io_uring_sqe *sqe = this->nextEntry();
+                    if (sqe)
+                    {
+                        sqe->opcode = IORING_OP_NOP;
+                        this->publish();
+                    }
+                }
+                this->reaper->cancel();
+            }
+            for (auto &request : this->pending)
+            {
+                this->complete(request.get(), ECANCELED);
+            }
+            this->pending.clear();
+            this->unmap();
+        }
+
+        virtual void submit(std::vector<osg::ref_ptr<Request> > &batch)
+        {
+            std::lock_guard<std::mutex> lock(this->ringMutex);
+            this->pending.insert(this->pending.end(), batch.begin(), batch.end());
+            this->submitPending();
+        }
+
+    private:
+        class ReapOperation : public osg::Operation
+        {
+            public:
+                ReapOperation(UringReader *reader) :
+                    osg::Operation("Reap", true),
+                    reader(reader)
+                { }
+
+                virtual void operator()(osg::Object *)
+                {
+                    this->reader->reap();
+                }
+
+            private:
+                UringReader *reader;
+        };
+
+        //! IORING_OP_READ and the probe both came with Linux 5.6, on older
+        //! kernels the probe fails and the reads go to the thread pool.
+        bool supportsRead() const
+        {
+            std::vector<uint8_t> storage(
+                sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op), 0
+            );
+            io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+            if (syscall(__NR_io_uring_register, this->ring, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) != 0)
+            {
+                return false;
+            }
+            return
+                probe->last_op >= IORING_OP_READ &&
+                probe->ops_len > IORING_OP_READ &&
+                (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+
+        bool map(const io_uring_params &params)
+        {
+            this->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            this->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single)
+            {
+                this->sqSize = this->cqSize = std::max(this->sqSize, this->cqSize);
+            }
+            this->sq = mmap(0, this->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQ_RING);
+            if (this->sq == MAP_FAILED)
+            {
+                this->sq = nullptr;
+                return false;
+            }
+            this->cq = single ? this->sq : mmap(0, this->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_CQ_RING);
+            if (this->cq == MAP_FAILED)
+            {
+                this->cq = nullptr;
+                return false;
+            }
+            this->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            void *sqes = mmap(0, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQES);
+            if (sqes == MAP_FAILED)
+            {
+                return false;
+            }
+            this->sqes = static_cast<io_uring_sqe *>(sqes);
+
+            uint8_t *sq = static_cast<uint8_t *>(this->sq);
+            uint8_t *cq = static_cast<uint8_t *>(this->cq);
+            this->sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+            this->sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+            this->sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+            this->sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+            this->cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+            this->cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+            this->cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+            this->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+            this->entries = params.sq_entries;
+            return true;
+        }
+        void unmap()
+        {
+            if (this->sqes)
+            {
+                munmap(this->sqes, this->sqesSize);
+            }
+            if (this->cq && this->cq != this->sq)
+            {
+                munmap(this->cq, this->cqSize);
+            }
+            if (this->sq)
+            {
+                munmap(this->sq, this->sqSize);
+            }
+            if (this->ring >= 0)
+            {
+                ::close(this->ring);
+            }
+            this->sqes = nullptr;
+            this->sq = this->cq = nullptr;
+            this->ring = -1;
+        }
+
+        //! Free submission entry, zeroed, or null if the ring is full.
+        //! Called with ringMutex held.
+        io_uring_sqe *nextEntry()
+        {
+            unsigned head = __atomic_load_n(this->sqHead, __ATOMIC_ACQUIRE);
+            if (this->tail - head >= this->entries)
+            {
+                return nullptr;
+            }
+            unsigned index = this->tail & this->sqMask;
+            io_uring_sqe *sqe = &this->sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            this->sqArray[index] = index;
+            ++this->tail;
+            ++this->toSubmit;
+            return sqe;
+        }
+        //! Hand the filled entries to the kernel in one system call.
+        void publish()
+        {
+            if (this->toSubmit == 0)
+            {
+                return;
+            }
+            __atomic_store_n(this->sqTail, this->tail, __ATOMIC_RELEASE);
+            syscall(__NR_io_uring_enter, this->ring, this->toSubmit, 0, 0, nullptr, 0);
+            this->toSubmit = 0;
+        }
+
+        //! Move pending requests into the ring while there are entries
+        //! and blocks for them. Called with ringMutex held.
+        void submitPending()
+        {
+            while (!this->pending.empty() && this->inFlight < this->entries)
+            {
+                Request *request = this->pending.front().get();
+                if (!this->prepare(request))
+                {
+                    this->pending.pop_front();
+                    continue;
+                }
+                if (getSize(request) == 0)
+                {
+                    this->complete(request, 0);
+                    this->pending.pop_front();
+                    continue;
+                }
+                io_uring_sqe *sqe = this->nextEntry();
+                if (!sqe)
+                {
+                    break;
+                }
+                size_t offset = getOffset(request);
+                int block = getBlock(request);
+                sqe->opcode = (this->fixedBuffers && block >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+                sqe->fd = getFile(request);
+                sqe->addr = reinterpret_cast<uint64_t>(getBuffer(request) + offset);
+                sqe->len = static_cast<unsigned int>(
+                    std::min<size_t>(getSize(request) - offset, 0x7ffff000)
+                );
+                sqe->off = offset;
+                sqe->buf_index = block >= 0 ? block : 0;
+                // The ring's reference, dropped by reap().
+                request->ref();
+                sqe->user_data = reinterpret_cast<uint64_t>(request);
+                ++this->inFlight;
+                this->pending.pop_front();
+            }
+            this->publish();
+        }
+
+        //! Wait for completions and finish their requests.
+        void reap()
+        {
+            if (this->stopping)
+            {
+                return;
+            }
+            syscall(__NR_io_uring_enter, this->ring, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+
+            std::lock_guard<std::mutex> lock(this->ringMutex);
+            unsigned head = *this->cqHead;
+            unsigned tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; ++head)
+            {
+                const io_uring_cqe &cqe = this->cqes[head & this->cqMask];
+                Request *request = reinterpret_cast<Request *>(cqe.user_data);
+                if (!request)
+                {
+                    continue;
+                }
+                --this->inFlight;
+                if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN)
+                {
+                    this->complete(request, -cqe.res);
+                }
+                else if (cqe.res == 0 && getOffset(request) < getSize(request))
+                {
+                    // The file shrank under us.
+                    this->complete(request, EIO);
+                }
+                else
+                {
+                    getOffset(request) += std::max(cqe.res, 0);
+                    if (getOffset(request) < getSize(request))
+                    {
+                        // Short read, the rest goes round again.
+                        this->pending.push_front(request);
+                    }
+                    else
+                    {
+                        this->complete(request, 0);
+                    }
+                }
+                request->unref();
+            }
+            __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+            this->submitPending();
+        }
+
+        int ring = -1;
+        bool fixedBuffers = false;
+        std::atomic<bool> stopping{false};
+
+        void *sq = nullptr;
+        void *cq = nullptr;
+        size_t sqSize = 0;
+        size_t cqSize = 0;
+        size_t sqesSize = 0;
+        io_uring_sqe *sqes = nullptr;
+        unsigned *sqHead = nullptr;
+        unsigned *sqTail = nullptr;
+        unsigned *sqArray = nullptr;
+        unsigned sqMask = 0;
+        unsigned *cqHead = nullptr;
+        unsigned *cqTail = nullptr;
+        io_uring_cqe *cqes = nullptr;
+        unsigned cqMask = 0;
+        unsigned entries = 0;
+
+        std::mutex ringMutex;
+        unsigned tail = 0;
+        unsigned toSubmit = 0;
+        unsigned inFlight = 0;
+        std::deque<osg::ref_ptr<Request> > pending;
+        osg::ref_ptr<osg::OperationThread> reaper;
+};
+
+#endif
+
+//! Create the io_uring Reader if the kernel allows it, the thread pool one
+//! otherwise. The pool is sized from DisplaySettings' database threads
+//! hint, as the pager's.
+osg::ref_ptr<Reader> createReader(
+    unsigned int queueDepth = 64,
+    size_t blockSize = 64 * 1024,
+    unsigned int numBlocks = 256,
+    bool allowUring = true
+) {
+    osg::ref_ptr<BufferPool> pool = new BufferPool(blockSize, numBlocks);
+#if defined(OGS_IO_URING)
+    if (allowUring)
+    {
+        osg::ref_ptr<UringReader> reader = new UringReader(pool.get(), queueDepth);
+        if (reader->valid())
+        {
+            return reader.get();
+        }
+    }
+#endif
+    unsigned int numThreads = osg::DisplaySettings::instance()->getNumOfDatabaseThreadsHint();
+    return new ThreadPoolReader(pool.get(), std::max(numThreads, 1u));
+}
+
+}
+#endif
+
+namespace paging
+{
+
+// Asynchronous tile paging.
+//
+// Cull asks the Pager for the tiles it sees with request(), passing their
+// screen-space size and distance. Requests wait in a queue ordered by that
+// priority and are loaded by a pool of OperationThreads sized from
+// DisplaySettings' database thread hints. Requests not renewed for a few
+// frames are stale and get cancelled, whether queued or already loading.
+// Loaded tiles are handed over on the update thread by update(), which
+// merges as many as fit in its time slice. Past the maximum number of
+// resident tiles, update() evicts the tiles requested longest ago, only
+// ones not requested for the expiry frames, so a view needing more tiles
+// than the maximum keeps them rather than reloading them every frame.
+
+//! Loaded tile, its vertices point into the Source's mapping.
+class Tile : public osg::Referenced
+{
+    public:
+        std::string name;
+        format::ArrayView<osg::Vec3f> positions;
+        osg::Vec3f center;
+        float radius = 0;
+        //! Seconds from the request to the end of the load.
+        double latency = 0;
+        //! Keeps the storage of the views alive.
+        osg::ref_ptr<osg::Referenced> storage;
+};
+
+//! Where tiles come from.
+class Source : public osg::Referenced
+{
+    public:
+        //! Load the named tile, called on the pager threads.
+        virtual osg::ref_ptr<Tile> load(const std::string &name) = 0;
+        //! Remote sources are loaded by the HTTP database threads.
+        virtual bool isRemote() const { return false; }
+};
+
+//! Local filesystem source: an ogs::format archive with a chunk of
+//! positions per tile.
+class ArchiveSource : public Source
+{
+    public:
+        ArchiveSource(const std::string &fileName)
+        {
+            this->file.open(fileName);
+        }
+
+        bool valid() const
+        {
+            return this->file.valid();
+        }
+
+        virtual osg::ref_ptr<Tile> load(const std::string &name)
+        {
+            const format::ChunkEntry *chunk = this->file.find(name);
+            if (!chunk)
+            {
+                return nullptr;
+            }
+            this->file.willNeed(*chunk);
+            osg::ref_ptr<Tile> tile = new Tile;
+            tile->name = name;
+            tile->positions = this->file.array<osg::Vec3f>(name);
+            tile->storage = this;
+            // The bound reads every vertex, the page faults are taken
+            // here rather than on the update thread.
+            osg::Vec3f min(FLT_MAX, FLT_MAX, FLT_MAX);
+            osg::Vec3f max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for (auto &position : tile->positions)
+            {
+                for (int i = 0; i < 3; ++i)
+                {
+                    min[i] = std::min(min[i], position[i]);
+                    max[i] = std::max(max[i], position[i]);
+                }
+            }
+            if (!tile->positions.empty())
+            {
+                tile->center = (min + max) * 0.5f;
+                tile->radius = (max - min).length() * 0.5f;
+            }
+            return tile;
+        }
+
+    private:
+        format::File file;
+};
+
+std::string tileName(unsigned int x, unsigned int y)
+{
+    return "tile_" + std::to_string(x) + "_" + std::to_string(y);
+}
+
+//! Write a grid of tilesX by tilesY tiles, tileSize apart, each a small
+//! height field of vertices.
+bool writeSyntheticScene(
+    const std::string &fileName,
+    unsigned int tilesX,
+    unsigned int tilesY,
+    float tileSize
+) {
+    const unsigned int side = 4;
+    format::Writer writer;
+    if (!writer.open(fileName))
+    {
+        return false;
+    }
+    std::vector<osg::Vec3f> positions(side * side);
+    for (unsigned int y = 0; y < tilesY; ++y)
+    {
+        for (unsigned int x = 0; x < tilesX; ++x)
+        {
+            for (unsigned int v = 0; v < side * side; ++v)
+            {
+                float px = (x + float(v % side) / (side - 1)) * tileSize;
+                float py = (y + float(v / side) / (side - 1)) * tileSize;
+                positions[v].set(px, py, std::sin(px * 0.01f) * std::cos(py * 0.01f) * tileSize);
+            }
+            if (!writer.addArray(tileName(x, y), positions))
+            {
+                return false;
+            }
+        }
+    }
+    return writer.close();
+}
+
+class Pager
+{
+    public:
+        struct Stats
+        {
+            unsigned int requested = 0;
+            unsigned int loaded = 0;
+            unsigned int failed = 0;
+            unsigned int cancelled = 0;
+            unsigned int merged = 0;
+            unsigned int evicted = 0;
+            //! Longest update() merge, in seconds.
+            double maxMergeTime = 0;
+        };
+
+        typedef std::function<void(Tile *)> MergeCallback;
+        typedef std::function<void(Tile *)> EvictCallback;
+
+        Pager(
+            Source *source,
+            osg::DisplaySettings *ds = osg::DisplaySettings::instance().get()
+        ) :
+            source(source)
+        {
+            // Local sources only need the file threads and remote ones
+            // only the HTTP threads, as osgDB::DatabasePager splits them.
+            this->numThreads =
+                source->isRemote() ?
+                ds->getNumOfHttpDatabaseThreadsHint() :
+                ds->getNumOfDatabaseThreadsHint();
+            this->numThreads = std::max(this->numThreads, 1u);
+            this->operationQueue = new osg::OperationQueue;
+        }
+        ~Pager()
+        {
+            this->stop();
+        }
+
+        void start()
+        {
+            for (unsigned int i = 0; i < this->numThreads; ++i)
+            {
+                osg::OperationThread *thread = new osg::OperationThread;
+                thread->setOperationQueue(this->operationQueue.get());
+                thread->startThread();
+                this->threads.push_back(thread);
+            }
+        }
+        void stop()
+        {
+            for (auto &thread : this->threads)
+            {
+                thread->cancel();
+            }
+            this->threads.clear();
+        }
+
+        unsigned int getNumThreads() const
+        {
+            return this->numThreads;
+        }
+        //! Requests not renewed for this many frames are cancelled.
+        void setExpiryFrames(unsigned int frames)
+        {
+            this->expiryFrames = frames;
+        }
+        void setMergeCallback(const MergeCallback &callback)
+        {
+            this->mergeCallback = callback;
+        }
+        //! Tiles kept merged, 0 keeps every tile merged. Defaults to 4096.
+        void setMaxTiles(size_t tiles)
+        {
+            this->maxTiles = tiles;
+        }
+        //! Called on the update thread with each tile evicted, before the
+        //! pager lets go of it.
+        void setEvictCallback(const EvictCallback &callback)
+        {
+            this->evictCallback = callback;
+        }
+
+        //! Ask for a tile seen this frame, return it once merged, valid
+        //! until update() evicts it. Safe to call from several cull threads.
+        Tile *request(
+            const std::string &name,
+            double pixelSize,
+            double distance,
+            unsigned int frameNumber
+        ) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto merged = this->tiles.find(name);
+            if (merged != this->tiles.end())
+            {
+                merged->second.frameNumber = std::max(merged->second.frameNumber, frameNumber);
+                return merged->second.tile.get();
+            }
+            osg::ref_ptr<Request> &request = this->requests[name];
+            if (!request.valid())
+            {
+                request = new Request(name);
+                request->requestTime = std::chrono::steady_clock::now();
+                this->queue.push_back(request);
+                ++this->stats.requested;
+                // One operation per queued request, it loads whichever
+                // request is then the most important.
+                this->operationQueue->add(new LoadOperation(this));
+            }
+            request->pixelSize = pixelSize;
+            request->distance = distance;
+            request->frameNumber = frameNumber;
+            return nullptr;
+        }
+
+        //! Cancel stale requests, merge loaded tiles until timeSlice
+        //! seconds are spent, at least one tile is merged per call, and
+        //! evict tiles past the maximum. Returns the number of tiles merged.
+        unsigned int update(unsigned int frameNumber, double timeSlice)
+        {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<osg::ref_ptr<Request> > loaded;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->frameNumber = frameNumber;
+                auto stale = [&](const osg::ref_ptr<Request> &request) {
+                    return this->isStale(request.get());
+                };
+                for (auto &request : this->queue)
+                {
+                    if (stale(request))
+                    {
+                        this->requests.erase(request->name);
+                        ++this->stats.cancelled;
+                    }
+                }
+                this->queue.erase(
+                    std::remove_if(this->queue.begin(), this->queue.end(), stale),
+                    this->queue.end()
+                );
+                for (auto &request : this->loaded)
+                {
+                    if (stale(request))
+                    {
+                        this->requests.erase(request->name);
+                        ++this->stats.cancelled;
+                    }
+                }
+                this->loaded.erase(
+                    std::remove_if(this->loaded.begin(), this->loaded.end(), stale),
+                    this->loaded.end()
+                );
+                // Failed tiles are retried once their requests went stale.
+                for (auto &request : this->failed)
+                {
+                    if (stale(request))
+                    {
+                        this->requests.erase(request->name);
+                    }
+                }
+                this->failed.erase(
+                    std::remove_if(this->failed.begin(), this->failed.end(), stale),
+                    this->failed.end()
+                );
+                // Most important first, what doesn't fit waits for the
+                // next frame.
+                std::sort(this->loaded.begin(), this->loaded.end(), &Request::before);
+                loaded.swap(this->loaded);
+            }
+
+            unsigned int merged = 0;
+            size_t next = 0;
+            for (; next < loaded.size(); ++next)
+            {
+                if (
+                    merged > 0 &&
+                    seconds(start, std::chrono::steady_clock::now()) >= timeSlice
+                ) {
+                    break;
+                }
+                Tile *tile = loaded[next]->tile.get();
+                if (this->mergeCallback)
+                {
+                    this->mergeCallback(tile);
+                }
+                ++merged;
+            }
+
+            std::vector<osg::ref_ptr<Tile> > evicted;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                for (size_t i = 0; i < next; ++i)
+                {
+                    Resident &resident = this->tiles[loaded[i]->name];
+                    resident.tile = loaded[i]->tile;
+                    resident.frameNumber = loaded[i]->frameNumber;
+                    this->requests.erase(loaded[i]->name);
+                }
+                this->loaded.insert(this->loaded.end(), loaded.begin() + next, loaded.end());
+                this->stats.merged += merged;
+                this->stats.maxMergeTime =
+                    std::max(
+                        this->stats.maxMergeTime,
+                        seconds(start, std::chrono::steady_clock::now())
+                    );
+                this->evict(evicted);
+            }
+            if (this->evictCallback)
+            {
+                for (auto &tile : evicted)
+                {
+                    this->evictCallback(tile.get());
+                }
+            }
+            return merged;
+        }
+
+        Tile *getTile(const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            auto tile = this->tiles.find(name);
+            return tile != this->tiles.end() ? tile->second.tile.get() : nullptr;
+        }
+        size_t getNumTiles()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->tiles.size();
+        }
+        //! Requests queued or loading.
+        size_t getNumPending()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->requests.size() - this->loaded.size() - this->failed.size();
+        }
+        Stats getStats()
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->stats;
+        }
+
+    private:
+        struct Request : public osg::Referenced
+        {
+            Request(const std::string &name) : name(name) { }
+
+            //! Bigger on screen first, then nearer.
+            static bool before(
+                const osg::ref_ptr<Request> &a,
+                const osg::ref_ptr<Request> &b
+            ) {
+                if (a->pixelSize != b->pixelSize)
+                {
+                    return a->pixelSize > b->pixelSize;
+                }
+                return a->distance < b->distance;
+            }
+
+            std::string name;
+            double pixelSize = 0;
+            double distance = 0;
+            unsigned int frameNumber = 0;
+            std::chrono::steady_clock::time_point requestTime;
+            osg::ref_ptr<Tile> tile;
+        };
+
+        class LoadOperation : public osg::Operation
+        {
+            public:
+                LoadOperation(Pager *pager) :
+                    osg::Operation("LoadTile", false),
+                    pager(pager)
+                { }
+
+                virtual void operator()(osg::Object *)
+                {
+                    this->pager->load();
+                }
+
+            private:
+                Pager *pager;
+        };
+
+        static double seconds(
+            std::chrono::steady_clock::time_point start,
+            std::chrono::steady_clock::time_point end
+        ) {
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        bool isStale(const Request *request) const
+        {
+            return request->frameNumber + this->expiryFrames < this->frameNumber;
+        }
+
+        //! Merged tile and the last frame it was requested in.
+        struct Resident
+        {
+            osg::ref_ptr<Tile> tile;
+            unsigned int frameNumber = 0;
+        };
+        typedef std::map<std::string, Resident> Tiles;
+
+        //! Move the tiles requested longest ago to evicted until no more
+        //! than maxTiles are left or the rest are still requested. Called
+        //! with the mutex held.
+        void evict(std::vector<osg::ref_ptr<Tile> > &evicted)
+        {
+            if (!this->maxTiles || this->tiles.size() <= this->maxTiles)
+            {
+                return;
+            }
+            std::vector<Tiles::iterator> unused;
+            for (auto it = this->tiles.begin(); it != this->tiles.end(); ++it)
+            {
+                if (it->second.frameNumber + this->expiryFrames < this->frameNumber)
+                {
+                    unused.push_back(it);
+                }
+            }
+            size_t count = std::min(unused.size(), this->tiles.size() - this->maxTiles);
+            std::partial_sort(
+                unused.begin(),
+                unused.begin() + count,
+                unused.end(),
+                [](const Tiles::iterator &a, const Tiles::iterator &b) {
+                    return a->second.frameNumber < b->second.frameNumber;
+                }
+            );
+            for (size_t i = 0; i < count; ++i)
+            {
+                evicted.push_back(unused[i]->second.tile);
+                this->tiles.erase(unused[i]);
+            }
+            this->stats.evicted += static_cast<unsigned int>(count);
+        }
+
+        //! Load the most important queued request, on a pager thread.
+        void load()
+        {
+            osg::ref_ptr<Request> request;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                if (this->queue.empty())
+                {
+                    return;
+                }
+                auto next = std::min_element(this->queue.begin(), this->queue.end(), &Request::before);
+                request = *next;
+                *next = this->queue.back();
+                this->queue.pop_back();
+            }
+
+            osg::ref_ptr<Tile> tile = this->source->load(request->name);
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            // Cancelled while loading: no longer wanted or replaced.
+            auto current = this->requests.find(request->name);
+            if (current == this->requests.end() || current->second != request)
+            {
+                return;
+            }
+            if (this->isStale(request.get()))
+            {
+                this->requests.erase(current);
+                ++this->stats.cancelled;
+                return;
+            }
+            if (!tile.valid())
+            {
+                this->failed.push_back(request);
+                ++this->stats.failed;
+                return;
+            }
+            tile->latency = seconds(request->requestTime, std::chrono::steady_clock::now());
+            request->tile = tile;
+            this->loaded.push_back(request);
+            ++this->stats.loaded;
+        }
+
+        osg::ref_ptr<Source> source;
+        unsigned int numThreads = 1;
+        unsigned int expiryFrames = 2;
+        size_t maxTiles = 4096;
+        MergeCallback mergeCallback;
+        EvictCallback evictCallback;
+
+        osg::ref_ptr<osg::OperationQueue> operationQueue;
+        std::vector<osg::ref_ptr<osg::OperationThread> > threads;
+
+        std::mutex mutex;
+        unsigned int frameNumber = 0;
+        //! Requests queued, loading, failed or loaded and waiting to be
+        //! merged.
+        std::map<std::string, osg::ref_ptr<Request> > requests;
+        std::vector<osg::ref_ptr<Request> > queue;
+        std::vector<osg::ref_ptr<Request> > loaded;
+        std::vector<osg::ref_ptr<Request> > failed;
+        Tiles tiles;
+        Stats stats;
+};
+
+}
+
+namespace log
+{
+
+
+}
+
+namespace render
+{
+
+//! Create graphics context for desktop: linux, macos, windows.
+osg::GraphicsContext *createGraphicsContext(
+    const std::string &title,
+    int x,
+    int y,
+    int width,
+    int height
+) {
+    // Traits combine configuration parameters.
+    osg::GraphicsContext::Traits *traits =
+        new osg::GraphicsContext::Traits;
+    // Geometry.
+    traits->x = x;
+    traits->y = y;
+    traits->width = width;
+    traits->height = height;
+    // Title.
+    traits->windowName = title;
+    // Window borders.
+    traits->windowDecoration = true;
+    // Double buffer (simply put, it's a flicker fix).
+    traits->doubleBuffer = true;
+
+    return osg::GraphicsContext::createGraphicsContext(traits);
+}
+
+//! Create graphics context without window or GPU: CI and batch nodes.
+//! Needs a build with OSG_GL_RECORDING, which counts GL calls instead of
+//! issuing them, returns 0 otherwise.
+osg::GraphicsContext *createHeadlessGraphicsContext(
+    int width,
+    int height
+) {
+    osg::GraphicsContext::Traits *traits =
+        new osg::GraphicsContext::Traits;
+    // Geometry.
+    traits->x = 0;
+    traits->y = 0;
+    traits->width = width;
+    traits->height = height;
+    // No window at all.
+    traits->windowDecoration = false;
+    traits->pbuffer = true;
+    traits->doubleBuffer = true;
+    // Pick the headless windowing system even if others are registered.
+    traits->windowingSystemPreference = "Headless";
+
+    return osg::GraphicsContext::createGraphicsContext(traits);
+}
+/*
+// Configure camera with common defaults.
+void setupCamera(
+    osg::Camera *cam,
+    osg::GraphicsContext *gc,
+    double fovy,
+    int width,
+    int height
+) {
+    // Provide GC.
+    cam->setGraphicsContext(gc);
+    // Viewport must have the same size.
+    cam->setViewport(new osg::Viewport(0, 0, width, height));
+    // Clear depth and color buffers each frame.
+    cam->setClearMask(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+    // Aspect ratio.
+    float aspect = static_cast<float>(width) / static_cast<float>(height);
+    // Configure projection.
+    cam->setProjectionMatrixAsPerspective(fovy, aspect, 1, 1000);
+}
+*/
+
+}
+
+namespace main
+{
+
+//! Per frame durations of one phase of the frame loop, in seconds.
+struct PhaseTiming
+{
+    std::string name;
+    std::vector<double> samples;
+
+    PhaseTiming(const std::string &name) : name(name) { }
+
+    void add(double seconds)
+    {
+        this->samples.push_back(seconds);
+    }
+    //! Mean of the samples from frame first on, to leave out warm up.
+    double mean(size_t first = 0) const
+    {
+        if (this->samples.size() <= first)
+        {
+            return 0;
+        }
+        double total = 0;
+        for (size_t i = first; i < this->samples.size(); ++i)
+        {
+            total += this->samples[i];
+        }
+        return total / (this->samples.size() - first);
+    }
+    //! Nearest rank percentile of the samples from frame first on,
+    //! fraction in [0, 1].
+    double percentile(double fraction, size_t first = 0) const
+    {
+        if (this->samples.size() <= first)
+        {
+            return 0;
+        }
+        std::vector<double> sorted(this->samples.begin() + first, this->samples.end());
+        std::sort(sorted.begin(), sorted.end());
+        size_t rank = static_cast<size_t>(fraction * (sorted.size() - 1) + 0.5);
+        return sorted[rank];
+    }
+};
+
+//! Operation running one job of a phase on an OperationThread of the pool.
+class PhaseJob : public osg::Operation
+{
+    public:
+        typedef std::function<void(unsigned int, unsigned int)> Callback;
+
+        PhaseJob(unsigned int job, unsigned int jobs) :
+            osg::Operation("PhaseJob", false),
+            job(job),
+            jobs(jobs)
+        { }
+
+        void setup(const Callback &callback, osg::RefBlockCount *completed)
+        {
+            this->callback = callback;
+            this->completed = completed;
+        }
+
+        virtual void operator()(osg::Object *)
+        {
+            this->callback(this->job, this->jobs);
+            this->completed->completed();
+        }
+
+    private:
+        unsigned int job;
+        unsigned int jobs;
+        Callback callback;
+        osg::RefBlockCount *completed = nullptr;
+};
+
+class Application
+{
+    public:
+        //! Fixed steps the update phase by the same interval every time,
+        //! variable steps it by the measured frame time.
+        enum TimestepMode
+        {
+            FIXED_TIMESTEP,
+            VARIABLE_TIMESTEP
+        };
+
+        //! Single threaded runs every phase on the frame loop thread.
+        //! Cull-draw per context runs cull and draw on the context's
+        //! GraphicsThread and meets it at a BarrierOperation every frame.
+        //! Pipelined updates the next frame on the frame loop thread while
+        //! the GraphicsThread culls and draws the previous one, with the
+        //! scene data double buffered between them, see DoubleBuffered.
+        enum ThreadingModel
+        {
+            SINGLE_THREADED,
+            CULL_DRAW_THREAD_PER_CONTEXT,
+            PIPELINED
+        };
+
+        //! Called with the time step in seconds.
+        typedef std::function<void(double)> UpdateCallback;
+        //! Called with the time step in seconds, the job index and the
+        //! number of jobs.
+        typedef std::function<void(double, unsigned int, unsigned int)> UpdateJobCallback;
+        //! Called with the job index and the number of jobs.
+        typedef PhaseJob::Callback CullCallback;
+        //! Called with the job index and the number of jobs, without the
+        //! graphics context.
+        typedef PhaseJob::Callback DrawJobCallback;
+        //! Called on the thread owning the graphics context before it runs its operations.
+        typedef std::function<void(osg::GraphicsContext *)> DrawCallback;
+
+        Application(const std::string &name) :
+            name(name),
+            updateTiming("update"),
+            cullTiming("cull"),
+            drawTiming("draw"),
+            idleTiming("idle"),
+            frameTiming("frame"),
+            latencyTiming("latency")
+        {
+
+            this->setupRendering();
+            
+        }
+        ~Application()
+        {
+
+            this->tearRenderingDown();
+            
+        }
+
+    public:
+        //! Select how the phases are spread over threads, threaded models
+        //! fall back to single threaded without a graphics context.
+        void setThreadingModel(ThreadingModel model)
+        {
+            this->stopGraphicsThread();
+            this->threadingModel = model;
+        }
+        ThreadingModel getThreadingModel() const { return this->threadingModel; }
+        static const char *getThreadingModelName(ThreadingModel model)
+        {
+            switch (model)
+            {
+                case CULL_DRAW_THREAD_PER_CONTEXT: return "cull_draw";
+                case PIPELINED: return "pipelined";
+                default: return "single";
+            }
+        }
+
+        void setTimestepMode(TimestepMode mode) { this->timestepMode = mode; }
+        TimestepMode getTimestepMode() const { return this->timestepMode; }
+        //! Interval in seconds of fixed time steps.
+        void setFixedTimestep(double seconds) { this->fixedTimestep = seconds; }
+        double getFixedTimestep() const { return this->fixedTimestep; }
+        //! Upper limit of a single variable time step, and of the time
+        //! caught up with fixed steps in one frame, so a stall doesn't
+        //! cause a burst of updates.
+        void setMaxTimestep(double seconds) { this->maxTimestep = seconds; }
+        double getMaxTimestep() const { return this->maxTimestep; }
+        //! Frame time budget in seconds, frames finishing early sleep
+        //! for the rest of it. 0 runs frames back to back.
+        void setFrameBudget(double seconds) { this->frameBudget = seconds; }
+        double getFrameBudget() const { return this->frameBudget; }
+        //! Run without a window or GPU, time advances by the fixed
+        //! time step each frame so runs are reproducible.
+        void setHeadless(bool headless) { this->headless = headless; }
+        bool isHeadless() const { return this->headless; }
+        //! Stop after the number of frames, 0 runs until setDone().
+        void setMaxFrames(unsigned int frames) { this->maxFrames = frames; }
+        unsigned int getMaxFrames() const { return this->maxFrames; }
+        //! Number of jobs the update job callback, the cull callback and
+        //! the draw job callback are split into.
+        void setUpdateJobs(unsigned int jobs) { this->updateJobs.count = std::max(jobs, 1u); }
+        unsigned int getUpdateJobs() const { return this->updateJobs.count; }
+        void setCullJobs(unsigned int jobs) { this->cullJobs.count = std::max(jobs, 1u); }
+        unsigned int getCullJobs() const { return this->cullJobs.count; }
+        void setDrawJobs(unsigned int jobs) { this->drawJobs.count = std::max(jobs, 1u); }
+        unsigned int getDrawJobs() const { return this->drawJobs.count; }
+        //! Number of OperationThreads running the jobs of every phase, 0
+        //! runs them on the thread running the phase.
+        void setThreads(unsigned int threads)
+        {
+            this->stopThreads();
+            this->numThreads = threads;
+        }
+        unsigned int getThreads() const { return this->numThreads; }
+
+        void setUpdateCallback(const UpdateCallback &callback) { this->updateCallback = callback; }
+        //! Runs after the update callback at every time step, in update
+        //! jobs.
+        void setUpdateJobCallback(const UpdateJobCallback &callback) { this->updateJobCallback = callback; }
+        void setCullCallback(const CullCallback &callback) { this->cullCallback = callback; }
+        //! Runs in draw jobs before the draw callback, for the CPU side of
+        //! the draw that needs no graphics context, such as filling the
+        //! command buffers the draw callback then submits.
+        void setDrawJobCallback(const DrawJobCallback &callback) { this->drawJobCallback = callback; }
+        void setDrawCallback(const DrawCallback &callback) { this->drawCallback = callback; }
+
+        //! Compile GL objects in slices of the service's time budget. A
+        //! slice is queued each frame on the compile context when it runs
+        //! its own GraphicsThread, otherwise it runs on the draw context
+        //! after the draw callback. Compiled sets become ready on the draw
+        //! context.
+        void setCompileService(osg::CompileService *service) { this->compileService = service; }
+        osg::CompileService *getCompileService() { return this->compileService.get(); }
+
+        //! Stream the headless timing report is written to, 0 for none.
+        void setReportStream(std::ostream *out) { this->reportStream = out; }
+
+        void setDone(bool done) { this->isDone = done; }
+        bool done() const { return this->isDone; }
+
+        unsigned int getFrameNumber() const { return this->frameNumber; }
+        //! Half of double buffered scene data written by the running
+        //! update phase and read by the running cull and draw phases.
+        unsigned int getUpdateBuffer() const { return this->updateBuffer; }
+        unsigned int getDrawBuffer() const { return this->drawBuffer; }
+        //! Time in seconds the update phase has been stepped to.
+        double getSimulationTime() const { return this->simulationTime; }
+
+        osg::GraphicsContext *getGraphicsContext() { return this->gc.get(); }
+
+    public:
+        //! Run one frame: update, cull and draw phases, then idle for the
+        //! rest of the frame budget.
+        void frame()
+        {
+            auto frameStart = Clock::now();
+            double frameTime =
+                this->headless ?
+                this->fixedTimestep :
+                std::min(seconds(this->previousFrameStart, frameStart), this->maxTimestep);
+            if (this->frameNumber == 0)
+            {
+                frameTime = this->fixedTimestep;
+            }
+            this->previousFrameStart = frameStart;
+            // Started here rather than by the first phase with jobs, which
+            // may run on the GraphicsThread while the next update runs.
+            this->startThreads();
+
+            // Update.
+            this->updateBuffer =
+                this->threadingModel == PIPELINED ? this->frameNumber % 2 : 0;
+            auto phaseStart = Clock::now();
+            this->update(frameTime);
+            auto phaseEnd = Clock::now();
+            this->updateTiming.add(seconds(phaseStart, phaseEnd));
+
+            if (this->compileService.valid())
+            {
+                this->compileService->scheduleCompile();
+            }
+
+            // Cull and draw.
+            ThreadingModel model =
+                this->startGraphicsThread() ? this->threadingModel : SINGLE_THREADED;
+            switch (model)
+            {
+                case SINGLE_THREADED:
+                    this->cullDraw(this->updateBuffer, frameStart);
+                    break;
+                case CULL_DRAW_THREAD_PER_CONTEXT:
+                    this->submitFrame(frameStart);
+                    this->graphicsThread->add(this->frameBarrier.get());
+                    this->frameBarrier->block(2);
+                    break;
+                case PIPELINED:
+                    // Wait for the previous frame to leave its buffer, the
+                    // next update writes to it.
+                    this->waitForFrame();
+                    this->submitFrame(frameStart);
+                    break;
+            }
+            phaseEnd = Clock::now();
+
+            // Idle.
+            double busy = seconds(frameStart, phaseEnd);
+            if (busy > this->frameBudget && this->frameBudget > 0)
+            {
+                ++this->framesOverBudget;
+            }
+            if (!this->headless && this->frameBudget > busy)
+            {
+                std::this_thread::sleep_for(
+                    std::chrono::duration<double>(this->frameBudget - busy)
+                );
+            }
+            auto frameEnd = Clock::now();
+            this->idleTiming.add(seconds(phaseEnd, frameEnd));
+            this->frameTiming.add(seconds(frameStart, frameEnd));
+
+            ++this->frameNumber;
+        }
+        void run()
+        {
+            auto runStart = Clock::now();
+            while (!this->done())
+            {
+                this->frame();
+                if (this->maxFrames && this->frameNumber >= this->maxFrames)
+                {
+                    this->setDone(true);
+                }
+            }
+            this->waitForFrame();
+            this->runTime = seconds(runStart, Clock::now());
+            if (this->headless && this->reportStream)
+            {
+                this->report(*this->reportStream);
+            }
+        }
+        //! Print frame count, rate and per phase timing in milliseconds.
+        void report(std::ostream &out) const
+        {
+            out
+                << this->name << ": "
+                << this->frameNumber << " frames in "
+                << this->runTime << "s, "
+                << (this->runTime > 0 ? this->frameNumber / this->runTime : 0)
+                << " fps, "
+                << this->framesOverBudget << " over budget, "
+                << getThreadingModelName(this->threadingModel)
+                << std::endl;
+            out << "phase\tmean\tp50\tp95\tp99\tmax (ms)" << std::endl;
+            for (auto timing : this->timings())
+            {
+                out
+                    << timing->name << "\t"
+                    << timing->mean() * 1000 << "\t"
+                    << timing->percentile(0.5) * 1000 << "\t"
+                    << timing->percentile(0.95) * 1000 << "\t"
+                    << timing->percentile(0.99) * 1000 << "\t"
+                    << timing->percentile(1) * 1000
+                    << std::endl;
+            }
+        }
+        std::vector<const PhaseTiming *> timings() const
+        {
+            return {
+                &this->updateTiming,
+                &this->cullTiming,
+                &this->drawTiming,
+                &this->idleTiming,
+                &this->frameTiming,
+                &this->latencyTiming,
+            };
+        }
+    public:
+        void setupWindow(
+            const std::string &title,
+            int x,
+            int y,
+            int width,
+            int height
+        ) {
+            if (this->headless)
+            {
+                this->gc = render::createHeadlessGraphicsContext(width, height);
+            }
+            else
+            {
+                this->gc = render::createGraphicsContext(title, x, y, width, height);
+            }
+            if (!this->gc.valid())
+            {
+                OSG_WARN
+                    << this->name
+                    << ": could not create graphics context, "
+                    << "running without the draw phase"
+                    << std::endl;
+                return;
+            }
+            this->gc->realize();
+            /*
+            // Configure viewer's camera with FOVY and window size.
+            osg::Camera *cam = this->viewer->getCamera();
+            render::setupCamera(cam, gc, 30, width, height);
+        */
+        }
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        //! Culls and draws one frame on the GraphicsThread.
+        class FrameOperation : public osg::GraphicsOperation
+        {
+            public:
+                FrameOperation(Application *app) :
+                    osg::GraphicsOperation("Frame", false),
+                    app(app),
+                    completed(new osg::RefBlock)
+                {
+                    this->completed->release();
+                }
+
+                virtual void operator()(osg::GraphicsContext *)
+                {
+                    this->app->cullDraw(this->buffer, this->frameStart);
+                    this->completed->release();
+                }
+
+                Application *app;
+                unsigned int buffer = 0;
+                Clock::time_point frameStart;
+                osg::ref_ptr<osg::RefBlock> completed;
+        };
+
+        //! Jobs of a phase, each phase has its own as the update of the
+        //! next frame runs its jobs alongside the pipelined cull and draw.
+        struct PhaseJobs
+        {
+            unsigned int count = 1;
+            std::vector<osg::ref_ptr<PhaseJob> > queue;
+            osg::ref_ptr<osg::RefBlockCount> completed = new osg::RefBlockCount(0);
+        };
+
+        static double seconds(Clock::time_point start, Clock::time_point end)
+        {
+            return std::chrono::duration<double>(end - start).count();
+        }
+
+        void update(double frameTime)
+        {
+            if (this->timestepMode == VARIABLE_TIMESTEP)
+            {
+                this->simulationTime += frameTime;
+                this->step(frameTime);
+                return;
+            }
+            // Catch up with fixed steps, carrying the remainder over.
+            this->accumulatedTime += std::min(frameTime, this->maxTimestep);
+            while (this->accumulatedTime >= this->fixedTimestep)
+            {
+                this->accumulatedTime -= this->fixedTimestep;
+                this->simulationTime += this->fixedTimestep;
+                this->step(this->fixedTimestep);
+            }
+        }
+        void step(double timestep)
+        {
+            if (this->updateCallback)
+            {
+                this->updateCallback(timestep);
+            }
+            if (this->updateJobCallback)
+            {
+                this->runJobs(this->updateJobs, [this, timestep](unsigned int job, unsigned int jobs) {
+                    this->updateJobCallback(timestep, job, jobs);
+                });
+            }
+        }
+        void cullDraw(unsigned int buffer, Clock::time_point frameStart)
+        {
+            this->drawBuffer = buffer;
+
+            auto phaseStart = Clock::now();
+            this->cull();
+            auto phaseEnd = Clock::now();
+            this->cullTiming.add(seconds(phaseStart, phaseEnd));
+
+            phaseStart = phaseEnd;
+            this->draw();
+            phaseEnd = Clock::now();
+            this->drawTiming.add(seconds(phaseStart, phaseEnd));
+
+            // From the start of the frame's update to its swap.
+            this->latencyTiming.add(seconds(frameStart, phaseEnd));
+        }
+        void submitFrame(Clock::time_point frameStart)
+        {
+            this->frameOperation->completed->reset();
+            this->frameOperation->buffer = this->updateBuffer;
+            this->frameOperation->frameStart = frameStart;
+            this->graphicsThread->add(this->frameOperation.get());
+        }
+        void waitForFrame()
+        {
+            if (this->frameOperation.valid())
+            {
+                this->frameOperation->completed->block();
+            }
+        }
+        //! Start the GraphicsThread of threaded models, return false if
+        //! frames have to be run on the frame loop thread.
+        bool startGraphicsThread()
+        {
+            if (this->threadingModel == SINGLE_THREADED || !this->gc.valid())
+            {
+                return false;
+            }
+            if (this->graphicsThread.valid())
+            {
+                return true;
+            }
+            // The GraphicsThread makes the context current on its own.
+            this->gc->releaseContext();
+            this->gc->createGraphicsThread();
+            this->graphicsThread = this->gc->getGraphicsThread();
+            this->frameOperation = new FrameOperation(this);
+            this->frameBarrier =
+                new osg::BarrierOperation(2, osg::BarrierOperation::NO_OPERATION, false);
+            this->graphicsThread->startThread();
+            return true;
+        }
+        void stopGraphicsThread()
+        {
+            if (!this->graphicsThread.valid())
+            {
+                return;
+            }
+            this->waitForFrame();
+            this->graphicsThread->cancel();
+            this->gc->setGraphicsThread(0);
+            this->graphicsThread = 0;
+        }
+        void cull()
+        {
+            if (this->cullCallback)
+            {
+                this->runJobs(this->cullJobs, this->cullCallback);
+            }
+        }
+        void draw()
+        {
+            if (!this->gc.valid())
+            {
+                return;
+            }
+            if (this->drawJobCallback)
+            {
+                this->runJobs(this->drawJobs, this->drawJobCallback);
+            }
+            this->gc->makeCurrent();
+            if (this->compileService.valid())
+            {
+                this->compileService->checkReady(this->gc.get());
+            }
+            if (this->drawCallback)
+            {
+                this->drawCallback(this->gc.get());
+            }
+            if (this->compileService.valid())
+            {
+                osg::GraphicsContext *compileContext = this->compileService->getCompileContext();
+                if (!compileContext || !compileContext->getGraphicsThread())
+                {
+                    this->compileService->compile(this->gc.get());
+                }
+            }
+            this->gc->runOperations();
+            this->gc->swapBuffers();
+        }
+        //! Run the jobs on the pool and wait for them, or one after the
+        //! other without threads.
+        void runJobs(PhaseJobs &jobs, const PhaseJob::Callback &callback)
+        {
+            if (!this->numThreads)
+            {
+                for (unsigned int job = 0; job < jobs.count; ++job)
+                {
+                    callback(job, jobs.count);
+                }
+                return;
+            }
+            // Jobs are reused between frames, only the block is reset.
+            if (jobs.queue.size() != jobs.count)
+            {
+                jobs.queue.clear();
+                for (unsigned int job = 0; job < jobs.count; ++job)
+                {
+                    jobs.queue.push_back(new PhaseJob(job, jobs.count));
+                }
+            }
+            jobs.completed->setBlockCount(jobs.count);
+            jobs.completed->reset();
+            for (auto &job : jobs.queue)
+            {
+                job->setup(callback, jobs.completed.get());
+                this->operationQueue->add(job.get());
+            }
+            jobs.completed->block();
+        }
+        void startThreads()
+        {
+            if (!this->threads.empty())
+            {
+                return;
+            }
+            for (unsigned int i = 0; i < this->numThreads; ++i)
+            {
+                osg::OperationThread *thread = new osg::OperationThread;
+                thread->setOperationQueue(this->operationQueue.get());
+                thread->startThread();
+                this->threads.push_back(thread);
+            }
+        }
+        void stopThreads()
+        {
+            for (auto &thread : this->threads)
+            {
+                thread->cancel();
+            }
+            this->threads.clear();
+        }
+        void setupRendering()
+        {
+            this->operationQueue = new osg::OperationQueue;
+            /*
+            // Create OpenSceneGraph viewer.
+            this->viewer = new osgViewer::Viewer;
+            // Use single thread: CRITICAL for mobile and web because
+            // there were are issues with multiple threads for OpenSceneGraph there.
+            this->viewer->setThreadingModel(osgViewer::ViewerBase::SingleThreaded);
+            // Create manipulator: CRITICAL for mobile and web to focus on the
+            // nodes in the scene.
+            this->viewer->setCameraManipulator(new osgGA::TrackballManipulator);
+            */
+        }
+        void tearRenderingDown()
+        {
+            this->stopGraphicsThread();
+            this->stopThreads();
+            if (this->gc.valid())
+            {
+                this->gc->close();
+            }
+        }
+
+    private:
+        std::string name;
+
+        ThreadingModel threadingModel = SINGLE_THREADED;
+        TimestepMode timestepMode = FIXED_TIMESTEP;
+        double fixedTimestep = 1.0 / 60;
+        double maxTimestep = 0.25;
+        double frameBudget = 0;
+        bool headless = false;
+        unsigned int maxFrames = 0;
+        unsigned int numThreads = 0;
+
+        UpdateCallback updateCallback;
+        UpdateJobCallback updateJobCallback;
+        CullCallback cullCallback;
+        DrawJobCallback drawJobCallback;
+        DrawCallback drawCallback;
+        osg::ref_ptr<osg::CompileService> compileService;
+
+        osg::ref_ptr<osg::GraphicsContext> gc;
+        osg::ref_ptr<osg::OperationQueue> operationQueue;
+        std::vector<osg::ref_ptr<osg::OperationThread> > threads;
+        PhaseJobs updateJobs;
+        PhaseJobs cullJobs;
+        PhaseJobs drawJobs;
+        osg::ref_ptr<osg::GraphicsThread> graphicsThread;
+        osg::ref_ptr<FrameOperation> frameOperation;
+        osg::ref_ptr<osg::BarrierOperation> frameBarrier;
+
+        std::ostream *reportStream = &std::cout;
+        bool isDone = false;
+        unsigned int frameNumber = 0;
+        unsigned int updateBuffer = 0;
+        unsigned int drawBuffer = 0;
+        unsigned int framesOverBudget = 0;
+        double simulationTime = 0;
+        double accumulatedTime = 0;
+        double runTime = 0;
+        Clock::time_point previousFrameStart;
+
+        PhaseTiming updateTiming;
+        PhaseTiming cullTiming;
+        PhaseTiming drawTiming;
+        PhaseTiming idleTiming;
+        PhaseTiming frameTiming;
+        PhaseTiming latencyTiming;
+};
+
+//! Scene data written by the update phase and read by the cull and draw
+//! phases. Double buffered so the pipelined threading model can update
+//! the next frame while the previous one is drawn, update has to carry
+//! over from the other buffer whatever it doesn't rewrite.
+template<typename T>
+struct DoubleBuffered
+{
+    T buffers[2];
+
+    T &update(const Application &app)
+    {
+        return this->buffers[app.getUpdateBuffer()];
+    }
+    const T &draw(const Application &app) const
+    {
+        return this->buffers[app.getDrawBuffer()];
+    }
+};
+
+//! Busy wait, standing in for the CPU cost of a phase.
+void spin(double seconds)
+{
+    auto end =
+        std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(seconds)
+        );
+    while (std::chrono::steady_clock::now() < end) { }
+}
+
+const auto EXAMPLE_TITLE = "Single-file OSG research";
+
+//! Synthetic scene driving every phase and the core paths under them:
+//! update animates the object matrices, cull splits the objects over the
+//! cull jobs, queues them in an osg::RenderQueue and records them into
+//! osg::CommandBuffers, draw replays the buffers through osg::State, and
+//! each frame queues a number of operations on the graphics context.
+class Scenario
+{
+    public:
+        //! Objects drawn with one state set, modes and a color.
+        struct StateSet
+        {
+            std::vector<std::pair<GLenum, bool> > modes;
+            float color[4];
+        };
+
+        //! How the scenario renders stereo: not at all, culling and
+        //! drawing once per eye, or culling once against both eyes and
+        //! drawing each object once with an instance per eye.
+        enum Stereo
+        {
+            STEREO_OFF,
+            STEREO_TWO_PASS,
+            STEREO_INSTANCED
+        };
+
+        static const char *getStereoName(Stereo stereo)
+        {
+            switch (stereo)
+            {
+                case STEREO_TWO_PASS: return "two_pass";
+                case STEREO_INSTANCED: return "instanced";
+                default: return "off";
+            }
+        }
+
+        Scenario(
+            Application *app,
+            const std::string &name,
+            unsigned int objects,
+            unsigned int stateSets,
+            unsigned int operations,
+            unsigned int warmup
+        ) :
+            app(app),
+            name(name),
+            numObjects(objects),
+            numOperations(operations),
+            warmup(warmup)
+        {
+            const GLenum modes[] = { GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE, GL_LIGHTING };
+            for (unsigned int i = 0; i < std::max(stateSets, 1u); ++i)
+            {
+                StateSet stateSet;
+                // Every state set gets its own combination of modes.
+                for (unsigned int m = 0; m < 4; ++m)
+                {
+                    stateSet.modes.push_back(std::make_pair(modes[m], ((i >> m) & 1) != 0));
+                }
+                stateSet.color[0] = (i % 7) / 7.0f;
+                stateSet.color[1] = (i % 5) / 5.0f;
+                stateSet.color[2] = (i % 3) / 3.0f;
+                stateSet.color[3] = 1;
+                this->stateSets.push_back(stateSet);
+            }
+            this->matrices.buffers[0].resize(objects);
+            this->matrices.buffers[1].resize(objects);
+
+            app->setUpdateCallback([this](double dt) { this->update(dt); });
+            app->setCullCallback([this](unsigned int job, unsigned int jobs) {
+                this->cull(job, jobs);
+            });
+            app->setDrawCallback([this](osg::GraphicsContext *gc) {
+                this->collectReplayStats(gc);
+            });
+        }
+
+        //! Record each cull job's objects in state sort order rather than
+        //! object order.
+        void setSortDraws(bool sort) { this->sortDraws = sort; }
+        bool getSortDraws() const { return this->sortDraws; }
+
+        //! Render stereo with the eyes of displaySettings, looking down
+        //! on the objects. Modes InstancedStereo does not support fall
+        //! back to a horizontally split head mounted display.
+        void setStereo(Stereo stereo, const osg::DisplaySettings &displaySettings)
+        {
+            this->stereo = stereo;
+            if (stereo == STEREO_OFF)
+            {
+                return;
+            }
+            osg::ref_ptr<osg::DisplaySettings> ds = new osg::DisplaySettings(displaySettings);
+            ds->setStereo(true);
+            if (!osg::InstancedStereo::isSupported(ds.get()))
+            {
+                ds->setStereoMode(osg::DisplaySettings::HORIZONTAL_SPLIT);
+                ds->setDisplayType(osg::DisplaySettings::HEAD_MOUNTED_DISPLAY);
+            }
+            this->view = osg::Matrixd::lookAt(
+                osg::Vec3d(50, -40, 60),
+                osg::Vec3d(50, 30, 0),
+                osg::Vec3d(0, 0, 1)
+            );
+            this->instancedStereo->update(
+                ds.get(),
+                this->view,
+                osg::Matrixd::perspective(60, 1280.0 / 720.0, 1, STEREO_FAR),
+                0,
+                0,
+                1280,
+                720
+            );
+            for (unsigned int eye = 0; eye < osg::InstancedStereo::NUM_EYES; ++eye)
+            {
+                auto e = static_cast<osg::InstancedStereo::Eye>(eye);
+                osg::InstancedStereo::computeFrustumPlanes(
+                    this->instancedStereo->getEyeViewMatrix(e) *
+                    this->instancedStereo->getEyeProjectionMatrix(e),
+                    this->eyePlanes[eye]
+                );
+            }
+        }
+        Stereo getStereo() const { return this->stereo; }
+
+        //! Write the scenario, its phase timings after warm up and the
+        //! command buffer statistics as JSON.
+        void writeJSON(std::ostream &out)
+        {
+            if (this->app->getGraphicsContext())
+            {
+                this->collectReplayStats(this->app->getGraphicsContext());
+            }
+            out
+                << "{\n"
+                << "  \"scenario\": \"" << escape(this->name) << "\",\n"
+                << "  \"threading\": \""
+                << Application::getThreadingModelName(this->app->getThreadingModel())
+                << "\",\n"
+                << "  \"objects\": " << this->numObjects << ",\n"
+                << "  \"state_sets\": " << this->stateSets.size() << ",\n"
+                << "  \"operations\": " << this->numOperations << ",\n"
+                << "  \"threads\": " << this->app->getThreads() << ",\n"
+                << "  \"cull_jobs\": " << this->app->getCullJobs() << ",\n"
+                << "  \"warmup_frames\": " << this->warmup << ",\n"
+                << "  \"frames\": "
+                << this->app->getFrameNumber() - std::min(this->warmup, this->app->getFrameNumber())
+                << ",\n"
+                << "  \"phases_ms\": {\n";
+            auto timings = this->app->timings();
+            for (size_t i = 0; i < timings.size(); ++i)
+            {
+                auto timing = timings[i];
+                out
+                    << "    \"" << timing->name << "\": {"
+                    << "\"mean\": " << timing->mean(this->warmup) * 1000
+                    << ", \"p50\": " << timing->percentile(0.5, this->warmup) * 1000
+                    << ", \"p90\": " << timing->percentile(0.9, this->warmup) * 1000
+                    << ", \"p95\": " << timing->percentile(0.95, this->warmup) * 1000
+                    << ", \"p99\": " << timing->percentile(0.99, this->warmup) * 1000
+                    << ", \"max\": " << timing->percentile(1, this->warmup) * 1000
+                    << "}" << (i + 1 < timings.size() ? "," : "") << "\n";
+            }
+            out
+                << "  },\n"
+                << "  \"command_buffers\": {"
+                << "\"buffers\": " << this->replayStats.numBuffers
+                << ", \"commands\": " << this->replayStats.numCommands
+                << ", \"elided\": " << this->replayStats.numElided
+                << ", \"ns_per_command\": " << this->replayStats.getNanoSecondsPerCommand()
+                << "},\n"
+                << "  \"render_queue\": {"
+                << "\"sorted\": " << (this->sortDraws ? "true" : "false")
+                << ", \"draws_per_frame\": " << this->perFrame(this->draws)
+                << ", \"state_changes_per_frame\": " << this->perFrame(this->stateChanges)
+                << ", \"unsorted_state_changes_per_frame\": " << this->perFrame(this->unsortedStateChanges)
+                << ", \"avoided_per_frame\": "
+                << this->perFrame(this->unsortedStateChanges) - this->perFrame(this->stateChanges)
+                << ", \"gl_state_calls_per_frame\": " << this->perFrame(this->glStateCalls)
+                << "},\n"
+                << "  \"stereo\": {"
+                << "\"mode\": \"" << getStereoName(this->stereo) << "\""
+                << ", \"draw_calls_per_frame\": " << this->perFrame(this->draws)
+                << ", \"cull_tests_per_frame\": " << this->perFrame(this->cullTests)
+                << "},\n"
+                << "  \"operations_run\": " << this->operationsRun
+                << "\n}" << std::endl;
+        }
+
+    private:
+        //! Operation queued on the graphics context, standing in for
+        //! the small GL jobs applications queue each frame.
+        class CountOperation : public osg::GraphicsOperation
+        {
+            public:
+                CountOperation(std::atomic<unsigned int> &count) :
+                    osg::GraphicsOperation("Count", false),
+                    count(count)
+                { }
+
+                virtual void operator()(osg::GraphicsContext *)
+                {
+                    ++this->count;
+                }
+
+            private:
+                std::atomic<unsigned int> &count;
+        };
+
+        static std::string escape(const std::string &text)
+        {
+            std::string escaped;
+            for (auto c : text)
+            {
+                if (c == '"' || c == '\\')
+                {
+                    escaped += '\\';
+                }
+                escaped += c;
+            }
+            return escaped;
+        }
+
+        //! Whether frame is past warm up, so its counts and timings make
+        //! it into the results.
+        bool isMeasured(unsigned int frame) const
+        {
+            return frame >= this->warmup;
+        }
+        //! Mean of a count accumulated over the measured frames.
+        double perFrame(double count) const
+        {
+            unsigned int frames = this->app->getFrameNumber();
+            frames -= std::min(this->warmup, frames);
+            return frames ? count / frames : 0;
+        }
+        //! glEnable, glDisable and glVertexAttrib calls recorded by a
+        //! headless context, 0 for other contexts.
+        static double countGLStateCalls(osg::GraphicsContext *gc)
+        {
+            auto headless = dynamic_cast<osg::HeadlessGraphicsContext *>(gc);
+            if (!headless || !headless->getGLRecorder())
+            {
+                return 0;
+            }
+            const osg::GLRecorder *recorder = headless->getGLRecorder();
+            return
+                recorder->getCount(osg::GLRecorder::ENABLE) +
+                recorder->getCount(osg::GLRecorder::DISABLE) +
+                recorder->getCount(osg::GLRecorder::VERTEX_ATTRIB);
+        }
+
+        void update(double dt)
+        {
+            this->time += dt;
+            auto &matrices = this->matrices.update(*this->app);
+            for (unsigned int i = 0; i < this->numObjects; ++i)
+            {
+                matrices[i] =
+                    osg::Matrixd::rotate(this->time + i, 0, 0, 1) *
+                    osg::Matrixd::translate(i % 100, i / 100, (i % 10) - 1.0);
+            }
+            osg::GraphicsContext *gc = this->app->getGraphicsContext();
+            for (unsigned int i = 0; gc && i < this->numOperations; ++i)
+            {
+                gc->add(new CountOperation(this->operationsRun));
+            }
+        }
+        void cull(unsigned int job, unsigned int jobs)
+        {
+            osg::GraphicsContext *gc = this->app->getGraphicsContext();
+            if (!gc)
+            {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(this->buffersMutex);
+                if (this->buffers.size() != jobs)
+                {
+                    this->buffers.clear();
+                    this->queues.clear();
+                    for (unsigned int i = 0; i < jobs; ++i)
+                    {
+                        this->buffers.push_back(new osg::CommandBuffer);
+                        this->queues.push_back(new osg::RenderQueue);
+                    }
+                }
+            }
+            osg::CommandBuffer *buffer = this->buffers[job].get();
+            buffer->reset();
+            // Keep the jobs' buffers in object order.
+            buffer->setOrder(job);
+
+            const auto &matrices = this->matrices.draw(*this->app);
+            unsigned int first = this->numObjects * job / jobs;
+            unsigned int last = this->numObjects * (job + 1) / jobs;
+            osg::RenderQueue *queue = this->queues[job].get();
+            // Two pass stereo culls and draws once per eye.
+            unsigned int passes = this->stereo == STEREO_TWO_PASS ? 2 : 1;
+            for (unsigned int pass = 0; pass < passes; ++pass)
+            {
+                queue->clear();
+                this->recordStereo(buffer, pass);
+                unsigned int tests = 0;
+                for (unsigned int i = first; i < last; ++i)
+                {
+                    double depth = 0;
+                    ++tests;
+                    if (!this->isVisible(matrices[i], pass, depth))
+                    {
+                        continue;
+                    }
+                    // State sets stand in for the attribute lists, the
+                    // scenario has neither programs nor textures.
+                    unsigned int attributes = i % this->stateSets.size();
+                    queue->add(osg::RenderQueue::makeKey(0, 0, attributes, depth), i);
+                }
+                unsigned int unsortedChanges = queue->getNumStateChanges();
+                if (this->sortDraws)
+                {
+                    queue->sort();
+                }
+                if (this->isMeasured(this->app->getFrameNumber()))
+                {
+                    this->draws += queue->size();
+                    this->unsortedStateChanges += unsortedChanges;
+                    this->stateChanges +=
+                        this->sortDraws ? queue->getNumStateChanges() : unsortedChanges;
+                    this->cullTests += tests;
+                }
+                for (auto &entry : queue->getEntries())
+                {
+                    const StateSet &stateSet =
+                        this->stateSets[entry.index % this->stateSets.size()];
+                    for (auto &mode : stateSet.modes)
+                    {
+                        buffer->mode(mode.first, mode.second);
+                    }
+                    buffer->vertexAttrib(
+                        3,
+                        stateSet.color[0],
+                        stateSet.color[1],
+                        stateSet.color[2],
+                        stateSet.color[3]
+                    );
+                    if (this->stereo == STEREO_INSTANCED)
+                    {
+                        // An instance per eye, the shader picking the eye
+                        // from gl_InstanceID.
+                        buffer->drawArraysInstanced(
+                            GL_TRIANGLES,
+                            0,
+                            36,
+                            osg::InstancedStereo::NUM_EYES
+                        );
+                    }
+                    else
+                    {
+                        buffer->drawArrays(GL_TRIANGLES, 0, 36);
+                    }
+                }
+            }
+            gc->submit(buffer);
+        }
+        //! Whether the object of matrix is drawn in pass, and its depth
+        //! in [0, 1] for the render queue key.
+        bool isVisible(const osg::Matrixd &matrix, unsigned int pass, double &depth) const
+        {
+            if (this->stereo == STEREO_OFF)
+            {
+                // Cull objects behind the eye.
+                depth = matrix(3, 2) / 10;
+                return depth >= 0;
+            }
+            const osg::Vec4d *planes =
+                this->stereo == STEREO_TWO_PASS ?
+                this->eyePlanes[pass] :
+                this->instancedStereo->getCullFrustumPlanes();
+            osg::Vec3d center = matrix.getTrans();
+            depth = -(center * this->view).z() / STEREO_FAR;
+            return osg::InstancedStereo::contains(planes, center, OBJECT_RADIUS);
+        }
+        //! Record the viewport of a stereo pass: the eye's for two pass
+        //! stereo, the union of the eyes' clipped per eye for instanced
+        //! stereo, as InstancedStereo::apply() sets them.
+        void recordStereo(osg::CommandBuffer *buffer, unsigned int pass) const
+        {
+            const osg::Vec4f *viewport = nullptr;
+            if (this->stereo == STEREO_TWO_PASS)
+            {
+                viewport = &this->instancedStereo->getEyeViewport(
+                    static_cast<osg::InstancedStereo::Eye>(pass)
+                );
+            }
+            else if (this->stereo == STEREO_INSTANCED)
+            {
+                viewport = &this->instancedStereo->getUnionViewport();
+                for (unsigned int i = 0; i < 4; ++i)
+                {
+                    buffer->mode(GL_CLIP_DISTANCE0 + i, true);
+                }
+            }
+            if (viewport)
+            {
+                buffer->viewport(
+                    static_cast<GLint>((*viewport)[0]),
+                    static_cast<GLint>((*viewport)[1]),
+                    static_cast<GLsizei>((*viewport)[2]),
+                    static_cast<GLsizei>((*viewport)[3])
+                );
+            }
+        }
+        void collectReplayStats(osg::GraphicsContext *gc)
+        {
+            // Replay stats of the previous runOperations, the one of the
+            // previous frame.
+            unsigned int frame = this->app->getFrameNumber();
+            bool measured = frame > 0 && this->isMeasured(frame - 1);
+            if (frame != this->statsFrame && measured)
+            {
+                this->replayStats += gc->getCommandBufferStats();
+            }
+            // Recorded calls are cumulative, count from the end of warm up.
+            double calls = countGLStateCalls(gc);
+            if (!measured)
+            {
+                this->glStateCallsWarmup = calls;
+            }
+            this->glStateCalls = calls - this->glStateCallsWarmup;
+            this->statsFrame = frame;
+        }
+
+        Application *app;
+        std::string name;
+        unsigned int numObjects;
+        unsigned int numOperations;
+        unsigned int warmup;
+        double time = 0;
+
+        std::vector<StateSet> stateSets;
+        DoubleBuffered<std::vector<osg::Matrixd> > matrices;
+        std::mutex buffersMutex;
+        std::vector<osg::ref_ptr<osg::CommandBuffer> > buffers;
+        std::vector<osg::ref_ptr<osg::RenderQueue> > queues;
+        bool sortDraws = false;
+        std::atomic<unsigned int> draws{0};
+        std::atomic<unsigned int> stateChanges{0};
+        std::atomic<unsigned int> unsortedStateChanges{0};
+        double glStateCalls = 0;
+        double glStateCallsWarmup = 0;
+
+        //! Far plane of the stereo camera and bounding radius of the
+        //! objects' unit cubes.
+        static constexpr double STEREO_FAR = 500;
+        static constexpr double OBJECT_RADIUS = 0.87;
+        Stereo stereo = STEREO_OFF;
+        osg::Matrixd view;
+        osg::ref_ptr<osg::InstancedStereo> instancedStereo = new osg::InstancedStereo;
+        osg::Vec4d eyePlanes[osg::InstancedStereo::NUM_EYES][6];
+        std::atomic<unsigned int> cullTests{0};
+
+        std::atomic<unsigned int> operationsRun{0};
+        osg::CommandBuffer::Stats replayStats;
+        unsigned int statsFrame = 0;
+};
+
+struct Example
+{
+    Application *app;
+    Scenario *scenario = nullptr;
+
+    typedef std::map<std::string, std::string> Parameters;
+
+    Example(const Parameters &parameters)
+    {
+        this->app = new Application(EXAMPLE_TITLE);
+
+        // Headless CI runs: `sfosg --headless --frames=1000`.
+        this->app->setHeadless(parameters.count("headless") > 0);
+        this->app->setMaxFrames(count(parameters, "frames", 0));
+        this->app->setTimestepMode(
+            parameter(parameters, "timestep", "fixed") == "variable" ?
+            Application::VARIABLE_TIMESTEP :
+            Application::FIXED_TIMESTEP
+        );
+        this->app->setFrameBudget(number(parameters, "budget", 0) / 1000);
+        this->app->setThreads(count(parameters, "threads", 0));
+        this->app->setThreadingModel(
+            threadingModel(parameter(parameters, "threading", "single"))
+        );
+        setupSyntheticLoad(this->app, parameters);
+
+        // Benchmark scenario: `sfosg --scenario=name --headless
+        // --objects=N --state_sets=M --operations=K --threads=T
+        // [--sort_draws] [--stereo=off|two_pass|instanced]`.
+        if (parameters.count("scenario"))
+        {
+            unsigned int warmup = count(parameters, "warmup", 10);
+            // Keep standard output for the JSON.
+            this->app->setReportStream(&std::cerr);
+            this->app->setMaxFrames(warmup + count(parameters, "frames", 100));
+            this->app->setCullJobs(
+                count(parameters, "cull_jobs", count(parameters, "threads", 1))
+            );
+            this->scenario = new Scenario(
+                this->app,
+                parameter(parameters, "scenario", ""),
+                count(parameters, "objects", 1000),
+                count(parameters, "state_sets", 16),
+                count(parameters, "operations", 8),
+                warmup
+            );
+            this->scenario->setSortDraws(parameters.count("sort_draws") > 0);
+            // Without --stereo, OSG_STEREO and OSG_INSTANCED_STEREO decide.
+            const osg::DisplaySettings *ds = osg::DisplaySettings::instance().get();
+            std::string stereo = parameter(
+                parameters,
+                "stereo",
+                !ds->getStereo() ? "off" :
+                ds->getInstancedStereoHint() ? "instanced" : "two_pass"
+            );
+            this->scenario->setStereo(stereoMode(stereo), *ds);
+        }
+    }
+    ~Example()
+    {
+
+        delete this->app;
+        delete this->scenario;
+    }
+
+    //! Write the scenario results as JSON to the `json` parameter's file,
+    //! or to out if it is not set.
+    void writeResults(const Parameters &parameters, std::ostream &out)
+    {
+        if (!this->scenario)
+        {
+            return;
+        }
+        std::string path = parameter(parameters, "json", "");
+        if (path.empty())
+        {
+            this->scenario->writeJSON(out);
+            return;
+        }
+        std::ofstream file(path);
+        this->scenario->writeJSON(file);
+    }
+
+    static Application::ThreadingModel threadingModel(const std::string &name)
+    {
+        if (name == "cull_draw")
+        {
+            return Application::CULL_DRAW_THREAD_PER_CONTEXT;
+        }
+        if (name == "pipelined")
+        {
+            return Application::PIPELINED;
+        }
+        return Application::SINGLE_THREADED;
+    }
+
+    static Scenario::Stereo stereoMode(const std::string &name)
+    {
+        if (name == "two_pass")
+        {
+            return Scenario::STEREO_TWO_PASS;
+        }
+        if (name == "instanced")
+        {
+            return Scenario::STEREO_INSTANCED;
+        }
+        return Scenario::STEREO_OFF;
+    }
+
+    //! Spend update_ms, cull_ms and draw_ms milliseconds of CPU per frame
+    //! in the phases, split over update_jobs, cull_jobs and draw_jobs jobs.
+    static void setupSyntheticLoad(
+        Application *app,
+        const Parameters &parameters
+    ) {
+        double update = number(parameters, "update_ms", 0) / 1000;
+        double cull = number(parameters, "cull_ms", 0) / 1000;
+        double draw = number(parameters, "draw_ms", 0) / 1000;
+        app->setUpdateJobs(count(parameters, "update_jobs", 1));
+        app->setCullJobs(count(parameters, "cull_jobs", 1));
+        app->setDrawJobs(count(parameters, "draw_jobs", 1));
+        if (update > 0)
+        {
+            app->setUpdateJobCallback([=](double, unsigned int, unsigned int jobs) {
+                spin(update / jobs);
+            });
+        }
+        if (cull > 0)
+        {
+            app->setCullCallback([=](unsigned int, unsigned int jobs) {
+                spin(cull / jobs);
+            });
+        }
+        if (draw > 0)
+        {
+            app->setDrawJobCallback([=](unsigned int, unsigned int jobs) {
+                spin(draw / jobs);
+            });
+        }
+    }
+
+    //! Run the same headless synthetic load with each threading model and
+    //! print throughput and update-to-swap latency side by side.
+    //! `sfosg --threading=compare --frames=300 --update_ms=2 --cull_ms=3 --draw_ms=4`
+    static void compareThreadingModels(
+        const Parameters &parameters,
+        std::ostream &out
+    ) {
+        const Application::ThreadingModel models[] = {
+            Application::SINGLE_THREADED,
+            Application::CULL_DRAW_THREAD_PER_CONTEXT,
+            Application::PIPELINED,
+        };
+        out << "model\tfps\tlatency mean\tp95\tp99 (ms)" << std::endl;
+        for (auto model : models)
+        {
+            Application app(EXAMPLE_TITLE);
+            app.setHeadless(true);
+            app.setMaxFrames(count(parameters, "frames", 300));
+            app.setThreads(count(parameters, "threads", 0));
+            app.setThreadingModel(model);
+            setupSyntheticLoad(&app, parameters);
+            app.setupWindow(EXAMPLE_TITLE, 0, 0, 800, 600);
+
+            auto start = std::chrono::steady_clock::now();
+            while (!app.done())
+            {
+                app.frame();
+                app.setDone(app.getFrameNumber() >= app.getMaxFrames());
+            }
+            double elapsed = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start
+            ).count();
+            // Drain the last pipelined frame before reading the timings.
+            app.setThreadingModel(Application::SINGLE_THREADED);
+
+            const PhaseTiming *latency = app.timings().back();
+            out
+                << Application::getThreadingModelName(model) << "\t"
+                << app.getFrameNumber() / elapsed << "\t"
+                << latency->mean() * 1000 << "\t"
+                << latency->percentile(0.95) * 1000 << "\t"
+                << latency->percentile(0.99) * 1000
+                << std::endl;
+        }
+    }
+
+    //! Value of parameter name, or fallback if it is not set.
+    static std::string parameter(
+        const Parameters &parameters,
+        const std::string &name,
+        const std::string &fallback
+    ) {
+        auto it = parameters.find(name);
+        return it == parameters.end() ? fallback : it->second;
+    }
+
+    //! Parse a whole string as a count, false if it isn't one.
+    static bool parseCount(const std::string &text, unsigned int &value)
+    {
+        if (text.empty() || !std::isdigit(static_cast<unsigned char>(text[0])))
+        {
+            return false;
+        }
+        errno = 0;
+        char *end = nullptr;
+        unsigned long result = std::strtoul(text.c_str(), &end, 10);
+        if (errno == ERANGE || *end != '\0' || result > UINT_MAX)
+        {
+            return false;
+        }
+        value = static_cast<unsigned int>(result);
+        return true;
+    }
+    //! Parse a whole string as a finite, non negative number, false if it
+    //! isn't one.
+    static bool parseNumber(const std::string &text, double &value)
+    {
+        if (text.empty() || std::isspace(static_cast<unsigned char>(text[0])))
+        {
+            return false;
+        }
+        errno = 0;
+        char *end = nullptr;
+        double result = std::strtod(text.c_str(), &end);
+        if (errno == ERANGE || *end != '\0' || !std::isfinite(result) || result < 0)
+        {
+            return false;
+        }
+        value = result;
+        return true;
+    }
+
+    //! Count parameter name, or fallback if it is not set. The parameters
+    //! have been through checkParameters(), fallback is also taken for
+    //! values that don't parse.
+    static unsigned int count(
+        const Parameters &parameters,
+        const std::string &name,
+        unsigned int fallback
+    ) {
+        unsigned int value = fallback;
+        auto it = parameters.find(name);
+        return it != parameters.end() && parseCount(it->second, value) ? value : fallback;
+    }
+    static double number(
+        const Parameters &parameters,
+        const std::string &name,
+        double fallback
+    ) {
+        double value = fallback;
+        auto it = parameters.find(name);
+        return it != parameters.end() && parseNumber(it->second, value) ? value : fallback;
+    }
+
+    //! Print a usage error to err for the first numeric parameter that
+    //! doesn't parse and return false.
+    static bool checkParameters(const Parameters &parameters, std::ostream &err)
+    {
+        static const char *counts[] = {
+            "frames", "threads", "warmup", "objects", "state_sets", "operations",
+            "update_jobs", "cull_jobs", "draw_jobs"
+        };
+        static const char *numbers[] = {
+            "budget", "update_ms", "cull_ms", "draw_ms"
+        };
+        for (auto name : counts)
+        {
+            auto it = parameters.find(name);
+            unsigned int value;
+            if (it != parameters.end() && !parseCount(it->second, value))
+            {
+                err << "sfosg: --" << name << " expects a count, not '" << it->second << "'" << std::endl;
+                err << USAGE;
+                return false;
+            }
+        }
+        for (auto name : numbers)
+        {
+            auto it = parameters.find(name);
+            double value;
+            if (it != parameters.end() && !parseNumber(it->second, value))
+            {
+                err << "sfosg: --" << name << " expects a number, not '" << it->second << "'" << std::endl;
+                err << USAGE;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static const char *const USAGE;
+
+};
+
+const char *const Example::USAGE =
+    "usage: sfosg [--headless] [--frames=N] [--timestep=fixed|variable] [--budget=ms]\n"
+    "             [--threads=N] [--threading=single|cull_draw|pipelined|compare]\n"
+    "             [--update_ms=ms] [--cull_ms=ms] [--draw_ms=ms]\n"
+    "             [--update_jobs=N] [--cull_jobs=N] [--draw_jobs=N]\n"
+    "             [--scenario=name [--warmup=N] [--objects=N] [--state_sets=N]\n"
+    "              [--operations=N] [--sort_draws] [--stereo=off|two_pass|instanced]\n"
+    "              [--json=file]]\n";
+
+//! Collect parameters from `SFOSG_NAME=value` environment variables and
+//! `--name=value` or `--flag` arguments, arguments taking precedence.
+Example::Parameters parseParameters(int argc, char *argv[])
+{
+    Example::Parameters parameters;
+    const std::string prefix = "SFOSG_";
+    for (char **env = environ; env && *env; ++env)
+    {
+        std::string var = *env;
+        auto equals = var.find('=');
+        if (var.compare(0, prefix.size(), prefix) || equals == std::string::npos)
+        {
+            continue;
+        }
+        std::string name = var.substr(prefix.size(), equals - prefix.size());
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        parameters[name] = var.substr(equals + 1);
+    }
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.compare(0, 2, "--"))
+        {
+            continue;
+        }
+        auto equals = arg.find('=');
+        if (equals == std::string::npos)
+        {
+            parameters[arg.substr(2)] = "1";
+        }
+        else
+        {
+            parameters[arg.substr(2, equals - 2)] = arg.substr(equals + 1);
+        }
+    }
+    return parameters;
+}
 
 }
 